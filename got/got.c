@@ -55,6 +55,8 @@
 #include "got_privsep.h"
 #include "got_opentemp.h"
 #include "got_gotconfig.h"
+#include "got_verify.h"
+#include "got_search_index.h"
 
 #ifndef nitems
 #define nitems(_a)	(sizeof((_a)) / sizeof((_a)[0]))
@@ -111,6 +113,7 @@ __dead static void	usage_stage(void);
 __dead static void	usage_unstage(void);
 __dead static void	usage_cat(void);
 __dead static void	usage_info(void);
+__dead static void	usage_verify(void);
 
 static const struct got_error*		cmd_init(int, char *[]);
 static const struct got_error*		cmd_import(int, char *[]);
@@ -139,6 +142,7 @@ static const struct got_error*		cmd_stage(int, char *[]);
 static const struct got_error*		cmd_unstage(int, char *[]);
 static const struct got_error*		cmd_cat(int, char *[]);
 static const struct got_error*		cmd_info(int, char *[]);
+static const struct got_error*		cmd_verify(int, char *[]);
 
 static struct got_cmd got_commands[] = {
 	{ "init",	cmd_init,	usage_init,	"" },
@@ -168,6 +172,7 @@ static struct got_cmd got_commands[] = {
 	{ "unstage",	cmd_unstage,	usage_unstage,	"ug" },
 	{ "cat",	cmd_cat,	usage_cat,	"" },
 	{ "info",	cmd_info,	usage_info,	"" },
+	{ "verify",	cmd_verify,	usage_verify,	"" },
 };
 
 static void
@@ -2528,15 +2533,7 @@ check_linear_ancestry(struct got_object_id *commit_id,
     struct got_repository *repo)
 {
 	const struct got_error *err = NULL;
-	struct got_object_id *yca_id;
-
-	err = got_commit_graph_find_youngest_common_ancestor(&yca_id,
-	    commit_id, base_commit_id, repo, check_cancelled, NULL);
-	if (err)
-		return err;
-
-	if (yca_id == NULL)
-		return got_error(GOT_ERR_ANCESTRY);
+	int is_ancestor;
 
 	/*
 	 * Require a straight line of history between the target commit
@@ -2556,71 +2553,36 @@ check_linear_ancestry(struct got_object_id *commit_id,
 	 * Update forwards in time:  A (base/yca) - B - C - D (commit)
 	 * Update backwards in time: D (base) - C - B - A (commit/yca)
 	 */
-	if (allow_forwards_in_time_only) {
-	    if (got_object_id_cmp(base_commit_id, yca_id) != 0)
-		return got_error(GOT_ERR_ANCESTRY);
-	} else if (got_object_id_cmp(commit_id, yca_id) != 0 &&
-	    got_object_id_cmp(base_commit_id, yca_id) != 0)
+	err = got_commit_graph_is_ancestor(&is_ancestor, base_commit_id,
+	    commit_id, repo, check_cancelled, NULL);
+	if (err || is_ancestor)
+		return err;
+	if (allow_forwards_in_time_only)
 		return got_error(GOT_ERR_ANCESTRY);
 
-	free(yca_id);
+	err = got_commit_graph_is_ancestor(&is_ancestor, commit_id,
+	    base_commit_id, repo, check_cancelled, NULL);
+	if (err)
+		return err;
+	if (!is_ancestor)
+		return got_error(GOT_ERR_ANCESTRY);
 	return NULL;
 }
 
 static const struct got_error *
 check_same_branch(struct got_object_id *commit_id,
-    struct got_reference *head_ref, struct got_object_id *yca_id,
-    struct got_repository *repo)
+    struct got_reference *head_ref, struct got_repository *repo)
 {
 	const struct got_error *err = NULL;
-	struct got_commit_graph *graph = NULL;
 	struct got_object_id *head_commit_id = NULL;
 	int is_same_branch = 0;
 
 	err = got_ref_resolve(&head_commit_id, repo, head_ref);
 	if (err)
-		goto done;
-
-	if (got_object_id_cmp(head_commit_id, commit_id) == 0) {
-		is_same_branch = 1;
-		goto done;
-	}
-	if (yca_id && got_object_id_cmp(commit_id, yca_id) == 0) {
-		is_same_branch = 1;
-		goto done;
-	}
-
-	err = got_commit_graph_open(&graph, "/", 1);
-	if (err)
-		goto done;
-
-	err = got_commit_graph_iter_start(graph, head_commit_id, repo,
-	    check_cancelled, NULL);
-	if (err)
-		goto done;
-
-	for (;;) {
-		struct got_object_id *id;
-		err = got_commit_graph_iter_next(&id, graph, repo,
-		    check_cancelled, NULL);
-		if (err) {
-			if (err->code == GOT_ERR_ITER_COMPLETED)
-				err = NULL;
-			break;
-		}
+		return err;
 
-		if (id) {
-			if (yca_id && got_object_id_cmp(id, yca_id) == 0)
-				break;
-			if (got_object_id_cmp(id, commit_id) == 0) {
-				is_same_branch = 1;
-				break;
-			}
-		}
-	}
-done:
-	if (graph)
-		got_commit_graph_close(graph);
+	err = got_commit_graph_is_ancestor(&is_same_branch, commit_id,
+	    head_commit_id, repo, check_cancelled, NULL);
 	free(head_commit_id);
 	if (!err && !is_same_branch)
 		err = got_error(GOT_ERR_ANCESTRY);
@@ -2818,7 +2780,7 @@ cmd_checkout(int argc, char *argv[])
 			}
 			goto done;
 		}
-		error = check_same_branch(commit_id, head_ref, NULL, repo);
+		error = check_same_branch(commit_id, head_ref, repo);
 		if (error) {
 			if (error->code == GOT_ERR_ANCESTRY) {
 				error = checkout_ancestry_error(
@@ -3147,7 +3109,7 @@ cmd_update(int argc, char *argv[])
 		free(head_commit_id);
 		if (error != NULL)
 			goto done;
-		error = check_same_branch(commit_id, head_ref, NULL, repo);
+		error = check_same_branch(commit_id, head_ref, repo);
 		if (error)
 			goto done;
 		error = switch_head_ref(head_ref, commit_id, worktree, repo);
@@ -3161,7 +3123,7 @@ cmd_update(int argc, char *argv[])
 				error = got_error(GOT_ERR_BRANCH_MOVED);
 			goto done;
 		}
-		error = check_same_branch(commit_id, head_ref, NULL, repo);
+		error = check_same_branch(commit_id, head_ref, repo);
 		if (error)
 			goto done;
 	}
@@ -3613,12 +3575,186 @@ done:
 	return err;
 }
 
+/*
+ * If the file at the specified path was renamed by the commit, return
+ * its previous path and the ID of the commit's first parent.
+ */
+static const struct got_error *
+get_renamed_path(char **old_path, struct got_object_id **parent_id,
+    struct got_commit_object *commit, struct got_object_id *commit_id,
+    const char *path, struct got_repository *repo)
+{
+	const struct got_error *err;
+	struct got_object_qid *qid;
+
+	*old_path = NULL;
+	*parent_id = NULL;
+
+	qid = SIMPLEQ_FIRST(got_object_commit_get_parent_ids(commit));
+	if (qid == NULL)
+		return NULL;
+
+	err = got_diff_find_rename_source(old_path, qid->id, commit_id,
+	    path, repo);
+	if (err || *old_path == NULL)
+		return err;
+
+	*parent_id = got_object_id_dup(qid->id);
+	if (*parent_id == NULL) {
+		err = got_error_from_errno("got_object_id_dup");
+		free(*old_path);
+		*old_path = NULL;
+	}
+	return err;
+}
+
+static const struct got_error *
+print_reversed_commits(struct got_object_id_queue *reversed_commits,
+    struct got_repository *repo, const char *path, int show_changed_paths,
+    int show_patch, int diff_context,
+    struct got_reflist_object_id_map *refs_idmap)
+{
+	const struct got_error *err = NULL;
+	struct got_object_qid *qid;
+	struct got_commit_object *commit;
+	struct got_pathlist_head changed_paths;
+	struct got_pathlist_entry *pe;
+
+	TAILQ_INIT(&changed_paths);
+
+	SIMPLEQ_FOREACH(qid, reversed_commits, entry) {
+		err = got_object_open_as_commit(&commit, repo, qid->id);
+		if (err)
+			break;
+		if (show_changed_paths) {
+			err = get_changed_paths(&changed_paths, commit, repo);
+			if (err) {
+				got_object_commit_close(commit);
+				break;
+			}
+		}
+		err = print_commit(commit, qid->id, repo,
+		    qid->data ? qid->data : path,
+		    show_changed_paths ? &changed_paths : NULL,
+		    show_patch, diff_context, refs_idmap);
+		got_object_commit_close(commit);
+		if (err)
+			break;
+		TAILQ_FOREACH(pe, &changed_paths, entry) {
+			free((char *)pe->path);
+			free(pe->data);
+		}
+		got_pathlist_free(&changed_paths);
+	}
+
+	TAILQ_FOREACH(pe, &changed_paths, entry) {
+		free((char *)pe->path);
+		free(pe->data);
+	}
+	got_pathlist_free(&changed_paths);
+	return err;
+}
+
+struct print_indexed_commit_arg {
+	regex_t *regex;
+	struct got_object_id *end_id;
+	int limit;
+	int reverse_display_order;
+	struct got_object_id_queue *reversed_commits;
+	struct got_repository *repo;
+	const char *path;
+	int show_patch;
+	int diff_context;
+	struct got_reflist_object_id_map *refs_idmap;
+};
+
+static const struct got_error *
+print_indexed_commit(void *arg, struct got_search_index_entry *entry)
+{
+	const struct got_error *err;
+	struct print_indexed_commit_arg *a = arg;
+	struct got_commit_object *commit;
+	struct got_object_qid *qid;
+	regmatch_t regmatch;
+
+	if (regexec(a->regex, entry->logmsg, 1, &regmatch, 0) != 0)
+		return NULL;
+
+	if (a->reverse_display_order) {
+		err = got_object_qid_alloc(&qid, entry->id);
+		if (err)
+			return err;
+		SIMPLEQ_INSERT_HEAD(a->reversed_commits, qid, entry);
+	} else {
+		err = got_object_open_as_commit(&commit, a->repo, entry->id);
+		if (err)
+			return err;
+		err = print_commit(commit, entry->id, a->repo, a->path, NULL,
+		    a->show_patch, a->diff_context, a->refs_idmap);
+		got_object_commit_close(commit);
+		if (err)
+			return err;
+	}
+
+	if ((a->limit && --a->limit == 0) ||
+	    (a->end_id && got_object_id_cmp(entry->id, a->end_id) == 0))
+		return got_error(GOT_ERR_ITER_COMPLETED);
+	return NULL;
+}
+
+/*
+ * Search log messages along first-parent links with help of the
+ * repository's search index.
+ */
+static const struct got_error *
+print_indexed_commits(struct got_search_index *search_index,
+    struct got_object_id *root_id, struct got_object_id *end_id,
+    struct got_repository *repo, const char *path, const char *search_pattern,
+    regex_t *regex, int show_patch, int diff_context, int limit,
+    int reverse_display_order, struct got_reflist_object_id_map *refs_idmap)
+{
+	const struct got_error *err;
+	struct got_object_id_queue reversed_commits;
+	struct got_object_qid *qid;
+	struct print_indexed_commit_arg arg;
+
+	SIMPLEQ_INIT(&reversed_commits);
+
+	err = got_search_index_update(search_index, root_id, repo,
+	    check_cancelled, NULL);
+	if (err)
+		return err;
+
+	arg.regex = regex;
+	arg.end_id = end_id;
+	arg.limit = limit;
+	arg.reverse_display_order = reverse_display_order;
+	arg.reversed_commits = &reversed_commits;
+	arg.repo = repo;
+	arg.path = path;
+	arg.show_patch = show_patch;
+	arg.diff_context = diff_context;
+	arg.refs_idmap = refs_idmap;
+	err = got_search_index_search(search_index, root_id, search_pattern,
+	    repo, print_indexed_commit, &arg, check_cancelled, NULL);
+	if (err == NULL && reverse_display_order)
+		err = print_reversed_commits(&reversed_commits, repo, path, 0,
+		    show_patch, diff_context, refs_idmap);
+
+	while (!SIMPLEQ_EMPTY(&reversed_commits)) {
+		qid = SIMPLEQ_FIRST(&reversed_commits);
+		SIMPLEQ_REMOVE_HEAD(&reversed_commits, entry);
+		got_object_qid_free(qid);
+	}
+	return err;
+}
+
 static const struct got_error *
 print_commits(struct got_object_id *root_id, struct got_object_id *end_id,
     struct got_repository *repo, const char *path, int show_changed_paths,
     int show_patch, const char *search_pattern, int diff_context, int limit,
-    int log_branches, int reverse_display_order,
-    struct got_reflist_object_id_map *refs_idmap)
+    int log_branches, int reverse_display_order, int follow_renames,
+    int njobs, struct got_reflist_object_id_map *refs_idmap)
 {
 	const struct got_error *err;
 	struct got_commit_graph *graph;
@@ -3629,6 +3765,9 @@ print_commits(struct got_object_id *root_id, struct got_object_id *end_id,
 	struct got_commit_object *commit;
 	struct got_pathlist_head changed_paths;
 	struct got_pathlist_entry *pe;
+	char *old_path = NULL, *followed_path = NULL;
+	struct got_object_id *old_path_commit_id = NULL;
+	struct got_search_index *search_index = NULL;
 
 	SIMPLEQ_INIT(&reversed_commits);
 	TAILQ_INIT(&changed_paths);
@@ -3637,9 +3776,26 @@ print_commits(struct got_object_id *root_id, struct got_object_id *end_id,
 	    REG_EXTENDED | REG_NOSUB | REG_NEWLINE))
 		return got_error_msg(GOT_ERR_REGEX, search_pattern);
 
+	if (search_pattern && !log_branches && !show_changed_paths &&
+	    got_path_is_root_dir(path)) {
+		err = got_search_index_open(&search_index, repo);
+		if (err == NULL && search_index) {
+			err = print_indexed_commits(search_index, root_id,
+			    end_id, repo, path, search_pattern, &regex,
+			    show_patch, diff_context, limit,
+			    reverse_display_order, refs_idmap);
+			got_search_index_close(search_index);
+		}
+		if (err || search_index) {
+			regfree(&regex);
+			return err;
+		}
+	}
+
 	err = got_commit_graph_open(&graph, path, !log_branches);
 	if (err)
 		return err;
+	got_commit_graph_set_nworkers(graph, njobs);
 	err = got_commit_graph_iter_start(graph, root_id, repo,
 	    check_cancelled, NULL);
 	if (err)
@@ -3650,6 +3806,28 @@ print_commits(struct got_object_id *root_id, struct got_object_id *end_id,
 		if (sigint_received || sigpipe_received)
 			break;
 
+		if (old_path) {
+			/* Follow the file's history along its old path. */
+			got_commit_graph_close(graph);
+			free(followed_path);
+			followed_path = old_path;
+			old_path = NULL;
+			path = followed_path;
+			err = got_commit_graph_open(&graph, path,
+			    !log_branches);
+			if (err) {
+				graph = NULL;
+				break;
+			}
+			got_commit_graph_set_nworkers(graph, njobs);
+			err = got_commit_graph_iter_start(graph,
+			    old_path_commit_id, repo, check_cancelled, NULL);
+			free(old_path_commit_id);
+			old_path_commit_id = NULL;
+			if (err)
+				break;
+		}
+
 		err = got_commit_graph_iter_next(&id, graph, repo,
 		    check_cancelled, NULL);
 		if (err) {
@@ -3664,6 +3842,15 @@ print_commits(struct got_object_id *root_id, struct got_object_id *end_id,
 		if (err)
 			break;
 
+		if (follow_renames && !got_path_is_root_dir(path)) {
+			err = get_renamed_path(&old_path, &old_path_commit_id,
+			    commit, id, path, repo);
+			if (err) {
+				got_object_commit_close(commit);
+				break;
+			}
+		}
+
 		if (show_changed_paths && !reverse_display_order) {
 			err = get_changed_paths(&changed_paths, commit, repo);
 			if (err)
@@ -3696,6 +3883,13 @@ print_commits(struct got_object_id *root_id, struct got_object_id *end_id,
 				break;
 			SIMPLEQ_INSERT_HEAD(&reversed_commits, qid, entry);
 			got_object_commit_close(commit);
+			if (follow_renames) {
+				qid->data = strdup(path);
+				if (qid->data == NULL) {
+					err = got_error_from_errno("strdup");
+					break;
+				}
+			}
 		} else {
 			err = print_commit(commit, id, repo, path,
 			    show_changed_paths ? &changed_paths : NULL,
@@ -3714,34 +3908,14 @@ print_commits(struct got_object_id *root_id, struct got_object_id *end_id,
 		}
 		got_pathlist_free(&changed_paths);
 	}
-	if (reverse_display_order) {
-		SIMPLEQ_FOREACH(qid, &reversed_commits, entry) {
-			err = got_object_open_as_commit(&commit, repo, qid->id);
-			if (err)
-				break;
-			if (show_changed_paths) {
-				err = get_changed_paths(&changed_paths,
-				    commit, repo);
-				if (err)
-					break;
-			}
-			err = print_commit(commit, qid->id, repo, path,
-			    show_changed_paths ? &changed_paths : NULL,
-			    show_patch, diff_context, refs_idmap);
-			got_object_commit_close(commit);
-			if (err)
-				break;
-			TAILQ_FOREACH(pe, &changed_paths, entry) {
-				free((char *)pe->path);
-				free(pe->data);
-			}
-			got_pathlist_free(&changed_paths);
-		}
-	}
+	if (reverse_display_order && err == NULL)
+		err = print_reversed_commits(&reversed_commits, repo, path,
+		    show_changed_paths, show_patch, diff_context, refs_idmap);
 done:
 	while (!SIMPLEQ_EMPTY(&reversed_commits)) {
 		qid = SIMPLEQ_FIRST(&reversed_commits);
 		SIMPLEQ_REMOVE_HEAD(&reversed_commits, entry);
+		free(qid->data);
 		got_object_qid_free(qid);
 	}
 	TAILQ_FOREACH(pe, &changed_paths, entry) {
@@ -3751,19 +3925,26 @@ done:
 	got_pathlist_free(&changed_paths);
 	if (search_pattern)
 		regfree(&regex);
-	got_commit_graph_close(graph);
+	if (graph)
+		got_commit_graph_close(graph);
+	free(old_path);
+	free(followed_path);
+	free(old_path_commit_id);
 	return err;
 }
 
 __dead static void
 usage_log(void)
 {
-	fprintf(stderr, "usage: %s log [-b] [-c commit] [-C number] [ -l N ] "
-	    "[-p] [-P] [-x commit] [-s search-pattern] [-r repository-path] "
-	    "[-R] [path]\n", getprogname());
+	fprintf(stderr, "usage: %s log [-b] [-c commit] [-C number] "
+	    "[-j jobs] [ -l N ] [-M] [-p] [-P] [-x commit] "
+	    "[-s search-pattern] [-r repository-path] [-R] [path]\n",
+	    getprogname());
 	exit(1);
 }
 
+#define GOT_LOG_MAX_JOBS	64
+
 static int
 get_default_log_limit(void)
 {
@@ -3792,7 +3973,7 @@ cmd_log(int argc, char *argv[])
 	const char *search_pattern = NULL;
 	int diff_context = -1, ch;
 	int show_changed_paths = 0, show_patch = 0, limit = 0, log_branches = 0;
-	int reverse_display_order = 0;
+	int reverse_display_order = 0, follow_renames = 0, njobs = 1;
 	const char *errstr;
 	struct got_reflist_head refs;
 	struct got_reflist_object_id_map *refs_idmap = NULL;
@@ -3808,7 +3989,7 @@ cmd_log(int argc, char *argv[])
 
 	limit = get_default_log_limit();
 
-	while ((ch = getopt(argc, argv, "bpPc:C:l:r:Rs:x:")) != -1) {
+	while ((ch = getopt(argc, argv, "bpPc:C:j:l:Mr:Rs:x:")) != -1) {
 		switch (ch) {
 		case 'p':
 			show_patch = 1;
@@ -3825,6 +4006,12 @@ cmd_log(int argc, char *argv[])
 			if (errstr != NULL)
 				err(1, "-C option %s", errstr);
 			break;
+		case 'j':
+			njobs = strtonum(optarg, 1, GOT_LOG_MAX_JOBS, &errstr);
+			if (errstr != NULL)
+				errx(1, "number of jobs is %s: %s", errstr,
+				    optarg);
+			break;
 		case 'l':
 			limit = strtonum(optarg, 0, INT_MAX, &errstr);
 			if (errstr != NULL)
@@ -3833,6 +4020,9 @@ cmd_log(int argc, char *argv[])
 		case 'b':
 			log_branches = 1;
 			break;
+		case 'M':
+			follow_renames = 1;
+			break;
 		case 'r':
 			repo_path = realpath(optarg, NULL);
 			if (repo_path == NULL)
@@ -3905,6 +4095,12 @@ cmd_log(int argc, char *argv[])
 	if (error != NULL)
 		goto done;
 
+	if (search_pattern) {
+		error = got_search_index_unveil(
+		    got_repo_get_path_git_dir(repo));
+		if (error)
+			goto done;
+	}
 	error = apply_unveil(got_repo_get_path(repo), 1,
 	    worktree ? got_worktree_get_root_path(worktree) : NULL);
 	if (error)
@@ -3975,7 +4171,8 @@ cmd_log(int argc, char *argv[])
 
 	error = print_commits(start_id, end_id, repo, path ? path : "",
 	    show_changed_paths, show_patch, search_pattern, diff_context,
-	    limit, log_branches, reverse_display_order, refs_idmap);
+	    limit, log_branches, reverse_display_order, follow_renames, njobs,
+	    refs_idmap);
 done:
 	free(path);
 	free(repo_path);
@@ -3997,8 +4194,9 @@ done:
 __dead static void
 usage_diff(void)
 {
-	fprintf(stderr, "usage: %s diff [-a] [-C number] [-r repository-path] "
-	    "[-s] [-w] [object1 object2 | path]\n", getprogname());
+	fprintf(stderr, "usage: %s diff [-a] [-C number] [-M] "
+	    "[-r repository-path] [-s] [-w] [object1 object2 | path]\n",
+	    getprogname());
 	exit(1);
 }
 
@@ -4212,7 +4410,7 @@ cmd_diff(int argc, char *argv[])
 	char *label1 = NULL, *label2 = NULL;
 	int type1, type2;
 	int diff_context = 3, diff_staged = 0, ignore_whitespace = 0, ch;
-	int force_text_diff = 0;
+	int force_text_diff = 0, find_renames = 0;
 	const char *errstr;
 	char *path = NULL;
 	struct got_reflist_head refs;
@@ -4225,7 +4423,7 @@ cmd_diff(int argc, char *argv[])
 		err(1, "pledge");
 #endif
 
-	while ((ch = getopt(argc, argv, "aC:r:sw")) != -1) {
+	while ((ch = getopt(argc, argv, "aC:Mr:sw")) != -1) {
 		switch (ch) {
 		case 'a':
 			force_text_diff = 1;
@@ -4236,6 +4434,9 @@ cmd_diff(int argc, char *argv[])
 			if (errstr != NULL)
 				err(1, "-C option %s", errstr);
 			break;
+		case 'M':
+			find_renames = 1;
+			break;
 		case 'r':
 			repo_path = realpath(optarg, NULL);
 			if (repo_path == NULL)
@@ -4267,6 +4468,9 @@ cmd_diff(int argc, char *argv[])
 		if (repo_path)
 			errx(1,
 			    "-r option can't be used when diffing a work tree");
+		if (find_renames)
+			errx(1,
+			    "-M option can't be used when diffing a work tree");
 		error = got_worktree_open(&worktree, cwd);
 		if (error) {
 			if (error->code == GOT_ERR_NOT_WORKTREE)
@@ -4396,13 +4600,13 @@ cmd_diff(int argc, char *argv[])
 	case GOT_OBJ_TYPE_TREE:
 		error = got_diff_objects_as_trees(NULL, NULL, id1, id2,
 		    "", "", diff_context, ignore_whitespace, force_text_diff,
-		    repo, stdout);
+		    find_renames, repo, stdout);
 		break;
 	case GOT_OBJ_TYPE_COMMIT:
 		printf("diff %s %s\n", label1, label2);
 		error = got_diff_objects_as_commits(NULL, NULL, id1, id2,
-		    diff_context, ignore_whitespace, force_text_diff, repo,
-		    stdout);
+		    diff_context, ignore_whitespace, force_text_diff,
+		    find_renames, repo, stdout);
 		break;
 	default:
 		error = got_error(GOT_ERR_OBJ_TYPE);
@@ -4429,8 +4633,8 @@ __dead static void
 usage_blame(void)
 {
 	fprintf(stderr,
-	    "usage: %s blame [-c commit] [-r repository-path] path\n",
-	    getprogname());
+	    "usage: %s blame [-c commit] [-L first,last] [-r repository-path] "
+	    "path\n", getprogname());
 	exit(1);
 }
 
@@ -4446,6 +4650,7 @@ struct blame_cb_args {
 	int nlines;
 	int nlines_prec;
 	int lineno_cur;
+	int lineno_last;
 	off_t *line_offsets;
 	FILE *f;
 	struct got_repository *repo;
@@ -4503,6 +4708,8 @@ blame_cb(void *arg, int nlines, int lineno, struct got_object_id *id)
 	bline->annotated = 1;
 
 	/* Print lines annotated so far. */
+	if (a->lineno_cur > a->lineno_last)
+		goto done;
 	bline = &a->lines[a->lineno_cur - 1];
 	if (!bline->annotated)
 		goto done;
@@ -4513,7 +4720,7 @@ blame_cb(void *arg, int nlines, int lineno, struct got_object_id *id)
 		goto done;
 	}
 
-	while (bline->annotated) {
+	while (a->lineno_cur <= a->lineno_last && bline->annotated) {
 		char *smallerthan, *at, *nl, *committer;
 		size_t len;
 
@@ -4541,8 +4748,13 @@ blame_cb(void *arg, int nlines, int lineno, struct got_object_id *id)
 		    bline->id_str, bline->datebuf, committer, line);
 
 		a->lineno_cur++;
-		bline = &a->lines[a->lineno_cur - 1];
+		if (a->lineno_cur <= a->lineno_last)
+			bline = &a->lines[a->lineno_cur - 1];
 	}
+
+	/* Show completed lines even if stdout is not line-buffered. */
+	if (fflush(stdout) == EOF && err == NULL)
+		err = got_error_from_errno("fflush");
 done:
 	if (commit)
 		got_object_commit_close(commit);
@@ -4563,8 +4775,10 @@ cmd_blame(int argc, char *argv[])
 	struct got_blob_object *blob = NULL;
 	char *commit_id_str = NULL;
 	struct blame_cb_args bca;
-	int ch, obj_type, i;
+	int ch, obj_type, i, first_line = 0, last_line = 0;
 	off_t filesize;
+	const char *errstr;
+	char *comma;
 
 	memset(&bca, 0, sizeof(bca));
 
@@ -4574,11 +4788,26 @@ cmd_blame(int argc, char *argv[])
 		err(1, "pledge");
 #endif
 
-	while ((ch = getopt(argc, argv, "c:r:")) != -1) {
+	while ((ch = getopt(argc, argv, "c:L:r:")) != -1) {
 		switch (ch) {
 		case 'c':
 			commit_id_str = optarg;
 			break;
+		case 'L':
+			comma = strchr(optarg, ',');
+			if (comma == NULL)
+				errx(1, "-L option requires first,last: %s",
+				    optarg);
+			*comma = '\0';
+			first_line = strtonum(optarg, 1, INT_MAX, &errstr);
+			if (errstr != NULL)
+				errx(1, "first line is %s: %s", errstr, optarg);
+			last_line = strtonum(comma + 1, first_line, INT_MAX,
+			    &errstr);
+			if (errstr != NULL)
+				errx(1, "last line is %s: %s", errstr,
+				    comma + 1);
+			break;
 		case 'r':
 			repo_path = realpath(optarg, NULL);
 			if (repo_path == NULL)
@@ -4647,8 +4876,14 @@ cmd_blame(int argc, char *argv[])
 			goto done;
 		}
 		free(p);
+		error = got_blame_unveil_cache(got_repo_get_path_git_dir(repo));
+		if (error)
+			goto done;
 		error = apply_unveil(got_repo_get_path(repo), 1, NULL);
 	} else {
+		error = got_blame_unveil_cache(got_repo_get_path_git_dir(repo));
+		if (error)
+			goto done;
 		error = apply_unveil(got_repo_get_path(repo), 1, NULL);
 		if (error)
 			goto done;
@@ -4718,12 +4953,24 @@ cmd_blame(int argc, char *argv[])
 	if (bca.line_offsets[bca.nlines - 1] == filesize)
 		bca.nlines--;
 
+	if (last_line > bca.nlines) {
+		error = got_error_fmt(GOT_ERR_RANGE, "%s has only %d lines",
+		    path, bca.nlines);
+		goto done;
+	}
+
 	bca.lines = calloc(bca.nlines, sizeof(*bca.lines));
 	if (bca.lines == NULL) {
 		error = got_error_from_errno("calloc");
 		goto done;
 	}
-	bca.lineno_cur = 1;
+	if (first_line) {
+		bca.lineno_cur = first_line;
+		bca.lineno_last = last_line;
+	} else {
+		bca.lineno_cur = 1;
+		bca.lineno_last = bca.nlines;
+	}
 	bca.nlines_prec = 0;
 	i = bca.nlines;
 	while (i > 0) {
@@ -4733,7 +4980,7 @@ cmd_blame(int argc, char *argv[])
 	bca.repo = repo;
 
 	error = got_blame(link_target ? link_target : in_repo_path, commit_id,
-	    repo, blame_cb, &bca, check_cancelled, NULL);
+	    first_line, last_line, repo, blame_cb, &bca, check_cancelled, NULL);
 done:
 	free(in_repo_path);
 	free(link_target);
@@ -7163,7 +7410,7 @@ cmd_cherrypick(int argc, char *argv[])
 	if (error != NULL)
 		goto done;
 
-	error = check_same_branch(commit_id, head_ref, NULL, repo);
+	error = check_same_branch(commit_id, head_ref, repo);
 	if (error) {
 		if (error->code != GOT_ERR_ANCESTRY)
 			goto done;
@@ -7285,7 +7532,7 @@ cmd_backout(int argc, char *argv[])
 	if (error != NULL)
 		goto done;
 
-	error = check_same_branch(commit_id, head_ref, NULL, repo);
+	error = check_same_branch(commit_id, head_ref, repo);
 	if (error)
 		goto done;
 
@@ -7753,7 +8000,7 @@ cmd_rebase(int argc, char *argv[])
 			goto done;
 		}
 
-		error = check_same_branch(base_commit_id, branch, yca_id, repo);
+		error = check_same_branch(base_commit_id, branch, repo);
 		if (error) {
 			if (error->code != GOT_ERR_ANCESTRY)
 				goto done;
@@ -10033,3 +10280,174 @@ done:
 	free(uuidstr);
 	return error;
 }
+
+__dead static void
+usage_verify(void)
+{
+	fprintf(stderr, "usage: %s verify [-q] [-j jobs] "
+	    "[-r repository-path]\n", getprogname());
+	exit(1);
+}
+
+#define GOT_VERIFY_MAX_JOBS	64
+
+struct got_verify_problem_arg {
+	int nproblems;
+};
+
+static const struct got_error *
+print_verify_problem(void *arg, const char *path_packfile,
+    struct got_object_id *id, off_t offset, int problem)
+{
+	const struct got_error *err;
+	struct got_verify_problem_arg *a = arg;
+	char *id_str = NULL;
+	const char *msg;
+
+	switch (problem) {
+	case GOT_VERIFY_BAD_PACKIDX:
+		msg = "bad pack index";
+		break;
+	case GOT_VERIFY_BAD_PACK_CHECKSUM:
+		msg = "pack file checksum mismatch";
+		break;
+	case GOT_VERIFY_BAD_CRC32:
+		msg = "CRC32 mismatch";
+		break;
+	case GOT_VERIFY_BAD_OBJ_DATA:
+		msg = "bad object data";
+		break;
+	case GOT_VERIFY_BAD_OBJ_ID:
+		msg = "object data does not match ID";
+		break;
+	default:
+		msg = "unknown problem";
+		break;
+	}
+
+	a->nproblems++;
+
+	if (id == NULL) {
+		printf("%s: %s\n", path_packfile, msg);
+		return NULL;
+	}
+
+	err = got_object_id_str(&id_str, id);
+	if (err)
+		return err;
+	printf("%s: %s at offset %lld: %s\n", path_packfile, id_str,
+	    (long long)offset, msg);
+	free(id_str);
+	return NULL;
+}
+
+static const struct got_error *
+cmd_verify(int argc, char *argv[])
+{
+	const struct got_error *error = NULL;
+	struct got_repository *repo = NULL;
+	struct got_worktree *worktree = NULL;
+	struct got_verify_problem_arg parg;
+	char *cwd = NULL, *repo_path = NULL;
+	const char *errstr;
+	long ncpu;
+	int ch, njobs = 0, npacks, nobjects, quiet = 0;
+
+#ifndef PROFILE
+	if (pledge("stdio rpath wpath cpath flock proc exec sendfd unveil",
+	    NULL) == -1)
+		err(1, "pledge");
+#endif
+
+	while ((ch = getopt(argc, argv, "j:qr:")) != -1) {
+		switch (ch) {
+		case 'j':
+			njobs = strtonum(optarg, 1, GOT_VERIFY_MAX_JOBS,
+			    &errstr);
+			if (errstr != NULL)
+				errx(1, "number of jobs is %s: %s", errstr,
+				    optarg);
+			break;
+		case 'q':
+			quiet = 1;
+			break;
+		case 'r':
+			repo_path = realpath(optarg, NULL);
+			if (repo_path == NULL)
+				return got_error_from_errno2("realpath",
+				    optarg);
+			got_path_strip_trailing_slashes(repo_path);
+			break;
+		default:
+			usage_verify();
+			/* NOTREACHED */
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc != 0)
+		usage_verify();
+
+	if (njobs == 0) {
+		ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		njobs = (ncpu < 1 ? 1 : MIN(ncpu, GOT_VERIFY_MAX_JOBS));
+	}
+
+	cwd = getcwd(NULL, 0);
+	if (cwd == NULL) {
+		error = got_error_from_errno("getcwd");
+		goto done;
+	}
+	if (repo_path == NULL) {
+		error = got_worktree_open(&worktree, cwd);
+		if (error && error->code != GOT_ERR_NOT_WORKTREE)
+			goto done;
+		error = NULL;
+		if (worktree) {
+			repo_path = strdup(
+			    got_worktree_get_repo_path(worktree));
+			if (repo_path == NULL) {
+				error = got_error_from_errno("strdup");
+				goto done;
+			}
+		} else {
+			repo_path = strdup(cwd);
+			if (repo_path == NULL) {
+				error = got_error_from_errno("strdup");
+				goto done;
+			}
+		}
+	}
+
+	error = got_repo_open(&repo, repo_path, NULL);
+	if (error != NULL)
+		goto done;
+
+	error = apply_unveil(got_repo_get_path(repo), 1, NULL);
+	if (error)
+		goto done;
+
+	parg.nproblems = 0;
+	error = got_verify_packs(&npacks, &nobjects, repo, njobs,
+	    print_verify_problem, &parg, check_cancelled, NULL);
+	if (error)
+		goto done;
+
+	if (!quiet)
+		printf("verified %d object%s in %d pack file%s\n", nobjects,
+		    nobjects == 1 ? "" : "s", npacks, npacks == 1 ? "" : "s");
+	if (parg.nproblems > 0)
+		error = got_error_fmt(GOT_ERR_BAD_PACKFILE,
+		    "%d problem%s found", parg.nproblems,
+		    parg.nproblems == 1 ? "" : "s");
+done:
+	if (repo)
+		got_repo_close(repo);
+	if (worktree)
+		got_worktree_close(worktree);
+	free(repo_path);
+	free(cwd);
+	return error;
+}
@@ -349,6 +349,9 @@ gw_blame(struct gw_trans *gw_trans)
 	if ((header = gw_init_header()) == NULL)
 		return got_error_from_errno("malloc");
 
+	error = got_blame_unveil_cache(gw_trans->gw_dir->path);
+	if (error)
+		goto done;
 	error = gw_apply_unveil(gw_trans->gw_dir->path);
 	if (error)
 		goto done;
@@ -2878,11 +2881,11 @@ gw_output_diff(struct gw_trans *gw_trans, struct gw_header *header)
 		break;
 	case GOT_OBJ_TYPE_TREE:
 		error = got_diff_objects_as_trees(NULL, NULL, id1, id2,
-		   "", "", 3, 0, 0, gw_trans->repo, f);
+		   "", "", 3, 0, 0, 0, gw_trans->repo, f);
 		break;
 	case GOT_OBJ_TYPE_COMMIT:
 		error = got_diff_objects_as_commits(NULL, NULL, id1, id2,
-		    3, 0, 0, gw_trans->repo, f);
+		    3, 0, 0, 0, gw_trans->repo, f);
 		break;
 	default:
 		error = got_error(GOT_ERR_OBJ_TYPE);
@@ -4035,8 +4038,8 @@ gw_output_file_blame(struct gw_trans *gw_trans, struct gw_header *header)
 	bca.repo = gw_trans->repo;
 	bca.gw_trans = gw_trans;
 
-	error = got_blame(in_repo_path, commit_id, gw_trans->repo, gw_blame_cb,
-	    &bca, NULL, NULL);
+	error = got_blame(in_repo_path, commit_id, 0, 0, gw_trans->repo,
+	    gw_blame_cb, &bca, NULL, NULL);
 done:
 	free(in_repo_path);
 	free(commit_id);
@@ -26,12 +26,25 @@
  * If no changes to the file were made in a commit, line number -1 will
  * be reported.
  *
+ * If the first and last line numbers passed are not zero, only lines in
+ * this range are annotated and history traversal stops once all of them
+ * have been annotated. GOT_ERR_RANGE is returned if the range does not
+ * fit the file.
+ *
  * If the callback returns GOT_ERR_ITER_COMPLETED, the blame operation
  * will be aborted and this function returns NULL.
  * If the callback returns any other error, the blame operation will be
  * aborted and the callback's error is returned from this function.
  */
 const struct got_error *got_blame(const char *,
-    struct got_object_id *, struct got_repository *,
+    struct got_object_id *, int, int, struct got_repository *,
     const struct got_error *(*cb)(void *, int, int, struct got_object_id *),
     void *, got_cancel_cb, void *);
+
+/*
+ * Allow the blame cache in the specified Git directory to be written
+ * after unveil(2) has restricted the repository to read-only access.
+ * Must be called before unveil(2) is locked. Nothing is unveiled if the
+ * repository has no blame cache.
+ */
+const struct got_error *got_blame_unveil_cache(const char *);
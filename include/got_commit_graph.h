@@ -20,6 +20,14 @@ const struct got_error *got_commit_graph_open(struct got_commit_graph **,
     const char *, int);
 void got_commit_graph_close(struct got_commit_graph *);
 
+/*
+ * Detect changes to the graph's path on different branches with up to the
+ * specified number of got-read-pack processes in parallel. Has no effect
+ * for first-parent traversals and for the root path, or once iteration
+ * has started.
+ */
+void got_commit_graph_set_nworkers(struct got_commit_graph *, int);
+
 const struct got_error *got_commit_graph_iter_start(
     struct got_commit_graph *, struct got_object_id *, struct got_repository *,
     got_cancel_cb, void *);
@@ -29,7 +37,19 @@ const struct got_error *got_commit_graph_intersect(struct got_object_id **,
     struct got_commit_graph *, struct got_commit_graph *,
     struct got_repository *);
 
-/* Find the youngest common ancestor of two commits. */
+/*
+ * Find the youngest common ancestor of two commits.
+ * Only first-parent lines of history are considered.
+ */
 const struct got_error *got_commit_graph_find_youngest_common_ancestor(
     struct got_object_id **, struct got_object_id *, struct got_object_id *,
     struct got_repository *, got_cancel_cb, void *);
+
+/*
+ * Determine whether the first commit is an ancestor of the second commit
+ * or equal to it. Only the first-parent line of history of the second
+ * commit is considered.
+ */
+const struct got_error *got_commit_graph_is_ancestor(int *,
+    struct got_object_id *, struct got_object_id *,
+    struct got_repository *, got_cancel_cb, void *);
@@ -97,6 +97,31 @@ const struct got_error *got_diff_tree(struct got_tree_object *,
     struct got_tree_object *, const char *, const char *,
     struct got_repository *, got_diff_blob_cb cb, void *cb_arg, int);
 
+/*
+ * Like got_diff_tree(), but detect files which were renamed.
+ * A file deleted from the first tree is paired with a file added to the
+ * second tree if both have the same blob ID, or otherwise if their content
+ * is at least 50% similar. A renamed file is passed to the callback as a
+ * single change with differing labels, at the position of its new path.
+ * Content similarity is estimated only if the number of deleted files
+ * times the number of added files stays within a fixed limit, such that
+ * the cost remains bounded on commits which touch very many files.
+ */
+const struct got_error *got_diff_tree_find_renames(struct got_tree_object *,
+    struct got_tree_object *, const char *, const char *,
+    struct got_repository *, got_diff_blob_cb cb, void *cb_arg, int);
+
+/*
+ * Find the path of a file in the first commit which was renamed to the
+ * specified path in the second commit, as detected by
+ * got_diff_tree_find_renames(). Paths are absolute in-repository paths.
+ * Set *old_path to NULL if the path exists in the first commit or if
+ * no rename was detected. The caller must free the returned path.
+ */
+const struct got_error *got_diff_find_rename_source(char **,
+    struct got_object_id *, struct got_object_id *, const char *,
+    struct got_repository *);
+
 /*
  * A pre-defined implementation of got_diff_blob_cb() which collects a list
  * of file paths that differ between two trees.
@@ -137,23 +162,25 @@ const struct got_error *got_diff_objects_as_blobs(off_t **, size_t *,
  * header labels may be provided which will be used to identify each blob in
  * the trees. If a label is NULL, use the blob's SHA1 checksum instead.
  * The number of context lines to show in diffs must be specified.
+ * Renamed files will be detected if the last integer argument is non-zero.
  * Write unified diff text to the provided output FILE.
  * If not NULL, the two initial output arguments will be populated with an
  * array of line offsets for, and the number of lines in, the unidiff text.
  */
 const struct got_error *got_diff_objects_as_trees(off_t **, size_t *,
     struct got_object_id *, struct got_object_id *, char *, char *,
-    int, int, int, struct got_repository *, FILE *);
+    int, int, int, int, struct got_repository *, FILE *);
 
 /*
  * Diff two objects, assuming both objects are commits.
  * The number of context lines to show in diffs must be specified.
+ * Renamed files will be detected if the last integer argument is non-zero.
  * Write unified diff text to the provided output FILE.
  * If not NULL, the two initial output arguments will be populated with an
  * array of line offsets for, and the number of lines in, the unidiff text.
  */
 const struct got_error *got_diff_objects_as_commits(off_t **, size_t *,
-    struct got_object_id *, struct got_object_id *, int, int, int,
+    struct got_object_id *, struct got_object_id *, int, int, int, int,
     struct got_repository *, FILE *);
 
 #define GOT_DIFF_MAX_CONTEXT	64
@@ -25,6 +25,7 @@ struct got_commit_object;
 struct got_object_qid {
 	SIMPLEQ_ENTRY(got_object_qid) entry;
 	struct got_object_id *id;
+	void *data; /* managed by API user */
 };
 
 SIMPLEQ_HEAD(got_object_id_queue, got_object_qid);
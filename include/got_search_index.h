@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+struct got_search_index;
+
+/* Commit meta data passed to got_search_index_search() callbacks. */
+struct got_search_index_entry {
+	struct got_object_id *id;
+	const char *author;
+	const char *committer;
+	const char *logmsg; /* as returned by got_object_commit_get_logmsg() */
+	int indexed; /* zero if the commit was read from the repository */
+};
+
+typedef const struct got_error *(*got_search_index_cb)(void *,
+    struct got_search_index_entry *);
+
+/*
+ * Open the search index of a repository. If the repository has no
+ * search index, NULL is returned as the index.
+ */
+const struct got_error *got_search_index_open(struct got_search_index **,
+    struct got_repository *);
+
+void got_search_index_close(struct got_search_index *);
+
+/*
+ * Allow the search index in the specified Git directory to be updated
+ * after unveil(2) has restricted the repository to read-only access.
+ * Must be called before unveil(2) is locked. Nothing is unveiled if the
+ * repository has no search index.
+ */
+const struct got_error *got_search_index_unveil(const char *);
+
+/*
+ * Add commits to the search index which are reachable from the specified
+ * commit via first-parent links and have not been indexed yet.
+ * Nothing is added if the index directory is not writable.
+ */
+const struct got_error *got_search_index_update(struct got_search_index *,
+    struct got_object_id *, struct got_repository *,
+    got_cancel_cb, void *);
+
+/*
+ * Traverse first-parent links starting at the specified commit and invoke
+ * the callback for every commit which might match the extended regular
+ * expression. Commits without words the expression requires are skipped.
+ * The callback must perform the actual match with regexec(3), and it may
+ * return GOT_ERR_ITER_COMPLETED to end the traversal early.
+ * Commits which have not been indexed are read from the repository.
+ */
+const struct got_error *got_search_index_search(struct got_search_index *,
+    struct got_object_id *, const char *, struct got_repository *,
+    got_search_index_cb, void *, got_cancel_cb, void *);
@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Problems which may be found while verifying pack files. */
+#define GOT_VERIFY_BAD_PACKIDX		1 /* pack index is unusable */
+#define GOT_VERIFY_BAD_PACK_CHECKSUM	2 /* pack file checksum mismatch */
+#define GOT_VERIFY_BAD_CRC32		3 /* packed data does not match CRC */
+#define GOT_VERIFY_BAD_OBJ_DATA		4 /* object cannot be extracted */
+#define GOT_VERIFY_BAD_OBJ_ID		5 /* object data does not match ID */
+
+/*
+ * A callback function which gets invoked for every problem found.
+ * The object ID is NULL for problems which concern an entire pack file,
+ * and the offset is the object's offset in the pack file.
+ */
+typedef const struct got_error *(*got_verify_problem_cb)(void *,
+    const char *, struct got_object_id *, off_t, int);
+
+/*
+ * Verify the integrity of all pack files in the repository, using up to
+ * the specified number of got-read-pack processes in parallel. Each pack
+ * file is split into ranges of objects along offsets listed in its pack
+ * index, and every object's CRC32 and SHA1 are checked, as well as the
+ * checksums of pack files. Problems are reported via the callback.
+ * Return the number of pack files and objects which were verified.
+ */
+const struct got_error *got_verify_packs(int *, int *,
+    struct got_repository *, int, got_verify_problem_cb, void *,
+    got_cancel_cb, void *);
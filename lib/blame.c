@@ -18,6 +18,7 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 
+#include <endian.h>
 #include <errno.h>
 #include <sha1.h>
 #include <string.h>
@@ -25,6 +26,7 @@
 #include <stdlib.h>
 #include <time.h>
 #include <limits.h>
+#include <unistd.h>
 #include <zlib.h>
 
 #include "got_compat.h"
@@ -34,17 +36,36 @@
 #include "got_cancel.h"
 #include "got_blame.h"
 #include "got_commit_graph.h"
+#include "got_diff.h"
 #include "got_opentemp.h"
+#include "got_repository.h"
 
 #include "got_lib_inflate.h"
 #include "got_lib_delta.h"
 #include "got_lib_object.h"
 #include "got_lib_diff.h"
+#include "got_lib_sha1.h"
 
 #ifndef MAX
 #define	MAX(_a,_b) ((_a) > (_b) ? (_a) : (_b))
 #endif
 
+/*
+ * Blame results are kept in this directory within the repository if it
+ * exists. Each file in this directory holds the annotations of a file in
+ * a commit which changed this file, and is named after a SHA1 hash of the
+ * commit ID and the path:
+ *
+ * signature, version, blob ID, number of lines, number of runs
+ * runs of lines annotated with the same commit: line count, commit ID
+ * SHA1 checksum of the above
+ *
+ * Blaming a file then stops at the most recent commit found in the cache.
+ */
+#define GOT_BLAME_CACHE_DIR		"got-blame-cache"
+#define GOT_BLAME_CACHE_SIGNATURE	0x676f7442 /* 'g', 'o', 't', 'B' */
+#define GOT_BLAME_CACHE_VERSION		2
+
 struct got_blame_line {
 	int annotated;
 	struct got_object_id id;
@@ -56,6 +77,7 @@ struct got_blame {
 	int nannotated;	/* number of lines already annotated */
 	struct got_blame_line *lines; /* one per line */
 	int ncommits;
+	int partial;	/* only a range of lines is being annotated */
 
 	/*
 	 * These change with every traversed commit. After diffing
@@ -86,6 +108,11 @@ struct got_blame {
 
 	struct diff_data *data1;
 	struct diff_data *data2;
+
+	/* The blame cache directory and the IDs of blobs in f1 and f2. */
+	char *cache_dir;
+	struct got_object_id *blob_id1;
+	struct got_object_id *blob_id2;
 };
 
 static const struct got_error *
@@ -112,20 +139,39 @@ annotate_line(struct got_blame *blame, int lineno, struct got_object_id *id,
 }
 
 static const struct got_error *
-blame_changes(struct got_blame *blame, struct diff_result *diff_result,
-    struct got_object_id *commit_id,
+blame_changes(struct got_blame *blame, int nhead, int ntail,
+    struct diff_result *diff_result, struct got_object_id *commit_id,
     const struct got_error *(*cb)(void *, int, int, struct got_object_id *),
     void *arg)
 {
 	const struct got_error *err = NULL;
 	int i;
 	int idx1 = 0, idx2 = 0;
+	int len1 = blame->data1->atoms.len, len2 = blame->data2->atoms.len;
+
+	/* Leading and trailing lines which were not diffed are identical. */
+	for (i = 0; i < nhead; i++)
+		blame->linemap1[i] = blame->linemap2[i];
+	for (i = 0; i < ntail; i++) {
+		blame->linemap1[len1 - ntail + i] =
+		    blame->linemap2[len2 - ntail + i];
+	}
+	idx1 = idx2 = nhead;
+
+	/*
+	 * Without a diff result none of the lines in between are of
+	 * interest, and older versions of them need not be tracked.
+	 */
+	if (diff_result == NULL) {
+		while (idx1 < len1 - ntail)
+			blame->linemap1[idx1++] = -1;
+		return NULL;
+	}
 
 	for (i = 0; i < diff_result->chunks.len &&
 	    blame->nannotated < blame->nlines; i++) {
 		struct diff_chunk *c = diff_chunk_get(diff_result, i);
-		unsigned int left_start, left_count;
-		unsigned int right_start, right_count;
+		unsigned int left_count, right_count;
 		int j;
 
 		/*
@@ -134,9 +180,7 @@ blame_changes(struct got_blame *blame, struct diff_result *diff_result,
 		 * that chunk ranges never exceed the number of lines
 		 * in the left/right input files.
 		 */
-		left_start = diff_chunk_get_left_start(c, diff_result, 0);
 		left_count = diff_chunk_get_left_count(c);
-		right_start = diff_chunk_get_right_start(c, diff_result, 0);
 		right_count = diff_chunk_get_right_count(c);
 
 		if (left_count == right_count) {
@@ -167,6 +211,24 @@ blame_changes(struct got_blame *blame, struct diff_result *diff_result,
 	return NULL;
 }
 
+/*
+ * Check whether any lines in the specified range of the newer version
+ * map to lines which have not been annotated yet.
+ */
+static int
+changes_wanted(struct got_blame *blame, int start, int end)
+{
+	int i;
+
+	for (i = start; i < end; i++) {
+		int ln = blame->linemap2[i];
+		if (ln >= 0 && ln < blame->nlines && !blame->lines[ln].annotated)
+			return 1;
+	}
+
+	return 0;
+}
+
 static const struct got_error *
 blame_prepare_file(FILE *f, unsigned char **p, off_t *size,
     int *nlines, off_t **line_offsets, struct diff_data *diff_data,
@@ -196,11 +258,32 @@ blame_prepare_file(FILE *f, unsigned char **p, off_t *size,
 	return NULL;
 }
 
+/* Check whether two lines are identical, comparing their hashes first. */
+static const struct got_error *
+lines_same(int *same, const struct diff_atom *a, const struct diff_atom *b)
+{
+	int cmp, rc;
+
+	*same = 0;
+	if (a->hash != b->hash)
+		return NULL;
+	rc = diff_atom_cmp(&cmp, a, b);
+	if (rc)
+		return got_error_set_errno(rc, "diff_atom_cmp");
+	*same = (cmp == 0);
+	return NULL;
+}
+
+/*
+ * Diff the file in the commit against its version in the commit's first
+ * parent. If the commit renamed the file, return its previous path and
+ * the parent commit's ID such that blame can continue along the old path.
+ */
 static const struct got_error *
 blame_commit(struct got_blame *blame, struct got_object_id *id,
     const char *path, struct got_repository *repo,
     const struct got_error *(*cb)(void *, int, int, struct got_object_id *),
-    void *arg)
+    void *arg, char **old_path, struct got_object_id **old_path_commit_id)
 {
 	const struct got_error *err = NULL;
 	struct got_commit_object *commit = NULL;
@@ -208,6 +291,10 @@ blame_commit(struct got_blame *blame, struct got_object_id *id,
 	struct got_object_id *pblob_id = NULL;
 	struct got_blob_object *pblob = NULL;
 	struct diff_result *diff_result = NULL;
+	struct diff_data d1, d2;
+	struct diff_atom *atoms1, *atoms2;
+	unsigned int len1, len2, nhead = 0, ntail = 0;
+	int same;
 
 	err = got_object_open_as_commit(&commit, repo, id);
 	if (err)
@@ -221,8 +308,33 @@ blame_commit(struct got_blame *blame, struct got_object_id *id,
 
 	err = got_object_id_by_path(&pblob_id, repo, pid->id, path);
 	if (err) {
-		if (err->code == GOT_ERR_NO_TREE_ENTRY)
-			err = NULL;
+		if (err->code != GOT_ERR_NO_TREE_ENTRY)
+			goto done;
+		err = got_diff_find_rename_source(old_path, pid->id, id, path,
+		    repo);
+		if (err || *old_path == NULL)
+			goto done;
+		*old_path_commit_id = got_object_id_dup(pid->id);
+		if (*old_path_commit_id == NULL) {
+			err = got_error_from_errno("got_object_id_dup");
+			goto done;
+		}
+		err = got_object_id_by_path(&pblob_id, repo, pid->id,
+		    *old_path);
+		if (err)
+			goto done;
+	}
+
+	/*
+	 * If only the file's mode was changed there is nothing to diff.
+	 * Keep the blob ID around for close_file2_and_reuse_file1().
+	 */
+	if (blame->blob_id2 &&
+	    got_object_id_cmp(pblob_id, blame->blob_id2) == 0) {
+		blame->blob_id1 = pblob_id;
+		pblob_id = NULL;
+		if (cb)
+			err = cb(arg, blame->nlines, -1, id);
 		goto done;
 	}
 
@@ -241,17 +353,55 @@ blame_commit(struct got_blame *blame, struct got_object_id *id,
 	    blame->cfg, pblob);
 	if (err)
 		goto done;
+	blame->blob_id1 = pblob_id;
+	pblob_id = NULL;
 
-	diff_result = diff_main(blame->cfg, blame->data1, blame->data2);
-	if (diff_result == NULL) {
-		err = got_error_set_errno(ENOMEM, "malloc");
-		goto done;
+	/*
+	 * Most commits only change a few lines of a file. Diff the range
+	 * between identical leading and trailing lines rather than making
+	 * the diff algorithm sort and match every line of both versions.
+	 */
+	atoms1 = blame->data1->atoms.head;
+	atoms2 = blame->data2->atoms.head;
+	len1 = blame->data1->atoms.len;
+	len2 = blame->data2->atoms.len;
+	while (nhead < len1 && nhead < len2) {
+		err = lines_same(&same, &atoms1[nhead], &atoms2[nhead]);
+		if (err)
+			goto done;
+		if (!same)
+			break;
+		nhead++;
 	}
-	if (diff_result->rc != DIFF_RC_OK) {
-		err = got_error_set_errno(diff_result->rc, "diff");
-		goto done;
+	while (ntail < len1 - nhead && ntail < len2 - nhead) {
+		err = lines_same(&same, &atoms1[len1 - 1 - ntail],
+		    &atoms2[len2 - 1 - ntail]);
+		if (err)
+			goto done;
+		if (!same)
+			break;
+		ntail++;
 	}
-	if (diff_result->chunks.len > 0) {
+
+	/* Changes to lines which are not being tracked need not be diffed. */
+	if (changes_wanted(blame, nhead, len2 - ntail)) {
+		diff_data_init_subsection(&d1, blame->data1, &atoms1[nhead],
+		    len1 - nhead - ntail);
+		diff_data_init_subsection(&d2, blame->data2, &atoms2[nhead],
+		    len2 - nhead - ntail);
+
+		diff_result = diff_main(blame->cfg, &d1, &d2);
+		if (diff_result == NULL) {
+			err = got_error_set_errno(ENOMEM, "malloc");
+			goto done;
+		}
+		if (diff_result->rc != DIFF_RC_OK) {
+			err = got_error_set_errno(diff_result->rc, "diff");
+			goto done;
+		}
+	}
+	if (diff_result == NULL || diff_result->chunks.len > 0 ||
+	    nhead > 0 || ntail > 0) {
 		if (blame->nlines1 > 0) {
 			blame->linemap1 = calloc(blame->nlines1,
 			    sizeof(*blame->linemap1));
@@ -260,7 +410,8 @@ blame_commit(struct got_blame *blame, struct got_object_id *id,
 				goto done;
 			}
 		}
-		err = blame_changes(blame, diff_result, id, cb, arg);
+		err = blame_changes(blame, nhead, ntail, diff_result, id,
+		    cb, arg);
 		if (err)
 			goto done;
 	} else if (cb)
@@ -303,6 +454,9 @@ blame_close(struct got_blame *blame)
 	free(blame->linemap1);
 	free(blame->linemap2);
 	free(blame->cfg);
+	free(blame->cache_dir);
+	free(blame->blob_id1);
+	free(blame->blob_id2);
 	free(blame);
 	return err;
 }
@@ -459,6 +613,14 @@ close_file2_and_reuse_file1(struct got_blame *blame)
 {
 	struct diff_data *d;
 
+	/* The older version is identical; keep using file2. */
+	if (blame->f1 == NULL && blame->blob_id1 && blame->blob_id2 &&
+	    got_object_id_cmp(blame->blob_id1, blame->blob_id2) == 0) {
+		free(blame->blob_id1);
+		blame->blob_id1 = NULL;
+		return NULL;
+	}
+
 	free(blame->line_offsets2);
 	blame->line_offsets2 = blame->line_offsets1;
 	blame->line_offsets1 = NULL;
@@ -467,6 +629,10 @@ close_file2_and_reuse_file1(struct got_blame *blame)
 	blame->linemap2 = blame->linemap1;
 	blame->linemap1 = NULL;
 
+	free(blame->blob_id2);
+	blame->blob_id2 = blame->blob_id1;
+	blame->blob_id1 = NULL;
+
 	if (blame->map2) {
 		if (munmap(blame->map2, blame->size2) == -1)
 			return got_error_from_errno("munmap");
@@ -495,8 +661,290 @@ close_file2_and_reuse_file1(struct got_blame *blame)
 }
 
 static const struct got_error *
-blame_open(struct got_blame **blamep, const char *path,
-    struct got_object_id *start_commit_id, struct got_repository *repo,
+get_blame_cache_path(char **cache_path, struct got_blame *blame,
+    struct got_object_id *commit_id, const char *path)
+{
+	struct got_sha1_ctx ctx;
+	uint8_t key[SHA1_DIGEST_LENGTH];
+	char hex[SHA1_DIGEST_STRING_LENGTH];
+
+	got_sha1_init(&ctx);
+	got_sha1_update(&ctx, commit_id->sha1, SHA1_DIGEST_LENGTH);
+	got_sha1_update(&ctx, (const uint8_t *)path, strlen(path));
+	got_sha1_final(key, &ctx);
+
+	if (got_sha1_digest_to_str(key, hex, sizeof(hex)) == NULL)
+		return got_error(GOT_ERR_BAD_OBJ_ID_STR);
+	if (asprintf(cache_path, "%s/%s", blame->cache_dir, hex) == -1)
+		return got_error_from_errno("asprintf");
+	return NULL;
+}
+
+static const struct got_error *
+write_blame_cache_data(struct got_sha1_ctx *ctx, const void *data,
+    size_t len, FILE *outfile)
+{
+	got_sha1_update(ctx, data, len);
+	if (fwrite(data, 1, len, outfile) != len)
+		return got_ferror(outfile, GOT_ERR_IO);
+	return NULL;
+}
+
+static const struct got_error *
+write_blame_cache_val32(struct got_sha1_ctx *ctx, uint32_t val,
+    FILE *outfile)
+{
+	val = htobe32(val);
+	return write_blame_cache_data(ctx, &val, sizeof(val), outfile);
+}
+
+static const struct got_error *
+read_blame_cache_data(struct got_sha1_ctx *ctx, void *data, size_t len,
+    FILE *infile)
+{
+	if (fread(data, 1, len, infile) != len)
+		return got_ferror(infile, GOT_ERR_IO);
+	got_sha1_update(ctx, data, len);
+	return NULL;
+}
+
+static const struct got_error *
+read_blame_cache_val32(uint32_t *val, struct got_sha1_ctx *ctx,
+    FILE *infile)
+{
+	const struct got_error *err;
+
+	err = read_blame_cache_data(ctx, val, sizeof(*val), infile);
+	if (err)
+		return err;
+	*val = be32toh(*val);
+	return NULL;
+}
+
+/* Store the annotations of the blamed file as found in a commit. */
+static const struct got_error *
+blame_cache_write(struct got_blame *blame, struct got_object_id *commit_id,
+    struct got_object_id *blob_id, const char *path)
+{
+	const struct got_error *err = NULL;
+	struct got_sha1_ctx ctx;
+	uint8_t sha1[SHA1_DIGEST_LENGTH];
+	char *cache_path = NULL, *tmppath = NULL;
+	FILE *f = NULL;
+	int i, n, nruns = 0;
+
+	for (i = 0; i < blame->nlines; i++) {
+		if (i == 0 || got_object_id_cmp(&blame->lines[i].id,
+		    &blame->lines[i - 1].id) != 0)
+			nruns++;
+	}
+
+	err = get_blame_cache_path(&cache_path, blame, commit_id, path);
+	if (err)
+		return err;
+	err = got_opentemp_named(&tmppath, &f, cache_path);
+	if (err)
+		goto done;
+
+	got_sha1_init(&ctx);
+	err = write_blame_cache_val32(&ctx, GOT_BLAME_CACHE_SIGNATURE, f);
+	if (err)
+		goto done;
+	err = write_blame_cache_val32(&ctx, GOT_BLAME_CACHE_VERSION, f);
+	if (err)
+		goto done;
+	err = write_blame_cache_data(&ctx, blob_id->sha1, SHA1_DIGEST_LENGTH,
+	    f);
+	if (err)
+		goto done;
+	err = write_blame_cache_val32(&ctx, blame->nlines, f);
+	if (err)
+		goto done;
+	err = write_blame_cache_val32(&ctx, nruns, f);
+	if (err)
+		goto done;
+	for (i = 0; i < blame->nlines; i += n) {
+		for (n = 1; i + n < blame->nlines; n++) {
+			if (got_object_id_cmp(&blame->lines[i + n].id,
+			    &blame->lines[i].id) != 0)
+				break;
+		}
+		err = write_blame_cache_val32(&ctx, n, f);
+		if (err)
+			goto done;
+		err = write_blame_cache_data(&ctx, blame->lines[i].id.sha1,
+		    SHA1_DIGEST_LENGTH, f);
+		if (err)
+			goto done;
+	}
+	got_sha1_final(sha1, &ctx);
+	if (fwrite(sha1, 1, sizeof(sha1), f) != sizeof(sha1)) {
+		err = got_ferror(f, GOT_ERR_IO);
+		goto done;
+	}
+
+	if (fclose(f) == EOF) {
+		f = NULL;
+		err = got_error_from_errno2("fclose", tmppath);
+		goto done;
+	}
+	f = NULL;
+	if (rename(tmppath, cache_path) == -1) {
+		err = got_error_from_errno3("rename", tmppath, cache_path);
+		goto done;
+	}
+	free(tmppath);
+	tmppath = NULL;
+done:
+	if (f && fclose(f) == EOF && err == NULL)
+		err = got_error_from_errno2("fclose", tmppath);
+	if (tmppath && unlink(tmppath) == -1 && err == NULL)
+		err = got_error_from_errno2("unlink", tmppath);
+	free(tmppath);
+	free(cache_path);
+	return err;
+}
+
+/*
+ * Look up the annotations of a file in a commit in the blame cache.
+ * Return one commit ID per line, or NULL if the commit is not cached
+ * with the expected blob.
+ */
+static const struct got_error *
+blame_cache_read(struct got_object_id **line_ids, int *nlines,
+    struct got_blame *blame, struct got_object_id *commit_id,
+    struct got_object_id *blob_id, const char *path)
+{
+	const struct got_error *err = NULL;
+	struct got_sha1_ctx ctx;
+	struct got_object_id id;
+	uint8_t sha1[SHA1_DIGEST_LENGTH], sha1_expected[SHA1_DIGEST_LENGTH];
+	uint32_t signature, version, nruns, n, i;
+	char *cache_path = NULL;
+	FILE *f = NULL;
+	int lineno = 0;
+
+	*line_ids = NULL;
+	*nlines = 0;
+
+	err = get_blame_cache_path(&cache_path, blame, commit_id, path);
+	if (err)
+		return err;
+	f = fopen(cache_path, "r");
+	if (f == NULL) {
+		if (errno != ENOENT)
+			err = got_error_from_errno2("fopen", cache_path);
+		goto done;
+	}
+
+	got_sha1_init(&ctx);
+	err = read_blame_cache_val32(&signature, &ctx, f);
+	if (err)
+		goto done;
+	err = read_blame_cache_val32(&version, &ctx, f);
+	if (err)
+		goto done;
+	if (signature != GOT_BLAME_CACHE_SIGNATURE ||
+	    version != GOT_BLAME_CACHE_VERSION)
+		goto done;
+	err = read_blame_cache_data(&ctx, id.sha1, SHA1_DIGEST_LENGTH, f);
+	if (err)
+		goto done;
+	if (got_object_id_cmp(&id, blob_id) != 0)
+		goto done;
+	err = read_blame_cache_val32(&n, &ctx, f);
+	if (err)
+		goto done;
+	if (n == 0 || n > blame->nlines2)
+		goto done;
+	*nlines = n;
+	err = read_blame_cache_val32(&nruns, &ctx, f);
+	if (err)
+		goto done;
+
+	*line_ids = calloc(*nlines, sizeof(**line_ids));
+	if (*line_ids == NULL) {
+		err = got_error_from_errno("calloc");
+		goto done;
+	}
+	for (i = 0; i < nruns; i++) {
+		err = read_blame_cache_val32(&n, &ctx, f);
+		if (err)
+			goto done;
+		err = read_blame_cache_data(&ctx, id.sha1, SHA1_DIGEST_LENGTH,
+		    f);
+		if (err)
+			goto done;
+		if (n > *nlines - lineno) {
+			err = got_error(GOT_ERR_BAD_OBJ_DATA);
+			goto done;
+		}
+		while (n-- > 0)
+			memcpy(&(*line_ids)[lineno++], &id, sizeof(id));
+	}
+	if (lineno != *nlines) {
+		err = got_error(GOT_ERR_BAD_OBJ_DATA);
+		goto done;
+	}
+
+	if (fread(sha1_expected, 1, sizeof(sha1_expected), f) !=
+	    sizeof(sha1_expected)) {
+		err = got_ferror(f, GOT_ERR_IO);
+		goto done;
+	}
+	got_sha1_final(sha1, &ctx);
+	if (memcmp(sha1, sha1_expected, SHA1_DIGEST_LENGTH) != 0)
+		err = got_error(GOT_ERR_BAD_OBJ_DATA);
+done:
+	if (f && fclose(f) == EOF && err == NULL)
+		err = got_error_from_errno2("fclose", cache_path);
+	if (err || *line_ids == NULL) {
+		free(*line_ids);
+		*line_ids = NULL;
+		*nlines = 0;
+	}
+	free(cache_path);
+	return err;
+}
+
+/*
+ * Annotate lines which are still unannotated with annotations found in
+ * the blame cache for the version of the file in the given commit.
+ * Problems with the cache are ignored since it only saves time.
+ */
+static const struct got_error *
+blame_cached_lines(struct got_blame *blame, struct got_object_id *commit_id,
+    const char *path,
+    const struct got_error *(*cb)(void *, int, int, struct got_object_id *),
+    void *arg)
+{
+	const struct got_error *err;
+	struct got_object_id *line_ids;
+	int i, nlines;
+
+	if (blame->cache_dir == NULL || blame->blob_id2 == NULL ||
+	    blame->linemap2 == NULL)
+		return NULL;
+
+	err = blame_cache_read(&line_ids, &nlines, blame, commit_id,
+	    blame->blob_id2, path);
+	if (err || line_ids == NULL)
+		return NULL;
+
+	for (i = 0; i < nlines && blame->nannotated < blame->nlines; i++) {
+		err = annotate_line(blame, blame->linemap2[i], &line_ids[i],
+		    cb, arg);
+		if (err)
+			break;
+	}
+	free(line_ids);
+	return err;
+}
+
+static const struct got_error *
+blame_open(struct got_blame **blamep, const char *blame_path,
+    struct got_object_id *start_commit_id, int first_line, int last_line,
+    struct got_repository *repo,
     const struct got_error *(*cb)(void *, int, int, struct got_object_id *),
     void *arg, got_cancel_cb cancel_cb, void *cancel_arg)
 {
@@ -504,9 +952,13 @@ blame_open(struct got_blame **blamep, const char *path,
 	struct got_object_id *obj_id = NULL;
 	struct got_blob_object *blob = NULL;
 	struct got_blame *blame = NULL;
-	struct got_object_id *id = NULL;
+	struct got_object_id *id = NULL, *first_id = NULL, *cached_id = NULL;
+	struct got_object_id *old_path_commit_id = NULL;
+	char *old_path = NULL, *followed_path = NULL;
+	const char *path = blame_path;
 	int lineno;
 	struct got_commit_graph *graph = NULL;
+	struct stat sb;
 
 	*blamep = NULL;
 
@@ -534,6 +986,22 @@ blame_open(struct got_blame **blamep, const char *path,
 		err = got_error_from_errno("calloc");
 		goto done;
 	}
+	blame->blob_id2 = got_object_id_dup(obj_id);
+	if (blame->blob_id2 == NULL) {
+		err = got_error_from_errno("got_object_id_dup");
+		goto done;
+	}
+
+	if (asprintf(&blame->cache_dir, "%s/%s",
+	    got_repo_get_path_git_dir(repo), GOT_BLAME_CACHE_DIR) == -1) {
+		err = got_error_from_errno("asprintf");
+		blame->cache_dir = NULL;
+		goto done;
+	}
+	if (stat(blame->cache_dir, &sb) == -1 || !S_ISDIR(sb.st_mode)) {
+		free(blame->cache_dir);
+		blame->cache_dir = NULL;
+	}
 
 	blame->f2 = got_opentemp();
 	if (blame->f2 == NULL) {
@@ -565,6 +1033,26 @@ blame_open(struct got_blame **blamep, const char *path,
 		goto done;
 	}
 
+	/*
+	 * Lines outside the requested range are treated as annotated,
+	 * such that history traversal ends once all lines in the range
+	 * have been annotated.
+	 */
+	if (first_line != 0 || last_line != 0) {
+		if (first_line < 1 || last_line < first_line ||
+		    last_line > blame->nlines) {
+			err = got_error(GOT_ERR_RANGE);
+			goto done;
+		}
+		for (lineno = 0; lineno < blame->nlines; lineno++) {
+			if (lineno >= first_line - 1 && lineno < last_line)
+				continue;
+			blame->lines[lineno].annotated = 1;
+			blame->nannotated++;
+		}
+		blame->partial = (blame->nannotated > 0);
+	}
+
 	blame->linemap2 = calloc(blame->nlines2, sizeof(*blame->linemap2));
 	if (blame->linemap2 == NULL) {
 		err = got_error_from_errno("calloc");
@@ -594,7 +1082,26 @@ blame_open(struct got_blame **blamep, const char *path,
 		}
 		if (next_id) {
 			id = next_id;
-			err = blame_commit(blame, id, path, repo, cb, arg);
+			if (first_id == NULL) {
+				first_id = got_object_id_dup(id);
+				if (first_id == NULL) {
+					err = got_error_from_errno(
+					    "got_object_id_dup");
+					goto done;
+				}
+			}
+			err = blame_cached_lines(blame, id, path, cb, arg);
+			if (err) {
+				if (err->code == GOT_ERR_ITER_COMPLETED)
+					err = NULL;
+				goto done;
+			}
+			if (blame->nannotated == blame->nlines) {
+				cached_id = id;
+				break;
+			}
+			err = blame_commit(blame, id, path, repo, cb, arg,
+			    &old_path, &old_path_commit_id);
 			if (err) {
 				if (err->code == GOT_ERR_ITER_COMPLETED)
 					err = NULL;
@@ -606,6 +1113,27 @@ blame_open(struct got_blame **blamep, const char *path,
 			err = close_file2_and_reuse_file1(blame);
 			if (err)
 				goto done;
+
+			if (old_path == NULL)
+				continue;
+
+			/* Follow the file's history along its old path. */
+			got_commit_graph_close(graph);
+			graph = NULL;
+			id = NULL;
+			free(followed_path);
+			followed_path = old_path;
+			old_path = NULL;
+			path = followed_path;
+			err = got_commit_graph_open(&graph, path, 1);
+			if (err)
+				goto done;
+			err = got_commit_graph_iter_start(graph,
+			    old_path_commit_id, repo, cancel_cb, cancel_arg);
+			free(old_path_commit_id);
+			old_path_commit_id = NULL;
+			if (err)
+				goto done;
 		}
 	}
 
@@ -618,9 +1146,22 @@ blame_open(struct got_blame **blamep, const char *path,
 		}
 	}
 
+	/*
+	 * The first commit found changed the file last, and thus has the
+	 * same annotations as the commit being blamed.
+	 */
+	if (blame->cache_dir && first_id && !blame->partial &&
+	    (cached_id == NULL || got_object_id_cmp(first_id, cached_id) != 0)) {
+		/* The cache is not essential; ignore problems with it. */
+		blame_cache_write(blame, first_id, obj_id, blame_path);
+	}
 done:
 	if (graph)
 		got_commit_graph_close(graph);
+	free(first_id);
+	free(old_path);
+	free(followed_path);
+	free(old_path_commit_id);
 	free(obj_id);
 	if (blob)
 		got_object_blob_close(blob);
@@ -635,7 +1176,7 @@ done:
 
 const struct got_error *
 got_blame(const char *path, struct got_object_id *commit_id,
-    struct got_repository *repo,
+    int first_line, int last_line, struct got_repository *repo,
     const struct got_error *(*cb)(void *, int, int, struct got_object_id *),
     void *arg, got_cancel_cb cancel_cb, void* cancel_arg)
 {
@@ -646,10 +1187,26 @@ got_blame(const char *path, struct got_object_id *commit_id,
 	if (asprintf(&abspath, "%s%s", path[0] == '/' ? "" : "/", path) == -1)
 		return got_error_from_errno2("asprintf", path);
 
-	err = blame_open(&blame, abspath, commit_id, repo, cb, arg,
-	    cancel_cb, cancel_arg);
+	err = blame_open(&blame, abspath, commit_id, first_line, last_line,
+	    repo, cb, arg, cancel_cb, cancel_arg);
 	free(abspath);
 	if (blame)
 		close_err = blame_close(blame);
 	return err ? err : close_err;
 }
+
+const struct got_error *
+got_blame_unveil_cache(const char *git_dir)
+{
+	const struct got_error *err = NULL;
+	char *cache_dir;
+	struct stat sb;
+
+	if (asprintf(&cache_dir, "%s/%s", git_dir, GOT_BLAME_CACHE_DIR) == -1)
+		return got_error_from_errno("asprintf");
+	if (stat(cache_dir, &sb) == 0 && S_ISDIR(sb.st_mode) &&
+	    unveil(cache_dir, "rwc") != 0)
+		err = got_error_from_errno2("unveil", cache_dir);
+	free(cache_dir);
+	return err;
+}
@@ -16,19 +16,24 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 
+#include <errno.h>
 #include <limits.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sha1.h>
 #include <zlib.h>
 #include <ctype.h>
+#include <unistd.h>
 
 #include "got_compat.h"
 
 #include "got_error.h"
 #include "got_object.h"
+#include "got_repository.h"
 #include "got_cancel.h"
 #include "got_commit_graph.h"
 #include "got_path.h"
@@ -37,23 +42,61 @@
 #include "got_lib_inflate.h"
 #include "got_lib_object.h"
 #include "got_lib_object_idset.h"
+#include "got_lib_object_cache.h"
+#include "got_lib_privsep.h"
+#include "got_lib_pack.h"
+#include "got_lib_repository.h"
+
+#ifndef MIN
+#define	MIN(_a,_b) ((_a) < (_b) ? (_a) : (_b))
+#endif
 
 struct got_commit_graph_node {
 	struct got_object_id id;
-
-	/* Used only during iteration. */
-	time_t timestamp;
 	TAILQ_ENTRY(got_commit_graph_node) entry;
 };
 
 TAILQ_HEAD(got_commit_graph_iter_list, got_commit_graph_node);
 
+struct got_commit_graph_worker;
+
+/* A commit at the tip of an open branch, which has not been traversed yet. */
 struct got_commit_graph_branch_tip {
-	struct got_object_id *commit_id;
-	struct got_commit_object *commit;
-	struct got_commit_graph_node *new_node;
+	struct got_object_id id;
+	struct got_commit_object *commit; /* NULL if traversed by got-read-pack */
+	struct got_traversed_commit *traversed;
+	time_t timestamp;
+	unsigned int seq;
+
+	int changed;	/* known change to path; -1 if unknown */
+	int queried;	/* set once this tip was handed to a worker */
+	struct got_commit_graph_worker *worker;	/* set while worker is busy */
+};
+
+/*
+ * A got-read-pack process which detects whether branch tips changed the
+ * graph's path while the main process is busy with other branch tips.
+ */
+struct got_commit_graph_worker {
+	struct got_privsep_pack_worker pw;
+	int busy;
+	struct got_commit_graph_branch_tip *tip; /* NULL if tip was closed */
 };
 
+/*
+ * Tips near the top of the heap are handed to workers. Looking at more
+ * tips than there are workers allows workers to stay busy while tips in
+ * loose objects or other pack files are skipped.
+ */
+#define GOT_COMMIT_GRAPH_TIPS_PER_WORKER	4
+
+/* Bounds for the number of commits traversed by got-read-pack at once. */
+#define GOT_COMMIT_GRAPH_MIN_TRAVERSED		32
+#define GOT_COMMIT_GRAPH_MAX_TRAVERSED		4096
+
+/* Maximum number of branch tips got-read-pack starts traversing from. */
+#define GOT_COMMIT_GRAPH_MAX_TRAVERSAL_TIPS	256
+
 struct got_commit_graph {
 	/* The set of all commits we have traversed. */
 	struct got_object_idset *node_ids;
@@ -71,25 +114,48 @@ struct got_commit_graph {
 	 * Whenever we add a commit with a matching ID to the graph, we remove
 	 * its corresponding element from this set, and add new elements for
 	 * each of that commit's parent commits which were not traversed yet.
-	 *
-	 * When API users ask us to fetch more commits, we fetch commits from
-	 * all currently open branches. This allows API users to process
-	 * commits in linear order even though the history contains branches.
+	 * Each element's data points to the branch's tip in the heap below.
 	 */
 	struct got_object_idset *open_branches;
 
-	/* Array of branch tips for fetch_commits_from_open_branches(). */
-	struct got_commit_graph_branch_tip *tips;
+	/*
+	 * Tips of all open branches, in a binary heap which has the most
+	 * recently committed tip at the top. Tips with equal timestamps
+	 * are traversed in the order they were found. Always traversing
+	 * the top tip next allows API users to process commits in linear
+	 * order even though the history contains branches.
+	 */
+	struct got_commit_graph_branch_tip **tips;
 	int ntips;
+	int nalloc_tips;
+	unsigned int tip_seq;
 
 	/* Path of tree entry of interest to the API user. */
 	char *path;
 
 	/*
-	 * Nodes which will be passed to the API user next, sorted by
-	 * commit timestmap.
+	 * Commits which got-read-pack has traversed ahead of us, which can
+	 * become branch tips without being opened. Each element's data is
+	 * a struct got_traversed_commit. The number of commits requested
+	 * from got-read-pack grows while traversal goes on, and requests
+	 * carry a random session ID which allows got-read-pack to continue
+	 * where it stopped.
 	 */
+	struct got_object_idset *traversed_commits;
+	int traversal_session;
+	int max_traversed;
+
+	/* Processes which detect changes to the path in parallel. */
+	struct got_commit_graph_worker *workers;
+	struct pollfd *pfd;
+	int nworkers;
+	int max_workers;
+
+	/* Nodes which will be passed to the API user next. */
 	struct got_commit_graph_iter_list iter_list;
+
+	/* Nodes passed to the API user, whose IDs we must keep around. */
+	struct got_commit_graph_iter_list done_list;
 };
 
 static const struct got_error *
@@ -145,47 +211,119 @@ done:
 	return err;
 }
 
-static void
+static const struct got_error *
 add_node_to_iter_list(struct got_commit_graph *graph,
-    struct got_commit_graph_node *node, time_t committer_time)
+    struct got_object_id *commit_id)
 {
-	struct got_commit_graph_node *n, *next;
+	struct got_commit_graph_node *node;
 
-	node->timestamp = committer_time;
+	node = calloc(1, sizeof(*node));
+	if (node == NULL)
+		return got_error_from_errno("calloc");
 
-	n = TAILQ_FIRST(&graph->iter_list);
-	while (n) {
-		next = TAILQ_NEXT(n, entry);
-		if (next && node->timestamp >= next->timestamp) {
-			TAILQ_INSERT_BEFORE(next, node, entry);
-			return;
-		}
-		n = next;
-	}
+	memcpy(&node->id, commit_id, sizeof(node->id));
 	TAILQ_INSERT_TAIL(&graph->iter_list, node, entry);
+	return NULL;
+}
+
+static int
+tip_is_newer(struct got_commit_graph_branch_tip *a,
+    struct got_commit_graph_branch_tip *b)
+{
+	if (a->timestamp != b->timestamp)
+		return a->timestamp > b->timestamp;
+	return a->seq < b->seq;
 }
 
 static const struct got_error *
-add_node(struct got_commit_graph_node **new_node,
-    struct got_commit_graph *graph, struct got_object_id *commit_id,
+open_branch(struct got_commit_graph *graph, struct got_object_id *commit_id,
     struct got_repository *repo)
 {
-	const struct got_error *err = NULL;
-	struct got_commit_graph_node *node;
+	const struct got_error *err;
+	struct got_commit_graph_branch_tip *tip;
+	int i;
 
-	*new_node = NULL;
+	if (got_object_idset_contains(graph->open_branches, commit_id))
+		return NULL;
 
-	node = calloc(1, sizeof(*node));
-	if (node == NULL)
+	if (graph->ntips == graph->nalloc_tips) {
+		struct got_commit_graph_branch_tip **tips;
+		int nalloc = graph->nalloc_tips ? graph->nalloc_tips * 2 : 16;
+
+		tips = recallocarray(graph->tips, graph->nalloc_tips, nalloc,
+		    sizeof(*tips));
+		if (tips == NULL)
+			return got_error_from_errno("recallocarray");
+		graph->tips = tips;
+		graph->nalloc_tips = nalloc;
+	}
+
+	tip = calloc(1, sizeof(*tip));
+	if (tip == NULL)
 		return got_error_from_errno("calloc");
+	memcpy(&tip->id, commit_id, sizeof(tip->id));
+
+	tip->traversed = got_object_idset_get(graph->traversed_commits,
+	    commit_id);
+	if (tip->traversed) {
+		tip->timestamp = tip->traversed->committer_time;
+		tip->changed = tip->traversed->changed;
+	} else {
+		err = got_object_open_as_commit(&tip->commit, repo, commit_id);
+		if (err) {
+			free(tip);
+			return err;
+		}
+		tip->timestamp =
+		    got_object_commit_get_committer_time(tip->commit);
+		tip->changed = -1;
+	}
+	tip->seq = graph->tip_seq++;
 
-	memcpy(&node->id, commit_id, sizeof(node->id));
-	err = got_object_idset_add(graph->node_ids, &node->id, NULL);
-	if (err)
-		free(node);
-	else
-		*new_node = node;
-	return err;
+	err = got_object_idset_add(graph->open_branches, &tip->id, tip);
+	if (err) {
+		if (tip->commit)
+			got_object_commit_close(tip->commit);
+		free(tip);
+		return err;
+	}
+
+	/* Move the new tip up the heap until its parent is newer. */
+	i = graph->ntips++;
+	while (i > 0 && tip_is_newer(tip, graph->tips[(i - 1) / 2])) {
+		graph->tips[i] = graph->tips[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	graph->tips[i] = tip;
+	return NULL;
+}
+
+/* Remove the most recent tip from the heap and from the open branches. */
+static const struct got_error *
+close_newest_branch(struct got_commit_graph_branch_tip **tip,
+    struct got_commit_graph *graph)
+{
+	struct got_commit_graph_branch_tip *last;
+	int i = 0, child;
+
+	*tip = graph->tips[0];
+	last = graph->tips[--graph->ntips];
+
+	/* Move the last tip down from the top until its children are older. */
+	while ((child = 2 * i + 1) < graph->ntips) {
+		if (child + 1 < graph->ntips &&
+		    tip_is_newer(graph->tips[child + 1], graph->tips[child]))
+			child++;
+		if (!tip_is_newer(graph->tips[child], last))
+			break;
+		graph->tips[i] = graph->tips[child];
+		i = child;
+	}
+	if (graph->ntips > 0)
+		graph->tips[i] = last;
+
+	return got_object_idset_remove(NULL, graph->open_branches,
+	    &(*tip)->id);
 }
 
 /*
@@ -213,8 +351,6 @@ packed_first_parent_traversal(int *ncommits_traversed,
 
 	/* Add all traversed commits to the graph... */
 	SIMPLEQ_FOREACH(qid, &traversed_commits, entry) {
-		struct got_commit_graph_node *node;
-
 		if (got_object_idset_contains(graph->open_branches, qid->id))
 			continue;
 		if (got_object_idset_contains(graph->node_ids, qid->id))
@@ -224,12 +360,11 @@ packed_first_parent_traversal(int *ncommits_traversed,
 
 		/* ... except the last commit is the new branch tip. */
 		if (SIMPLEQ_NEXT(qid, entry) == NULL) {
-			err = got_object_idset_add(graph->open_branches,
-			    qid->id, NULL);
+			err = open_branch(graph, qid->id, repo);
 			break;
 		}
 
-		err = add_node(&node, graph, qid->id, repo);
+		err = got_object_idset_add(graph->node_ids, qid->id, NULL);
 		if (err)
 			break;
 	}
@@ -238,30 +373,48 @@ packed_first_parent_traversal(int *ncommits_traversed,
 	return err;
 }
 
+/*
+ * Look up the ID of the path in a commit, preferring a path ID which was
+ * reported by got-read-pack. Index 0 refers to the branch tip's commit
+ * and subsequent indices refer to its parents.
+ */
 static const struct got_error *
-close_branch(struct got_commit_graph *graph, struct got_object_id *commit_id)
+path_id(struct got_object_id **id, struct got_commit_graph *graph,
+    struct got_commit_graph_branch_tip *tip, int i,
+    struct got_object_id *commit_id, struct got_repository *repo)
 {
-	const struct got_error *err;
+	struct got_traversed_commit *tc = tip->traversed;
 
-	err = got_object_idset_remove(NULL, graph->open_branches, commit_id);
-	if (err && err->code != GOT_ERR_NO_OBJ)
-		return err;
+	if (tc == NULL || i >= tc->npath_ids)
+		return got_object_id_by_path(id, repo, commit_id, graph->path);
+
+	if (tc->path_ids[i] == NULL)
+		return got_error_path(graph->path, GOT_ERR_NO_TREE_ENTRY);
+	*id = got_object_id_dup(tc->path_ids[i]);
+	if (*id == NULL)
+		return got_error_from_errno("got_object_id_dup");
 	return NULL;
 }
 
 static const struct got_error *
-advance_branch(struct got_commit_graph *graph, struct got_object_id *commit_id,
-    struct got_commit_object *commit, struct got_repository *repo)
+advance_branch(struct got_commit_graph *graph,
+    struct got_commit_graph_branch_tip *tip, struct got_repository *repo)
 {
 	const struct got_error *err;
+	const struct got_object_id_queue *parent_ids;
 	struct got_object_qid *qid;
-
-	err = close_branch(graph, commit_id);
-	if (err)
-		return err;
+	unsigned int nparents;
+
+	if (tip->commit) {
+		parent_ids = &tip->commit->parent_ids;
+		nparents = tip->commit->nparents;
+	} else {
+		parent_ids = &tip->traversed->parent_ids;
+		nparents = tip->traversed->nparents;
+	}
 
 	if (graph->flags & GOT_COMMIT_GRAPH_FIRST_PARENT_TRAVERSAL) {
-		qid = SIMPLEQ_FIRST(&commit->parent_ids);
+		qid = SIMPLEQ_FIRST(parent_ids);
 		if (qid == NULL ||
 		    got_object_idset_contains(graph->open_branches, qid->id))
 			return NULL;
@@ -273,40 +426,38 @@ advance_branch(struct got_commit_graph *graph, struct got_object_id *commit_id,
 		 * fetching packed commits which did not modify the path and
 		 * only fetch their IDs. This speeds up 'got blame'.
 		 */
-		if (!got_path_is_root_dir(graph->path) &&
-		    (commit->flags & GOT_COMMIT_FLAG_PACKED)) {
+		if (!got_path_is_root_dir(graph->path) && tip->commit &&
+		    (tip->commit->flags & GOT_COMMIT_FLAG_PACKED)) {
 			int ncommits = 0;
 			err = packed_first_parent_traversal(&ncommits,
 			    graph, qid->id, repo);
 			if (err || ncommits > 0)
 				return err;
 		}
-		return got_object_idset_add(graph->open_branches,
-		    qid->id, NULL);
+		return open_branch(graph, qid->id, repo);
 	}
 
 	/*
 	 * If we are graphing commits for a specific path, skip branches
 	 * which do not contribute any content to this path.
 	 */
-	if (commit->nparents > 1 && !got_path_is_root_dir(graph->path)) {
+	if (nparents > 1 && !got_path_is_root_dir(graph->path)) {
 		struct got_object_id *merged_id, *prev_id = NULL;
-		int branches_differ = 0;
+		int i = 0, branches_differ = 0;
 
-		err = got_object_id_by_path(&merged_id, repo, commit_id,
-		    graph->path);
+		err = path_id(&merged_id, graph, tip, 0, &tip->id, repo);
 		if (err)
 			return err;
 
-		SIMPLEQ_FOREACH(qid, &commit->parent_ids, entry) {
+		SIMPLEQ_FOREACH(qid, parent_ids, entry) {
 			struct got_object_id *id;
 
+			i++;
 			if (got_object_idset_contains(graph->open_branches,
 			    qid->id))
 				continue;
 
-			err = got_object_id_by_path(&id, repo, qid->id,
-			    graph->path);
+			err = path_id(&id, graph, tip, i, qid->id, repo);
 			if (err) {
 				if (err->code == GOT_ERR_NO_TREE_ENTRY) {
 					branches_differ = 1;
@@ -330,8 +481,7 @@ advance_branch(struct got_commit_graph *graph, struct got_object_id *commit_id,
 			 * skip any other branches.
 			 */
 			if (got_object_id_cmp(merged_id, id) == 0) {
-				err = got_object_idset_add(graph->open_branches,
-				    qid->id, NULL);
+				err = open_branch(graph, qid->id, repo);
 				free(merged_id);
 				free(id);
 				return err;
@@ -348,7 +498,7 @@ advance_branch(struct got_commit_graph *graph, struct got_object_id *commit_id,
 		 * follow the first parent only.
 		 */
 		if (!branches_differ) {
-			qid = SIMPLEQ_FIRST(&commit->parent_ids);
+			qid = SIMPLEQ_FIRST(parent_ids);
 			if (qid == NULL)
 				return NULL;
 			if (got_object_idset_contains(graph->open_branches,
@@ -357,17 +507,16 @@ advance_branch(struct got_commit_graph *graph, struct got_object_id *commit_id,
 			if (got_object_idset_contains(graph->node_ids,
 			    qid->id))
 				return NULL; /* parent already traversed */
-			return got_object_idset_add(graph->open_branches,
-			    qid->id, NULL);
+			return open_branch(graph, qid->id, repo);
 		}
 	}
 
-	SIMPLEQ_FOREACH(qid, &commit->parent_ids, entry) {
+	SIMPLEQ_FOREACH(qid, parent_ids, entry) {
 		if (got_object_idset_contains(graph->open_branches, qid->id))
 			continue;
 		if (got_object_idset_contains(graph->node_ids, qid->id))
 			continue; /* parent already traversed */
-		err = got_object_idset_add(graph->open_branches, qid->id, NULL);
+		err = open_branch(graph, qid->id, repo);
 		if (err)
 			return err;
 	}
@@ -386,6 +535,7 @@ got_commit_graph_open(struct got_commit_graph **graph,
 		return got_error_from_errno("calloc");
 
 	TAILQ_INIT(&(*graph)->iter_list);
+	TAILQ_INIT(&(*graph)->done_list);
 
 	(*graph)->path = strdup(path);
 	if ((*graph)->path == NULL) {
@@ -405,6 +555,14 @@ got_commit_graph_open(struct got_commit_graph **graph,
 		goto done;
 	}
 
+	(*graph)->traversed_commits = got_object_idset_alloc();
+	if ((*graph)->traversed_commits == NULL) {
+		err = got_error_from_errno("got_object_idset_alloc");
+		goto done;
+	}
+	(*graph)->traversal_session = arc4random();
+	(*graph)->max_traversed = GOT_COMMIT_GRAPH_MIN_TRAVERSED;
+
 	if (first_parent_traversal)
 		(*graph)->flags |= GOT_COMMIT_GRAPH_FIRST_PARENT_TRAVERSAL;
 done:
@@ -415,119 +573,424 @@ done:
 	return err;
 }
 
-struct add_branch_tip_arg {
-	struct got_commit_graph_branch_tip *tips;
-	int ntips;
-	struct got_repository *repo;
-	struct got_commit_graph *graph;
-};
+static void
+free_tip(struct got_commit_graph_branch_tip *tip)
+{
+	/* A busy worker's result for this tip will be discarded. */
+	if (tip->worker)
+		tip->worker->tip = NULL;
+	if (tip->commit)
+		got_object_commit_close(tip->commit);
+	free(tip);
+}
 
 static const struct got_error *
-add_branch_tip(struct got_object_id *commit_id, void *data, void *arg)
+recv_worker_result(struct got_commit_graph_worker *worker)
 {
 	const struct got_error *err;
-	struct add_branch_tip_arg *a = arg;
-	struct got_commit_graph_node *new_node;
-	struct got_commit_object *commit;
+	int changed;
 
-	err = got_object_open_as_commit(&commit, a->repo, commit_id);
+	err = got_privsep_recv_path_changed(&changed, &worker->pw.ibuf);
 	if (err)
 		return err;
 
-	err = add_node(&new_node, a->graph, commit_id, a->repo);
-	if (err)
-		return err;
+	worker->busy = 0;
+	if (worker->tip) {
+		worker->tip->changed = changed;
+		worker->tip->worker = NULL;
+		worker->tip = NULL;
+	}
+	return NULL;
+}
+
+/* Collect results from workers which are done, without blocking. */
+static const struct got_error *
+poll_workers(struct got_commit_graph *graph)
+{
+	const struct got_error *err;
+	struct pollfd *pfd = graph->pfd;
+	int i, n = 0;
 
-	a->tips[a->ntips].commit_id = new_node ? &new_node->id : NULL;
-	a->tips[a->ntips].commit = commit;
-	a->tips[a->ntips].new_node = new_node;
-	a->ntips++;
+	for (i = 0; i < graph->nworkers; i++) {
+		if (!graph->workers[i].busy)
+			continue;
+		pfd[n].fd = graph->workers[i].pw.imsg_fd;
+		pfd[n].events = POLLIN;
+		pfd[n].revents = 0;
+		n++;
+	}
+	if (n == 0)
+		return NULL;
+
+	if (poll(pfd, n, 0) == -1) {
+		if (errno == EINTR)
+			return NULL;
+		return got_error_from_errno("poll");
+	}
 
+	n = 0;
+	for (i = 0; i < graph->nworkers; i++) {
+		if (!graph->workers[i].busy)
+			continue;
+		if (pfd[n++].revents == 0)
+			continue;
+		err = recv_worker_result(&graph->workers[i]);
+		if (err)
+			return err;
+	}
 	return NULL;
 }
 
+/*
+ * Hand branch tips which will be traversed soon to idle workers.
+ * The heap's array is ordered by level, so the tips nearest to the
+ * top of the heap are looked at first.
+ */
 static const struct got_error *
-fetch_commits_from_open_branches(struct got_commit_graph *graph,
-    struct got_repository *repo, got_cancel_cb cancel_cb, void *cancel_arg)
+dispatch_tips(struct got_commit_graph *graph, struct got_repository *repo)
 {
 	const struct got_error *err;
-	struct add_branch_tip_arg arg;
-	int i, ntips;
-
-	ntips = got_object_idset_num_elements(graph->open_branches);
-	if (ntips == 0)
+	struct got_commit_graph_worker *worker;
+	struct got_commit_graph_branch_tip *tip;
+	struct got_packidx *packidx;
+	char *path_packfile;
+	size_t len;
+	int i, j, idx, nidle = 0, ntips;
+
+	if (graph->max_workers <= 1 || got_path_is_root_dir(graph->path) ||
+	    (graph->flags & GOT_COMMIT_GRAPH_FIRST_PARENT_TRAVERSAL))
 		return NULL;
 
-	/* (Re-)allocate branch tips array if necessary. */
-	if (graph->ntips < ntips) {
-		struct got_commit_graph_branch_tip *tips;
-		tips = recallocarray(graph->tips, graph->ntips, ntips,
-		    sizeof(*tips));
-		if (tips == NULL)
-			return got_error_from_errno("recallocarray");
-		graph->tips = tips;
-		graph->ntips = ntips;
-	}
-	arg.tips = graph->tips;
-	arg.ntips = 0; /* add_branch_tip() will increment */
-	arg.repo = repo;
-	arg.graph = graph;
-	err = got_object_idset_for_each(graph->open_branches, add_branch_tip,
-	    &arg);
+	if (graph->workers == NULL) {
+		graph->workers = calloc(graph->max_workers,
+		    sizeof(*graph->workers));
+		if (graph->workers == NULL)
+			return got_error_from_errno("calloc");
+		graph->pfd = calloc(graph->max_workers, sizeof(*graph->pfd));
+		if (graph->pfd == NULL) {
+			free(graph->workers);
+			graph->workers = NULL;
+			return got_error_from_errno("calloc");
+		}
+		for (i = 0; i < graph->max_workers; i++)
+			graph->workers[i].pw.imsg_fd = -1;
+		graph->nworkers = graph->max_workers;
+	}
+
+	err = poll_workers(graph);
 	if (err)
-		goto done;
+		return err;
 
-	for (i = 0; i < arg.ntips; i++) {
-		struct got_object_id *commit_id;
-		struct got_commit_object *commit;
-		struct got_commit_graph_node *new_node;
-		int changed;
+	for (i = 0; i < graph->nworkers; i++) {
+		if (!graph->workers[i].busy)
+			nidle++;
+	}
 
-		if (cancel_cb) {
-			err = (*cancel_cb)(cancel_arg);
-			if (err)
+	ntips = MIN(graph->ntips,
+	    graph->nworkers * GOT_COMMIT_GRAPH_TIPS_PER_WORKER);
+	for (i = 0; i < ntips && nidle > 0; i++) {
+		tip = graph->tips[i];
+		if (tip->queried || tip->changed != -1)
+			continue;
+		tip->queried = 1;
+
+		err = got_repo_search_packidx(&packidx, &idx, repo, &tip->id);
+		if (err) {
+			if (err->code != GOT_ERR_NO_OBJ)
+				return err;
+			continue; /* loose commit */
+		}
+
+		len = strlen(packidx->path_packidx) -
+		    strlen(GOT_PACKIDX_SUFFIX);
+		if (asprintf(&path_packfile, "%.*s%s", (int)len,
+		    packidx->path_packidx, GOT_PACKFILE_SUFFIX) == -1)
+			return got_error_from_errno("asprintf");
+
+		/* Prefer an idle worker which is reading this pack already. */
+		worker = NULL;
+		for (j = 0; j < graph->nworkers; j++) {
+			struct got_commit_graph_worker *w = &graph->workers[j];
+			if (w->busy)
+				continue;
+			if (worker == NULL)
+				worker = w;
+			if (got_privsep_pack_worker_reads(&w->pw,
+			    path_packfile)) {
+				worker = w;
 				break;
+			}
+		}
+
+		if (worker->pw.imsg_fd == -1) {
+			err = got_privsep_pack_worker_start(&worker->pw,
+			    got_repo_get_path(repo));
+			if (err) {
+				free(path_packfile);
+				return err;
+			}
 		}
+		err = got_privsep_pack_worker_switch(&worker->pw,
+		    got_repo_get_fd(repo), path_packfile, packidx);
+		free(path_packfile);
+		if (err)
+			return err;
+
+		err = got_privsep_send_path_changed_req(&worker->pw.ibuf,
+		    &tip->id, idx, graph->path);
+		if (err)
+			return err;
+		worker->busy = 1;
+		worker->tip = tip;
+		tip->worker = worker;
+		nidle--;
+	}
 
-		commit_id = arg.tips[i].commit_id;
-		commit = arg.tips[i].commit;
-		new_node = arg.tips[i].new_node;
+	return NULL;
+}
 
-		err = detect_changed_path(&changed, commit, commit_id,
-		    graph->path, repo);
+void
+got_commit_graph_set_nworkers(struct got_commit_graph *graph, int nworkers)
+{
+	if (graph->workers == NULL)
+		graph->max_workers = nworkers;
+}
+
+static const struct got_error *
+free_traversed_commit(struct got_object_id *id, void *data, void *arg)
+{
+	got_traversed_commit_free(data);
+	return NULL;
+}
+
+/*
+ * Ask got-read-pack to traverse history below a packed branch tip and
+ * below other open branch tips stored in the same pack file, so that the
+ * commits it finds can be added to the graph without being opened one
+ * by one, and without comparing their trees in this process.
+ */
+static const struct got_error *
+traverse_packed_history(struct got_commit_graph *graph,
+    struct got_commit_graph_branch_tip *tip, struct got_repository *repo)
+{
+	const struct got_error *err = NULL;
+	struct got_object_id_queue ids;
+	struct got_traversed_commit_list commits;
+	struct got_traversed_commit *tc;
+	struct got_object_qid *qid;
+	struct got_packidx *packidx;
+	char *path_packidx = NULL;
+	int i, idx, nids = 0;
+
+	if (tip->traversed || tip->changed != -1 ||
+	    (tip->commit->flags & GOT_COMMIT_FLAG_PACKED) == 0 ||
+	    got_path_is_root_dir(graph->path) ||
+	    (graph->flags & GOT_COMMIT_GRAPH_FIRST_PARENT_TRAVERSAL))
+		return NULL;
+
+	SIMPLEQ_INIT(&ids);
+	SIMPLEQ_INIT(&commits);
+
+	err = got_repo_search_packidx(&packidx, &idx, repo, &tip->id);
+	if (err) {
+		if (err->code == GOT_ERR_NO_OBJ)
+			err = NULL;
+		return err;
+	}
+	path_packidx = strdup(packidx->path_packidx);
+	if (path_packidx == NULL)
+		return got_error_from_errno("strdup");
+	err = got_object_qid_alloc(&qid, &tip->id);
+	if (err)
+		goto done;
+	SIMPLEQ_INSERT_TAIL(&ids, qid, entry);
+	nids++;
+
+	for (i = 0; i < graph->ntips &&
+	    nids < GOT_COMMIT_GRAPH_MAX_TRAVERSAL_TIPS; i++) {
+		struct got_commit_graph_branch_tip *t = graph->tips[i];
+
+		if (t->traversed || t->changed != -1 || t->worker)
+			continue;
+		err = got_repo_search_packidx(&packidx, &idx, repo, &t->id);
 		if (err) {
 			if (err->code != GOT_ERR_NO_OBJ)
-				break;
-			/*
-			 * History of the path stops here on the current
-			 * branch. Keep going on other branches.
-			 */
-			err = close_branch(graph, commit_id);
-			if (err)
-				break;
+				goto done;
+			err = NULL;
 			continue;
 		}
-		if (changed)
-			add_node_to_iter_list(graph, new_node,
-			    got_object_commit_get_committer_time(commit));
-		err = advance_branch(graph, commit_id, commit, repo);
+		if (strcmp(packidx->path_packidx, path_packidx) != 0)
+			continue;
+		err = got_object_qid_alloc(&qid, &t->id);
 		if (err)
-			break;
+			goto done;
+		SIMPLEQ_INSERT_TAIL(&ids, qid, entry);
+		nids++;
 	}
+
+	err = got_traverse_packed_history(&commits, graph->traversal_session,
+	    &ids, graph->path, graph->max_traversed, repo);
+	if (err)
+		goto done;
+	if (graph->max_traversed < GOT_COMMIT_GRAPH_MAX_TRAVERSED)
+		graph->max_traversed *= 2;
+
+	while ((tc = SIMPLEQ_FIRST(&commits))) {
+		SIMPLEQ_REMOVE_HEAD(&commits, entry);
+		if (got_object_idset_contains(graph->traversed_commits,
+		    &tc->id)) {
+			got_traversed_commit_free(tc);
+			continue;
+		}
+		err = got_object_idset_add(graph->traversed_commits,
+		    &tc->id, tc);
+		if (err) {
+			got_traversed_commit_free(tc);
+			goto done;
+		}
+	}
+
+	/* Tips which are open already can use results as well. */
+	tip->traversed = got_object_idset_get(graph->traversed_commits,
+	    &tip->id);
+	if (tip->traversed)
+		tip->changed = tip->traversed->changed;
+	for (i = 0; i < graph->ntips; i++) {
+		struct got_commit_graph_branch_tip *t = graph->tips[i];
+
+		if (t->traversed || t->changed != -1 || t->worker)
+			continue;
+		t->traversed = got_object_idset_get(graph->traversed_commits,
+		    &t->id);
+		if (t->traversed)
+			t->changed = t->traversed->changed;
+	}
+done:
+	free(path_packidx);
+	got_object_id_queue_free(&ids);
+	got_traversed_commit_list_free(&commits);
+	return err;
+}
+
+static const struct got_error *
+fetch_next_commit(struct got_commit_graph *graph,
+    struct got_repository *repo, got_cancel_cb cancel_cb, void *cancel_arg)
+{
+	const struct got_error *err;
+	struct got_commit_graph_branch_tip *tip;
+	int changed;
+
+	err = close_newest_branch(&tip, graph);
+	if (err) {
+		free_tip(tip);
+		return err;
+	}
+
+	if (cancel_cb) {
+		err = (*cancel_cb)(cancel_arg);
+		if (err)
+			goto done;
+	}
+
+	err = got_object_idset_add(graph->node_ids, &tip->id, NULL);
+	if (err)
+		goto done;
+
+	err = traverse_packed_history(graph, tip, repo);
+	if (err)
+		goto done;
+
+	/* Keep workers busy while we are waiting for this tip's result. */
+	err = dispatch_tips(graph, repo);
+	if (err)
+		goto done;
+	if (tip->worker) {
+		err = recv_worker_result(tip->worker);
+		if (err)
+			goto done;
+	}
+
+	if (tip->changed != -1) {
+		changed = tip->changed;
+	} else {
+		if (tip->commit == NULL) {
+			err = got_object_open_as_commit(&tip->commit, repo,
+			    &tip->id);
+			if (err)
+				goto done;
+		}
+		err = detect_changed_path(&changed, tip->commit, &tip->id,
+		    graph->path, repo);
+	}
+	if (err) {
+		/*
+		 * History of the path stops here on the current
+		 * branch. Keep going on other branches.
+		 */
+		if (err->code == GOT_ERR_NO_OBJ)
+			err = NULL;
+		goto done;
+	}
+	if (changed) {
+		err = add_node_to_iter_list(graph, &tip->id);
+		if (err)
+			goto done;
+		/*
+		 * The API user will likely open this commit again soon.
+		 * It may have been evicted from the cache while other
+		 * branch tips were being opened, so cache it again.
+		 */
+		if (tip->commit &&
+		    got_repo_get_cached_commit(repo, &tip->id) == NULL) {
+			err = got_repo_cache_commit(repo, &tip->id,
+			    tip->commit);
+			if (err)
+				goto done;
+		}
+	}
+	err = advance_branch(graph, tip, repo);
 done:
-	for (i = 0; i < arg.ntips; i++)
-		got_object_commit_close(arg.tips[i].commit);
+	free_tip(tip);
 	return err;
 }
 
+static void
+free_iter_list(struct got_commit_graph_iter_list *iter_list)
+{
+	struct got_commit_graph_node *node;
+
+	while ((node = TAILQ_FIRST(iter_list))) {
+		TAILQ_REMOVE(iter_list, node, entry);
+		free(node);
+	}
+}
+
 void
 got_commit_graph_close(struct got_commit_graph *graph)
 {
+	int i;
+
+	for (i = 0; i < graph->ntips; i++)
+		free_tip(graph->tips[i]);
+	free(graph->tips);
+	for (i = 0; i < graph->nworkers; i++) {
+		if (graph->workers[i].pw.imsg_fd != -1)
+			got_privsep_pack_worker_stop(&graph->workers[i].pw,
+			    graph->workers[i].busy);
+	}
+	free(graph->workers);
+	free(graph->pfd);
+	free_iter_list(&graph->iter_list);
+	free_iter_list(&graph->done_list);
 	if (graph->open_branches)
 		got_object_idset_free(graph->open_branches);
 	if (graph->node_ids)
 		got_object_idset_free(graph->node_ids);
-	free(graph->tips);
+	if (graph->traversed_commits) {
+		got_object_idset_for_each(graph->traversed_commits,
+		    free_traversed_commit, NULL);
+		got_object_idset_free(graph->traversed_commits);
+	}
 	free(graph->path);
 	free(graph);
 }
@@ -542,15 +1005,13 @@ got_commit_graph_iter_start(struct got_commit_graph *graph,
 	if (!TAILQ_EMPTY(&graph->iter_list))
 		return got_error(GOT_ERR_ITER_BUSY);
 
-	err = got_object_idset_add(graph->open_branches, id, NULL);
+	err = open_branch(graph, id, repo);
 	if (err)
 		return err;
 
 	/* Locate first commit which changed graph->path. */
-	while (TAILQ_EMPTY(&graph->iter_list) &&
-	    got_object_idset_num_elements(graph->open_branches) > 0) {
-		err = fetch_commits_from_open_branches(graph, repo,
-		    cancel_cb, cancel_arg);
+	while (TAILQ_EMPTY(&graph->iter_list) && graph->ntips > 0) {
+		err = fetch_next_commit(graph, repo, cancel_cb, cancel_arg);
 		if (err)
 			return err;
 	}
@@ -578,61 +1039,227 @@ got_commit_graph_iter_next(struct got_object_id **id,
 
 	*id = NULL;
 
+	while (TAILQ_EMPTY(&graph->iter_list) && graph->ntips > 0) {
+		err = fetch_next_commit(graph, repo, cancel_cb, cancel_arg);
+		if (err)
+			return err;
+	}
+
 	node = TAILQ_FIRST(&graph->iter_list);
 	if (node == NULL) {
 		/* We are done iterating, or iteration was not started. */
 		return got_error(GOT_ERR_ITER_COMPLETED);
 	}
 
-	while (TAILQ_NEXT(node, entry) == NULL &&
-	    got_object_idset_num_elements(graph->open_branches) > 0) {
-		err = fetch_commits_from_open_branches(graph, repo,
-		    cancel_cb, cancel_arg);
-		if (err)
+	*id = &node->id;
+	TAILQ_REMOVE(&graph->iter_list, node, entry);
+	TAILQ_INSERT_TAIL(&graph->done_list, node, entry);
+	return NULL;
+}
+
+/*
+ * A commit visited while painting history below two commits in order
+ * to find their common ancestors.
+ */
+struct got_commit_graph_paint_node {
+	struct got_object_id id;
+	struct got_commit_object *commit;	/* open while queued */
+	time_t timestamp;
+	unsigned int seq;
+	int queued;
+
+	int flags;
+#define GOT_COMMIT_GRAPH_PAINT_PARENT1	0x01 /* reachable from commit 1 */
+#define GOT_COMMIT_GRAPH_PAINT_PARENT2	0x02 /* reachable from commit 2 */
+#define GOT_COMMIT_GRAPH_PAINT_STALE	0x04 /* below a common ancestor */
+#define GOT_COMMIT_GRAPH_PAINT_RESULT	0x08 /* a common ancestor */
+};
+
+struct got_commit_graph_paint {
+	struct got_object_idset *nodes;
+
+	/* Queued nodes in a binary heap with the most recent commit on top. */
+	struct got_commit_graph_paint_node **queue;
+	int nqueued;
+	int nalloc;
+	unsigned int seq;
+};
+
+static int
+paint_node_is_newer(struct got_commit_graph_paint_node *a,
+    struct got_commit_graph_paint_node *b)
+{
+	if (a->timestamp != b->timestamp)
+		return a->timestamp > b->timestamp;
+	return a->seq < b->seq;
+}
+
+/*
+ * Add the given flags to a commit and queue the commit unless it already
+ * carries all of these flags. A commit which is already queued will see
+ * the new flags once it is dequeued.
+ */
+static const struct got_error *
+paint_commit(struct got_commit_graph_paint_node **nodep,
+    struct got_commit_graph_paint *paint, struct got_object_id *id,
+    int flags, struct got_repository *repo)
+{
+	const struct got_error *err;
+	struct got_commit_graph_paint_node *node;
+	int i;
+
+	node = got_object_idset_get(paint->nodes, id);
+	if (node) {
+		if (nodep)
+			*nodep = node;
+		if ((node->flags & flags) == flags)
+			return NULL;
+		node->flags |= flags;
+		if (node->queued)
+			return NULL;
+	} else {
+		node = calloc(1, sizeof(*node));
+		if (node == NULL)
+			return got_error_from_errno("calloc");
+		memcpy(&node->id, id, sizeof(node->id));
+		node->flags = flags;
+		err = got_object_idset_add(paint->nodes, &node->id, node);
+		if (err) {
+			free(node);
 			return err;
+		}
+		if (nodep)
+			*nodep = node;
 	}
 
-	*id = &node->id;
-	TAILQ_REMOVE(&graph->iter_list, node, entry);
+	if (paint->nqueued == paint->nalloc) {
+		struct got_commit_graph_paint_node **queue;
+		int nalloc = paint->nalloc ? paint->nalloc * 2 : 16;
+
+		queue = recallocarray(paint->queue, paint->nalloc, nalloc,
+		    sizeof(*queue));
+		if (queue == NULL)
+			return got_error_from_errno("recallocarray");
+		paint->queue = queue;
+		paint->nalloc = nalloc;
+	}
+
+	err = got_object_open_as_commit(&node->commit, repo, &node->id);
+	if (err)
+		return err;
+	node->timestamp = got_object_commit_get_committer_time(node->commit);
+	node->seq = paint->seq++;
+	node->queued = 1;
+
+	i = paint->nqueued++;
+	while (i > 0 && paint_node_is_newer(node, paint->queue[(i - 1) / 2])) {
+		paint->queue[i] = paint->queue[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	paint->queue[i] = node;
 	return NULL;
 }
 
-const struct got_error *
-got_commit_graph_find_youngest_common_ancestor(struct got_object_id **yca_id,
+static struct got_commit_graph_paint_node *
+dequeue_newest_commit(struct got_commit_graph_paint *paint)
+{
+	struct got_commit_graph_paint_node *node, *last;
+	int i = 0, child;
+
+	node = paint->queue[0];
+	last = paint->queue[--paint->nqueued];
+	while ((child = 2 * i + 1) < paint->nqueued) {
+		if (child + 1 < paint->nqueued &&
+		    paint_node_is_newer(paint->queue[child + 1],
+		    paint->queue[child]))
+			child++;
+		if (!paint_node_is_newer(paint->queue[child], last))
+			break;
+		paint->queue[i] = paint->queue[child];
+		i = child;
+	}
+	if (paint->nqueued > 0)
+		paint->queue[i] = last;
+
+	node->queued = 0;
+	return node;
+}
+
+/*
+ * Painting can stop once every queued commit is known to be an ancestor
+ * of a common ancestor which was already found.
+ */
+static int
+paint_queue_has_nonstale(struct got_commit_graph_paint *paint)
+{
+	int i;
+
+	for (i = 0; i < paint->nqueued; i++) {
+		if ((paint->queue[i]->flags & GOT_COMMIT_GRAPH_PAINT_STALE) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+static const struct got_error *
+free_paint_node(struct got_object_id *id, void *data, void *arg)
+{
+	struct got_commit_graph_paint_node *node = data;
+
+	if (node->commit)
+		got_object_commit_close(node->commit);
+	free(node);
+	return NULL;
+}
+
+/*
+ * Walk first-parent history below two commits, newest commits first, and
+ * paint each commit with the side(s) it can be reached from. The first
+ * commit reached from both sides is the youngest common ancestor. Its
+ * ancestors are painted stale and painting ends as soon as only stale
+ * commits remain queued, rather than walking both histories to the end.
+ * If is_ancestor is not NULL, stop as soon as commit_id is found to be
+ * reachable from commit_id2.
+ */
+static const struct got_error *
+paint_down_to_common(struct got_object_id **yca_id, int *is_ancestor,
     struct got_object_id *commit_id, struct got_object_id *commit_id2,
     struct got_repository *repo, got_cancel_cb cancel_cb, void *cancel_arg)
 {
 	const struct got_error *err = NULL;
-	struct got_commit_graph *graph = NULL, *graph2 = NULL;
-	int completed = 0, completed2 = 0;
-	struct got_object_idset *commit_ids;
+	struct got_commit_graph_paint paint;
+	struct got_commit_graph_paint_node *node1 = NULL;
 
-	*yca_id = NULL;
+	if (yca_id)
+		*yca_id = NULL;
+	if (is_ancestor)
+		*is_ancestor = 0;
 
-	commit_ids = got_object_idset_alloc();
-	if (commit_ids == NULL)
+	memset(&paint, 0, sizeof(paint));
+	paint.nodes = got_object_idset_alloc();
+	if (paint.nodes == NULL)
 		return got_error_from_errno("got_object_idset_alloc");
 
-	err = got_commit_graph_open(&graph, "/", 1);
+	err = paint_commit(&node1, &paint, commit_id,
+	    GOT_COMMIT_GRAPH_PAINT_PARENT1, repo);
 	if (err)
 		goto done;
-
-	err = got_commit_graph_open(&graph2, "/", 1);
+	err = paint_commit(NULL, &paint, commit_id2,
+	    GOT_COMMIT_GRAPH_PAINT_PARENT2, repo);
 	if (err)
 		goto done;
 
-	err = got_commit_graph_iter_start(graph, commit_id, repo,
-	    cancel_cb, cancel_arg);
-	if (err)
-		goto done;
+	while (paint_queue_has_nonstale(&paint)) {
+		struct got_commit_graph_paint_node *node;
+		const struct got_object_id_queue *parent_ids;
+		struct got_object_qid *pid;
+		int flags;
 
-	err = got_commit_graph_iter_start(graph2, commit_id2, repo,
-	    cancel_cb, cancel_arg);
-	if (err)
-		goto done;
-
-	for (;;) {
-		struct got_object_id *id = NULL, *id2 = NULL;
+		if (is_ancestor &&
+		    (node1->flags & GOT_COMMIT_GRAPH_PAINT_PARENT2)) {
+			*is_ancestor = 1;
+			break;
+		}
 
 		if (cancel_cb) {
 			err = (*cancel_cb)(cancel_arg);
@@ -640,66 +1267,76 @@ got_commit_graph_find_youngest_common_ancestor(struct got_object_id **yca_id,
 				break;
 		}
 
-		if (!completed) {
-			err = got_commit_graph_iter_next(&id, graph, repo,
-			    cancel_cb, cancel_arg);
-			if (err) {
-				if (err->code != GOT_ERR_ITER_COMPLETED)
-					break;
-				err = NULL;
-				completed = 1;
-			}
-		}
-
-		if (!completed2) {
-			err = got_commit_graph_iter_next(&id2, graph2, repo,
-			    cancel_cb, cancel_arg);
-			if (err) {
-				if (err->code != GOT_ERR_ITER_COMPLETED)
-					break;
-				err = NULL;
-				completed2 = 1;
+		node = dequeue_newest_commit(&paint);
+		flags = node->flags & (GOT_COMMIT_GRAPH_PAINT_PARENT1 |
+		    GOT_COMMIT_GRAPH_PAINT_PARENT2 |
+		    GOT_COMMIT_GRAPH_PAINT_STALE);
+		if (flags == (GOT_COMMIT_GRAPH_PAINT_PARENT1 |
+		    GOT_COMMIT_GRAPH_PAINT_PARENT2)) {
+			if ((node->flags & GOT_COMMIT_GRAPH_PAINT_RESULT) == 0) {
+				node->flags |= GOT_COMMIT_GRAPH_PAINT_RESULT;
+				if (yca_id && *yca_id == NULL) {
+					*yca_id = got_object_id_dup(&node->id);
+					if (*yca_id == NULL) {
+						err = got_error_from_errno(
+						    "got_object_id_dup");
+						break;
+					}
+				}
 			}
+			flags |= GOT_COMMIT_GRAPH_PAINT_STALE;
 		}
 
-		if (id) {
-			if (got_object_idset_contains(commit_ids, id)) {
-				*yca_id = got_object_id_dup(id);
-				if (*yca_id)
-					break;
-				err = got_error_from_errno("got_object_id_dup");
-				break;
+		parent_ids = got_object_commit_get_parent_ids(node->commit);
+		pid = SIMPLEQ_FIRST(parent_ids);
+		if (pid)
+			err = paint_commit(NULL, &paint, pid->id, flags, repo);
+		got_object_commit_close(node->commit);
+		node->commit = NULL;
+		if (err)
+			break;
+	}
 
-			}
-			err = got_object_idset_add(commit_ids, id, NULL);
-			if (err)
-				break;
-		}
-		if (id2) {
-			if (got_object_idset_contains(commit_ids, id2)) {
-				*yca_id = got_object_id_dup(id2);
-				if (*yca_id)
-					break;
-				err = got_error_from_errno("got_object_id_dup");
-				break;
+	if (err == NULL && is_ancestor &&
+	    (node1->flags & GOT_COMMIT_GRAPH_PAINT_PARENT2))
+		*is_ancestor = 1;
+done:
+	got_object_idset_for_each(paint.nodes, free_paint_node, NULL);
+	got_object_idset_free(paint.nodes);
+	free(paint.queue);
+	if (err && yca_id) {
+		free(*yca_id);
+		*yca_id = NULL;
+	}
+	return err;
+}
 
-			}
-			err = got_object_idset_add(commit_ids, id2, NULL);
-			if (err)
-				break;
-		}
+const struct got_error *
+got_commit_graph_find_youngest_common_ancestor(struct got_object_id **yca_id,
+    struct got_object_id *commit_id, struct got_object_id *commit_id2,
+    struct got_repository *repo, got_cancel_cb cancel_cb, void *cancel_arg)
+{
+	const struct got_error *err;
 
-		if (completed && completed2) {
-			err = got_error(GOT_ERR_ANCESTRY);
-			break;
-		}
+	err = paint_down_to_common(yca_id, NULL, commit_id, commit_id2,
+	    repo, cancel_cb, cancel_arg);
+	if (err)
+		return err;
+	if (*yca_id == NULL)
+		return got_error(GOT_ERR_ANCESTRY);
+	return NULL;
+}
 
+const struct got_error *
+got_commit_graph_is_ancestor(int *is_ancestor,
+    struct got_object_id *ancestor_id, struct got_object_id *commit_id,
+    struct got_repository *repo, got_cancel_cb cancel_cb, void *cancel_arg)
+{
+	if (got_object_id_cmp(ancestor_id, commit_id) == 0) {
+		*is_ancestor = 1;
+		return NULL;
 	}
-done:
-	got_object_idset_free(commit_ids);
-	if (graph)
-		got_commit_graph_close(graph);
-	if (graph2)
-		got_commit_graph_close(graph2);
-	return err;
+
+	return paint_down_to_common(NULL, is_ancestor, ancestor_id,
+	    commit_id, repo, cancel_cb, cancel_arg);
 }
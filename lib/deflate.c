@@ -34,7 +34,8 @@
 #endif
 
 const struct got_error *
-got_deflate_init(struct got_deflate_buf *zb, uint8_t *outbuf, size_t bufsize)
+got_deflate_init(struct got_deflate_buf *zb, uint8_t *outbuf, size_t bufsize,
+    int level)
 {
 	const struct got_error *err = NULL;
 	int zerr;
@@ -43,7 +44,7 @@ got_deflate_init(struct got_deflate_buf *zb, uint8_t *outbuf, size_t bufsize)
 
 	zb->z.zalloc = Z_NULL;
 	zb->z.zfree = Z_NULL;
-	zerr = deflateInit(&zb->z, Z_DEFAULT_COMPRESSION);
+	zerr = deflateInit(&zb->z, level);
 	if (zerr != Z_OK) {
 		if  (zerr == Z_ERRNO)
 			return got_error_from_errno("deflateInit");
@@ -128,13 +129,13 @@ got_deflate_end(struct got_deflate_buf *zb)
 }
 
 const struct got_error *
-got_deflate_to_file(size_t *outlen, FILE *infile, FILE *outfile)
+got_deflate_to_file(size_t *outlen, FILE *infile, FILE *outfile, int level)
 {
 	const struct got_error *err;
 	size_t avail;
 	struct got_deflate_buf zb;
 
-	err = got_deflate_init(&zb, NULL, GOT_DEFLATE_BUFSIZE);
+	err = got_deflate_init(&zb, NULL, GOT_DEFLATE_BUFSIZE, level);
 	if (err)
 		goto done;
 
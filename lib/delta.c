@@ -395,3 +395,224 @@ got_delta_apply(FILE *base_file, const uint8_t *delta_buf,
 		rewind(outfile);
 	return err;
 }
+
+static const struct got_error *
+add_delta_op(struct got_delta_ops *dops, const uint8_t *data,
+    off_t base_offset, size_t len, size_t max_ops)
+{
+	struct got_delta_op *op;
+
+	/* Merge adjacent copies of contiguous ranges of the delta base. */
+	if (data == NULL && dops->nops > 0) {
+		op = &dops->ops[dops->nops - 1];
+		if (op->data == NULL && op->base_offset + op->len ==
+		    base_offset && SIZE_MAX - op->len >= len) {
+			op->len += len;
+			dops->result_size += len;
+			return NULL;
+		}
+	}
+
+	if (dops->nops >= dops->nalloc) {
+		struct got_delta_op *new;
+		size_t nalloc = dops->nalloc ? dops->nalloc * 2 : 64;
+
+		if (max_ops > 0 && dops->nops >= max_ops)
+			return got_error(GOT_ERR_NO_SPACE);
+		new = reallocarray(dops->ops, nalloc, sizeof(*new));
+		if (new == NULL)
+			return got_error_from_errno("reallocarray");
+		dops->ops = new;
+		dops->nalloc = nalloc;
+	}
+
+	op = &dops->ops[dops->nops++];
+	op->data = data;
+	op->base_offset = base_offset;
+	op->len = len;
+	op->result_offset = dops->result_size;
+	dops->result_size += len;
+	return NULL;
+}
+
+/*
+ * Decode a delta stream into a list of instructions. Literal data
+ * points into delta_buf, which must remain valid while the list is used.
+ */
+const struct got_error *
+got_delta_ops_parse(struct got_delta_ops *dops, const uint8_t *delta_buf,
+    size_t delta_len)
+{
+	const struct got_error *err = NULL;
+	uint64_t base_size, result_size;
+	size_t remain;
+	const uint8_t *p;
+
+	memset(dops, 0, sizeof(*dops));
+
+	if (delta_len < GOT_DELTA_STREAM_LENGTH_MIN)
+		return got_error(GOT_ERR_BAD_DELTA);
+
+	p = delta_buf;
+	remain = delta_len;
+	err = parse_delta_sizes(&base_size, &result_size, &p, &remain);
+	if (err)
+		return err;
+
+	err = next_delta_byte(&p, &remain);
+	while (err == NULL && remain > 0) {
+		if (*p & GOT_DELTA_BASE_COPY) {
+			off_t offset = 0;
+			size_t len = 0;
+			err = parse_opcode(&offset, &len, &p, &remain);
+			if (err)
+				break;
+			if (SIZE_MAX - offset < len || offset + len < 0) {
+				err = got_error(GOT_ERR_BAD_DELTA);
+				break;
+			}
+			err = add_delta_op(dops, NULL, offset, len, 0);
+			if (err)
+				break;
+			if (remain > 0) {
+				p++;
+				remain--;
+			}
+		} else {
+			size_t len = (size_t)*p;
+			if (len == 0) {
+				err = got_error(GOT_ERR_BAD_DELTA);
+				break;
+			}
+			err = next_delta_byte(&p, &remain);
+			if (err)
+				break;
+			if (remain < len) {
+				err = got_error(GOT_ERR_BAD_DELTA);
+				break;
+			}
+			err = add_delta_op(dops, p, 0, len, 0);
+			if (err)
+				break;
+			p += len;
+			remain -= len;
+		}
+	}
+
+	if (err == NULL && dops->result_size != result_size)
+		err = got_error(GOT_ERR_BAD_DELTA);
+	if (err)
+		got_delta_ops_free(dops);
+	else
+		dops->base_size = base_size;
+	return err;
+}
+
+/*
+ * Compose two deltas, where the result of the first delta is the base of
+ * the second delta, into a single delta against the base of the first one.
+ * Give up with GOT_ERR_NO_SPACE if more than max_ops instructions would be
+ * needed (zero means no limit).
+ */
+const struct got_error *
+got_delta_ops_compose(struct got_delta_ops *result,
+    struct got_delta_ops *first, struct got_delta_ops *second,
+    size_t max_ops)
+{
+	const struct got_error *err = NULL;
+	size_t i;
+
+	memset(result, 0, sizeof(*result));
+
+	for (i = 0; i < second->nops; i++) {
+		struct got_delta_op *op = &second->ops[i];
+		uint64_t offset = op->base_offset;
+		size_t len = op->len, lo, hi;
+
+		if (op->data) {
+			err = add_delta_op(result, op->data, 0, len, max_ops);
+			if (err)
+				break;
+			continue;
+		}
+
+		if (offset + len > first->result_size) {
+			err = got_error(GOT_ERR_BAD_DELTA);
+			break;
+		}
+
+		/* Find the instruction which produced the copied range. */
+		lo = 0;
+		hi = first->nops;
+		while (hi - lo > 1) {
+			size_t mid = lo + (hi - lo) / 2;
+			if (first->ops[mid].result_offset <= offset)
+				lo = mid;
+			else
+				hi = mid;
+		}
+
+		while (len > 0) {
+			struct got_delta_op *fop = &first->ops[lo++];
+			size_t skip = offset - fop->result_offset;
+			size_t n = MIN(fop->len - skip, len);
+
+			if (fop->data)
+				err = add_delta_op(result, fop->data + skip, 0,
+				    n, max_ops);
+			else
+				err = add_delta_op(result, NULL,
+				    fop->base_offset + skip, n, max_ops);
+			if (err)
+				break;
+			offset += n;
+			len -= n;
+		}
+		if (err)
+			break;
+	}
+
+	if (err == NULL && result->result_size != second->result_size)
+		err = got_error(GOT_ERR_BAD_DELTA);
+	if (err)
+		got_delta_ops_free(result);
+	else
+		result->base_size = first->base_size;
+	return err;
+}
+
+const struct got_error *
+got_delta_ops_apply(uint8_t *base_buf, size_t base_bufsz,
+    struct got_delta_ops *dops, uint8_t *outbuf, size_t *outsize,
+    size_t maxoutsize)
+{
+	size_t i;
+
+	*outsize = 0;
+
+	if (dops->result_size > maxoutsize)
+		return got_error(GOT_ERR_BAD_DELTA);
+
+	for (i = 0; i < dops->nops; i++) {
+		struct got_delta_op *op = &dops->ops[i];
+
+		if (op->data)
+			memcpy(outbuf + *outsize, op->data, op->len);
+		else {
+			if (base_bufsz < op->base_offset + op->len)
+				return got_error(GOT_ERR_BAD_DELTA);
+			memcpy(outbuf + *outsize, base_buf + op->base_offset,
+			    op->len);
+		}
+		*outsize += op->len;
+	}
+
+	return NULL;
+}
+
+void
+got_delta_ops_free(struct got_delta_ops *dops)
+{
+	free(dops->ops);
+	memset(dops, 0, sizeof(*dops));
+}
@@ -20,6 +20,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <stdint.h>
 #include <sha1.h>
 #include <zlib.h>
 
@@ -39,6 +40,14 @@
 #include "got_lib_inflate.h"
 #include "got_lib_object.h"
 
+#ifndef MIN
+#define	MIN(_a,_b) ((_a) < (_b) ? (_a) : (_b))
+#endif
+
+#ifndef MAX
+#define	MAX(_a,_b) ((_a) > (_b) ? (_a) : (_b))
+#endif
+
 static const struct got_error *
 add_line_offset(off_t **line_offsets, size_t *nlines, off_t off)
 {
@@ -58,7 +67,8 @@ diff_blobs(off_t **line_offsets, size_t *nlines,
     struct got_diffreg_result **resultp, struct got_blob_object *blob1,
     struct got_blob_object *blob2,
     const char *label1, const char *label2, mode_t mode1, mode_t mode2,
-    int diff_context, int ignore_whitespace, int force_text_diff, FILE *outfile)
+    int diff_context, int ignore_whitespace, int force_text_diff,
+    int show_rename, FILE *outfile)
 {
 	const struct got_error *err = NULL, *free_err;
 	FILE *f1 = NULL, *f2 = NULL;
@@ -166,6 +176,21 @@ diff_blobs(off_t **line_offsets, size_t *nlines,
 
 		free(modestr1);
 		free(modestr2);
+
+		if (show_rename && blob1 && blob2 && label1 && label2 &&
+		    strcmp(label1, label2) != 0) {
+			n = fprintf(outfile, "rename %s -> %s\n", label1,
+			    label2);
+			if (n < 0)
+				goto done;
+			outoff += n;
+			if (line_offsets) {
+				err = add_line_offset(line_offsets, nlines,
+				    outoff);
+				if (err)
+					goto done;
+			}
+		}
 	}
 	err = got_diffreg(&result, f1, f2, GOT_DIFF_ALGORITHM_PATIENCE,
 	    ignore_whitespace, force_text_diff);
@@ -207,7 +232,7 @@ got_diff_blob_output_unidiff(void *arg, struct got_blob_object *blob1,
 
 	return diff_blobs(&a->line_offsets, &a->nlines, NULL,
 	    blob1, blob2, label1, label2, mode1, mode2, a->diff_context,
-	    a->ignore_whitespace, a->force_text_diff, a->outfile);
+	    a->ignore_whitespace, a->force_text_diff, 1, a->outfile);
 }
 
 const struct got_error *
@@ -218,7 +243,7 @@ got_diff_blob(off_t **line_offsets, size_t *nlines,
 {
 	return diff_blobs(line_offsets, nlines, NULL, blob1, blob2,
 	    label1, label2, 0, 0, diff_context, ignore_whitespace,
-	    force_text_diff, outfile);
+	    force_text_diff, 0, outfile);
 }
 
 static const struct got_error *
@@ -728,6 +753,567 @@ got_diff_tree(struct got_tree_object *tree1, struct got_tree_object *tree2,
 	return err;
 }
 
+/*
+ * Content similarity is only estimated if the number of deleted files
+ * times the number of added files does not exceed this limit squared.
+ */
+#define GOT_DIFF_RENAME_LIMIT		1000
+
+/* Minimum percentage of similar content for a file to count as renamed. */
+#define GOT_DIFF_RENAME_MIN_SCORE	50
+
+/* Files are fingerprinted in chunks which end at '\n' or at this length. */
+#define GOT_DIFF_RENAME_CHUNK_SIZE	64
+
+/* A change between two trees, as passed to a got_diff_blob_cb(). */
+struct got_diff_change {
+	struct got_object_id *id1;
+	struct got_object_id *id2;
+	char *label1;
+	char *label2;
+	mode_t mode1;
+	mode_t mode2;
+	int src;	/* index of the deleted file this file was renamed from */
+	int dst;	/* index of the added file this file was renamed to */
+};
+
+struct got_diff_changes {
+	struct got_diff_change *changes;
+	int nchanges;
+	int nalloc;
+};
+
+/* Hashes of a blob's chunks, with the number of bytes hashed to each. */
+struct got_diff_chunk {
+	uint32_t hash;
+	uint32_t len;
+};
+
+struct got_diff_fingerprint {
+	struct got_diff_chunk *chunks;
+	int nchunks;
+	off_t size;
+};
+
+/* A possible rename, scored by content similarity. */
+struct got_diff_rename_candidate {
+	int score;
+	int src;
+	int dst;
+};
+
+static const struct got_error *
+collect_change(void *arg, struct got_blob_object *blob1,
+    struct got_blob_object *blob2, struct got_object_id *id1,
+    struct got_object_id *id2, const char *label1, const char *label2,
+    mode_t mode1, mode_t mode2, struct got_repository *repo)
+{
+	struct got_diff_changes *c = arg;
+	struct got_diff_change *change;
+
+	if (c->nchanges >= c->nalloc) {
+		size_t n = c->nalloc ? c->nalloc * 2 : 64;
+		change = reallocarray(c->changes, n, sizeof(*change));
+		if (change == NULL)
+			return got_error_from_errno("reallocarray");
+		c->changes = change;
+		c->nalloc = n;
+	}
+
+	change = &c->changes[c->nchanges];
+	memset(change, 0, sizeof(*change));
+	change->src = -1;
+	change->dst = -1;
+	change->mode1 = mode1;
+	change->mode2 = mode2;
+	c->nchanges++;
+
+	if (id1) {
+		change->id1 = got_object_id_dup(id1);
+		if (change->id1 == NULL)
+			return got_error_from_errno("got_object_id_dup");
+	}
+	if (id2) {
+		change->id2 = got_object_id_dup(id2);
+		if (change->id2 == NULL)
+			return got_error_from_errno("got_object_id_dup");
+	}
+	if (label1) {
+		change->label1 = strdup(label1);
+		if (change->label1 == NULL)
+			return got_error_from_errno("strdup");
+	}
+	if (label2) {
+		change->label2 = strdup(label2);
+		if (change->label2 == NULL)
+			return got_error_from_errno("strdup");
+	}
+	return NULL;
+}
+
+static void
+free_changes(struct got_diff_changes *c)
+{
+	int i;
+
+	for (i = 0; i < c->nchanges; i++) {
+		free(c->changes[i].id1);
+		free(c->changes[i].id2);
+		free(c->changes[i].label1);
+		free(c->changes[i].label2);
+	}
+	free(c->changes);
+	c->changes = NULL;
+	c->nchanges = 0;
+	c->nalloc = 0;
+}
+
+static int
+cmp_change_id1(const void *a, const void *b)
+{
+	const struct got_diff_change *c1 = *(const struct got_diff_change **)a;
+	const struct got_diff_change *c2 = *(const struct got_diff_change **)b;
+	int cmp;
+
+	cmp = got_object_id_cmp(c1->id1, c2->id1);
+	if (cmp)
+		return cmp;
+	return (c1 > c2) - (c1 < c2);
+}
+
+static int
+cmp_change_id2(const void *a, const void *b)
+{
+	const struct got_diff_change *c1 = *(const struct got_diff_change **)a;
+	const struct got_diff_change *c2 = *(const struct got_diff_change **)b;
+	int cmp;
+
+	cmp = got_object_id_cmp(c1->id2, c2->id2);
+	if (cmp)
+		return cmp;
+	return (c1 > c2) - (c1 < c2);
+}
+
+static int
+cmp_chunks(const void *a, const void *b)
+{
+	const struct got_diff_chunk *c1 = a, *c2 = b;
+
+	return (c1->hash > c2->hash) - (c1->hash < c2->hash);
+}
+
+static int
+cmp_rename_candidates(const void *a, const void *b)
+{
+	const struct got_diff_rename_candidate *c1 = a, *c2 = b;
+
+	if (c1->score != c2->score)
+		return c2->score - c1->score;
+	if (c1->dst != c2->dst)
+		return c1->dst - c2->dst;
+	return c1->src - c2->src;
+}
+
+static const struct got_error *
+add_chunk(struct got_diff_fingerprint *fp, int *nalloc, uint32_t hash,
+    uint32_t len)
+{
+	struct got_diff_chunk *p;
+
+	if (fp->nchunks >= *nalloc) {
+		size_t n = *nalloc ? *nalloc * 2 : 256;
+		p = reallocarray(fp->chunks, n, sizeof(*p));
+		if (p == NULL)
+			return got_error_from_errno("reallocarray");
+		fp->chunks = p;
+		*nalloc = n;
+	}
+	fp->chunks[fp->nchunks].hash = hash;
+	fp->chunks[fp->nchunks].len = len;
+	fp->nchunks++;
+	return NULL;
+}
+
+/*
+ * Hash a blob's content in chunks, and sort the chunk hashes such that
+ * the content of two blobs can be compared in linear time.
+ */
+static const struct got_error *
+fingerprint_blob(struct got_diff_fingerprint *fp, struct got_object_id *id,
+    struct got_repository *repo)
+{
+	const struct got_error *err;
+	struct got_blob_object *blob;
+	const uint8_t *buf;
+	size_t len, hdrlen, i;
+	uint32_t hash = 2166136261U, chunklen = 0;
+	int nalloc = 0, j, k;
+
+	memset(fp, 0, sizeof(*fp));
+
+	err = got_object_open_as_blob(&blob, repo, id, 8192);
+	if (err)
+		return err;
+
+	hdrlen = got_object_blob_get_hdrlen(blob);
+	for (;;) {
+		err = got_object_blob_read_block(&len, blob);
+		if (err || len == 0)
+			break;
+		buf = got_object_blob_get_read_buf(blob);
+		for (i = hdrlen; i < len; i++) {
+			hash = (hash ^ buf[i]) * 16777619U;
+			chunklen++;
+			if (buf[i] != '\n' &&
+			    chunklen < GOT_DIFF_RENAME_CHUNK_SIZE)
+				continue;
+			err = add_chunk(fp, &nalloc, hash, chunklen);
+			if (err)
+				goto done;
+			hash = 2166136261U;
+			chunklen = 0;
+		}
+		fp->size += len - hdrlen;
+		hdrlen = 0;
+	}
+	if (err == NULL && chunklen > 0)
+		err = add_chunk(fp, &nalloc, hash, chunklen);
+	if (err)
+		goto done;
+
+	/* Merge chunks with identical content. */
+	qsort(fp->chunks, fp->nchunks, sizeof(fp->chunks[0]), cmp_chunks);
+	for (j = 0, k = 0; j < fp->nchunks; j++) {
+		if (k > 0 && fp->chunks[k - 1].hash == fp->chunks[j].hash)
+			fp->chunks[k - 1].len += fp->chunks[j].len;
+		else
+			fp->chunks[k++] = fp->chunks[j];
+	}
+	fp->nchunks = k;
+done:
+	got_object_blob_close(blob);
+	if (err) {
+		free(fp->chunks);
+		fp->chunks = NULL;
+		fp->nchunks = 0;
+	}
+	return err;
+}
+
+/* Return the percentage of content two blobs have in common. */
+static int
+similarity_score(struct got_diff_fingerprint *fp1,
+    struct got_diff_fingerprint *fp2)
+{
+	off_t common = 0, maxsize;
+	int i = 0, j = 0;
+
+	maxsize = MAX(fp1->size, fp2->size);
+	if (maxsize == 0)
+		return 100;
+
+	while (i < fp1->nchunks && j < fp2->nchunks) {
+		if (fp1->chunks[i].hash < fp2->chunks[j].hash)
+			i++;
+		else if (fp1->chunks[i].hash > fp2->chunks[j].hash)
+			j++;
+		else {
+			common += MIN(fp1->chunks[i].len, fp2->chunks[j].len);
+			i++;
+			j++;
+		}
+	}
+
+	return (int)(common * 100 / maxsize);
+}
+
+/*
+ * Pair remaining deleted and added regular files which have similar
+ * content. Candidate pairs are ranked by similarity, and each file is
+ * paired with its most similar counterpart which is still available.
+ */
+static const struct got_error *
+pair_similar_files(struct got_diff_changes *c,
+    struct got_diff_change **del, int ndel, struct got_diff_change **add,
+    int nadd, struct got_repository *repo)
+{
+	const struct got_error *err = NULL;
+	struct got_diff_fingerprint *fp1 = NULL, *fp2 = NULL;
+	struct got_diff_rename_candidate *cand = NULL;
+	struct got_diff_change *src, *dst;
+	int i, j, ncand = 0;
+
+	fp1 = calloc(ndel, sizeof(*fp1));
+	if (fp1 == NULL)
+		return got_error_from_errno("calloc");
+	fp2 = calloc(nadd, sizeof(*fp2));
+	if (fp2 == NULL) {
+		err = got_error_from_errno("calloc");
+		goto done;
+	}
+	cand = calloc(ndel, nadd * sizeof(*cand));
+	if (cand == NULL) {
+		err = got_error_from_errno("calloc");
+		goto done;
+	}
+
+	for (i = 0; i < ndel; i++) {
+		err = fingerprint_blob(&fp1[i], del[i]->id1, repo);
+		if (err)
+			goto done;
+	}
+	for (j = 0; j < nadd; j++) {
+		err = fingerprint_blob(&fp2[j], add[j]->id2, repo);
+		if (err)
+			goto done;
+	}
+
+	for (i = 0; i < ndel; i++) {
+		for (j = 0; j < nadd; j++) {
+			off_t minsize, maxsize;
+			int score;
+
+			/* Skip pairs which differ too much in size. */
+			minsize = MIN(fp1[i].size, fp2[j].size);
+			maxsize = MAX(fp1[i].size, fp2[j].size);
+			if (minsize * 100 < maxsize * GOT_DIFF_RENAME_MIN_SCORE)
+				continue;
+
+			score = similarity_score(&fp1[i], &fp2[j]);
+			if (score < GOT_DIFF_RENAME_MIN_SCORE)
+				continue;
+			cand[ncand].score = score;
+			cand[ncand].src = del[i] - c->changes;
+			cand[ncand].dst = add[j] - c->changes;
+			ncand++;
+		}
+	}
+
+	qsort(cand, ncand, sizeof(cand[0]), cmp_rename_candidates);
+	for (i = 0; i < ncand; i++) {
+		src = &c->changes[cand[i].src];
+		dst = &c->changes[cand[i].dst];
+		if (src->dst != -1 || dst->src != -1)
+			continue;
+		src->dst = cand[i].dst;
+		dst->src = cand[i].src;
+	}
+done:
+	if (fp1) {
+		for (i = 0; i < ndel; i++)
+			free(fp1[i].chunks);
+		free(fp1);
+	}
+	if (fp2) {
+		for (j = 0; j < nadd; j++)
+			free(fp2[j].chunks);
+		free(fp2);
+	}
+	free(cand);
+	return err;
+}
+
+/*
+ * Pair up deleted and added files. Files with identical blob IDs are
+ * matched first, which only requires sorting tree entries. Then the
+ * content of remaining files is compared if there are not too many.
+ */
+static const struct got_error *
+pair_renamed_files(struct got_diff_changes *c, struct got_repository *repo)
+{
+	const struct got_error *err = NULL;
+	struct got_diff_change **del = NULL, **add = NULL;
+	int i, j, k, ndel = 0, nadd = 0;
+
+	del = calloc(c->nchanges, sizeof(*del));
+	if (del == NULL)
+		return got_error_from_errno("calloc");
+	add = calloc(c->nchanges, sizeof(*add));
+	if (add == NULL) {
+		err = got_error_from_errno("calloc");
+		goto done;
+	}
+
+	for (i = 0; i < c->nchanges; i++) {
+		struct got_diff_change *change = &c->changes[i];
+		if (change->id1 && change->id2 == NULL)
+			del[ndel++] = change;
+		else if (change->id1 == NULL && change->id2)
+			add[nadd++] = change;
+	}
+	if (ndel == 0 || nadd == 0)
+		goto done;
+
+	qsort(del, ndel, sizeof(del[0]), cmp_change_id1);
+	qsort(add, nadd, sizeof(add[0]), cmp_change_id2);
+	i = 0;
+	j = 0;
+	while (i < ndel && j < nadd) {
+		int cmp = got_object_id_cmp(del[i]->id1, add[j]->id2);
+		if (cmp < 0)
+			i++;
+		else if (cmp > 0)
+			j++;
+		else {
+			if (S_ISLNK(del[i]->mode1) == S_ISLNK(add[j]->mode2)) {
+				del[i]->dst = add[j] - c->changes;
+				add[j]->src = del[i] - c->changes;
+				j++;
+			}
+			i++;
+		}
+	}
+
+	/* Only regular files which remain unpaired are compared. */
+	for (i = 0, k = 0; i < ndel; i++) {
+		if (del[i]->dst == -1 && S_ISREG(del[i]->mode1))
+			del[k++] = del[i];
+	}
+	ndel = k;
+	for (j = 0, k = 0; j < nadd; j++) {
+		if (add[j]->src == -1 && S_ISREG(add[j]->mode2))
+			add[k++] = add[j];
+	}
+	nadd = k;
+	if (ndel == 0 || nadd == 0 || (long long)ndel * nadd >
+	    (long long)GOT_DIFF_RENAME_LIMIT * GOT_DIFF_RENAME_LIMIT)
+		goto done;
+
+	err = pair_similar_files(c, del, ndel, add, nadd, repo);
+done:
+	free(del);
+	free(add);
+	return err;
+}
+
+static const struct got_error *
+collect_renames(struct got_diff_changes *c, struct got_tree_object *tree1,
+    struct got_tree_object *tree2, const char *label1, const char *label2,
+    struct got_repository *repo)
+{
+	const struct got_error *err;
+
+	err = got_diff_tree(tree1, tree2, label1, label2, repo,
+	    collect_change, c, 0);
+	if (err)
+		return err;
+
+	return pair_renamed_files(c, repo);
+}
+
+const struct got_error *
+got_diff_tree_find_renames(struct got_tree_object *tree1,
+    struct got_tree_object *tree2, const char *label1, const char *label2,
+    struct got_repository *repo, got_diff_blob_cb cb, void *cb_arg,
+    int diff_content)
+{
+	const struct got_error *err;
+	struct got_diff_changes c;
+	int i;
+
+	memset(&c, 0, sizeof(c));
+
+	err = collect_renames(&c, tree1, tree2, label1, label2, repo);
+	if (err)
+		goto done;
+
+	for (i = 0; i < c.nchanges; i++) {
+		struct got_diff_change *change = &c.changes[i];
+		struct got_diff_change *src = change;
+
+		if (change->dst != -1) /* shown along with its new path */
+			continue;
+		if (change->src != -1)
+			src = &c.changes[change->src];
+
+		if (!diff_content)
+			err = cb(cb_arg, NULL, NULL, src->id1, change->id2,
+			    src->label1, change->label2, src->mode1,
+			    change->mode2, repo);
+		else if (src->id1 && change->id2)
+			err = diff_modified_blob(src->id1, change->id2,
+			    src->label1, change->label2, src->mode1,
+			    change->mode2, repo, cb, cb_arg);
+		else if (change->id2)
+			err = diff_added_blob(change->id2, change->label2,
+			    change->mode2, repo, cb, cb_arg);
+		else
+			err = diff_deleted_blob(change->id1, change->label1,
+			    change->mode1, repo, cb, cb_arg);
+		if (err)
+			break;
+	}
+done:
+	free_changes(&c);
+	return err;
+}
+
+const struct got_error *
+got_diff_find_rename_source(char **old_path, struct got_object_id *commit_id1,
+    struct got_object_id *commit_id2, const char *path,
+    struct got_repository *repo)
+{
+	const struct got_error *err;
+	struct got_object_id *id = NULL;
+	struct got_commit_object *commit1 = NULL, *commit2 = NULL;
+	struct got_tree_object *tree1 = NULL, *tree2 = NULL;
+	struct got_diff_changes c;
+	int i;
+
+	*old_path = NULL;
+	memset(&c, 0, sizeof(c));
+
+	err = got_object_id_by_path(&id, repo, commit_id1, path);
+	if (err == NULL || err->code != GOT_ERR_NO_TREE_ENTRY)
+		goto done;
+	err = NULL;
+
+	err = got_object_open_as_commit(&commit1, repo, commit_id1);
+	if (err)
+		goto done;
+	err = got_object_open_as_commit(&commit2, repo, commit_id2);
+	if (err)
+		goto done;
+	err = got_object_open_as_tree(&tree1, repo,
+	    got_object_commit_get_tree_id(commit1));
+	if (err)
+		goto done;
+	err = got_object_open_as_tree(&tree2, repo,
+	    got_object_commit_get_tree_id(commit2));
+	if (err)
+		goto done;
+
+	err = collect_renames(&c, tree1, tree2, "", "", repo);
+	if (err)
+		goto done;
+
+	while (path[0] == '/')
+		path++;
+	for (i = 0; i < c.nchanges; i++) {
+		struct got_diff_change *change = &c.changes[i];
+		if (change->src == -1 || strcmp(change->label2, path) != 0)
+			continue;
+		if (asprintf(old_path, "/%s",
+		    c.changes[change->src].label1) == -1) {
+			err = got_error_from_errno("asprintf");
+			*old_path = NULL;
+		}
+		break;
+	}
+done:
+	free(id);
+	free_changes(&c);
+	if (commit1)
+		got_object_commit_close(commit1);
+	if (commit2)
+		got_object_commit_close(commit2);
+	if (tree1)
+		got_object_tree_close(tree1);
+	if (tree2)
+		got_object_tree_close(tree2);
+	return err;
+}
+
 const struct got_error *
 got_diff_objects_as_blobs(off_t **line_offsets, size_t *nlines,
     struct got_object_id *id1, struct got_object_id *id2,
@@ -766,7 +1352,8 @@ const struct got_error *
 got_diff_objects_as_trees(off_t **line_offsets, size_t *nlines,
     struct got_object_id *id1, struct got_object_id *id2,
     char *label1, char *label2, int diff_context, int ignore_whitespace,
-    int force_text_diff, struct got_repository *repo, FILE *outfile)
+    int force_text_diff, int find_renames, struct got_repository *repo,
+    FILE *outfile)
 {
 	const struct got_error *err;
 	struct got_tree_object *tree1 = NULL, *tree2 = NULL;
@@ -797,8 +1384,12 @@ got_diff_objects_as_trees(off_t **line_offsets, size_t *nlines,
 		arg.line_offsets = NULL;
 		arg.nlines = 0;
 	}
-	err = got_diff_tree(tree1, tree2, label1, label2, repo,
-	    got_diff_blob_output_unidiff, &arg, 1);
+	if (find_renames)
+		err = got_diff_tree_find_renames(tree1, tree2, label1, label2,
+		    repo, got_diff_blob_output_unidiff, &arg, 1);
+	else
+		err = got_diff_tree(tree1, tree2, label1, label2, repo,
+		    got_diff_blob_output_unidiff, &arg, 1);
 
 	if (want_lineoffsets) {
 		*line_offsets = arg.line_offsets; /* was likely re-allocated */
@@ -816,7 +1407,7 @@ const struct got_error *
 got_diff_objects_as_commits(off_t **line_offsets, size_t *nlines,
     struct got_object_id *id1, struct got_object_id *id2,
     int diff_context, int ignore_whitespace, int force_text_diff,
-    struct got_repository *repo, FILE *outfile)
+    int find_renames, struct got_repository *repo, FILE *outfile)
 {
 	const struct got_error *err;
 	struct got_commit_object *commit1 = NULL, *commit2 = NULL;
@@ -837,7 +1428,7 @@ got_diff_objects_as_commits(off_t **line_offsets, size_t *nlines,
 	err = got_diff_objects_as_trees(line_offsets, nlines,
 	    commit1 ? got_object_commit_get_tree_id(commit1) : NULL,
 	    got_object_commit_get_tree_id(commit2), "", "", diff_context,
-	    ignore_whitespace, force_text_diff, repo, outfile);
+	    ignore_whitespace, force_text_diff, find_renames, repo, outfile);
 done:
 	if (commit1)
 		got_object_commit_close(commit1);
@@ -180,7 +180,3 @@ int diff_output_match_function_prototype(char *prototype, size_t prototype_size,
 					 const struct diff_chunk_context *cc);
 
 struct diff_output_info *diff_output_info_alloc(void);
-
-void
-diff_data_init_subsection(struct diff_data *d, struct diff_data *parent,
-			  struct diff_atom *from_atom, unsigned int atoms_count);
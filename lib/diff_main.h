@@ -247,6 +247,13 @@ struct diff_config {
 
 int diff_atomize_file(struct diff_data *d, const struct diff_config *config,
 		      FILE *f, const uint8_t *data, off_t len, int diff_flags);
+
+/* Initialize d to reference atoms_count atoms of an atomized parent, starting
+ * at from_atom. The subsection shares the parent's atoms and must not be
+ * freed with diff_data_free(). */
+void
+diff_data_init_subsection(struct diff_data *d, struct diff_data *parent,
+			  struct diff_atom *from_atom, unsigned int atoms_count);
 struct diff_result *diff_main(const struct diff_config *config,
 			      struct diff_data *left,
 			      struct diff_data *right);
@@ -27,9 +27,16 @@ struct got_deflate_buf {
 
 #define GOT_DEFLATE_BUFSIZE		8192
 
+/*
+ * Compression level used for loose objects unless core.looseCompression
+ * or core.compression say otherwise. Like Git, favour speed over size
+ * since loose objects are short-lived and get compressed again when packed.
+ */
+#define GOT_DEFLATE_LEVEL_LOOSE		Z_BEST_SPEED
+
 const struct got_error *got_deflate_init(struct got_deflate_buf *, uint8_t *,
-    size_t);
+    size_t, int);
 const struct got_error *got_deflate_read(struct got_deflate_buf *, FILE *,
     size_t *);
 void got_deflate_end(struct got_deflate_buf *);
-const struct got_error *got_deflate_to_file(size_t *, FILE *, FILE *);
+const struct got_error *got_deflate_to_file(size_t *, FILE *, FILE *, int);
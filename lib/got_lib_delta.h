@@ -40,12 +40,58 @@ const struct got_error *got_delta_apply_in_mem(uint8_t *, size_t,
 const struct got_error *got_delta_apply(FILE *, const uint8_t *, size_t,
     FILE *, size_t *);
 
+/*
+ * A delta stream decoded into a list of instructions. Each instruction
+ * either copies a range of the delta base or inserts literal data, which
+ * points into the delta stream the instruction was decoded from.
+ * A sequence of deltas can be composed into a single list of instructions
+ * which produces the final result from the base of the first delta.
+ */
+struct got_delta_op {
+	const uint8_t *data;	/* literal data to insert, or NULL */
+	off_t base_offset;	/* offset of data to copy from delta base */
+	size_t len;
+	uint64_t result_offset;	/* offset of this instruction's output */
+};
+
+struct got_delta_ops {
+	struct got_delta_op *ops;
+	size_t nops;
+	size_t nalloc;
+	uint64_t base_size;
+	uint64_t result_size;
+};
+
+const struct got_error *got_delta_ops_parse(struct got_delta_ops *,
+    const uint8_t *, size_t);
+const struct got_error *got_delta_ops_compose(struct got_delta_ops *,
+    struct got_delta_ops *, struct got_delta_ops *, size_t);
+const struct got_error *got_delta_ops_apply(uint8_t *, size_t,
+    struct got_delta_ops *, uint8_t *, size_t *, size_t);
+void got_delta_ops_free(struct got_delta_ops *);
+
+/* Composed deltas may always use at least this many instructions. */
+#define GOT_DELTA_COMPOSE_OPS_MIN	4096
+
 /*
  * The amount of result data we may keep in RAM while applying deltas.
  * Data larger than this is written to disk during delta application (slow).
  */
 #define GOT_DELTA_RESULT_SIZE_CACHED_MAX	(8 * 1024 * 1024) /* bytes */
 
+/*
+ * Results larger than GOT_DELTA_RESULT_SIZE_CACHED_MAX but not larger than
+ * this are computed in anonymous memory mappings rather than temporary files.
+ * Two buffers of this size may be mapped during delta application.
+ */
+#ifndef GOT_DELTA_RESULT_SIZE_MAPPED_MAX
+#if SIZE_MAX > 0xffffffffUL
+#define GOT_DELTA_RESULT_SIZE_MAPPED_MAX	(512UL * 1024 * 1024) /* bytes */
+#else
+#define GOT_DELTA_RESULT_SIZE_MAPPED_MAX	(64UL * 1024 * 1024) /* bytes */
+#endif
+#endif
+
 /*
  * Definitions for delta data streams.
  */
@@ -19,7 +19,7 @@ struct got_inflate_checksum {
 	uint32_t *input_crc;
 
 	/* If not NULL, mix input bytes into this SHA1 context. */
-	SHA1_CTX *input_sha1;
+	struct got_sha1_ctx *input_sha1;
 };
 
 struct got_inflate_buf {
@@ -51,6 +51,12 @@ const struct got_error *got_inflate_to_mem_fd(uint8_t **, size_t *, size_t *,
     struct got_inflate_checksum *, size_t, int);
 const struct got_error *got_inflate_to_mem_mmap(uint8_t **, size_t *, size_t *,
     struct got_inflate_checksum *, uint8_t *, size_t, size_t);
+const struct got_error *got_inflate_mem(uint8_t *, size_t, size_t *, size_t *,
+    struct got_inflate_checksum *, const uint8_t *, size_t);
+const struct got_error *got_inflate_to_buf_fd(uint8_t *, size_t, size_t *,
+    struct got_inflate_checksum *, int);
+const struct got_error *got_inflate_to_buf_mmap(uint8_t *, size_t, size_t *,
+    struct got_inflate_checksum *, uint8_t *, size_t, size_t);
 const struct got_error *got_inflate_to_file(size_t *, FILE *, FILE *);
 const struct got_error *got_inflate_to_file_fd(size_t *, size_t *,
     struct got_inflate_checksum *, int, FILE *);
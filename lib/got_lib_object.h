@@ -85,6 +85,28 @@ struct got_tag_object {
 	int refcnt;		/* > 0 if open and/or cached */
 };
 
+/* A commit found while traversing history stored in a pack file. */
+struct got_traversed_commit {
+	SIMPLEQ_ENTRY(got_traversed_commit) entry;
+	struct got_object_id id;
+	time_t committer_time;	/* UTC */
+	int changed;		/* changed path; -1 if unknown */
+	unsigned int nparents;
+	struct got_object_id_queue parent_ids;
+
+	/*
+	 * IDs of the path in a merge commit and in each of its parents,
+	 * if known. Entries for commits which lack the path are NULL.
+	 */
+	int npath_ids;
+	struct got_object_id **path_ids;
+};
+
+SIMPLEQ_HEAD(got_traversed_commit_list, got_traversed_commit);
+
+void got_traversed_commit_free(struct got_traversed_commit *);
+void got_traversed_commit_list_free(struct got_traversed_commit_list *);
+
 struct got_object_id *got_object_get_id(struct got_object *);
 const struct got_error *got_object_get_id_str(char **, struct got_object *);
 const struct got_error *got_object_get_path(char **, struct got_object_id *,
@@ -109,3 +131,6 @@ const struct got_error *got_object_tree_entry_dup(struct got_tree_entry **,
 const struct got_error *got_traverse_packed_commits(
     struct got_object_id_queue *, struct got_object_id *, const char *,
     struct got_repository *);
+const struct got_error *got_traverse_packed_history(
+    struct got_traversed_commit_list *, int, struct got_object_id_queue *,
+    const char *, int, struct got_repository *);
@@ -26,3 +26,13 @@ const struct got_error *got_object_commit_create(struct got_object_id **,
     struct got_object_id *, struct got_object_id_queue *, int,
     const char *, time_t, const char *, time_t, const char *,
     struct got_repository *);
+
+/*
+ * Defer publication of loose objects created by the functions above until
+ * got_object_batch_publish() is called. Objects in an unpublished batch
+ * cannot be read back from the repository. got_object_batch_abort()
+ * discards them.
+ */
+const struct got_error *got_object_batch_open(struct got_repository *);
+const struct got_error *got_object_batch_publish(struct got_repository *);
+const struct got_error *got_object_batch_abort(struct got_repository *);
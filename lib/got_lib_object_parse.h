@@ -45,3 +45,12 @@ struct got_packidx;
 
 const struct got_error *got_object_parse_header(struct got_object **, char *, size_t);
 const struct got_error *got_object_read_header(struct got_object **, int);
+
+/*
+ * Longest valid loose object header, e.g. "commit <LONG_MAX>" followed
+ * by a NUL byte. got_object_read_header_bounded() refuses to look any
+ * further into the object and is therefore cheap to use without privsep.
+ */
+#define GOT_OBJECT_HEADER_MAXLEN	32
+const struct got_error *got_object_read_header_bounded(struct got_object **,
+    int);
@@ -14,17 +14,60 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+/*
+ * Pack files which fit into the mapping budget are mapped in their entirety.
+ * Larger pack files are accessed via a set of fixed-size windows which are
+ * mapped on demand and recycled in least-recently-used order. Both sizes can
+ * be overridden at build time. GOT_PACK_WINDOW_SIZE must be a multiple of
+ * the page size.
+ */
+#ifndef GOT_PACK_WINDOW_SIZE
+#define GOT_PACK_WINDOW_SIZE	(32 * 1024 * 1024)
+#endif
+#ifndef GOT_PACK_MAPPED_MAX
+#if SIZE_MAX > 0xffffffffUL
+#define GOT_PACK_MAPPED_MAX	(1024UL * 1024 * 1024)
+#else
+#define GOT_PACK_MAPPED_MAX	(256UL * 1024 * 1024)
+#endif
+#endif
+#define GOT_PACK_NUM_WINDOWS	32
+
+/* Interpolation steps taken before pack index search turns binary. */
+#define GOT_PACKIDX_INTERPOLATION_STEPS	4
+
+/* A memory-mapped region of a pack file. */
+struct got_pack_window {
+	uint8_t *map;
+	off_t offset;		/* page-aligned offset of map in pack file */
+	size_t len;
+	unsigned int lru;	/* counter value at last use */
+};
+
 /* An open pack file. */
 struct got_pack {
 	char *path_packfile;
 	int fd;
-	uint8_t *map;
-	size_t filesize;
+	uint8_t *map;		/* entire pack file, if mapped as a whole */
+	off_t filesize;
 	struct got_privsep_child *privsep_child;
 	struct got_delta_cache *delta_cache;
+
+	/* Windows into pack files which are not mapped as a whole. */
+	struct got_pack_window windows[GOT_PACK_NUM_WINDOWS];
+	int nwindows;
+	size_t window_size;	/* 0 if windows are not used */
+	size_t mapped_max;
+	size_t mapped_total;
+	unsigned int window_lru;
+
+	/* Bookkeeping for the repository's pack cache. */
+	unsigned int cache_hits;
+	unsigned int cache_lru;
 };
 
-const struct got_error *got_pack_stop_privsep_child(struct got_pack *);
+const struct got_error *got_pack_init_mmap(struct got_pack *, size_t, size_t);
+int got_pack_is_mapped(struct got_pack *);
 const struct got_error *got_pack_close(struct got_pack *);
 
 const struct got_error *got_pack_parse_offset_delta(off_t *, size_t *,
@@ -100,6 +143,7 @@ struct got_packidx {
 	size_t len;
 	size_t nlargeobj;
 	struct got_packidx_v2_hdr hdr; /* convenient pointers into map */
+	unsigned int cache_hits; /* used by the repository's packidx cache */
 };
 
 struct got_packfile_hdr {
@@ -171,6 +215,7 @@ const struct got_error *got_packidx_open(struct got_packidx **,
     int, const char *, int);
 const struct got_error *got_packidx_close(struct got_packidx *);
 int got_packidx_get_object_idx(struct got_packidx *, struct got_object_id *);
+off_t got_packidx_get_object_offset(struct got_packidx *, int);
 const struct got_error *got_packidx_match_id_str_prefix(
     struct got_object_id_queue *, struct got_packidx *, const char *);
 
@@ -81,6 +81,36 @@ struct got_privsep_child {
 	struct imsgbuf *ibuf;
 };
 
+/*
+ * A got-read-pack process keeps several pack files open, such that it
+ * can switch between them without verifying their pack indexes again
+ * and without losing cached state. Slots are assigned by the main process,
+ * which evicts the least recently used pack file when all slots are taken.
+ */
+#if SIZE_MAX > 0xffffffffUL
+#define GOT_PRIVSEP_PACK_SLOTS	8
+#else
+#define GOT_PRIVSEP_PACK_SLOTS	2
+#endif
+
+struct got_privsep_pack_slots {
+	char *paths[GOT_PRIVSEP_PACK_SLOTS];	/* pack file paths */
+	unsigned int lru[GOT_PRIVSEP_PACK_SLOTS];
+	unsigned int lru_counter;
+	int current;	/* slot the child is reading from, or -1 */
+};
+
+/*
+ * A got-read-pack process which serves requests in parallel with other
+ * got-read-pack processes, reading from one of its pack slots at a time.
+ */
+struct got_privsep_pack_worker {
+	pid_t pid;
+	int imsg_fd;	/* -1 if the worker has not been started */
+	struct imsgbuf ibuf;
+	struct got_privsep_pack_slots pack_slots;
+};
+
 enum got_imsg_type {
 	/* An error occured while processing a request. */
 	GOT_IMSG_ERROR,
@@ -130,10 +160,18 @@ enum got_imsg_type {
 	/* Messages related to pack files. */
 	GOT_IMSG_PACKIDX,
 	GOT_IMSG_PACK,
+	GOT_IMSG_PACK_SELECT,
 	GOT_IMSG_PACKED_OBJECT_REQUEST,
 	GOT_IMSG_COMMIT_TRAVERSAL_REQUEST,
 	GOT_IMSG_TRAVERSED_COMMITS,
 	GOT_IMSG_COMMIT_TRAVERSAL_DONE,
+	GOT_IMSG_PACK_VERIFY_REQUEST,
+	GOT_IMSG_PACK_VERIFY_PROBLEM,
+	GOT_IMSG_PACK_VERIFY_DONE,
+	GOT_IMSG_PATH_CHANGED_REQUEST,
+	GOT_IMSG_PATH_CHANGED,
+	GOT_IMSG_HISTORY_TRAVERSAL_REQUEST,
+	GOT_IMSG_TRAVERSED_HISTORY,
 
 	/* Message sending file descriptor to a temporary file. */
 	GOT_IMSG_TMPFD,
@@ -151,6 +189,8 @@ enum got_imsg_type {
 	GOT_IMSG_GITCONFIG_REMOTE,
 	GOT_IMSG_GITCONFIG_OWNER_REQUEST,
 	GOT_IMSG_GITCONFIG_OWNER,
+	GOT_IMSG_GITCONFIG_LOOSE_COMPRESSION_REQUEST,
+	GOT_IMSG_GITCONFIG_FSYNC_OBJECT_FILES_REQUEST,
 
 	/* Messages related to gotconfig files. */
 	GOT_IMSG_GOTCONFIG_PARSE_REQUEST,
@@ -339,16 +379,23 @@ struct got_imsg_index_pack_progress {
 /* Structure for GOT_IMSG_PACKIDX. */
 struct got_imsg_packidx {
 	size_t len;
+	int slot;
 	/* Additionally, a file desciptor is passed via imsg. */
 };
 
 /* Structure for GOT_IMSG_PACK. */
 struct got_imsg_pack {
 	char path_packfile[PATH_MAX];
-	size_t filesize;
+	off_t filesize;
+	int slot;
 	/* Additionally, a file desciptor is passed via imsg. */
 } __attribute__((__packed__));
 
+/* Structure for GOT_IMSG_PACK_SELECT. */
+struct got_imsg_pack_select {
+	int slot;
+};
+
 /*
  * Structure for GOT_IMSG_PACKED_OBJECT_REQUEST data.
  */
@@ -365,6 +412,86 @@ struct got_imsg_commit_traversal_request {
 	/* Followed by path_len bytes of path data */
 } __attribute__((__packed__));
 
+/* Structure for GOT_IMSG_PACK_VERIFY_REQUEST */
+struct got_imsg_pack_verify_request {
+	/*
+	 * Verify objects starting at offsets in [start, end), or the pack
+	 * file checksum if the checksum flag is set.
+	 */
+	off_t start;
+	off_t end;
+	int checksum;
+
+	/* Object requests are followed by three GOT_IMSG_TMPFD messages. */
+} __attribute__((__packed__));
+
+/* Structure for GOT_IMSG_PACK_VERIFY_PROBLEM */
+struct got_imsg_pack_verify_problem {
+	uint8_t id[SHA1_DIGEST_LENGTH];
+	off_t offset;
+	int problem; /* GOT_VERIFY_BAD_* */
+} __attribute__((__packed__));
+
+/* Structure for GOT_IMSG_PACK_VERIFY_DONE */
+struct got_imsg_pack_verify_done {
+	int nobjects;
+} __attribute__((__packed__));
+
+/*
+ * Structure for GOT_IMSG_PATH_CHANGED_REQUEST data.
+ * A struct got_imsg_packed_object for the commit is followed by the path.
+ */
+
+/* Structure for GOT_IMSG_PATH_CHANGED */
+struct got_imsg_path_changed {
+	/*
+	 * Set to 1 if the commit changed the path compared to its first
+	 * parent, to 0 if it did not, and to -1 if the pack file does not
+	 * contain enough information to tell.
+	 */
+	int changed;
+} __attribute__((__packed__));
+
+/* Structure for GOT_IMSG_HISTORY_TRAVERSAL_REQUEST */
+struct got_imsg_history_traversal_request {
+	/*
+	 * Requests with the same session ID continue a traversal where the
+	 * previous request stopped. Commits reported once are not reported
+	 * again within a session.
+	 */
+	int session;
+	int max_commits;
+	int nids;
+	/*
+	 * Followed by nids commit IDs of SHA1_DIGEST_LENGTH each to start
+	 * from, and a NUL-terminated path.
+	 */
+} __attribute__((__packed__));
+
+/* Structure for GOT_IMSG_TRAVERSED_HISTORY */
+struct got_imsg_traversed_history {
+	int ncommits;
+	/* Followed by ncommits struct got_imsg_traversed_commit records. */
+} __attribute__((__packed__));
+
+struct got_imsg_traversed_commit {
+	uint8_t id[SHA1_DIGEST_LENGTH];
+	time_t committer_time;
+	int changed; /* as in struct got_imsg_path_changed */
+	int nparents;
+	int npath_ids; /* 0 if not a merge or unknown, else nparents + 1 */
+	/*
+	 * Followed by nparents IDs of SHA1_DIGEST_LENGTH each, and by
+	 * npath_ids struct got_imsg_traversed_path_id for the path in the
+	 * merge commit followed by the path in each of its parents.
+	 */
+} __attribute__((__packed__));
+
+struct got_imsg_traversed_path_id {
+	uint8_t id[SHA1_DIGEST_LENGTH];
+	int found; /* zero if the path does not exist */
+} __attribute__((__packed__));
+
 /* Structure for GOT_IMSG_TRAVERSED_COMMITS  */
 struct got_imsg_traversed_commits {
 	size_t ncommits;
@@ -396,6 +523,7 @@ struct got_remote_repo;
 struct got_pack;
 struct got_packidx;
 struct got_pathlist_head;
+struct got_traversed_commit_list;
 
 const struct got_error *got_send_ack(pid_t);
 const struct got_error *got_privsep_wait_for_child(pid_t);
@@ -452,8 +580,20 @@ const struct got_error *got_privsep_send_tag(struct imsgbuf *,
     struct got_tag_object *);
 const struct got_error *got_privsep_recv_tag(struct got_tag_object **,
     struct imsgbuf *);
+void got_privsep_pack_slots_init(struct got_privsep_pack_slots *);
+void got_privsep_pack_slots_free(struct got_privsep_pack_slots *);
+const struct got_error *got_privsep_select_pack(int *, struct imsgbuf *,
+    struct got_privsep_pack_slots *, const char *);
 const struct got_error *got_privsep_init_pack_child(struct imsgbuf *,
-    struct got_pack *, struct got_packidx *);
+    struct got_privsep_pack_slots *, struct got_pack *, struct got_packidx *);
+const struct got_error *got_privsep_pack_worker_start(
+    struct got_privsep_pack_worker *, const char *);
+const struct got_error *got_privsep_pack_worker_stop(
+    struct got_privsep_pack_worker *, int);
+int got_privsep_pack_worker_reads(struct got_privsep_pack_worker *,
+    const char *);
+const struct got_error *got_privsep_pack_worker_switch(
+    struct got_privsep_pack_worker *, int, const char *, struct got_packidx *);
 const struct got_error *got_privsep_send_packed_obj_req(struct imsgbuf *, int,
     struct got_object_id *);
 const struct got_error *got_privsep_send_pack_child_ready(struct imsgbuf *);
@@ -471,6 +611,10 @@ const struct got_error *got_privsep_send_gitconfig_author_email_req(
 const struct got_error *got_privsep_send_gitconfig_remotes_req(
     struct imsgbuf *);
 const struct got_error *got_privsep_send_gitconfig_owner_req(struct imsgbuf *);
+const struct got_error *got_privsep_send_gitconfig_loose_compression_req(
+    struct imsgbuf *);
+const struct got_error *got_privsep_send_gitconfig_fsync_object_files_req(
+    struct imsgbuf *);
 const struct got_error *got_privsep_recv_gitconfig_str(char **,
     struct imsgbuf *);
 const struct got_error *got_privsep_recv_gitconfig_int(int *, struct imsgbuf *);
@@ -493,4 +637,24 @@ const struct got_error *got_privsep_recv_traversed_commits(
     struct got_commit_object **, struct got_object_id **,
     struct got_object_id_queue *, struct imsgbuf *);
 
+const struct got_error *got_privsep_send_history_traversal_request(
+    struct imsgbuf *, int, struct got_object_id_queue *, int, const char *);
+const struct got_error *got_privsep_recv_traversed_history(
+    struct got_traversed_commit_list *, struct imsgbuf *);
+
+const struct got_error *got_privsep_send_pack_verify_req(struct imsgbuf *,
+    off_t, off_t, int);
+const struct got_error *got_privsep_send_pack_verify_problem(struct imsgbuf *,
+    struct got_object_id *, off_t, int);
+const struct got_error *got_privsep_send_pack_verify_done(struct imsgbuf *,
+    int);
+const struct got_error *got_privsep_recv_pack_verify_result(
+    struct got_imsg_pack_verify_problem **, int *, int *, struct imsgbuf *);
+
+const struct got_error *got_privsep_send_path_changed_req(struct imsgbuf *,
+    struct got_object_id *, int, const char *);
+const struct got_error *got_privsep_send_path_changed(struct imsgbuf *, int);
+const struct got_error *got_privsep_recv_path_changed(int *,
+    struct imsgbuf *);
+
 void got_privsep_exec_child(int[2], const char *, const char *);
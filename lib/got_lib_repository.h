@@ -28,8 +28,49 @@
 #define GOT_OBJECTS_PACK_DIR	"objects/pack"
 #define GOT_PACKED_REFS_FILE	"packed-refs"
 
-#define GOT_PACKIDX_CACHE_SIZE	16
-#define GOT_PACK_CACHE_SIZE	GOT_PACKIDX_CACHE_SIZE
+/*
+ * The pack and pack index caches are sized when the repository is opened,
+ * based on the open file limit. Each cached pack and pack index holds one
+ * file descriptor, and at most a quarter of the limit is spent on them.
+ */
+#define GOT_PACK_CACHE_SIZE_MIN	4
+#define GOT_PACK_CACHE_SIZE_MAX	128
+
+/* Upper bounds for memory mapped by the pack and pack index caches. */
+#ifndef GOT_PACK_CACHE_MAPPED_MAX
+#if SIZE_MAX > 0xffffffffUL
+#define GOT_PACK_CACHE_MAPPED_MAX	(8ULL * 1024 * 1024 * 1024)
+#else
+#define GOT_PACK_CACHE_MAPPED_MAX	(512ULL * 1024 * 1024)
+#endif
+#endif
+#ifndef GOT_PACKIDX_CACHE_MAPPED_MAX
+#if SIZE_MAX > 0xffffffffUL
+#define GOT_PACKIDX_CACHE_MAPPED_MAX	(2ULL * 1024 * 1024 * 1024)
+#else
+#define GOT_PACKIDX_CACHE_MAPPED_MAX	(128ULL * 1024 * 1024)
+#endif
+#endif
+
+/*
+ * Cache entries which were hit at least this many times are only evicted
+ * if no other entry can be evicted. Hit counts are halved whenever an
+ * entry gets evicted so that packs which are no longer used will age out.
+ */
+#define GOT_PACK_CACHE_PIN_HITS	32
+
+/*
+ * Sorted listing of object IDs found in one loose object fan-out
+ * directory (e.g. objects/ab/). Re-read when the directory's
+ * modification time changes.
+ */
+struct got_loose_object_dir {
+	int cached;
+	time_t mtime_sec;
+	long mtime_nsec;
+	struct got_object_id *ids;
+	size_t nids;
+};
 
 struct got_repository {
 	char *path;
@@ -37,18 +78,32 @@ struct got_repository {
 	int gitdir_fd;
 
 	/* The pack index cache speeds up search for packed objects. */
-	struct got_packidx *packidx_cache[GOT_PACKIDX_CACHE_SIZE];
+	struct got_packidx **packidx_cache;
+	size_t packidx_cache_size;
+	uint64_t packidx_cache_mapped;
 
 	/* Open file handles for pack files. */
-	struct got_pack packs[GOT_PACK_CACHE_SIZE];
+	struct got_pack *packs;
+	size_t pack_cache_size;
+	uint64_t pack_cache_mapped;
+	unsigned int pack_cache_lru;
 
-	/* Handles to child processes for reading loose objects. */
-	 struct got_privsep_child privsep_children[5];
+	/*
+	 * Handles to child processes for reading objects. A single
+	 * got-read-pack child is shared by all packs; pack_child_slots
+	 * tracks which pack files it has open.
+	 */
+	 struct got_privsep_child privsep_children[6];
 #define GOT_REPO_PRIVSEP_CHILD_OBJECT	0
 #define GOT_REPO_PRIVSEP_CHILD_COMMIT	1
 #define GOT_REPO_PRIVSEP_CHILD_TREE	2
 #define GOT_REPO_PRIVSEP_CHILD_BLOB	3
 #define GOT_REPO_PRIVSEP_CHILD_TAG	4
+#define GOT_REPO_PRIVSEP_CHILD_PACK	5
+	struct got_privsep_pack_slots pack_child_slots;
+
+	/* Listings of loose object directories, used for ID prefix lookup. */
+	struct got_loose_object_dir loose_object_dirs[0xff + 1];
 
 	/* Caches for open objects. */
 	struct got_object_cache objcache;
@@ -56,6 +111,9 @@ struct got_repository {
 	struct got_object_cache commitcache;
 	struct got_object_cache tagcache;
 
+	/* Loose objects written but not yet published, if batching. */
+	struct got_object_batch *object_batch;
+
 	/* Settings read from Git configuration files. */
 	int gitconfig_repository_format_version;
 	char *gitconfig_author_name;
@@ -67,6 +125,8 @@ struct got_repository {
 	char *gitconfig_owner;
 	char **extensions;
 	int nextensions;
+	int gitconfig_loose_compression;
+	int gitconfig_fsync_object_files;
 
 	/* Settings read from got.conf. */
 	struct got_gotconfig *gotconfig;
@@ -92,3 +152,4 @@ const struct got_error *got_repo_search_packidx(struct got_packidx **, int *,
     struct got_repository *, struct got_object_id *);
 const struct got_error *got_repo_cache_pack(struct got_pack **,
     struct got_repository *, const char *, struct got_packidx *);
+int got_repo_is_packidx_filename(const char *, size_t);
@@ -19,3 +19,39 @@
 int got_parse_xdigit(uint8_t *, const char *);
 int got_parse_sha1_digest(uint8_t *, const char *);
 char *got_sha1_digest_to_str(const uint8_t *, char *, size_t);
+int got_parse_sha1_digest_prefix(uint8_t *, size_t *, const char *);
+int got_sha1_digest_prefix_cmp(const uint8_t *, const uint8_t *, size_t);
+
+/*
+ * SHA1 implementations which may back a got_sha1_ctx. The fastest one
+ * supported by the CPU is selected when the first context is set up.
+ */
+#define GOT_SHA1_BACKEND_PORTABLE	0 /* SHA1Update(3) */
+#define GOT_SHA1_BACKEND_SHANI		1 /* x86 SHA extensions */
+#define GOT_SHA1_BACKEND_SHA1DC		2 /* collision detection */
+
+struct got_sha1_ctx {
+	int backend;
+	union {
+		SHA1_CTX portable;
+		struct {
+			uint32_t state[5];
+			uint64_t count;
+			uint8_t buffer[64];
+		} block;
+#ifdef GOT_SHA1DC
+		uint64_t sha1dc[512]; /* SHA1_CTX of libsha1detectcoll */
+#endif
+	} u;
+};
+
+void got_sha1_init(struct got_sha1_ctx *);
+void got_sha1_update(struct got_sha1_ctx *, const uint8_t *, size_t);
+void got_sha1_final(uint8_t *, struct got_sha1_ctx *);
+
+/*
+ * Get or set the SHA1 backend used by subsequently initialized contexts.
+ * Setting a backend which is not available fails and returns zero.
+ */
+int got_sha1_get_backend(void);
+int got_sha1_set_backend(int);
@@ -16,6 +16,7 @@
 
 
 #include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -24,10 +25,15 @@
 #include <zlib.h>
 #include <time.h>
 
+#ifdef GOT_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
 #include "got_error.h"
 #include "got_object.h"
 #include "got_path.h"
 
+#include "got_lib_sha1.h"
 #include "got_lib_inflate.h"
 
 #ifndef MIN
@@ -89,7 +95,7 @@ csum_input(struct got_inflate_checksum *csum, const char *buf, size_t len)
 		*csum->input_crc = crc32(*csum->input_crc, buf, len);
 
 	if (csum->input_sha1)
-		SHA1Update(csum->input_sha1, buf, len);
+		got_sha1_update(csum->input_sha1, buf, len);
 }
 
 const struct got_error *
@@ -435,6 +441,176 @@ done:
 	return err;
 }
 
+#ifdef GOT_LIBDEFLATE
+static struct libdeflate_decompressor *decompressor;
+
+static const struct got_error *
+inflate_mem(uint8_t *out, size_t outsize, size_t *outlen, size_t *consumed,
+    const uint8_t *in, size_t inlen)
+{
+	enum libdeflate_result res;
+
+	if (decompressor == NULL) {
+		decompressor = libdeflate_alloc_decompressor();
+		if (decompressor == NULL) {
+			errno = ENOMEM;
+			return got_error_from_errno(
+			    "libdeflate_alloc_decompressor");
+		}
+	}
+
+	res = libdeflate_zlib_decompress_ex(decompressor, in, inlen,
+	    out, outsize, consumed, outlen);
+	switch (res) {
+	case LIBDEFLATE_SUCCESS:
+		return NULL;
+	case LIBDEFLATE_INSUFFICIENT_SPACE:
+		return got_error(GOT_ERR_NO_SPACE);
+	default:
+		return got_error(GOT_ERR_DECOMPRESSION);
+	}
+}
+#else
+static const struct got_error *
+inflate_mem(uint8_t *out, size_t outsize, size_t *outlen, size_t *consumed,
+    const uint8_t *in, size_t inlen)
+{
+	const struct got_error *err = NULL;
+	z_stream z;
+	int ret;
+
+	memset(&z, 0, sizeof(z));
+	ret = inflateInit(&z);
+	if (ret != Z_OK) {
+		if (ret == Z_MEM_ERROR) {
+			errno = ENOMEM;
+			return got_error_from_errno("inflateInit");
+		}
+		return got_error(GOT_ERR_DECOMPRESSION);
+	}
+
+	z.next_in = (Bytef *)in;
+	z.next_out = out;
+	do {
+		/* Buffers may exceed what fits into avail_in/avail_out. */
+		if (z.avail_in == 0)
+			z.avail_in = MIN(inlen - z.total_in, UINT_MAX);
+		if (z.avail_out == 0)
+			z.avail_out = MIN(outsize - z.total_out, UINT_MAX);
+		ret = inflate(&z, Z_SYNC_FLUSH);
+	} while (ret == Z_OK);
+
+	if (ret == Z_STREAM_END) {
+		*outlen = z.total_out;
+		*consumed = z.total_in;
+	} else if (ret == Z_BUF_ERROR && z.total_out == outsize)
+		err = got_error(GOT_ERR_NO_SPACE);
+	else if (ret == Z_MEM_ERROR) {
+		errno = ENOMEM;
+		err = got_error_from_errno("inflate");
+	} else
+		err = got_error(GOT_ERR_DECOMPRESSION);
+
+	inflateEnd(&z);
+	return err;
+}
+#endif
+
+/*
+ * Inflate a complete zlib stream which starts at 'in' into 'out', which
+ * must have room for all of the inflated data. The input may extend past
+ * the end of the stream. This avoids the setup and copying overhead of
+ * streaming when the inflated size is known in advance, such as for
+ * packed objects.
+ */
+const struct got_error *
+got_inflate_mem(uint8_t *out, size_t outsize, size_t *outlen,
+    size_t *consumed, struct got_inflate_checksum *csum, const uint8_t *in,
+    size_t inlen)
+{
+	const struct got_error *err;
+	size_t n = 0;
+
+	*outlen = 0;
+	if (consumed)
+		*consumed = 0;
+
+	err = inflate_mem(out, outsize, outlen, &n, in, inlen);
+	if (err)
+		return err;
+
+	if (csum)
+		csum_input(csum, (const char *)in, n);
+	if (consumed)
+		*consumed = n;
+	return NULL;
+}
+
+/*
+ * Inflate an object whose inflated size is known in advance, for instance
+ * from a pack file object header, into a buffer of exactly that size.
+ * Inflated data which does not match the expected size is an error.
+ */
+const struct got_error *
+got_inflate_to_buf_fd(uint8_t *outbuf, size_t size, size_t *consumed_total,
+    struct got_inflate_checksum *csum, int infd)
+{
+	const struct got_error *err;
+	size_t avail, consumed, total = 0;
+	struct got_inflate_buf zb;
+
+	err = got_inflate_init(&zb, outbuf, GOT_INFLATE_BUFSIZE, csum);
+	if (err)
+		return err;
+	zb.outlen = MIN(size, UINT_MAX);
+
+	if (consumed_total)
+		*consumed_total = 0;
+	for (;;) {
+		err = got_inflate_read_fd(&zb, infd, &avail, &consumed);
+		if (err)
+			goto done;
+		total += avail;
+		if (consumed_total)
+			*consumed_total += consumed;
+		if ((zb.flags & GOT_INFLATE_F_HAVE_MORE) == 0)
+			break;
+		if (total == size && avail == 0 && consumed == 0) {
+			/* More data follows but the buffer is full. */
+			err = got_error(GOT_ERR_BAD_OBJ_DATA);
+			goto done;
+		}
+		zb.outbuf += avail;
+		zb.outlen = MIN(size - total, UINT_MAX);
+	}
+
+	if (total != size)
+		err = got_error(GOT_ERR_BAD_OBJ_DATA);
+done:
+	got_inflate_end(&zb);
+	return err;
+}
+
+const struct got_error *
+got_inflate_to_buf_mmap(uint8_t *outbuf, size_t size, size_t *consumed,
+    struct got_inflate_checksum *csum, uint8_t *map, size_t offset,
+    size_t len)
+{
+	const struct got_error *err;
+	size_t outlen;
+
+	err = got_inflate_mem(outbuf, size, &outlen, consumed, csum,
+	    map + offset, len);
+	if (err) {
+		if (err->code == GOT_ERR_NO_SPACE)
+			err = got_error(GOT_ERR_BAD_OBJ_DATA);
+		return err;
+	}
+	if (outlen != size)
+		return got_error(GOT_ERR_BAD_OBJ_DATA);
+	return NULL;
+}
+
 const struct got_error *
 got_inflate_to_fd(size_t *outlen, FILE *infile, int outfd)
 {
@@ -115,8 +115,7 @@ got_object_get_path(char **path, struct got_object_id *id,
 	if (err)
 		goto done;
 
-	if (asprintf(path, "%s/%.2x/%s", path_objects,
-	    id->sha1[0], hex + 2) == -1)
+	if (asprintf(path, "%s/%.2s/%s", path_objects, hex, hex + 2) == -1)
 		err = got_error_from_errno("asprintf");
 
 done:
@@ -203,63 +202,87 @@ set_max_datasize(void)
 }
 
 static const struct got_error *
-start_pack_privsep_child(struct got_pack *pack, struct got_packidx *packidx)
+start_pack_privsep_child(struct got_repository *repo)
 {
 	const struct got_error *err = NULL;
+	struct got_privsep_child *child;
 	int imsg_fds[2];
 	pid_t pid;
 	struct imsgbuf *ibuf;
 
+	child = &repo->privsep_children[GOT_REPO_PRIVSEP_CHILD_PACK];
+
 	ibuf = calloc(1, sizeof(*ibuf));
 	if (ibuf == NULL)
 		return got_error_from_errno("calloc");
 
-	pack->privsep_child = calloc(1, sizeof(*pack->privsep_child));
-	if (pack->privsep_child == NULL) {
-		err = got_error_from_errno("calloc");
-		free(ibuf);
-		return err;
-	}
-
 	if (socketpair(AF_UNIX, SOCK_STREAM, PF_UNSPEC, imsg_fds) == -1) {
 		err = got_error_from_errno("socketpair");
-		goto done;
+		free(ibuf);
+		return err;
 	}
 
 	pid = fork();
 	if (pid == -1) {
 		err = got_error_from_errno("fork");
-		goto done;
+		close(imsg_fds[0]);
+		close(imsg_fds[1]);
+		free(ibuf);
+		return err;
 	} else if (pid == 0) {
 		set_max_datasize();
 		got_privsep_exec_child(imsg_fds, GOT_PATH_PROG_READ_PACK,
-		    pack->path_packfile);
+		    repo->path);
 		/* not reached */
 	}
 
-	if (close(imsg_fds[1]) != 0)
-		return got_error_from_errno("close");
-	pack->privsep_child->imsg_fd = imsg_fds[0];
-	pack->privsep_child->pid = pid;
+	if (close(imsg_fds[1]) != 0) {
+		err = got_error_from_errno("close");
+		free(ibuf);
+		return err;
+	}
+	child->imsg_fd = imsg_fds[0];
+	child->pid = pid;
 	imsg_init(ibuf, imsg_fds[0]);
-	pack->privsep_child->ibuf = ibuf;
+	child->ibuf = ibuf;
+	return NULL;
+}
 
-	err = got_privsep_init_pack_child(ibuf, pack, packidx);
-	if (err) {
-		const struct got_error *child_err;
-		err = got_privsep_send_stop(pack->privsep_child->imsg_fd);
-		child_err = got_privsep_wait_for_child(
-		    pack->privsep_child->pid);
-		if (child_err && err == NULL)
-			err = child_err;
+/*
+ * Ensure that the got-read-pack child process is reading from the given
+ * pack. The child is shared by all packs in the repository's pack cache
+ * and keeps several of them open; it only gets passed a pack and pack
+ * index if it does not have them open yet.
+ */
+static const struct got_error *
+get_pack_privsep_child(struct got_repository *repo, struct got_pack *pack,
+    struct got_packidx *packidx)
+{
+	const struct got_error *err;
+	struct got_privsep_child *child;
+	int selected;
+
+	child = &repo->privsep_children[GOT_REPO_PRIVSEP_CHILD_PACK];
+	if (child->imsg_fd == -1) {
+		err = start_pack_privsep_child(repo);
+		if (err)
+			return err;
+		got_privsep_pack_slots_free(&repo->pack_child_slots);
 	}
-done:
-	if (err) {
-		free(ibuf);
-		free(pack->privsep_child);
-		pack->privsep_child = NULL;
+
+	err = got_privsep_select_pack(&selected, child->ibuf,
+	    &repo->pack_child_slots, pack->path_packfile);
+	if (err)
+		return err;
+	if (!selected) {
+		err = got_privsep_init_pack_child(child->ibuf,
+		    &repo->pack_child_slots, pack, packidx);
+		if (err)
+			return err;
 	}
-	return err;
+
+	pack->privsep_child = child;
+	return NULL;
 }
 
 static const struct got_error *
@@ -269,10 +292,7 @@ read_packed_object_privsep(struct got_object **obj,
 {
 	const struct got_error *err = NULL;
 
-	if (pack->privsep_child)
-		return request_packed_object(obj, pack, idx, id);
-
-	err = start_pack_privsep_child(pack, packidx);
+	err = get_pack_privsep_child(repo, pack, packidx);
 	if (err)
 		return err;
 
@@ -305,7 +325,16 @@ open_packed_object(struct got_object **obj, struct got_object_id *id,
 			goto done;
 	}
 
-	err = read_packed_object_privsep(obj, repo, pack, packidx, idx, id);
+	/*
+	 * Object headers in a memory-mapped pack file consist of fixed-size
+	 * fields and can be parsed without the help of a privsep child.
+	 * Deltified objects are resolved to their base object's type.
+	 */
+	if (got_pack_is_mapped(pack))
+		err = got_packfile_open_object(obj, pack, packidx, idx, id);
+	else
+		err = read_packed_object_privsep(obj, repo, pack, packidx,
+		    idx, id);
 	if (err)
 		goto done;
 done:
@@ -411,7 +440,21 @@ got_object_open(struct got_object **obj, struct got_repository *repo,
 			err = got_error_from_errno2("open", path);
 		goto done;
 	} else {
-		err = read_object_header_privsep(obj, repo, fd);
+		/*
+		 * Loose object headers are short. Only hand the object to
+		 * a privsep child if its header does not fit a fixed-size
+		 * buffer; such objects are probably invalid anyway.
+		 */
+		err = got_object_read_header_bounded(obj, fd);
+		if (err && err->code == GOT_ERR_BAD_OBJ_HDR) {
+			if (lseek(fd, 0, SEEK_SET) == -1) {
+				err = got_error_from_errno2("lseek", path);
+				close(fd);
+				goto done;
+			}
+			err = read_object_header_privsep(obj, repo, fd);
+		} else if (close(fd) == -1 && err == NULL)
+			err = got_error_from_errno2("close", path);
 		if (err)
 			goto done;
 		memcpy((*obj)->id.sha1, id->sha1, SHA1_DIGEST_LENGTH);
@@ -477,15 +520,12 @@ request_packed_commit(struct got_commit_object **commit, struct got_pack *pack,
 
 static const struct got_error *
 read_packed_commit_privsep(struct got_commit_object **commit,
-    struct got_pack *pack, struct got_packidx *packidx, int idx,
-    struct got_object_id *id)
+    struct got_repository *repo, struct got_pack *pack,
+    struct got_packidx *packidx, int idx, struct got_object_id *id)
 {
 	const struct got_error *err = NULL;
 
-	if (pack->privsep_child)
-		return request_packed_commit(commit, pack, idx, id);
-
-	err = start_pack_privsep_child(pack, packidx);
+	err = get_pack_privsep_child(repo, pack, packidx);
 	if (err)
 		return err;
 
@@ -590,7 +630,7 @@ open_commit(struct got_commit_object **commit,
 			if (err)
 				goto done;
 		}
-		err = read_packed_commit_privsep(commit, pack,
+		err = read_packed_commit_privsep(commit, repo, pack,
 		    packidx, idx, id);
 	} else if (err->code == GOT_ERR_NO_OBJ) {
 		int fd;
@@ -666,15 +706,12 @@ request_packed_tree(struct got_tree_object **tree, struct got_pack *pack,
 
 static const struct got_error *
 read_packed_tree_privsep(struct got_tree_object **tree,
-    struct got_pack *pack, struct got_packidx *packidx, int idx,
-    struct got_object_id *id)
+    struct got_repository *repo, struct got_pack *pack,
+    struct got_packidx *packidx, int idx, struct got_object_id *id)
 {
 	const struct got_error *err = NULL;
 
-	if (pack->privsep_child)
-		return request_packed_tree(tree, pack, idx, id);
-
-	err = start_pack_privsep_child(pack, packidx);
+	err = get_pack_privsep_child(repo, pack, packidx);
 	if (err)
 		return err;
 
@@ -779,7 +816,7 @@ open_tree(struct got_tree_object **tree, struct got_repository *repo,
 			if (err)
 				goto done;
 		}
-		err = read_packed_tree_privsep(tree, pack,
+		err = read_packed_tree_privsep(tree, repo, pack,
 		    packidx, idx, id);
 	} else if (err->code == GOT_ERR_NO_OBJ) {
 		int fd;
@@ -1007,16 +1044,14 @@ request_packed_blob(uint8_t **outbuf, size_t *size, size_t *hdrlen, int outfd,
 
 static const struct got_error *
 read_packed_blob_privsep(uint8_t **outbuf, size_t *size, size_t *hdrlen,
-    int outfd, struct got_pack *pack, struct got_packidx *packidx, int idx,
-    struct got_object_id *id)
+    int outfd, struct got_repository *repo, struct got_pack *pack,
+    struct got_packidx *packidx, int idx, struct got_object_id *id)
 {
 	const struct got_error *err = NULL;
 
-	if (pack->privsep_child == NULL) {
-		err = start_pack_privsep_child(pack, packidx);
-		if (err)
-			return err;
-	}
+	err = get_pack_privsep_child(repo, pack, packidx);
+	if (err)
+		return err;
 
 	return request_packed_blob(outbuf, size, hdrlen, outfd, pack, packidx,
 	    idx, id);
@@ -1144,7 +1179,7 @@ open_blob(struct got_blob_object **blob, struct got_repository *repo,
 				goto done;
 		}
 		err = read_packed_blob_privsep(&outbuf, &size, &hdrlen, outfd,
-		    pack, packidx, idx, id);
+		    repo, pack, packidx, idx, id);
 	} else if (err->code == GOT_ERR_NO_OBJ) {
 		int infd;
 
@@ -1379,15 +1414,12 @@ request_packed_tag(struct got_tag_object **tag, struct got_pack *pack,
 
 static const struct got_error *
 read_packed_tag_privsep(struct got_tag_object **tag,
-    struct got_pack *pack, struct got_packidx *packidx, int idx,
-    struct got_object_id *id)
+    struct got_repository *repo, struct got_pack *pack,
+    struct got_packidx *packidx, int idx, struct got_object_id *id)
 {
 	const struct got_error *err = NULL;
 
-	if (pack->privsep_child)
-		return request_packed_tag(tag, pack, idx, id);
-
-	err = start_pack_privsep_child(pack, packidx);
+	err = get_pack_privsep_child(repo, pack, packidx);
 	if (err)
 		return err;
 
@@ -1505,7 +1537,8 @@ open_tag(struct got_tag_object **tag, struct got_repository *repo,
 			err = got_error(GOT_ERR_OBJ_TYPE);
 			goto done;
 		}
-		err = read_packed_tag_privsep(tag, pack, packidx, idx, id);
+		err = read_packed_tag_privsep(tag, repo, pack, packidx, idx,
+		    id);
 	} else if (err->code == GOT_ERR_NO_OBJ) {
 		int fd;
 
@@ -1997,11 +2030,9 @@ got_traverse_packed_commits(struct got_object_id_queue *traversed_commits,
 			goto done;
 	}
 
-	if (pack->privsep_child == NULL) {
-		err = start_pack_privsep_child(pack, packidx);
-		if (err)
-			goto done;
-	}
+	err = get_pack_privsep_child(repo, pack, packidx);
+	if (err)
+		goto done;
 
 	err = got_privsep_send_commit_traversal_request(
 	    pack->privsep_child->ibuf, commit_id, idx, path);
@@ -2028,3 +2059,53 @@ done:
 	free(changed_commit_id);
 	return err;
 }
+
+const struct got_error *
+got_traverse_packed_history(struct got_traversed_commit_list *commits,
+    int session, struct got_object_id_queue *commit_ids, const char *path,
+    int max_commits, struct got_repository *repo)
+{
+	const struct got_error *err = NULL;
+	struct got_pack *pack = NULL;
+	struct got_packidx *packidx = NULL;
+	struct got_object_qid *qid;
+	char *path_packfile = NULL;
+	int idx;
+
+	/* All commits are expected to be stored in the same pack file. */
+	qid = SIMPLEQ_FIRST(commit_ids);
+	if (qid == NULL)
+		return NULL;
+	err = got_repo_search_packidx(&packidx, &idx, repo, qid->id);
+	if (err) {
+		if (err->code != GOT_ERR_NO_OBJ)
+			return err;
+		return NULL;
+	}
+
+	err = get_packfile_path(&path_packfile, packidx);
+	if (err)
+		return err;
+
+	pack = got_repo_get_cached_pack(repo, path_packfile);
+	if (pack == NULL) {
+		err = got_repo_cache_pack(&pack, repo, path_packfile, packidx);
+		if (err)
+			goto done;
+	}
+
+	err = get_pack_privsep_child(repo, pack, packidx);
+	if (err)
+		goto done;
+
+	err = got_privsep_send_history_traversal_request(
+	    pack->privsep_child->ibuf, session, commit_ids, max_commits, path);
+	if (err)
+		goto done;
+
+	err = got_privsep_recv_traversed_history(commits,
+	    pack->privsep_child->ibuf);
+done:
+	free(path_packfile);
+	return err;
+}
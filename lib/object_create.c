@@ -15,7 +15,9 @@
  */
 
 #include <sys/types.h>
+#include <sys/queue.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 
 #include <ctype.h>
 #include <errno.h>
@@ -28,6 +30,7 @@
 #include <sha1.h>
 #include <unistd.h>
 #include <zlib.h>
+#include <imsg.h>
 
 #include "got_compat.h"
 
@@ -42,22 +45,184 @@
 #include "got_lib_delta.h"
 #include "got_lib_object.h"
 #include "got_lib_object_parse.h"
+#include "got_lib_object_idset.h"
+#include "got_lib_object_cache.h"
+#include "got_lib_privsep.h"
+#include "got_lib_object_create.h"
 #include "got_lib_lockfile.h"
+#include "got_lib_repository.h"
 
 #ifndef nitems
 #define nitems(_a) (sizeof(_a) / sizeof((_a)[0]))
 #endif
 
+/*
+ * While a batch is open, new loose objects stay in temporary files next to
+ * their final location. Publishing the batch renames all of them into place
+ * and, if core.fsyncObjectFiles is set, flushes every affected directory to
+ * disk once instead of once per object.
+ */
+struct got_object_batch_entry {
+	TAILQ_ENTRY(got_object_batch_entry) entry;
+	char *tmppath;
+	char *objpath;
+};
+TAILQ_HEAD(got_object_batch_head, got_object_batch_entry);
+
+struct got_object_batch {
+	struct got_object_batch_head objects;
+	struct got_object_idset *ids;
+	char fanout_dirs[0xff + 1];
+};
+
+static void
+free_object_batch(struct got_object_batch *batch)
+{
+	struct got_object_batch_entry *e;
+
+	while ((e = TAILQ_FIRST(&batch->objects)) != NULL) {
+		TAILQ_REMOVE(&batch->objects, e, entry);
+		free(e->tmppath);
+		free(e->objpath);
+		free(e);
+	}
+	got_object_idset_free(batch->ids);
+	free(batch);
+}
+
+const struct got_error *
+got_object_batch_open(struct got_repository *repo)
+{
+	struct got_object_batch *batch;
+
+	if (repo->object_batch)
+		return got_error_msg(GOT_ERR_NOT_IMPL,
+		    "nested object batches are not supported");
+
+	batch = calloc(1, sizeof(*batch));
+	if (batch == NULL)
+		return got_error_from_errno("calloc");
+	TAILQ_INIT(&batch->objects);
+	batch->ids = got_object_idset_alloc();
+	if (batch->ids == NULL) {
+		free(batch);
+		return got_error_from_errno("got_object_idset_alloc");
+	}
+
+	repo->object_batch = batch;
+	return NULL;
+}
+
+static const struct got_error *
+fsync_path(int dirfd, const char *path, int flags)
+{
+	const struct got_error *err = NULL;
+	int fd;
+
+	fd = openat(dirfd, path, O_RDONLY | O_NOFOLLOW | flags);
+	if (fd == -1)
+		return got_error_from_errno2("open", path);
+	if (fsync(fd) == -1)
+		err = got_error_from_errno2("fsync", path);
+	if (close(fd) == -1 && err == NULL)
+		err = got_error_from_errno2("close", path);
+	return err;
+}
+
+const struct got_error *
+got_object_batch_publish(struct got_repository *repo)
+{
+	const struct got_error *err = NULL;
+	struct got_object_batch *batch = repo->object_batch;
+	struct got_object_batch_entry *e;
+	char *path;
+	int i;
+
+	if (batch == NULL)
+		return NULL;
+
+	if (repo->gitconfig_fsync_object_files) {
+		TAILQ_FOREACH(e, &batch->objects, entry) {
+			err = fsync_path(AT_FDCWD, e->tmppath, 0);
+			if (err)
+				goto done;
+		}
+	}
+
+	TAILQ_FOREACH(e, &batch->objects, entry) {
+		if (rename(e->tmppath, e->objpath) != 0) {
+			err = got_error_from_errno3("rename", e->tmppath,
+			    e->objpath);
+			goto done;
+		}
+		free(e->tmppath);
+		e->tmppath = NULL;
+	}
+
+	if (!repo->gitconfig_fsync_object_files ||
+	    TAILQ_EMPTY(&batch->objects))
+		goto done;
+
+	for (i = 0; i < nitems(batch->fanout_dirs); i++) {
+		if (!batch->fanout_dirs[i])
+			continue;
+		if (asprintf(&path, "%s/%.2x", GOT_OBJECTS_DIR, i) == -1) {
+			err = got_error_from_errno("asprintf");
+			goto done;
+		}
+		err = fsync_path(repo->gitdir_fd, path, O_DIRECTORY);
+		free(path);
+		if (err)
+			goto done;
+	}
+	/* Fan-out directories may have been created by this batch. */
+	err = fsync_path(repo->gitdir_fd, GOT_OBJECTS_DIR, O_DIRECTORY);
+done:
+	if (err) {
+		got_object_batch_abort(repo);
+		return err;
+	}
+	repo->object_batch = NULL;
+	free_object_batch(batch);
+	return NULL;
+}
+
+const struct got_error *
+got_object_batch_abort(struct got_repository *repo)
+{
+	const struct got_error *err = NULL;
+	struct got_object_batch *batch = repo->object_batch;
+	struct got_object_batch_entry *e;
+
+	if (batch == NULL)
+		return NULL;
+
+	TAILQ_FOREACH(e, &batch->objects, entry) {
+		if (e->tmppath && unlink(e->tmppath) != 0 && err == NULL)
+			err = got_error_from_errno2("unlink", e->tmppath);
+	}
+
+	repo->object_batch = NULL;
+	free_object_batch(batch);
+	return err;
+}
+
 static const struct got_error *
 create_object_file(struct got_object_id *id, FILE *content,
     struct got_repository *repo)
 {
 	const struct got_error *err = NULL, *unlock_err = NULL;
+	struct got_object_batch *batch = repo->object_batch;
+	struct got_object_batch_entry *e;
 	char *objpath = NULL, *tmppath = NULL;
 	FILE *tmpfile = NULL;
 	struct got_lockfile *lf = NULL;
 	size_t tmplen = 0;
 
+	/* An object is only written once per batch. */
+	if (batch && got_object_idset_contains(batch->ids, id))
+		return NULL;
+
 	err = got_object_get_path(&objpath, id, repo);
 	if (err)
 		return err;
@@ -84,10 +249,42 @@ create_object_file(struct got_object_id *id, FILE *content,
 		goto done;
 	}
 
-	err = got_deflate_to_file(&tmplen, content, tmpfile);
+	err = got_deflate_to_file(&tmplen, content, tmpfile,
+	    repo->gitconfig_loose_compression);
 	if (err)
 		goto done;
 
+	if (batch) {
+		e = calloc(1, sizeof(*e));
+		if (e == NULL) {
+			err = got_error_from_errno("calloc");
+			goto done;
+		}
+		err = got_object_idset_add(batch->ids, id, NULL);
+		if (err) {
+			free(e);
+			goto done;
+		}
+		e->tmppath = tmppath;
+		e->objpath = objpath;
+		TAILQ_INSERT_TAIL(&batch->objects, e, entry);
+		batch->fanout_dirs[id->sha1[0]] = 1;
+		tmppath = NULL;
+		objpath = NULL;
+		goto done;
+	}
+
+	if (repo->gitconfig_fsync_object_files) {
+		if (fflush(tmpfile) != 0) {
+			err = got_ferror(tmpfile, GOT_ERR_IO);
+			goto done;
+		}
+		if (fsync(fileno(tmpfile)) == -1) {
+			err = got_error_from_errno2("fsync", tmppath);
+			goto done;
+		}
+	}
+
 	err = got_lockfile_lock(&lf, objpath);
 	if (err)
 		goto done;
@@ -120,13 +317,13 @@ got_object_blob_file_create(struct got_object_id **id, FILE **blobfile,
 	char *header = NULL;
 	int fd = -1;
 	struct stat sb;
-	SHA1_CTX sha1_ctx;
+	struct got_sha1_ctx sha1_ctx;
 	size_t headerlen = 0, n;
 
 	*id = NULL;
 	*blobfile = NULL;
 
-	SHA1Init(&sha1_ctx);
+	got_sha1_init(&sha1_ctx);
 
 	fd = open(ondisk_path, O_RDONLY | O_NOFOLLOW);
 	if (fd == -1) {
@@ -148,7 +345,7 @@ got_object_blob_file_create(struct got_object_id **id, FILE **blobfile,
 		goto done;
 	}
 	headerlen = strlen(header) + 1;
-	SHA1Update(&sha1_ctx, header, headerlen);
+	got_sha1_update(&sha1_ctx, header, headerlen);
 
 	*blobfile = got_opentemp();
 	if (*blobfile == NULL) {
@@ -180,7 +377,7 @@ got_object_blob_file_create(struct got_object_id **id, FILE **blobfile,
 		}
 		if (inlen == 0)
 			break; /* EOF */
-		SHA1Update(&sha1_ctx, buf, inlen);
+		got_sha1_update(&sha1_ctx, buf, inlen);
 		n = fwrite(buf, 1, inlen, *blobfile);
 		if (n != inlen) {
 			err = got_ferror(*blobfile, GOT_ERR_IO);
@@ -195,7 +392,7 @@ got_object_blob_file_create(struct got_object_id **id, FILE **blobfile,
 		err = got_error_from_errno("malloc");
 		goto done;
 	}
-	SHA1Final((*id)->sha1, &sha1_ctx);
+	got_sha1_final((*id)->sha1, &sha1_ctx);
 
 	if (fflush(*blobfile) != 0) {
 		err = got_error_from_errno("fflush");
@@ -297,7 +494,7 @@ got_object_tree_create(struct got_object_id **id,
 {
 	const struct got_error *err = NULL;
 	char modebuf[sizeof("100644 ")];
-	SHA1_CTX sha1_ctx;
+	struct got_sha1_ctx sha1_ctx;
 	char *header = NULL;
 	size_t headerlen, len = 0, n;
 	FILE *treefile = NULL;
@@ -308,7 +505,7 @@ got_object_tree_create(struct got_object_id **id,
 
 	*id = NULL;
 
-	SHA1Init(&sha1_ctx);
+	got_sha1_init(&sha1_ctx);
 
 	sorted_entries = calloc(nentries, sizeof(struct got_tree_entry *));
 	if (sorted_entries == NULL)
@@ -334,7 +531,7 @@ got_object_tree_create(struct got_object_id **id,
 		goto done;
 	}
 	headerlen = strlen(header) + 1;
-	SHA1Update(&sha1_ctx, header, headerlen);
+	got_sha1_update(&sha1_ctx, header, headerlen);
 
 	treefile = got_opentemp();
 	if (treefile == NULL) {
@@ -359,7 +556,7 @@ got_object_tree_create(struct got_object_id **id,
 			err = got_ferror(treefile, GOT_ERR_IO);
 			goto done;
 		}
-		SHA1Update(&sha1_ctx, modebuf, len);
+		got_sha1_update(&sha1_ctx, modebuf, len);
 
 		len = strlen(te->name) + 1; /* must include NUL */
 		n = fwrite(te->name, 1, len, treefile);
@@ -367,7 +564,7 @@ got_object_tree_create(struct got_object_id **id,
 			err = got_ferror(treefile, GOT_ERR_IO);
 			goto done;
 		}
-		SHA1Update(&sha1_ctx, te->name, len);
+		got_sha1_update(&sha1_ctx, te->name, len);
 
 		len = SHA1_DIGEST_LENGTH;
 		n = fwrite(te->id.sha1, 1, len, treefile);
@@ -375,7 +572,7 @@ got_object_tree_create(struct got_object_id **id,
 			err = got_ferror(treefile, GOT_ERR_IO);
 			goto done;
 		}
-		SHA1Update(&sha1_ctx, te->id.sha1, len);
+		got_sha1_update(&sha1_ctx, te->id.sha1, len);
 	}
 
 	*id = malloc(sizeof(**id));
@@ -383,7 +580,7 @@ got_object_tree_create(struct got_object_id **id,
 		err = got_error_from_errno("malloc");
 		goto done;
 	}
-	SHA1Final((*id)->sha1, &sha1_ctx);
+	got_sha1_final((*id)->sha1, &sha1_ctx);
 
 	if (fflush(treefile) != 0) {
 		err = got_error_from_errno("fflush");
@@ -412,7 +609,7 @@ got_object_commit_create(struct got_object_id **id,
     const char *logmsg, struct got_repository *repo)
 {
 	const struct got_error *err = NULL;
-	SHA1_CTX sha1_ctx;
+	struct got_sha1_ctx sha1_ctx;
 	char *header = NULL, *tree_str = NULL;
 	char *author_str = NULL, *committer_str = NULL;
 	char *id_str = NULL;
@@ -423,7 +620,7 @@ got_object_commit_create(struct got_object_id **id,
 
 	*id = NULL;
 
-	SHA1Init(&sha1_ctx);
+	got_sha1_init(&sha1_ctx);
 
 	msg0 = strdup(logmsg);
 	if (msg0 == NULL)
@@ -460,7 +657,7 @@ got_object_commit_create(struct got_object_id **id,
 		goto done;
 	}
 	headerlen = strlen(header) + 1;
-	SHA1Update(&sha1_ctx, header, headerlen);
+	got_sha1_update(&sha1_ctx, header, headerlen);
 
 	commitfile = got_opentemp();
 	if (commitfile == NULL) {
@@ -483,7 +680,7 @@ got_object_commit_create(struct got_object_id **id,
 		goto done;
 	}
 	len = strlen(tree_str);
-	SHA1Update(&sha1_ctx, tree_str, len);
+	got_sha1_update(&sha1_ctx, tree_str, len);
 	n = fwrite(tree_str, 1, len, commitfile);
 	if (n != len) {
 		err = got_ferror(commitfile, GOT_ERR_IO);
@@ -505,7 +702,7 @@ got_object_commit_create(struct got_object_id **id,
 				goto done;
 			}
 			len = strlen(parent_str);
-			SHA1Update(&sha1_ctx, parent_str, len);
+			got_sha1_update(&sha1_ctx, parent_str, len);
 			n = fwrite(parent_str, 1, len, commitfile);
 			if (n != len) {
 				err = got_ferror(commitfile, GOT_ERR_IO);
@@ -517,7 +714,7 @@ got_object_commit_create(struct got_object_id **id,
 	}
 
 	len = strlen(author_str);
-	SHA1Update(&sha1_ctx, author_str, len);
+	got_sha1_update(&sha1_ctx, author_str, len);
 	n = fwrite(author_str, 1, len, commitfile);
 	if (n != len) {
 		err = got_ferror(commitfile, GOT_ERR_IO);
@@ -525,14 +722,14 @@ got_object_commit_create(struct got_object_id **id,
 	}
 
 	len = strlen(committer_str);
-	SHA1Update(&sha1_ctx, committer_str, len);
+	got_sha1_update(&sha1_ctx, committer_str, len);
 	n = fwrite(committer_str, 1, len, commitfile);
 	if (n != len) {
 		err = got_ferror(commitfile, GOT_ERR_IO);
 		goto done;
 	}
 
-	SHA1Update(&sha1_ctx, "\n", 1);
+	got_sha1_update(&sha1_ctx, "\n", 1);
 	n = fwrite("\n", 1, 1, commitfile);
 	if (n != 1) {
 		err = got_ferror(commitfile, GOT_ERR_IO);
@@ -540,14 +737,14 @@ got_object_commit_create(struct got_object_id **id,
 	}
 
 	len = strlen(msg);
-	SHA1Update(&sha1_ctx, msg, len);
+	got_sha1_update(&sha1_ctx, msg, len);
 	n = fwrite(msg, 1, len, commitfile);
 	if (n != len) {
 		err = got_ferror(commitfile, GOT_ERR_IO);
 		goto done;
 	}
 
-	SHA1Update(&sha1_ctx, "\n", 1);
+	got_sha1_update(&sha1_ctx, "\n", 1);
 	n = fwrite("\n", 1, 1, commitfile);
 	if (n != 1) {
 		err = got_ferror(commitfile, GOT_ERR_IO);
@@ -559,7 +756,7 @@ got_object_commit_create(struct got_object_id **id,
 		err = got_error_from_errno("malloc");
 		goto done;
 	}
-	SHA1Final((*id)->sha1, &sha1_ctx);
+	got_sha1_final((*id)->sha1, &sha1_ctx);
 
 	if (fflush(commitfile) != 0) {
 		err = got_error_from_errno("fflush");
@@ -589,7 +786,7 @@ got_object_tag_create(struct got_object_id **id,
     time_t tagger_time, const char *tagmsg, struct got_repository *repo)
 {
 	const struct got_error *err = NULL;
-	SHA1_CTX sha1_ctx;
+	struct got_sha1_ctx sha1_ctx;
 	char *header = NULL;
 	char *tag_str = NULL, *tagger_str = NULL;
 	char *id_str = NULL, *obj_str = NULL, *type_str = NULL;
@@ -601,7 +798,7 @@ got_object_tag_create(struct got_object_id **id,
 
 	*id = NULL;
 
-	SHA1Init(&sha1_ctx);
+	got_sha1_init(&sha1_ctx);
 
 	err = got_object_id_str(&id_str, object_id);
 	if (err)
@@ -667,7 +864,7 @@ got_object_tag_create(struct got_object_id **id,
 	}
 
 	headerlen = strlen(header) + 1;
-	SHA1Update(&sha1_ctx, header, headerlen);
+	got_sha1_update(&sha1_ctx, header, headerlen);
 
 	tagfile = got_opentemp();
 	if (tagfile == NULL) {
@@ -681,14 +878,14 @@ got_object_tag_create(struct got_object_id **id,
 		goto done;
 	}
 	len = strlen(obj_str);
-	SHA1Update(&sha1_ctx, obj_str, len);
+	got_sha1_update(&sha1_ctx, obj_str, len);
 	n = fwrite(obj_str, 1, len, tagfile);
 	if (n != len) {
 		err = got_ferror(tagfile, GOT_ERR_IO);
 		goto done;
 	}
 	len = strlen(type_str);
-	SHA1Update(&sha1_ctx, type_str, len);
+	got_sha1_update(&sha1_ctx, type_str, len);
 	n = fwrite(type_str, 1, len, tagfile);
 	if (n != len) {
 		err = got_ferror(tagfile, GOT_ERR_IO);
@@ -696,7 +893,7 @@ got_object_tag_create(struct got_object_id **id,
 	}
 
 	len = strlen(tag_str);
-	SHA1Update(&sha1_ctx, tag_str, len);
+	got_sha1_update(&sha1_ctx, tag_str, len);
 	n = fwrite(tag_str, 1, len, tagfile);
 	if (n != len) {
 		err = got_ferror(tagfile, GOT_ERR_IO);
@@ -704,14 +901,14 @@ got_object_tag_create(struct got_object_id **id,
 	}
 
 	len = strlen(tagger_str);
-	SHA1Update(&sha1_ctx, tagger_str, len);
+	got_sha1_update(&sha1_ctx, tagger_str, len);
 	n = fwrite(tagger_str, 1, len, tagfile);
 	if (n != len) {
 		err = got_ferror(tagfile, GOT_ERR_IO);
 		goto done;
 	}
 
-	SHA1Update(&sha1_ctx, "\n", 1);
+	got_sha1_update(&sha1_ctx, "\n", 1);
 	n = fwrite("\n", 1, 1, tagfile);
 	if (n != 1) {
 		err = got_ferror(tagfile, GOT_ERR_IO);
@@ -719,14 +916,14 @@ got_object_tag_create(struct got_object_id **id,
 	}
 
 	len = strlen(msg);
-	SHA1Update(&sha1_ctx, msg, len);
+	got_sha1_update(&sha1_ctx, msg, len);
 	n = fwrite(msg, 1, len, tagfile);
 	if (n != len) {
 		err = got_ferror(tagfile, GOT_ERR_IO);
 		goto done;
 	}
 
-	SHA1Update(&sha1_ctx, "\n", 1);
+	got_sha1_update(&sha1_ctx, "\n", 1);
 	n = fwrite("\n", 1, 1, tagfile);
 	if (n != 1) {
 		err = got_ferror(tagfile, GOT_ERR_IO);
@@ -738,7 +935,7 @@ got_object_tag_create(struct got_object_id **id,
 		err = got_error_from_errno("malloc");
 		goto done;
 	}
-	SHA1Final((*id)->sha1, &sha1_ctx);
+	got_sha1_final((*id)->sha1, &sha1_ctx);
 
 	if (fflush(tagfile) != 0) {
 		err = got_error_from_errno("fflush");
@@ -78,9 +78,9 @@ got_object_qid_alloc_partial(struct got_object_qid **qid)
 {
 	const struct got_error *err = NULL;
 
-	*qid = malloc(sizeof(**qid));
+	*qid = calloc(1, sizeof(**qid));
 	if (*qid == NULL)
-		return got_error_from_errno("malloc");
+		return got_error_from_errno("calloc");
 
 	(*qid)->id = malloc(sizeof(*((*qid)->id)));
 	if ((*qid)->id == NULL) {
@@ -150,6 +150,30 @@ got_object_id_queue_free(struct got_object_id_queue *ids)
 	}
 }
 
+void
+got_traversed_commit_free(struct got_traversed_commit *tc)
+{
+	int i;
+
+	got_object_id_queue_free(&tc->parent_ids);
+	for (i = 0; i < tc->npath_ids; i++)
+		free(tc->path_ids[i]);
+	free(tc->path_ids);
+	free(tc);
+}
+
+void
+got_traversed_commit_list_free(struct got_traversed_commit_list *commits)
+{
+	struct got_traversed_commit *tc;
+
+	while (!SIMPLEQ_EMPTY(commits)) {
+		tc = SIMPLEQ_FIRST(commits);
+		SIMPLEQ_REMOVE_HEAD(commits, entry);
+		got_traversed_commit_free(tc);
+	}
+}
+
 const struct got_error *
 got_object_parse_header(struct got_object **obj, char *buf, size_t len)
 {
@@ -253,6 +277,36 @@ done:
 	return err;
 }
 
+const struct got_error *
+got_object_read_header_bounded(struct got_object **obj, int fd)
+{
+	const struct got_error *err;
+	struct got_inflate_buf zb;
+	char buf[GOT_OBJECT_HEADER_MAXLEN];
+	size_t outlen;
+
+	*obj = NULL;
+
+	err = got_inflate_init(&zb, buf, sizeof(buf), NULL);
+	if (err)
+		return err;
+
+	err = got_inflate_read_fd(&zb, fd, &outlen, NULL);
+	if (err)
+		goto done;
+
+	/* Do not read any further if the header does not fit. */
+	if (memchr(buf, '\0', outlen) == NULL) {
+		err = got_error(GOT_ERR_BAD_OBJ_HDR);
+		goto done;
+	}
+
+	err = got_object_parse_header(obj, buf, outlen);
+done:
+	got_inflate_end(&zb);
+	return err;
+}
+
 struct got_commit_object *
 got_object_commit_alloc_partial(void)
 {
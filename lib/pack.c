@@ -53,6 +53,10 @@
 #define	MIN(_a,_b) ((_a) < (_b) ? (_a) : (_b))
 #endif
 
+#ifndef MAX
+#define	MAX(_a,_b) ((_a) > (_b) ? (_a) : (_b))
+#endif
+
 static const struct got_error *
 verify_fanout_table(uint32_t *fanout_table)
 {
@@ -71,13 +75,13 @@ got_packidx_init_hdr(struct got_packidx *p, int verify)
 {
 	const struct got_error *err = NULL;
 	struct got_packidx_v2_hdr *h;
-	SHA1_CTX ctx;
+	struct got_sha1_ctx ctx;
 	uint8_t sha1[SHA1_DIGEST_LENGTH];
 	size_t nobj, len_fanout, len_ids, offset, remain;
 	ssize_t n;
 	int i;
 
-	SHA1Init(&ctx);
+	got_sha1_init(&ctx);
 
 	h = &p->hdr;
 	offset = 0;
@@ -112,7 +116,7 @@ got_packidx_init_hdr(struct got_packidx *p, int verify)
 	remain -= sizeof(*h->magic);
 
 	if (verify)
-		SHA1Update(&ctx, (uint8_t *)h->magic, sizeof(*h->magic));
+		got_sha1_update(&ctx, (uint8_t *)h->magic, sizeof(*h->magic));
 
 	if (remain < sizeof(*h->version)) {
 		err = got_error(GOT_ERR_BAD_PACKIDX);
@@ -143,7 +147,8 @@ got_packidx_init_hdr(struct got_packidx *p, int verify)
 	remain -= sizeof(*h->version);
 
 	if (verify)
-		SHA1Update(&ctx, (uint8_t *)h->version, sizeof(*h->version));
+		got_sha1_update(&ctx, (uint8_t *)h->version,
+		    sizeof(*h->version));
 
 	len_fanout =
 	    sizeof(*h->fanout_table) * GOT_PACKIDX_V2_FANOUT_TABLE_ITEMS;
@@ -172,7 +177,7 @@ got_packidx_init_hdr(struct got_packidx *p, int verify)
 	if (err)
 		goto done;
 	if (verify)
-		SHA1Update(&ctx, (uint8_t *)h->fanout_table, len_fanout);
+		got_sha1_update(&ctx, (uint8_t *)h->fanout_table, len_fanout);
 	offset += len_fanout;
 	remain -= len_fanout;
 
@@ -200,7 +205,7 @@ got_packidx_init_hdr(struct got_packidx *p, int verify)
 		}
 	}
 	if (verify)
-		SHA1Update(&ctx, (uint8_t *)h->sorted_ids, len_ids);
+		got_sha1_update(&ctx, (uint8_t *)h->sorted_ids, len_ids);
 	offset += len_ids;
 	remain -= len_ids;
 
@@ -225,7 +230,8 @@ got_packidx_init_hdr(struct got_packidx *p, int verify)
 		}
 	}
 	if (verify)
-		SHA1Update(&ctx, (uint8_t *)h->crc32, nobj * sizeof(*h->crc32));
+		got_sha1_update(&ctx, (uint8_t *)h->crc32,
+		    nobj * sizeof(*h->crc32));
 	remain -= nobj * sizeof(*h->crc32);
 	offset += nobj * sizeof(*h->crc32);
 
@@ -250,7 +256,7 @@ got_packidx_init_hdr(struct got_packidx *p, int verify)
 		}
 	}
 	if (verify)
-		SHA1Update(&ctx, (uint8_t *)h->offsets,
+		got_sha1_update(&ctx, (uint8_t *)h->offsets,
 		    nobj * sizeof(*h->offsets));
 	remain -= nobj * sizeof(*h->offsets);
 	offset += nobj * sizeof(*h->offsets);
@@ -287,7 +293,7 @@ got_packidx_init_hdr(struct got_packidx *p, int verify)
 		}
 	}
 	if (verify)
-		SHA1Update(&ctx, (uint8_t*)h->large_offsets,
+		got_sha1_update(&ctx, (uint8_t*)h->large_offsets,
 		    p->nlargeobj * sizeof(*h->large_offsets));
 	remain -= p->nlargeobj * sizeof(*h->large_offsets);
 	offset += p->nlargeobj * sizeof(*h->large_offsets);
@@ -315,8 +321,9 @@ checksum:
 		}
 	}
 	if (verify) {
-		SHA1Update(&ctx, h->trailer->packfile_sha1, SHA1_DIGEST_LENGTH);
-		SHA1Final(sha1, &ctx);
+		got_sha1_update(&ctx, h->trailer->packfile_sha1,
+		    SHA1_DIGEST_LENGTH);
+		got_sha1_final(sha1, &ctx);
 		if (memcmp(h->trailer->packidx_sha1, sha1,
 		    SHA1_DIGEST_LENGTH) != 0)
 			err = got_error(GOT_ERR_PACKIDX_CSUM);
@@ -413,8 +420,8 @@ got_packidx_close(struct got_packidx *packidx)
 	return err;
 }
 
-static off_t
-get_object_offset(struct got_packidx *packidx, int idx)
+off_t
+got_packidx_get_object_offset(struct got_packidx *packidx, int idx)
 {
 	uint32_t offset = be32toh(packidx->hdr.offsets[idx]);
 	if (offset & GOT_PACKIDX_OFFSET_VAL_IS_LARGE_IDX) {
@@ -429,72 +436,121 @@ get_object_offset(struct got_packidx *packidx, int idx)
 	return (off_t)(offset & GOT_PACKIDX_OFFSET_VAL_MASK);
 }
 
-int
-got_packidx_get_object_idx(struct got_packidx *packidx, struct got_object_id *id)
+static uint64_t
+sorted_id_key(struct got_packidx *packidx, uint32_t i)
 {
-	u_int8_t id0 = id->sha1[0];
-	uint32_t totobj = be32toh(packidx->hdr.fanout_table[0xff]);
-	int left = 0, right = totobj - 1;
+	uint64_t key;
 
-	if (id0 > 0)
-		left = be32toh(packidx->hdr.fanout_table[id0 - 1]);
+	memcpy(&key, packidx->hdr.sorted_ids[i].sha1, sizeof(key));
+	return be64toh(key);
+}
 
-	while (left <= right) {
-		struct got_packidx_object_id *oid;
-		int i, cmp;
+/*
+ * Search for an object ID among the sorted IDs in the range [lo, hi).
+ * Return the index of the object if found, otherwise -1.
+ *
+ * Because SHA1 hashes are uniformly distributed, the position of an ID
+ * within the range can be estimated from the leading 8 bytes of the IDs
+ * at either end of the range. If such interpolation does not converge
+ * quickly, fall back to binary search.
+ */
+static int
+search_sorted_ids(struct got_packidx *packidx, struct got_object_id *id,
+    uint32_t lo, uint32_t hi)
+{
+	uint64_t key, klo, khi;
+	int nsteps = 0;
+
+	memcpy(&key, id->sha1, sizeof(key));
+	key = be64toh(key);
 
-		i = ((left + right) / 2);
-		oid = &packidx->hdr.sorted_ids[i];
-		cmp = memcmp(id->sha1, oid->sha1, SHA1_DIGEST_LENGTH);
+	while (lo < hi) {
+		uint32_t i;
+		int cmp;
+
+		if (nsteps++ < GOT_PACKIDX_INTERPOLATION_STEPS &&
+		    hi - lo > 2) {
+			klo = sorted_id_key(packidx, lo);
+			khi = sorted_id_key(packidx, hi - 1);
+			if (key < klo || key > khi)
+				return -1;
+			if (khi == klo)
+				i = lo + (hi - lo) / 2;
+			else
+				i = lo + (uint32_t)((double)(key - klo) /
+				    (double)(khi - klo) * (hi - 1 - lo));
+		} else
+			i = lo + (hi - lo) / 2;
+
+		cmp = memcmp(id->sha1, packidx->hdr.sorted_ids[i].sha1,
+		    SHA1_DIGEST_LENGTH);
 		if (cmp == 0)
 			return i;
 		else if (cmp > 0)
-			left = i + 1;
-		else if (cmp < 0)
-			right = i - 1;
+			lo = i + 1;
+		else
+			hi = i;
 	}
 
 	return -1;
 }
 
+/* Get the range of sorted IDs which begin with the given byte. */
+static void
+get_fanout_range(uint32_t *lo, uint32_t *hi, struct got_packidx *packidx,
+    uint8_t id0)
+{
+	*lo = (id0 > 0 ? be32toh(packidx->hdr.fanout_table[id0 - 1]) : 0);
+	*hi = be32toh(packidx->hdr.fanout_table[id0]);
+}
+
+int
+got_packidx_get_object_idx(struct got_packidx *packidx, struct got_object_id *id)
+{
+	uint32_t lo, hi;
+
+	get_fanout_range(&lo, &hi, packidx, id->sha1[0]);
+	return search_sorted_ids(packidx, id, lo, hi);
+}
+
 const struct got_error *
 got_packidx_match_id_str_prefix(struct got_object_id_queue *matched_ids,
     struct got_packidx *packidx, const char *id_str_prefix)
 {
 	const struct got_error *err = NULL;
-	u_int8_t id0;
-	uint32_t totobj = be32toh(packidx->hdr.fanout_table[0xff]);
-	char hex[3];
-	size_t prefix_len = strlen(id_str_prefix);
-	struct got_packidx_object_id *oid;
-	uint32_t i;
+	uint8_t prefix[SHA1_DIGEST_LENGTH];
+	size_t ndigits;
+	uint32_t left = 0, right;
 
 	SIMPLEQ_INIT(matched_ids);
 
-	if (prefix_len < 2)
+	if (strlen(id_str_prefix) < 2 ||
+	    !got_parse_sha1_digest_prefix(prefix, &ndigits, id_str_prefix))
 		return got_error_path(id_str_prefix, GOT_ERR_BAD_OBJ_ID_STR);
 
-	hex[0] = id_str_prefix[0];
-	hex[1] = id_str_prefix[1];
-	hex[2] = '\0';
-	if (!got_parse_xdigit(&id0, hex))
-		return got_error_path(id_str_prefix, GOT_ERR_BAD_OBJ_ID_STR);
+	/*
+	 * Binary search for the first ID in the fanout bucket which
+	 * sorts at or after the prefix. Matching IDs follow it.
+	 */
+	if (prefix[0] > 0)
+		left = be32toh(packidx->hdr.fanout_table[prefix[0] - 1]);
+	right = be32toh(packidx->hdr.fanout_table[prefix[0]]);
+	while (left < right) {
+		uint32_t i = left + (right - left) / 2;
+		if (got_sha1_digest_prefix_cmp(packidx->hdr.sorted_ids[i].sha1,
+		    prefix, ndigits) < 0)
+			left = i + 1;
+		else
+			right = i;
+	}
 
-	i = be32toh(packidx->hdr.fanout_table[id0 - 1]);
-	oid = &packidx->hdr.sorted_ids[i];
-	while (i < totobj && oid->sha1[0] == id0) {
-		char id_str[SHA1_DIGEST_STRING_LENGTH];
+	right = be32toh(packidx->hdr.fanout_table[prefix[0]]);
+	while (left < right) {
+		struct got_packidx_object_id *oid;
 		struct got_object_qid *qid;
-		int cmp;
-
-		if (!got_sha1_digest_to_str(oid->sha1, id_str, sizeof(id_str)))
-		        return got_error(GOT_ERR_NO_SPACE);
 
-		cmp = strncmp(id_str, id_str_prefix, prefix_len);
-		if (cmp < 0) {
-			oid = &packidx->hdr.sorted_ids[++i];
-			continue;
-		} else if (cmp > 0)
+		oid = &packidx->hdr.sorted_ids[left++];
+		if (got_sha1_digest_prefix_cmp(oid->sha1, prefix, ndigits) != 0)
 			break;
 
 		err = got_object_qid_alloc_partial(&qid);
@@ -502,8 +558,6 @@ got_packidx_match_id_str_prefix(struct got_object_id_queue *matched_ids,
 			break;
 		memcpy(qid->id->sha1, oid->sha1, SHA1_DIGEST_LENGTH);
 		SIMPLEQ_INSERT_TAIL(matched_ids, qid, entry);
-
-		oid = &packidx->hdr.sorted_ids[++i];
 	}
 
 	if (err)
@@ -511,33 +565,23 @@ got_packidx_match_id_str_prefix(struct got_object_id_queue *matched_ids,
 	return err;
 }
 
-const struct got_error *
-got_pack_stop_privsep_child(struct got_pack *pack)
-{
-	const struct got_error *err = NULL;
-
-	if (pack->privsep_child == NULL)
-		return NULL;
-
-	err = got_privsep_send_stop(pack->privsep_child->imsg_fd);
-	if (err)
-		return err;
-	err = got_privsep_wait_for_child(pack->privsep_child->pid);
-	if (close(pack->privsep_child->imsg_fd) != 0 && err == NULL)
-		err = got_error_from_errno("close");
-	free(pack->privsep_child);
-	pack->privsep_child = NULL;
-	return err;
-}
-
 const struct got_error *
 got_pack_close(struct got_pack *pack)
 {
 	const struct got_error *err = NULL;
+	int i;
 
-	err = got_pack_stop_privsep_child(pack);
+	/* The got-read-pack child process is owned by the repository. */
+	pack->privsep_child = NULL;
 	if (pack->map && munmap(pack->map, pack->filesize) == -1 && !err)
 		err = got_error_from_errno("munmap");
+	for (i = 0; i < pack->nwindows; i++) {
+		struct got_pack_window *w = &pack->windows[i];
+		if (munmap(w->map, w->len) == -1 && err == NULL)
+			err = got_error_from_errno("munmap");
+	}
+	pack->nwindows = 0;
+	pack->mapped_total = 0;
 	if (pack->fd != -1 && close(pack->fd) != 0 && err == NULL)
 		err = got_error_from_errno("close");
 	pack->fd = -1;
@@ -552,14 +596,248 @@ got_pack_close(struct got_pack *pack)
 	return err;
 }
 
+/*
+ * Set up memory-mapped access to an open pack file. If window_size or
+ * mapped_max are zero, the compile-time defaults are used. If the pack
+ * file cannot be mapped at all, pack file data will be read with read(2).
+ */
+const struct got_error *
+got_pack_init_mmap(struct got_pack *pack, size_t window_size,
+    size_t mapped_max)
+{
+	long pagesize;
+
+	pack->map = NULL;
+	pack->window_size = 0;
+	pack->nwindows = 0;
+	pack->mapped_total = 0;
+	pack->window_lru = 0;
+#ifndef GOT_PACK_NO_MMAP
+	pagesize = sysconf(_SC_PAGESIZE);
+	if (pagesize <= 0)
+		return got_error_from_errno("sysconf");
+	if (window_size == 0)
+		window_size = GOT_PACK_WINDOW_SIZE;
+	if (mapped_max == 0)
+		mapped_max = GOT_PACK_MAPPED_MAX;
+	if (window_size % pagesize)
+		window_size += pagesize - (window_size % pagesize);
+	if (mapped_max < window_size)
+		mapped_max = window_size;
+
+	if (pack->filesize <= mapped_max) {
+		pack->map = mmap(NULL, pack->filesize, PROT_READ, MAP_PRIVATE,
+		    pack->fd, 0);
+		if (pack->map != MAP_FAILED)
+			return NULL;
+		pack->map = NULL;
+		if (errno != ENOMEM)
+			return got_error_from_errno("mmap");
+	}
+
+	/* Fall back to mapping windows of the pack file on demand. */
+	pack->window_size = window_size;
+	pack->mapped_max = mapped_max;
+#endif
+	return NULL;
+}
+
+int
+got_pack_is_mapped(struct got_pack *pack)
+{
+	return (pack->map != NULL || pack->window_size > 0);
+}
+
+static void
+unmap_pack_window(struct got_pack *pack, int idx)
+{
+	struct got_pack_window *w = &pack->windows[idx];
+
+	munmap(w->map, w->len);
+	pack->mapped_total -= w->len;
+	pack->nwindows--;
+	if (idx < pack->nwindows)
+		memmove(&pack->windows[idx], &pack->windows[idx + 1],
+		    (pack->nwindows - idx) * sizeof(pack->windows[0]));
+}
+
+/*
+ * Return a pointer to pack file data at the given offset, along with the
+ * number of bytes which may be accessed through this pointer. At least
+ * minlen bytes will be accessible unless the end of the pack file is
+ * reached first. The pointer remains valid until the next call.
+ * If the requested range cannot be mapped, *p is set to NULL and the
+ * caller must fall back to read(2).
+ */
+static const struct got_error *
+pack_map_range(uint8_t **p, size_t *len, struct got_pack *pack, off_t offset,
+    uint64_t minlen)
+{
+	struct got_pack_window *w;
+	off_t start, end;
+	size_t wlen;
+	uint8_t *map;
+	int i;
+
+	*p = NULL;
+	*len = 0;
+
+	if (offset < 0 || offset >= pack->filesize)
+		return got_error(GOT_ERR_PACK_OFFSET);
+
+	if (pack->map) {
+		*p = pack->map + offset;
+		*len = pack->filesize - offset;
+		return NULL;
+	}
+
+	if (pack->window_size == 0)
+		return NULL;
+
+	if (minlen > pack->filesize - offset)
+		end = pack->filesize;
+	else
+		end = offset + minlen;
+
+	for (i = 0; i < pack->nwindows; i++) {
+		w = &pack->windows[i];
+		if (w->offset <= offset && end <= w->offset + w->len) {
+			w->lru = ++pack->window_lru;
+			*p = w->map + (offset - w->offset);
+			*len = w->len - (offset - w->offset);
+			return NULL;
+		}
+	}
+
+	start = offset - (offset % pack->window_size);
+	if (end - start > pack->mapped_max)
+		return NULL;
+	wlen = MAX(pack->window_size, end - start);
+	if (wlen > pack->filesize - start)
+		wlen = pack->filesize - start;
+
+	/* Evict least recently used windows until the new one fits. */
+	while (pack->nwindows > 0 &&
+	    (pack->nwindows >= GOT_PACK_NUM_WINDOWS ||
+	    pack->mapped_total + wlen > pack->mapped_max)) {
+		int lru_idx = 0;
+		for (i = 1; i < pack->nwindows; i++) {
+			if (pack->windows[i].lru < pack->windows[lru_idx].lru)
+				lru_idx = i;
+		}
+		unmap_pack_window(pack, lru_idx);
+	}
+
+	map = mmap(NULL, wlen, PROT_READ, MAP_PRIVATE, pack->fd, start);
+	if (map == MAP_FAILED)
+		return NULL; /* fall back to read(2) */
+
+	w = &pack->windows[pack->nwindows++];
+	w->map = map;
+	w->offset = start;
+	w->len = wlen;
+	w->lru = ++pack->window_lru;
+	pack->mapped_total += wlen;
+
+	*p = w->map + (offset - start);
+	*len = w->len - (offset - start);
+	return NULL;
+}
+
+/*
+ * Upper bound for the size of a zlib stream which inflates to the given
+ * number of bytes, allowing for incompressible data in stored blocks.
+ */
+static uint64_t
+deflate_bound(uint64_t size)
+{
+	return size + (size >> 8) + 64;
+}
+
+static const struct got_error *
+pack_inflate_to_mem(uint8_t **outbuf, size_t *outlen, struct got_pack *pack,
+    off_t offset, uint64_t size)
+{
+	const struct got_error *err;
+	uint8_t *map;
+	size_t maplen;
+
+	*outbuf = NULL;
+	*outlen = 0;
+
+	if (size >= SIZE_MAX)
+		return got_error(GOT_ERR_NO_SPACE);
+
+	err = pack_map_range(&map, &maplen, pack, offset, deflate_bound(size));
+	if (err)
+		return err;
+
+	/* The pack header tells us how large the result is. */
+	*outbuf = malloc(size > 0 ? size : 1);
+	if (*outbuf == NULL)
+		return got_error_from_errno("malloc");
+
+	if (map) {
+		err = got_inflate_to_buf_mmap(*outbuf, size, NULL, NULL,
+		    map, 0, maplen);
+		/* Retry from disk if the data may extend beyond the window. */
+		if (err == NULL || err->code == GOT_ERR_BAD_OBJ_DATA ||
+		    pack->map || maplen >= deflate_bound(size))
+			goto done;
+	}
+
+	if (lseek(pack->fd, offset, SEEK_SET) == -1) {
+		err = got_error_from_errno("lseek");
+		goto done;
+	}
+	err = got_inflate_to_buf_fd(*outbuf, size, NULL, NULL, pack->fd);
+done:
+	if (err) {
+		free(*outbuf);
+		*outbuf = NULL;
+	} else
+		*outlen = size;
+	return err;
+}
+
+static const struct got_error *
+pack_inflate_to_file(size_t *outlen, struct got_pack *pack, off_t offset,
+    uint64_t size, FILE *outfile)
+{
+	const struct got_error *err;
+	uint8_t *map;
+	size_t maplen;
+
+	*outlen = 0;
+
+	err = pack_map_range(&map, &maplen, pack, offset, deflate_bound(size));
+	if (err)
+		return err;
+	if (map) {
+		err = got_inflate_to_file_mmap(outlen, NULL, NULL, map, 0,
+		    maplen, outfile);
+		if (err || pack->map || *outlen == size)
+			return err;
+		/* Compressed data extends beyond the window. */
+		*outlen = 0;
+		rewind(outfile);
+	}
+
+	if (lseek(pack->fd, offset, SEEK_SET) == -1)
+		return got_error_from_errno("lseek");
+	return got_inflate_to_file_fd(outlen, NULL, NULL, pack->fd, outfile);
+}
+
 const struct got_error *
 got_pack_parse_object_type_and_size(uint8_t *type, uint64_t *size, size_t *len,
     struct got_pack *pack, off_t offset)
 {
+	const struct got_error *err;
 	uint8_t t = 0;
 	uint64_t s = 0;
 	uint8_t sizeN;
-	size_t mapoff = 0;
+	uint8_t *map;
+	size_t maplen, mapoff = 0;
 	int i = 0;
 
 	*len = 0;
@@ -567,9 +845,11 @@ got_pack_parse_object_type_and_size(uint8_t *type, uint64_t *size, size_t *len,
 	if (offset >= pack->filesize)
 		return got_error(GOT_ERR_PACK_OFFSET);
 
-	if (pack->map) {
-		mapoff = (size_t)offset;
-	} else {
+	/* The variable-length size field occupies at most 10 bytes. */
+	err = pack_map_range(&map, &maplen, pack, offset, 10);
+	if (err)
+		return err;
+	if (map == NULL) {
 		if (lseek(pack->fd, offset, SEEK_SET) == -1)
 			return got_error_from_errno("lseek");
 	}
@@ -579,8 +859,10 @@ got_pack_parse_object_type_and_size(uint8_t *type, uint64_t *size, size_t *len,
 		if (i > 9)
 			return got_error(GOT_ERR_NO_SPACE);
 
-		if (pack->map) {
-			sizeN = *(pack->map + mapoff);
+		if (map) {
+			if (mapoff >= maplen)
+				return got_error(GOT_ERR_BAD_PACKFILE);
+			sizeN = *(map + mapoff);
 			mapoff += sizeof(sizeN);
 		} else {
 			ssize_t n = read(pack->fd, &sizeN, sizeof(sizeN));
@@ -630,24 +912,41 @@ static const struct got_error *
 parse_negative_offset(int64_t *offset, size_t *len, struct got_pack *pack,
     off_t delta_offset)
 {
+	const struct got_error *err;
 	int64_t o = 0;
 	uint8_t offN;
+	uint8_t *map = NULL;
+	size_t maplen = 0;
 	int i = 0;
 
 	*offset = 0;
 	*len = 0;
 
+	if (got_pack_is_mapped(pack)) {
+		/* The offset field occupies at most 9 bytes. */
+		err = pack_map_range(&map, &maplen, pack, delta_offset, 9);
+		if (err)
+			return err;
+	}
+
 	do {
 		/* We do not support offset values which don't fit in 64 bit. */
 		if (i > 8)
 			return got_error(GOT_ERR_NO_SPACE);
 
-		if (pack->map) {
-			size_t mapoff;
-			if (delta_offset >= pack->filesize)
+		if (map) {
+			if (*len >= maplen)
 				return got_error(GOT_ERR_PACK_OFFSET);
-			mapoff = (size_t)delta_offset + *len;
-			offN = *(pack->map + mapoff);
+			offN = *(map + *len);
+		} else if (got_pack_is_mapped(pack)) {
+			/* This range could not be mapped; use pread(2). */
+			ssize_t n;
+			n = pread(pack->fd, &offN, sizeof(offN),
+			    delta_offset + *len);
+			if (n < 0)
+				return got_error_from_errno("pread");
+			if (n != sizeof(offN))
+				return got_error(GOT_ERR_BAD_PACKFILE);
 		} else {
 			ssize_t n;
 			n = read(pack->fd, &offN, sizeof(offN));
@@ -698,23 +997,13 @@ got_pack_parse_offset_delta(off_t *base_offset, size_t *len, struct got_pack *pa
 
 static const struct got_error *
 read_delta_data(uint8_t **delta_buf, size_t *delta_len,
-    size_t delta_data_offset, struct got_pack *pack)
+    size_t delta_data_offset, uint64_t delta_size, struct got_pack *pack)
 {
-	const struct got_error *err = NULL;
+	if (delta_data_offset >= pack->filesize)
+		return got_error(GOT_ERR_PACK_OFFSET);
 
-	if (pack->map) {
-		if (delta_data_offset >= pack->filesize)
-			return got_error(GOT_ERR_PACK_OFFSET);
-		err = got_inflate_to_mem_mmap(delta_buf, delta_len,
-		    NULL, NULL, pack->map, delta_data_offset,
-		    pack->filesize - delta_data_offset);
-	} else {
-		if (lseek(pack->fd, delta_data_offset, SEEK_SET) == -1)
-			return got_error_from_errno("lseek");
-		err = got_inflate_to_mem_fd(delta_buf, delta_len, NULL,
-		    NULL, 0, pack->fd);
-	}
-	return err;
+	return pack_inflate_to_mem(delta_buf, delta_len, pack,
+	    delta_data_offset, delta_size);
 }
 
 static const struct got_error *
@@ -756,7 +1045,7 @@ resolve_offset_delta(struct got_delta_chain *deltas,
 	if (delta_data_offset >= pack->filesize)
 		return got_error(GOT_ERR_PACK_OFFSET);
 
-	if (pack->map == NULL) {
+	if (!got_pack_is_mapped(pack)) {
 		delta_data_offset = lseek(pack->fd, 0, SEEK_CUR);
 		if (delta_data_offset == -1)
 			return got_error_from_errno("lseek");
@@ -797,11 +1086,28 @@ resolve_ref_delta(struct got_delta_chain *deltas, struct got_packidx *packidx,
 	if (delta_offset + tslen >= pack->filesize)
 		return got_error(GOT_ERR_PACK_OFFSET);
 
-	if (pack->map) {
-		size_t mapoff = delta_offset + tslen;
-		memcpy(&id, pack->map + mapoff, sizeof(id));
-		mapoff += sizeof(id);
-		delta_data_offset = (off_t)mapoff;
+	if (got_pack_is_mapped(pack)) {
+		uint8_t *map;
+		size_t maplen;
+		err = pack_map_range(&map, &maplen, pack, delta_offset + tslen,
+		    sizeof(id));
+		if (err)
+			return err;
+		if (map) {
+			if (maplen < sizeof(id))
+				return got_error(GOT_ERR_BAD_PACKFILE);
+			memcpy(&id, map, sizeof(id));
+		} else {
+			/* This range could not be mapped; use pread(2). */
+			ssize_t n;
+			n = pread(pack->fd, &id, sizeof(id),
+			    delta_offset + tslen);
+			if (n < 0)
+				return got_error_from_errno("pread");
+			if (n != sizeof(id))
+				return got_error(GOT_ERR_BAD_PACKFILE);
+		}
+		delta_data_offset = delta_offset + tslen + sizeof(id);
 	} else {
 		ssize_t n;
 		n = read(pack->fd, &id, sizeof(id));
@@ -824,7 +1130,7 @@ resolve_ref_delta(struct got_delta_chain *deltas, struct got_packidx *packidx,
 	if (idx == -1)
 		return got_error(GOT_ERR_NO_OBJ);
 
-	base_offset = get_object_offset(packidx, idx);
+	base_offset = got_packidx_get_object_offset(packidx, idx);
 	if (base_offset == (uint64_t)-1)
 		return got_error(GOT_ERR_BAD_PACKIDX);
 
@@ -927,7 +1233,7 @@ got_packfile_open_object(struct got_object **obj, struct got_pack *pack,
 
 	*obj = NULL;
 
-	offset = get_object_offset(packidx, idx);
+	offset = got_packidx_get_object_offset(packidx, idx);
 	if (offset == (uint64_t)-1)
 		return got_error(GOT_ERR_BAD_PACKIDX);
 
@@ -981,7 +1287,7 @@ got_pack_get_delta_chain_max_size(uint64_t *max_size, struct got_delta_chain *de
 			if (delta_buf == NULL) {
 				cached = 0;
 				err = read_delta_data(&delta_buf, &delta_len,
-				    delta->data_offset, pack);
+				    delta->data_offset, delta->size, pack);
 				if (err)
 					return err;
 				err = got_delta_cache_add(pack->delta_cache,
@@ -1020,6 +1326,33 @@ got_pack_get_max_delta_object_size(uint64_t *size, struct got_object *obj,
 	return got_pack_get_delta_chain_max_size(size, &obj->deltas, pack);
 }
 
+/*
+ * Grow a malloc'd delta base buffer to the given size. Large buffers are
+ * replaced with an anonymous memory mapping if want_mmap is set, unless
+ * creating the mapping fails.
+ */
+static const struct got_error *
+grow_base_buf(uint8_t **buf, size_t *bufsz, int *mapped, size_t size,
+    int want_mmap)
+{
+	uint8_t *p = MAP_FAILED;
+
+	if (want_mmap)
+		p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANON, -1, 0);
+	if (p != MAP_FAILED) {
+		free(*buf);
+		*mapped = 1;
+	} else {
+		p = reallocarray(*buf, 1, size);
+		if (p == NULL)
+			return got_error_from_errno("reallocarray");
+	}
+	*buf = p;
+	*bufsz = size;
+	return NULL;
+}
+
 const struct got_error *
 got_pack_dump_delta_chain_to_file(size_t *result_size,
     struct got_delta_chain *deltas, struct got_pack *pack, FILE *outfile,
@@ -1030,7 +1363,7 @@ got_pack_dump_delta_chain_to_file(size_t *result_size,
 	uint8_t *base_buf = NULL, *accum_buf = NULL, *delta_buf;
 	size_t base_bufsz = 0, accum_size = 0, delta_len;
 	uint64_t max_size;
-	int n = 0;
+	int n = 0, accum_mapped = 0, base_mapped = 0, tmp_mapped;
 
 	*result_size = 0;
 
@@ -1047,13 +1380,27 @@ got_pack_dump_delta_chain_to_file(size_t *result_size,
 			return got_error_from_errno("malloc");
 		base_file = NULL;
 		accum_file = NULL;
+	} else if (max_size <= GOT_DELTA_RESULT_SIZE_MAPPED_MAX) {
+		/*
+		 * Large objects are processed in anonymous memory mappings,
+		 * which are returned to the system as soon as we are done.
+		 * Fall back to temporary files if mapping fails.
+		 */
+		accum_buf = mmap(NULL, max_size, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANON, -1, 0);
+		if (accum_buf == MAP_FAILED)
+			accum_buf = NULL;
+		else {
+			accum_mapped = 1;
+			base_file = NULL;
+			accum_file = NULL;
+		}
 	}
 
 	/* Deltas are ordered in ascending order. */
 	SIMPLEQ_FOREACH(delta, &deltas->entries, entry) {
 		int cached = 1;
 		if (n == 0) {
-			size_t mapoff;
 			off_t delta_data_offset;
 
 			/* Plain object types are the delta base. */
@@ -1070,36 +1417,13 @@ got_pack_dump_delta_chain_to_file(size_t *result_size,
 				err = got_error(GOT_ERR_PACK_OFFSET);
 				goto done;
 			}
-			if (pack->map == NULL) {
-				if (lseek(pack->fd, delta_data_offset, SEEK_SET)
-				    == -1) {
-					err = got_error_from_errno("lseek");
-					goto done;
-				}
-			}
-			if (base_file) {
-				if (pack->map) {
-					mapoff = (size_t)delta_data_offset;
-					err = got_inflate_to_file_mmap(
-					    &base_bufsz, NULL, NULL, pack->map,
-					    mapoff, pack->filesize - mapoff,
-					    base_file);
-				} else
-					err = got_inflate_to_file_fd(
-					    &base_bufsz, NULL, NULL, pack->fd,
-					    base_file);
-			} else {
-				if (pack->map) {
-					mapoff = (size_t)delta_data_offset;
-					err = got_inflate_to_mem_mmap(&base_buf,
-					    &base_bufsz, NULL, NULL,
-					    pack->map, mapoff,
-					    pack->filesize - mapoff);
-				} else
-					err = got_inflate_to_mem_fd(&base_buf,
-					    &base_bufsz, NULL, NULL, max_size,
-					    pack->fd);
-			}
+			if (base_file)
+				err = pack_inflate_to_file(&base_bufsz, pack,
+				    delta_data_offset, delta->size, base_file);
+			else
+				err = pack_inflate_to_mem(&base_buf,
+				    &base_bufsz, pack, delta_data_offset,
+				    delta->size);
 			if (err)
 				goto done;
 			n++;
@@ -1113,7 +1437,7 @@ got_pack_dump_delta_chain_to_file(size_t *result_size,
 		if (delta_buf == NULL) {
 			cached = 0;
 			err = read_delta_data(&delta_buf, &delta_len,
-			    delta->data_offset, pack);
+			    delta->data_offset, delta->size, pack);
 			if (err)
 				goto done;
 			err = got_delta_cache_add(pack->delta_cache,
@@ -1153,18 +1477,17 @@ got_pack_dump_delta_chain_to_file(size_t *result_size,
 				 * allocation might have been smaller.
 				 */
 				if (base_bufsz < max_size) {
-					uint8_t *p;
-					p = reallocarray(base_buf, 1, max_size);
-					if (p == NULL) {
-						err = got_error_from_errno(
-						    "reallocarray");
+					err = grow_base_buf(&base_buf,
+					    &base_bufsz, &base_mapped,
+					    max_size, accum_mapped);
+					if (err)
 						goto done;
-					}
-					base_buf = p;
-					base_bufsz = max_size;
 				}
 				accum_buf = base_buf;
 				base_buf = tmp;
+				tmp_mapped = accum_mapped;
+				accum_mapped = base_mapped;
+				base_mapped = tmp_mapped;
 			} else {
 				FILE *tmp = accum_file;
 				accum_file = base_file;
@@ -1176,12 +1499,20 @@ got_pack_dump_delta_chain_to_file(size_t *result_size,
 	}
 
 done:
-	free(base_buf);
+	if (base_mapped) {
+		if (munmap(base_buf, max_size) == -1 && err == NULL)
+			err = got_error_from_errno("munmap");
+	} else
+		free(base_buf);
 	if (accum_buf) {
 		size_t len = fwrite(accum_buf, 1, accum_size, outfile);
-		free(accum_buf);
-		if (len != accum_size)
+		if (len != accum_size && err == NULL)
 			err = got_ferror(outfile, GOT_ERR_IO);
+		if (accum_mapped) {
+			if (munmap(accum_buf, max_size) == -1 && err == NULL)
+				err = got_error_from_errno("munmap");
+		} else
+			free(accum_buf);
 	}
 	rewind(outfile);
 	if (err == NULL)
@@ -1189,6 +1520,143 @@ done:
 	return err;
 }
 
+/*
+ * Compose all deltas in the chain into a single delta against the base
+ * object and apply it in one pass, without materializing intermediate
+ * results. Returns GOT_ERR_NO_SPACE if the composed delta would need too
+ * many instructions, in which case the caller should apply each delta in
+ * turn instead.
+ */
+static const struct got_error *
+dump_composed_delta_chain_to_mem(uint8_t **outbuf, size_t *outlen,
+    struct got_delta_chain *deltas, struct got_pack *pack, uint64_t max_size)
+{
+	const struct got_error *err = NULL;
+	struct got_delta *delta;
+	struct got_delta_ops composed, next, tmp;
+	uint8_t *base_buf = NULL, *accum_buf = NULL;
+	uint8_t **delta_bufs = NULL;
+	size_t *delta_lens = NULL;
+	size_t base_bufsz = 0, accum_size = 0, max_ops;
+	off_t *delta_offsets = NULL;
+	int i, n = 0, nuncached = 0;
+
+	*outbuf = NULL;
+	*outlen = 0;
+
+	memset(&composed, 0, sizeof(composed));
+	max_ops = MAX(max_size / sizeof(struct got_delta_op),
+	    GOT_DELTA_COMPOSE_OPS_MIN);
+
+	/*
+	 * Delta data which is not in the delta cache yet is kept around
+	 * until the composed delta has been applied. Adding it to the
+	 * cache any earlier could evict data our instructions point to.
+	 */
+	delta_bufs = calloc(deltas->nentries, sizeof(*delta_bufs));
+	delta_lens = calloc(deltas->nentries, sizeof(*delta_lens));
+	delta_offsets = calloc(deltas->nentries, sizeof(*delta_offsets));
+	if (delta_bufs == NULL || delta_lens == NULL ||
+	    delta_offsets == NULL) {
+		err = got_error_from_errno("calloc");
+		goto done;
+	}
+
+	/* Deltas are ordered in ascending order. */
+	SIMPLEQ_FOREACH(delta, &deltas->entries, entry) {
+		uint8_t *delta_buf;
+		size_t delta_len;
+
+		if (n == 0) {
+			off_t delta_data_offset;
+
+			/* Plain object types are the delta base. */
+			if (delta->type != GOT_OBJ_TYPE_COMMIT &&
+			    delta->type != GOT_OBJ_TYPE_TREE &&
+			    delta->type != GOT_OBJ_TYPE_BLOB &&
+			    delta->type != GOT_OBJ_TYPE_TAG) {
+				err = got_error(GOT_ERR_BAD_DELTA_CHAIN);
+				goto done;
+			}
+
+			delta_data_offset = delta->offset + delta->tslen;
+			if (delta_data_offset >= pack->filesize) {
+				err = got_error(GOT_ERR_PACK_OFFSET);
+				goto done;
+			}
+			err = pack_inflate_to_mem(&base_buf, &base_bufsz,
+			    pack, delta_data_offset, delta->size);
+			if (err)
+				goto done;
+			n++;
+			continue;
+		}
+
+		got_delta_cache_get(&delta_buf, &delta_len,
+		    pack->delta_cache, delta->data_offset);
+		if (delta_buf == NULL) {
+			err = read_delta_data(&delta_buf, &delta_len,
+			    delta->data_offset, delta->size, pack);
+			if (err)
+				goto done;
+			delta_bufs[nuncached] = delta_buf;
+			delta_lens[nuncached] = delta_len;
+			delta_offsets[nuncached] = delta->data_offset;
+			nuncached++;
+		}
+
+		err = got_delta_ops_parse(&next, delta_buf, delta_len);
+		if (err)
+			goto done;
+		if (n == 1)
+			composed = next;
+		else {
+			err = got_delta_ops_compose(&tmp, &composed, &next,
+			    max_ops);
+			got_delta_ops_free(&next);
+			if (err)
+				goto done;
+			got_delta_ops_free(&composed);
+			composed = tmp;
+		}
+		n++;
+	}
+
+	accum_buf = malloc(composed.result_size > 0 ?
+	    composed.result_size : 1);
+	if (accum_buf == NULL) {
+		err = got_error_from_errno("malloc");
+		goto done;
+	}
+	err = got_delta_ops_apply(base_buf, base_bufsz, &composed,
+	    accum_buf, &accum_size, composed.result_size);
+done:
+	got_delta_ops_free(&composed);
+	free(base_buf);
+	for (i = 0; i < nuncached; i++) {
+		const struct got_error *cache_err;
+		cache_err = got_delta_cache_add(pack->delta_cache,
+		    delta_offsets[i], delta_bufs[i], delta_lens[i]);
+		if (cache_err) {
+			free(delta_bufs[i]);
+			if (cache_err->code != GOT_ERR_NO_SPACE && err == NULL)
+				err = cache_err;
+		}
+	}
+	free(delta_bufs);
+	free(delta_lens);
+	free(delta_offsets);
+	if (err) {
+		free(accum_buf);
+		*outbuf = NULL;
+		*outlen = 0;
+	} else {
+		*outbuf = accum_buf;
+		*outlen = accum_size;
+	}
+	return err;
+}
+
 const struct got_error *
 got_pack_dump_delta_chain_to_mem(uint8_t **outbuf, size_t *outlen,
     struct got_delta_chain *deltas, struct got_pack *pack)
@@ -1209,6 +1677,15 @@ got_pack_dump_delta_chain_to_mem(uint8_t **outbuf, size_t *outlen,
 	err = got_pack_get_delta_chain_max_size(&max_size, deltas, pack);
 	if (err)
 		return err;
+
+	if (deltas->nentries > 2) {
+		err = dump_composed_delta_chain_to_mem(outbuf, outlen, deltas,
+		    pack, max_size);
+		if (err == NULL || err->code != GOT_ERR_NO_SPACE)
+			return err;
+		err = NULL;
+	}
+
 	accum_buf = malloc(max_size);
 	if (accum_buf == NULL)
 		return got_error_from_errno("malloc");
@@ -1233,21 +1710,8 @@ got_pack_dump_delta_chain_to_mem(uint8_t **outbuf, size_t *outlen,
 				err = got_error(GOT_ERR_PACK_OFFSET);
 				goto done;
 			}
-			if (pack->map) {
-				size_t mapoff = (size_t)delta_data_offset;
-				err = got_inflate_to_mem_mmap(&base_buf,
-				    &base_bufsz, NULL, NULL, pack->map,
-				    mapoff, pack->filesize - mapoff);
-			} else {
-				if (lseek(pack->fd, delta_data_offset, SEEK_SET)
-				    == -1) {
-					err = got_error_from_errno("lseek");
-					goto done;
-				}
-				err = got_inflate_to_mem_fd(&base_buf,
-				    &base_bufsz, NULL, NULL, max_size,
-				    pack->fd);
-			}
+			err = pack_inflate_to_mem(&base_buf, &base_bufsz,
+			    pack, delta_data_offset, delta->size);
 			if (err)
 				goto done;
 			n++;
@@ -1259,7 +1723,7 @@ got_pack_dump_delta_chain_to_mem(uint8_t **outbuf, size_t *outlen,
 		if (delta_buf == NULL) {
 			cached = 0;
 			err = read_delta_data(&delta_buf, &delta_len,
-			    delta->data_offset, pack);
+			    delta->data_offset, delta->size, pack);
 			if (err)
 				goto done;
 			err = got_delta_cache_add(pack->delta_cache,
@@ -1330,17 +1794,8 @@ got_packfile_extract_object(struct got_pack *pack, struct got_object *obj,
 		if (obj->pack_offset >= pack->filesize)
 			return got_error(GOT_ERR_PACK_OFFSET);
 
-		if (pack->map) {
-			size_t mapoff = (size_t)obj->pack_offset;
-			err = got_inflate_to_file_mmap(&obj->size, NULL, NULL,
-			    pack->map, mapoff, pack->filesize - mapoff,
-			    outfile);
-		} else {
-			if (lseek(pack->fd, obj->pack_offset, SEEK_SET) == -1)
-				return got_error_from_errno("lseek");
-			err = got_inflate_to_file_fd(&obj->size, NULL, NULL,
-			    pack->fd, outfile);
-		}
+		err = pack_inflate_to_file(&obj->size, pack, obj->pack_offset,
+		    obj->size, outfile);
 	} else
 		err = got_pack_dump_delta_chain_to_file(&obj->size,
 		    &obj->deltas, pack, outfile, base_file, accum_file);
@@ -1360,16 +1815,8 @@ got_packfile_extract_object_to_mem(uint8_t **buf, size_t *len,
 	if ((obj->flags & GOT_OBJ_FLAG_DELTIFIED) == 0) {
 		if (obj->pack_offset >= pack->filesize)
 			return got_error(GOT_ERR_PACK_OFFSET);
-		if (pack->map) {
-			size_t mapoff = (size_t)obj->pack_offset;
-			err = got_inflate_to_mem_mmap(buf, len, NULL, NULL,
-			    pack->map, mapoff, pack->filesize - mapoff);
-		} else {
-			if (lseek(pack->fd, obj->pack_offset, SEEK_SET) == -1)
-				return got_error_from_errno("lseek");
-			err = got_inflate_to_mem_fd(buf, len, NULL, NULL,
-			    obj->size, pack->fd);
-		}
+		err = pack_inflate_to_mem(buf, len, pack, obj->pack_offset,
+		    obj->size);
 	} else
 		err = got_pack_dump_delta_chain_to_mem(buf, len, &obj->deltas,
 		    pack);
@@ -16,6 +16,8 @@
  */
 
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
 #include <sys/uio.h>
 #include <sys/wait.h>
 
@@ -25,6 +27,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <stdint.h>
 #include <poll.h>
 #include <sha1.h>
@@ -1586,44 +1590,268 @@ got_privsep_recv_tag(struct got_tag_object **tag, struct imsgbuf *ibuf)
 	return err;
 }
 
+void
+got_privsep_pack_slots_init(struct got_privsep_pack_slots *slots)
+{
+	memset(slots, 0, sizeof(*slots));
+	slots->current = -1;
+}
+
+void
+got_privsep_pack_slots_free(struct got_privsep_pack_slots *slots)
+{
+	int i;
+
+	for (i = 0; i < nitems(slots->paths); i++)
+		free(slots->paths[i]);
+	got_privsep_pack_slots_init(slots);
+}
+
+/*
+ * Make a got-read-pack process read from the given pack file if it has
+ * the pack file open already. Otherwise set *selected to zero, and the
+ * caller must pass the pack file with got_privsep_init_pack_child().
+ */
+const struct got_error *
+got_privsep_select_pack(int *selected, struct imsgbuf *ibuf,
+    struct got_privsep_pack_slots *slots, const char *path_packfile)
+{
+	struct got_imsg_pack_select isel;
+	int i;
+
+	*selected = 0;
+
+	for (i = 0; i < nitems(slots->paths); i++) {
+		if (slots->paths[i] &&
+		    strcmp(slots->paths[i], path_packfile) == 0)
+			break;
+	}
+	if (i == nitems(slots->paths))
+		return NULL;
+
+	slots->lru[i] = ++slots->lru_counter;
+	*selected = 1;
+	if (slots->current == i)
+		return NULL;
+
+	isel.slot = i;
+	if (imsg_compose(ibuf, GOT_IMSG_PACK_SELECT, 0, 0, -1, &isel,
+	    sizeof(isel)) == -1)
+		return got_error_from_errno("imsg_compose PACK_SELECT");
+	slots->current = i;
+	return flush_imsg(ibuf);
+}
+
+/*
+ * Pass a pack file and its pack index to a got-read-pack process, which
+ * keeps them open in a free slot or in place of the least recently used
+ * pack file, and reads from them until another pack file is selected.
+ */
 const struct got_error *
-got_privsep_init_pack_child(struct imsgbuf *ibuf, struct got_pack *pack,
+got_privsep_init_pack_child(struct imsgbuf *ibuf,
+    struct got_privsep_pack_slots *slots, struct got_pack *pack,
     struct got_packidx *packidx)
 {
 	const struct got_error *err = NULL;
 	struct got_imsg_packidx ipackidx;
 	struct got_imsg_pack ipack;
-	int fd;
+	char *path;
+	int fd, i, slot = 0;
+
+	for (i = 0; i < nitems(slots->paths); i++) {
+		if (slots->paths[i] == NULL) {
+			slot = i;
+			break;
+		}
+		if (slots->lru[i] < slots->lru[slot])
+			slot = i;
+	}
+
+	path = strdup(pack->path_packfile);
+	if (path == NULL)
+		return got_error_from_errno("strdup");
 
+	/* The child closes whatever it had open in this slot. */
+	free(slots->paths[slot]);
+	slots->paths[slot] = NULL;
+	slots->current = -1;
+
+	memset(&ipackidx, 0, sizeof(ipackidx));
 	ipackidx.len = packidx->len;
+	ipackidx.slot = slot;
 	fd = dup(packidx->fd);
-	if (fd == -1)
-		return got_error_from_errno("dup");
+	if (fd == -1) {
+		err = got_error_from_errno("dup");
+		goto done;
+	}
 
 	if (imsg_compose(ibuf, GOT_IMSG_PACKIDX, 0, 0, fd, &ipackidx,
 	    sizeof(ipackidx)) == -1) {
 		err = got_error_from_errno("imsg_compose PACKIDX");
 		close(fd);
-		return err;
+		goto done;
 	}
 
+	memset(&ipack, 0, sizeof(ipack));
 	if (strlcpy(ipack.path_packfile, pack->path_packfile,
-	    sizeof(ipack.path_packfile)) >= sizeof(ipack.path_packfile))
-		return got_error(GOT_ERR_NO_SPACE);
+	    sizeof(ipack.path_packfile)) >= sizeof(ipack.path_packfile)) {
+		err = got_error(GOT_ERR_NO_SPACE);
+		goto done;
+	}
 	ipack.filesize = pack->filesize;
+	ipack.slot = slot;
 
 	fd = dup(pack->fd);
-	if (fd == -1)
-		return got_error_from_errno("dup");
+	if (fd == -1) {
+		err = got_error_from_errno("dup");
+		goto done;
+	}
 
 	if (imsg_compose(ibuf, GOT_IMSG_PACK, 0, 0, fd, &ipack, sizeof(ipack))
 	    == -1) {
 		err = got_error_from_errno("imsg_compose PACK");
 		close(fd);
+		goto done;
+	}
+
+	err = flush_imsg(ibuf);
+done:
+	if (err)
+		free(path);
+	else {
+		slots->paths[slot] = path;
+		slots->lru[slot] = ++slots->lru_counter;
+		slots->current = slot;
+	}
+	return err;
+}
+
+/* Start a got-read-pack process for the repository at the given path. */
+const struct got_error *
+got_privsep_pack_worker_start(struct got_privsep_pack_worker *worker,
+    const char *repo_path)
+{
+	const struct got_error *err = NULL;
+	int imsg_fds[2];
+	pid_t pid;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, PF_UNSPEC, imsg_fds) == -1)
+		return got_error_from_errno("socketpair");
+
+	pid = fork();
+	if (pid == -1) {
+		err = got_error_from_errno("fork");
+		close(imsg_fds[0]);
+		close(imsg_fds[1]);
 		return err;
+	} else if (pid == 0) {
+		got_privsep_exec_child(imsg_fds, GOT_PATH_PROG_READ_PACK,
+		    repo_path);
+		/* not reached */
 	}
 
-	return flush_imsg(ibuf);
+	if (close(imsg_fds[1]) != 0) {
+		err = got_error_from_errno("close");
+		close(imsg_fds[0]);
+		return err;
+	}
+	worker->pid = pid;
+	worker->imsg_fd = imsg_fds[0];
+	imsg_init(&worker->ibuf, worker->imsg_fd);
+	got_privsep_pack_slots_init(&worker->pack_slots);
+	return NULL;
+}
+
+/*
+ * Stop a got-read-pack process. A busy process is killed since it would
+ * not read the stop message before sending its reply.
+ */
+const struct got_error *
+got_privsep_pack_worker_stop(struct got_privsep_pack_worker *worker,
+    int busy)
+{
+	const struct got_error *err = NULL, *child_err;
+
+	if (busy) {
+		kill(worker->pid, SIGTERM);
+		got_privsep_wait_for_child(worker->pid);
+	} else {
+		err = got_privsep_send_stop(worker->imsg_fd);
+		child_err = got_privsep_wait_for_child(worker->pid);
+		if (child_err && err == NULL)
+			err = child_err;
+	}
+	imsg_clear(&worker->ibuf);
+	if (close(worker->imsg_fd) != 0 && err == NULL)
+		err = got_error_from_errno("close");
+	worker->imsg_fd = -1;
+	got_privsep_pack_slots_free(&worker->pack_slots);
+	return err;
+}
+
+/* Return non-zero if a got-read-pack process is reading the given pack. */
+int
+got_privsep_pack_worker_reads(struct got_privsep_pack_worker *worker,
+    const char *path_packfile)
+{
+	struct got_privsep_pack_slots *slots = &worker->pack_slots;
+
+	if (worker->imsg_fd == -1 || slots->current == -1)
+		return 0;
+	return strcmp(slots->paths[slots->current], path_packfile) == 0;
+}
+
+/*
+ * Switch a got-read-pack process to another pack. Unless the process has
+ * this pack open already, send it its own file descriptors for the pack
+ * and pack index, opened relative to the repository's directory.
+ * Descriptors obtained with dup(2) would share their file offset with
+ * other got-read-pack processes which read from the same pack.
+ */
+const struct got_error *
+got_privsep_pack_worker_switch(struct got_privsep_pack_worker *worker,
+    int repo_fd, const char *path_packfile, struct got_packidx *packidx0)
+{
+	const struct got_error *err = NULL;
+	struct got_pack pack;
+	struct got_packidx packidx;
+	struct stat sb;
+	int selected;
+
+	err = got_privsep_select_pack(&selected, &worker->ibuf,
+	    &worker->pack_slots, path_packfile);
+	if (err || selected)
+		return err;
+
+	memset(&pack, 0, sizeof(pack));
+	memcpy(&packidx, packidx0, sizeof(packidx));
+	pack.path_packfile = (char *)path_packfile;
+
+	pack.fd = openat(repo_fd, path_packfile, O_RDONLY | O_NOFOLLOW);
+	if (pack.fd == -1)
+		return got_error_from_errno2("openat", path_packfile);
+	if (fstat(pack.fd, &sb) == -1) {
+		err = got_error_from_errno2("fstat", path_packfile);
+		close(pack.fd);
+		return err;
+	}
+	pack.filesize = sb.st_size;
+
+	packidx.fd = openat(repo_fd, packidx.path_packidx,
+	    O_RDONLY | O_NOFOLLOW);
+	if (packidx.fd == -1) {
+		err = got_error_from_errno2("openat", packidx.path_packidx);
+		close(pack.fd);
+		return err;
+	}
+
+	err = got_privsep_init_pack_child(&worker->ibuf, &worker->pack_slots,
+	    &pack, &packidx);
+	if (close(pack.fd) != 0 && err == NULL)
+		err = got_error_from_errno("close");
+	if (close(packidx.fd) != 0 && err == NULL)
+		err = got_error_from_errno("close");
+	return err;
 }
 
 const struct got_error *
@@ -1728,6 +1956,30 @@ got_privsep_send_gitconfig_owner_req(struct imsgbuf *ibuf)
 	return flush_imsg(ibuf);
 }
 
+const struct got_error *
+got_privsep_send_gitconfig_loose_compression_req(struct imsgbuf *ibuf)
+{
+	if (imsg_compose(ibuf,
+	    GOT_IMSG_GITCONFIG_LOOSE_COMPRESSION_REQUEST, 0, 0, -1,
+	    NULL, 0) == -1)
+		return got_error_from_errno("imsg_compose "
+		    "GITCONFIG_LOOSE_COMPRESSION_REQUEST");
+
+	return flush_imsg(ibuf);
+}
+
+const struct got_error *
+got_privsep_send_gitconfig_fsync_object_files_req(struct imsgbuf *ibuf)
+{
+	if (imsg_compose(ibuf,
+	    GOT_IMSG_GITCONFIG_FSYNC_OBJECT_FILES_REQUEST, 0, 0, -1,
+	    NULL, 0) == -1)
+		return got_error_from_errno("imsg_compose "
+		    "GITCONFIG_FSYNC_OBJECT_FILES_REQUEST");
+
+	return flush_imsg(ibuf);
+}
+
 const struct got_error *
 got_privsep_recv_gitconfig_str(char **str, struct imsgbuf *ibuf)
 {
@@ -2252,6 +2504,383 @@ got_privsep_recv_traversed_commits(struct got_commit_object **changed_commit,
 	return err;
 }
 
+const struct got_error *
+got_privsep_send_history_traversal_request(struct imsgbuf *ibuf,
+    int session, struct got_object_id_queue *ids, int max_commits,
+    const char *path)
+{
+	const struct got_error *err = NULL;
+	struct got_imsg_history_traversal_request ireq;
+	struct got_object_qid *qid;
+	struct ibuf *wbuf;
+	size_t path_len = strlen(path) + 1;
+
+	memset(&ireq, 0, sizeof(ireq));
+	ireq.session = session;
+	ireq.max_commits = max_commits;
+	SIMPLEQ_FOREACH(qid, ids, entry)
+		ireq.nids++;
+
+	if (sizeof(ireq) + ireq.nids * SHA1_DIGEST_LENGTH + path_len >
+	    MAX_IMSGSIZE - IMSG_HEADER_SIZE)
+		return got_error(GOT_ERR_NO_SPACE);
+
+	wbuf = imsg_create(ibuf, GOT_IMSG_HISTORY_TRAVERSAL_REQUEST, 0, 0,
+	    sizeof(ireq) + ireq.nids * SHA1_DIGEST_LENGTH + path_len);
+	if (wbuf == NULL)
+		return got_error_from_errno(
+		    "imsg_create HISTORY_TRAVERSAL_REQUEST");
+	if (imsg_add(wbuf, &ireq, sizeof(ireq)) == -1) {
+		err = got_error_from_errno(
+		    "imsg_add HISTORY_TRAVERSAL_REQUEST");
+		ibuf_free(wbuf);
+		return err;
+	}
+	SIMPLEQ_FOREACH(qid, ids, entry) {
+		if (imsg_add(wbuf, qid->id->sha1, SHA1_DIGEST_LENGTH) == -1) {
+			err = got_error_from_errno(
+			    "imsg_add HISTORY_TRAVERSAL_REQUEST");
+			ibuf_free(wbuf);
+			return err;
+		}
+	}
+	if (imsg_add(wbuf, path, path_len) == -1) {
+		err = got_error_from_errno(
+		    "imsg_add HISTORY_TRAVERSAL_REQUEST");
+		ibuf_free(wbuf);
+		return err;
+	}
+
+	wbuf->fd = -1;
+	imsg_close(ibuf, wbuf);
+
+	return flush_imsg(ibuf);
+}
+
+static const struct got_error *
+recv_traversed_history(struct got_traversed_commit_list *commits,
+    struct imsg *imsg, size_t datalen)
+{
+	const struct got_error *err = NULL;
+	struct got_imsg_traversed_history ihist;
+	struct got_imsg_traversed_commit icommit;
+	struct got_imsg_traversed_path_id ipath;
+	uint8_t *p = imsg->data;
+	size_t remain = datalen;
+	int i, j;
+
+	if (remain < sizeof(ihist))
+		return got_error(GOT_ERR_PRIVSEP_LEN);
+	memcpy(&ihist, p, sizeof(ihist));
+	p += sizeof(ihist);
+	remain -= sizeof(ihist);
+
+	for (i = 0; i < ihist.ncommits; i++) {
+		struct got_traversed_commit *tc;
+
+		if (remain < sizeof(icommit))
+			return got_error(GOT_ERR_PRIVSEP_LEN);
+		memcpy(&icommit, p, sizeof(icommit));
+		p += sizeof(icommit);
+		remain -= sizeof(icommit);
+		if (icommit.nparents < 0 ||
+		    remain < (size_t)icommit.nparents * SHA1_DIGEST_LENGTH)
+			return got_error(GOT_ERR_PRIVSEP_LEN);
+
+		tc = calloc(1, sizeof(*tc));
+		if (tc == NULL)
+			return got_error_from_errno("calloc");
+		memcpy(tc->id.sha1, icommit.id, SHA1_DIGEST_LENGTH);
+		tc->committer_time = icommit.committer_time;
+		tc->changed = icommit.changed;
+		SIMPLEQ_INIT(&tc->parent_ids);
+		SIMPLEQ_INSERT_TAIL(commits, tc, entry);
+
+		for (j = 0; j < icommit.nparents; j++) {
+			struct got_object_qid *qid;
+
+			err = got_object_qid_alloc_partial(&qid);
+			if (err)
+				return err;
+			memcpy(qid->id->sha1, p, SHA1_DIGEST_LENGTH);
+			SIMPLEQ_INSERT_TAIL(&tc->parent_ids, qid, entry);
+			tc->nparents++;
+			p += SHA1_DIGEST_LENGTH;
+			remain -= SHA1_DIGEST_LENGTH;
+		}
+
+		if (icommit.npath_ids == 0)
+			continue;
+		if (icommit.npath_ids != icommit.nparents + 1 ||
+		    remain < (size_t)icommit.npath_ids * sizeof(ipath))
+			return got_error(GOT_ERR_PRIVSEP_LEN);
+		tc->path_ids = calloc(icommit.npath_ids,
+		    sizeof(*tc->path_ids));
+		if (tc->path_ids == NULL)
+			return got_error_from_errno("calloc");
+		tc->npath_ids = icommit.npath_ids;
+		for (j = 0; j < icommit.npath_ids; j++) {
+			memcpy(&ipath, p, sizeof(ipath));
+			p += sizeof(ipath);
+			remain -= sizeof(ipath);
+			if (!ipath.found)
+				continue;
+			tc->path_ids[j] = calloc(1, sizeof(*tc->path_ids[j]));
+			if (tc->path_ids[j] == NULL)
+				return got_error_from_errno("calloc");
+			memcpy(tc->path_ids[j]->sha1, ipath.id,
+			    SHA1_DIGEST_LENGTH);
+		}
+	}
+
+	if (remain != 0)
+		return got_error(GOT_ERR_PRIVSEP_LEN);
+	return NULL;
+}
+
+const struct got_error *
+got_privsep_recv_traversed_history(struct got_traversed_commit_list *commits,
+    struct imsgbuf *ibuf)
+{
+	const struct got_error *err = NULL;
+	struct imsg imsg;
+	size_t datalen;
+	int done = 0;
+
+	while (!done) {
+		err = got_privsep_recv_imsg(&imsg, ibuf, 0);
+		if (err)
+			break;
+
+		datalen = imsg.hdr.len - IMSG_HEADER_SIZE;
+		switch (imsg.hdr.type) {
+		case GOT_IMSG_TRAVERSED_HISTORY:
+			err = recv_traversed_history(commits, &imsg, datalen);
+			break;
+		case GOT_IMSG_COMMIT_TRAVERSAL_DONE:
+			done = 1;
+			break;
+		default:
+			err = got_error(GOT_ERR_PRIVSEP_MSG);
+			break;
+		}
+
+		imsg_free(&imsg);
+		if (err)
+			break;
+	}
+
+	if (err)
+		got_traversed_commit_list_free(commits);
+	return err;
+}
+
+const struct got_error *
+got_privsep_send_pack_verify_req(struct imsgbuf *ibuf, off_t start, off_t end,
+    int checksum)
+{
+	struct got_imsg_pack_verify_request ireq;
+
+	memset(&ireq, 0, sizeof(ireq));
+	ireq.start = start;
+	ireq.end = end;
+	ireq.checksum = checksum;
+
+	if (imsg_compose(ibuf, GOT_IMSG_PACK_VERIFY_REQUEST, 0, 0, -1,
+	    &ireq, sizeof(ireq)) == -1)
+		return got_error_from_errno("imsg_compose "
+		    "PACK_VERIFY_REQUEST");
+
+	return flush_imsg(ibuf);
+}
+
+/*
+ * Problems are queued and get flushed along with the message which
+ * concludes a verification request.
+ */
+const struct got_error *
+got_privsep_send_pack_verify_problem(struct imsgbuf *ibuf,
+    struct got_object_id *id, off_t offset, int problem)
+{
+	struct got_imsg_pack_verify_problem iprob;
+
+	memset(&iprob, 0, sizeof(iprob));
+	if (id)
+		memcpy(iprob.id, id->sha1, sizeof(iprob.id));
+	iprob.offset = offset;
+	iprob.problem = problem;
+
+	if (imsg_compose(ibuf, GOT_IMSG_PACK_VERIFY_PROBLEM, 0, 0, -1,
+	    &iprob, sizeof(iprob)) == -1)
+		return got_error_from_errno("imsg_compose "
+		    "PACK_VERIFY_PROBLEM");
+
+	return NULL;
+}
+
+const struct got_error *
+got_privsep_send_pack_verify_done(struct imsgbuf *ibuf, int nobjects)
+{
+	struct got_imsg_pack_verify_done idone;
+
+	idone.nobjects = nobjects;
+
+	if (imsg_compose(ibuf, GOT_IMSG_PACK_VERIFY_DONE, 0, 0, -1,
+	    &idone, sizeof(idone)) == -1)
+		return got_error_from_errno("imsg_compose PACK_VERIFY_DONE");
+
+	return flush_imsg(ibuf);
+}
+
+const struct got_error *
+got_privsep_recv_pack_verify_result(
+    struct got_imsg_pack_verify_problem **problems, int *nproblems,
+    int *nobjects, struct imsgbuf *ibuf)
+{
+	const struct got_error *err = NULL;
+	struct got_imsg_pack_verify_problem *p;
+	struct got_imsg_pack_verify_done idone;
+	struct imsg imsg;
+	size_t datalen;
+	int done = 0, nalloc = 0;
+
+	*problems = NULL;
+	*nproblems = 0;
+	*nobjects = 0;
+
+	while (!done) {
+		err = got_privsep_recv_imsg(&imsg, ibuf, 0);
+		if (err)
+			break;
+
+		datalen = imsg.hdr.len - IMSG_HEADER_SIZE;
+		switch (imsg.hdr.type) {
+		case GOT_IMSG_PACK_VERIFY_PROBLEM:
+			if (datalen != sizeof(**problems)) {
+				err = got_error(GOT_ERR_PRIVSEP_LEN);
+				break;
+			}
+			if (*nproblems == nalloc) {
+				nalloc = nalloc ? nalloc * 2 : 16;
+				p = reallocarray(*problems, nalloc,
+				    sizeof(**problems));
+				if (p == NULL) {
+					err = got_error_from_errno(
+					    "reallocarray");
+					break;
+				}
+				*problems = p;
+			}
+			memcpy(&(*problems)[(*nproblems)++], imsg.data,
+			    sizeof(**problems));
+			break;
+		case GOT_IMSG_PACK_VERIFY_DONE:
+			if (datalen != sizeof(idone)) {
+				err = got_error(GOT_ERR_PRIVSEP_LEN);
+				break;
+			}
+			memcpy(&idone, imsg.data, sizeof(idone));
+			*nobjects = idone.nobjects;
+			done = 1;
+			break;
+		default:
+			err = got_error(GOT_ERR_PRIVSEP_MSG);
+			break;
+		}
+
+		imsg_free(&imsg);
+		if (err)
+			break;
+	}
+
+	if (err) {
+		free(*problems);
+		*problems = NULL;
+		*nproblems = 0;
+	}
+	return err;
+}
+
+const struct got_error *
+got_privsep_send_path_changed_req(struct imsgbuf *ibuf,
+    struct got_object_id *id, int idx, const char *path)
+{
+	const struct got_error *err = NULL;
+	struct got_imsg_packed_object iobj;
+	struct ibuf *wbuf;
+	size_t path_len = strlen(path) + 1;
+
+	iobj.idx = idx;
+	memcpy(iobj.id, id->sha1, sizeof(iobj.id));
+
+	wbuf = imsg_create(ibuf, GOT_IMSG_PATH_CHANGED_REQUEST, 0, 0,
+	    sizeof(iobj) + path_len);
+	if (wbuf == NULL)
+		return got_error_from_errno("imsg_create PATH_CHANGED_REQUEST");
+	if (imsg_add(wbuf, &iobj, sizeof(iobj)) == -1) {
+		err = got_error_from_errno("imsg_add PATH_CHANGED_REQUEST");
+		ibuf_free(wbuf);
+		return err;
+	}
+	if (imsg_add(wbuf, path, path_len) == -1) {
+		err = got_error_from_errno("imsg_add PATH_CHANGED_REQUEST");
+		ibuf_free(wbuf);
+		return err;
+	}
+
+	wbuf->fd = -1;
+	imsg_close(ibuf, wbuf);
+
+	return flush_imsg(ibuf);
+}
+
+const struct got_error *
+got_privsep_send_path_changed(struct imsgbuf *ibuf, int changed)
+{
+	struct got_imsg_path_changed ichanged;
+
+	ichanged.changed = changed;
+
+	if (imsg_compose(ibuf, GOT_IMSG_PATH_CHANGED, 0, 0, -1,
+	    &ichanged, sizeof(ichanged)) == -1)
+		return got_error_from_errno("imsg_compose PATH_CHANGED");
+
+	return flush_imsg(ibuf);
+}
+
+const struct got_error *
+got_privsep_recv_path_changed(int *changed, struct imsgbuf *ibuf)
+{
+	const struct got_error *err = NULL;
+	struct got_imsg_path_changed ichanged;
+	struct imsg imsg;
+	size_t datalen;
+
+	*changed = -1;
+
+	err = got_privsep_recv_imsg(&imsg, ibuf, 0);
+	if (err)
+		return err;
+
+	datalen = imsg.hdr.len - IMSG_HEADER_SIZE;
+	switch (imsg.hdr.type) {
+	case GOT_IMSG_PATH_CHANGED:
+		if (datalen != sizeof(ichanged)) {
+			err = got_error(GOT_ERR_PRIVSEP_LEN);
+			break;
+		}
+		memcpy(&ichanged, imsg.data, sizeof(ichanged));
+		*changed = ichanged.changed;
+		break;
+	default:
+		err = got_error(GOT_ERR_PRIVSEP_MSG);
+		break;
+	}
+
+	imsg_free(&imsg);
+	return err;
+}
+
 const struct got_error *
 got_privsep_unveil_exec_helpers(void)
 {
@@ -19,6 +19,7 @@
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
 
 #include <ctype.h>
 #include <endian.h>
@@ -49,6 +50,7 @@
 #include "got_object.h"
 
 #include "got_lib_delta.h"
+#include "got_lib_deflate.h"
 #include "got_lib_inflate.h"
 #include "got_lib_object.h"
 #include "got_lib_object_parse.h"
@@ -65,6 +67,10 @@
 #define nitems(_a) (sizeof(_a) / sizeof((_a)[0]))
 #endif
 
+#ifndef MIN
+#define	MIN(_a,_b) ((_a) < (_b) ? (_a) : (_b))
+#endif
+
 const char *
 got_repo_get_path(struct got_repository *repo)
 {
@@ -402,6 +408,7 @@ parse_gitconfig_file(int *gitconfig_repository_format_version,
     char **gitconfig_author_name, char **gitconfig_author_email,
     struct got_remote_repo **remotes, int *nremotes,
     char **gitconfig_owner, char ***extensions, int *nextensions,
+    int *gitconfig_loose_compression, int *gitconfig_fsync_object_files,
     const char *gitconfig_path)
 {
 	const struct got_error *err = NULL, *child_err = NULL;
@@ -423,6 +430,10 @@ parse_gitconfig_file(int *gitconfig_repository_format_version,
 		*nremotes = 0;
 	if (gitconfig_owner)
 		*gitconfig_owner = NULL;
+	if (gitconfig_loose_compression)
+		*gitconfig_loose_compression = GOT_DEFLATE_LEVEL_LOOSE;
+	if (gitconfig_fsync_object_files)
+		*gitconfig_fsync_object_files = 0;
 
 	fd = open(gitconfig_path, O_RDONLY);
 	if (fd == -1) {
@@ -535,6 +546,26 @@ parse_gitconfig_file(int *gitconfig_repository_format_version,
 			goto done;
 	}
 
+	if (gitconfig_loose_compression) {
+		err = got_privsep_send_gitconfig_loose_compression_req(ibuf);
+		if (err)
+			goto done;
+		err = got_privsep_recv_gitconfig_int(
+		    gitconfig_loose_compression, ibuf);
+		if (err)
+			goto done;
+	}
+
+	if (gitconfig_fsync_object_files) {
+		err = got_privsep_send_gitconfig_fsync_object_files_req(ibuf);
+		if (err)
+			goto done;
+		err = got_privsep_recv_gitconfig_int(
+		    gitconfig_fsync_object_files, ibuf);
+		if (err)
+			goto done;
+	}
+
 	imsg_clear(ibuf);
 	err = got_privsep_send_stop(imsg_fds[0]);
 	child_err = got_privsep_wait_for_child(pid);
@@ -563,7 +594,8 @@ read_gitconfig(struct got_repository *repo, const char *global_gitconfig_path)
 		err = parse_gitconfig_file(&dummy_repo_version,
 		    &repo->global_gitconfig_author_name,
 		    &repo->global_gitconfig_author_email,
-		    NULL, NULL, NULL, NULL, NULL, global_gitconfig_path);
+		    NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+		    global_gitconfig_path);
 		if (err)
 			return err;
 	}
@@ -577,7 +609,8 @@ read_gitconfig(struct got_repository *repo, const char *global_gitconfig_path)
 	    &repo->gitconfig_author_name, &repo->gitconfig_author_email,
 	    &repo->gitconfig_remotes, &repo->ngitconfig_remotes,
 	    &repo->gitconfig_owner, &repo->extensions, &repo->nextensions,
-	    repo_gitconfig_path);
+	    &repo->gitconfig_loose_compression,
+	    &repo->gitconfig_fsync_object_files, repo_gitconfig_path);
 	if (err)
 		goto done;
 done:
@@ -600,6 +633,45 @@ read_gotconfig(struct got_repository *repo)
 	return err;
 }
 
+static size_t
+get_pack_cache_size(void)
+{
+	struct rlimit rl;
+	rlim_t n;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl) == -1 ||
+	    rl.rlim_cur == RLIM_INFINITY)
+		return GOT_PACK_CACHE_SIZE_MAX;
+
+	/* Each cache slot may use two file descriptors (pack and index). */
+	n = rl.rlim_cur / 4 / 2;
+	if (n < GOT_PACK_CACHE_SIZE_MIN)
+		return GOT_PACK_CACHE_SIZE_MIN;
+	if (n > GOT_PACK_CACHE_SIZE_MAX)
+		return GOT_PACK_CACHE_SIZE_MAX;
+	return n;
+}
+
+static const struct got_error *
+alloc_pack_caches(struct got_repository *repo)
+{
+	size_t i, size = get_pack_cache_size();
+
+	repo->packidx_cache = calloc(size, sizeof(repo->packidx_cache[0]));
+	if (repo->packidx_cache == NULL)
+		return got_error_from_errno("calloc");
+	repo->packidx_cache_size = size;
+
+	repo->packs = calloc(size, sizeof(repo->packs[0]));
+	if (repo->packs == NULL)
+		return got_error_from_errno("calloc");
+	for (i = 0; i < size; i++)
+		repo->packs[i].fd = -1;
+	repo->pack_cache_size = size;
+
+	return NULL;
+}
+
 /* Supported repository format extensions. */
 static const char *repo_extensions[] = {
 	"noop",			/* Got supports repository format version 1. */
@@ -629,6 +701,11 @@ got_repo_open(struct got_repository **repop, const char *path,
 		    sizeof(repo->privsep_children[0]));
 		repo->privsep_children[i].imsg_fd = -1;
 	}
+	got_privsep_pack_slots_init(&repo->pack_child_slots);
+
+	err = alloc_pack_caches(repo);
+	if (err)
+		goto done;
 
 	err = got_object_cache_init(&repo->objcache,
 	    GOT_OBJECT_CACHE_TYPE_OBJ);
@@ -704,23 +781,38 @@ done:
 	return err;
 }
 
+static void
+free_loose_object_dir(struct got_loose_object_dir *lod)
+{
+	free(lod->ids);
+	memset(lod, 0, sizeof(*lod));
+}
+
 const struct got_error *
 got_repo_close(struct got_repository *repo)
 {
 	const struct got_error *err = NULL, *child_err;
 	size_t i;
 
-	for (i = 0; i < nitems(repo->packidx_cache); i++) {
+	if (repo->object_batch)
+		err = got_object_batch_abort(repo);
+
+	for (i = 0; i < repo->packidx_cache_size; i++) {
 		if (repo->packidx_cache[i] == NULL)
 			break;
 		got_packidx_close(repo->packidx_cache[i]);
 	}
+	free(repo->packidx_cache);
 
-	for (i = 0; i < nitems(repo->packs); i++) {
+	for (i = 0; i < repo->pack_cache_size; i++) {
 		if (repo->packs[i].path_packfile == NULL)
-			break;
+			continue;
 		got_pack_close(&repo->packs[i]);
 	}
+	free(repo->packs);
+
+	for (i = 0; i < nitems(repo->loose_object_dirs); i++)
+		free_loose_object_dir(&repo->loose_object_dirs[i]);
 
 	free(repo->path);
 	free(repo->path_git_dir);
@@ -744,6 +836,7 @@ got_repo_close(struct got_repository *repo)
 		    err == NULL)
 			err = got_error_from_errno("close");
 	}
+	got_privsep_pack_slots_free(&repo->pack_child_slots);
 
 	if (repo->gotconfig)
 		got_gotconfig_free(repo->gotconfig);
@@ -886,6 +979,39 @@ done:
 	return err;
 }
 
+/*
+ * Evict a pack index from a cache which currently holds n entries.
+ * Entries are ordered by recent use; the least recently used entry
+ * which has not been pinned by frequent hits is chosen.
+ */
+static const struct got_error *
+evict_packidx(struct got_repository *repo, size_t n)
+{
+	const struct got_error *err;
+	struct got_packidx *packidx;
+	size_t i, victim = n - 1;
+
+	for (i = n; i > 0; i--) {
+		if (repo->packidx_cache[i - 1]->cache_hits <
+		    GOT_PACK_CACHE_PIN_HITS) {
+			victim = i - 1;
+			break;
+		}
+	}
+
+	packidx = repo->packidx_cache[victim];
+	repo->packidx_cache_mapped -= packidx->len;
+	memmove(&repo->packidx_cache[victim], &repo->packidx_cache[victim + 1],
+	    (n - victim - 1) * sizeof(repo->packidx_cache[0]));
+	repo->packidx_cache[n - 1] = NULL;
+
+	for (i = 0; i < n - 1; i++)
+		repo->packidx_cache[i]->cache_hits /= 2;
+
+	err = got_packidx_close(packidx);
+	return err;
+}
+
 static const struct got_error *
 cache_packidx(struct got_repository *repo, struct got_packidx *packidx,
     const char *path_packidx)
@@ -893,7 +1019,7 @@ cache_packidx(struct got_repository *repo, struct got_packidx *packidx,
 	const struct got_error *err = NULL;
 	size_t i;
 
-	for (i = 0; i < nitems(repo->packidx_cache); i++) {
+	for (i = 0; i < repo->packidx_cache_size; i++) {
 		if (repo->packidx_cache[i] == NULL)
 			break;
 		if (strcmp(repo->packidx_cache[i]->path_packidx,
@@ -901,10 +1027,13 @@ cache_packidx(struct got_repository *repo, struct got_packidx *packidx,
 			return got_error(GOT_ERR_CACHE_DUP_ENTRY);
 		}
 	}
-	if (i == nitems(repo->packidx_cache)) {
-		err = got_packidx_close(repo->packidx_cache[i - 1]);
+	while (i > 0 && (i == repo->packidx_cache_size ||
+	    repo->packidx_cache_mapped + packidx->len >
+	    GOT_PACKIDX_CACHE_MAPPED_MAX)) {
+		err = evict_packidx(repo, i);
 		if (err)
 			return err;
+		i--;
 	}
 
 	/*
@@ -912,15 +1041,16 @@ cache_packidx(struct got_repository *repo, struct got_packidx *packidx,
 	 * be searched first in the future.
 	 */
 	memmove(&repo->packidx_cache[1], &repo->packidx_cache[0],
-	    sizeof(repo->packidx_cache) -
-	    sizeof(repo->packidx_cache[0]));
+	    i * sizeof(repo->packidx_cache[0]));
 	repo->packidx_cache[0] = packidx;
+	repo->packidx_cache_mapped += packidx->len;
+	packidx->cache_hits = 0;
 
 	return NULL;
 }
 
-static int
-is_packidx_filename(const char *name, size_t len)
+int
+got_repo_is_packidx_filename(const char *name, size_t len)
 {
 	if (len != GOT_PACKIDX_NAMELEN)
 		return 0;
@@ -947,12 +1077,13 @@ got_repo_search_packidx(struct got_packidx **packidx, int *idx,
 	int packdir_fd;
 
 	/* Search pack index cache. */
-	for (i = 0; i < nitems(repo->packidx_cache); i++) {
+	for (i = 0; i < repo->packidx_cache_size; i++) {
 		if (repo->packidx_cache[i] == NULL)
 			break;
 		*idx = got_packidx_get_object_idx(repo->packidx_cache[i], id);
 		if (*idx != -1) {
 			*packidx = repo->packidx_cache[i];
+			(*packidx)->cache_hits++;
 			/*
 			 * Move this cache entry to the front. Repeatedly
 			 * searching a wrong pack index can be expensive.
@@ -989,7 +1120,8 @@ got_repo_search_packidx(struct got_packidx **packidx, int *idx,
 	while ((dent = readdir(packdir)) != NULL) {
 		int is_cached = 0;
 
-		if (!is_packidx_filename(dent->d_name, strlen(dent->d_name)))
+		if (!got_repo_is_packidx_filename(dent->d_name,
+		    strlen(dent->d_name)))
 			continue;
 
 		if (asprintf(&path_packidx, "%s/%s", GOT_OBJECTS_PACK_DIR,
@@ -998,7 +1130,7 @@ got_repo_search_packidx(struct got_packidx **packidx, int *idx,
 			goto done;
 		}
 
-		for (i = 0; i < nitems(repo->packidx_cache); i++) {
+		for (i = 0; i < repo->packidx_cache_size; i++) {
 			if (repo->packidx_cache[i] == NULL)
 				break;
 			if (strcmp(repo->packidx_cache[i]->path_packidx,
@@ -1082,6 +1214,59 @@ open_packfile(int *fd, struct got_repository *repo,
 	return err;
 }
 
+static uint64_t
+pack_mapped_size(struct got_pack *pack)
+{
+	return MIN(pack->filesize, GOT_PACK_MAPPED_MAX);
+}
+
+/*
+ * Evict the least recently used pack which has not been pinned by
+ * frequent hits, or the least recently used pack if all are pinned.
+ * The slot which was freed is returned in *slot, or -1 if the pack
+ * cache was empty.
+ */
+static const struct got_error *
+evict_pack(int *slot, struct got_repository *repo)
+{
+	const struct got_error *err;
+	struct got_pack *pack;
+	size_t i;
+	int victim = -1, victim_pinned = 0;
+
+	*slot = -1;
+
+	for (i = 0; i < repo->pack_cache_size; i++) {
+		int pinned;
+
+		pack = &repo->packs[i];
+		if (pack->path_packfile == NULL)
+			continue;
+		pinned = (pack->cache_hits >= GOT_PACK_CACHE_PIN_HITS);
+		if (victim == -1 || (victim_pinned && !pinned) ||
+		    (victim_pinned == pinned &&
+		    repo->pack_cache_lru - pack->cache_lru >
+		    repo->pack_cache_lru - repo->packs[victim].cache_lru)) {
+			victim = i;
+			victim_pinned = pinned;
+		}
+	}
+	if (victim == -1)
+		return NULL;
+
+	pack = &repo->packs[victim];
+	repo->pack_cache_mapped -= pack_mapped_size(pack);
+	err = got_pack_close(pack);
+	memset(pack, 0, sizeof(*pack));
+	pack->fd = -1;
+
+	for (i = 0; i < repo->pack_cache_size; i++)
+		repo->packs[i].cache_hits /= 2;
+
+	*slot = victim;
+	return err;
+}
+
 const struct got_error *
 got_repo_cache_pack(struct got_pack **packp, struct got_repository *repo,
     const char *path_packfile, struct got_packidx *packidx)
@@ -1090,63 +1275,79 @@ got_repo_cache_pack(struct got_pack **packp, struct got_repository *repo,
 	struct got_pack *pack = NULL;
 	struct stat sb;
 	size_t i;
+	int fd = -1, slot = -1, evicted;
+	uint64_t mapped_size, mapped_max;
 
 	if (packp)
 		*packp = NULL;
 
-	for (i = 0; i < nitems(repo->packs); i++) {
+	for (i = 0; i < repo->pack_cache_size; i++) {
 		pack = &repo->packs[i];
-		if (pack->path_packfile == NULL)
-			break;
+		if (pack->path_packfile == NULL) {
+			if (slot == -1)
+				slot = i;
+			continue;
+		}
 		if (strcmp(pack->path_packfile, path_packfile) == 0)
 			return got_error(GOT_ERR_CACHE_DUP_ENTRY);
 	}
+	pack = NULL;
 
-	if (i == nitems(repo->packs) - 1) {
-		err = got_pack_close(&repo->packs[i - 1]);
+	err = open_packfile(&fd, repo, path_packfile, packidx);
+	if (err)
+		return err;
+
+	if (fstat(fd, &sb) != 0) {
+		err = got_error_from_errno("fstat");
+		goto done;
+	}
+	mapped_size = MIN(sb.st_size, GOT_PACK_MAPPED_MAX);
+
+	/* Evict packs to free a slot and stay within the memory budget. */
+	while (slot == -1 || repo->pack_cache_mapped + mapped_size >
+	    GOT_PACK_CACHE_MAPPED_MAX) {
+		err = evict_pack(&evicted, repo);
 		if (err)
-			return err;
-		memmove(&repo->packs[1], &repo->packs[0],
-		    sizeof(repo->packs) - sizeof(repo->packs[0]));
-		i = 0;
+			goto done;
+		if (evicted == -1)
+			break;
+		if (slot == -1)
+			slot = evicted;
+	}
+	if (slot == -1) {
+		err = got_error(GOT_ERR_NO_SPACE);
+		goto done;
 	}
 
-	pack = &repo->packs[i];
+	pack = &repo->packs[slot];
 
 	pack->path_packfile = strdup(path_packfile);
 	if (pack->path_packfile == NULL) {
 		err = got_error_from_errno("strdup");
 		goto done;
 	}
-
-	err = open_packfile(&pack->fd, repo, path_packfile, packidx);
-	if (err)
-		goto done;
-
-	if (fstat(pack->fd, &sb) != 0) {
-		err = got_error_from_errno("fstat");
-		goto done;
-	}
+	pack->fd = fd;
 	pack->filesize = sb.st_size;
-
 	pack->privsep_child = NULL;
 
-#ifndef GOT_PACK_NO_MMAP
-	pack->map = mmap(NULL, pack->filesize, PROT_READ, MAP_PRIVATE,
-	    pack->fd, 0);
-	if (pack->map == MAP_FAILED) {
-		if (errno != ENOMEM) {
-			err = got_error_from_errno("mmap");
-			goto done;
-		}
-		pack->map = NULL; /* fall back to read(2) */
-	}
-#endif
+	/* Whatever does not fit the budget is read with read(2). */
+	mapped_max = GOT_PACK_CACHE_MAPPED_MAX - repo->pack_cache_mapped;
+	if (mapped_max > GOT_PACK_MAPPED_MAX)
+		mapped_max = GOT_PACK_MAPPED_MAX;
+	err = got_pack_init_mmap(pack, 0, mapped_max);
+	if (err)
+		goto done;
+	repo->pack_cache_mapped += pack_mapped_size(pack);
+	pack->cache_hits = 0;
+	pack->cache_lru = ++repo->pack_cache_lru;
 done:
 	if (err) {
+		if (fd != -1)
+			close(fd);
 		if (pack) {
 			free(pack->path_packfile);
 			memset(pack, 0, sizeof(*pack));
+			pack->fd = -1;
 		}
 	} else if (packp)
 		*packp = pack;
@@ -1159,12 +1360,15 @@ got_repo_get_cached_pack(struct got_repository *repo, const char *path_packfile)
 	struct got_pack *pack = NULL;
 	size_t i;
 
-	for (i = 0; i < nitems(repo->packs); i++) {
+	for (i = 0; i < repo->pack_cache_size; i++) {
 		pack = &repo->packs[i];
 		if (pack->path_packfile == NULL)
-			break;
-		if (strcmp(pack->path_packfile, path_packfile) == 0)
+			continue;
+		if (strcmp(pack->path_packfile, path_packfile) == 0) {
+			pack->cache_hits++;
+			pack->cache_lru = ++repo->pack_cache_lru;
 			return pack;
+		}
 	}
 
 	return NULL;
@@ -1226,6 +1430,36 @@ got_repo_init(const char *repo_path)
 	return NULL;
 }
 
+static const struct got_error *
+open_cached_packidx(struct got_packidx **packidx,
+    struct got_repository *repo, const char *path_packidx)
+{
+	const struct got_error *err;
+	size_t i;
+
+	for (i = 0; i < repo->packidx_cache_size; i++) {
+		if (repo->packidx_cache[i] == NULL)
+			break;
+		if (strcmp(repo->packidx_cache[i]->path_packidx,
+		    path_packidx) == 0) {
+			*packidx = repo->packidx_cache[i];
+			return NULL;
+		}
+	}
+
+	err = got_packidx_open(packidx, got_repo_get_fd(repo),
+	    path_packidx, 0);
+	if (err)
+		return err;
+
+	err = cache_packidx(repo, *packidx, path_packidx);
+	if (err) {
+		got_packidx_close(*packidx);
+		*packidx = NULL;
+	}
+	return err;
+}
+
 static const struct got_error *
 match_packed_object(struct got_object_id **unique_id,
     struct got_repository *repo, const char *id_str_prefix, int obj_type)
@@ -1257,7 +1491,8 @@ match_packed_object(struct got_object_id **unique_id,
 		struct got_packidx *packidx;
 		struct got_object_qid *qid;
 
-		if (!is_packidx_filename(dent->d_name, strlen(dent->d_name)))
+		if (!got_repo_is_packidx_filename(dent->d_name,
+		    strlen(dent->d_name)))
 			continue;
 
 		if (asprintf(&path_packidx, "%s/%s", GOT_OBJECTS_PACK_DIR,
@@ -1266,19 +1501,15 @@ match_packed_object(struct got_object_id **unique_id,
 			break;
 		}
 
-		err = got_packidx_open(&packidx, got_repo_get_fd(repo),
-		    path_packidx, 0);
+		/* Pack indices stay cached for subsequent lookups. */
+		err = open_cached_packidx(&packidx, repo, path_packidx);
 		free(path_packidx);
 		if (err)
 			break;
 
+		got_object_id_queue_free(&matched_ids);
 		err = got_packidx_match_id_str_prefix(&matched_ids,
 		    packidx, id_str_prefix);
-		if (err) {
-			got_packidx_close(packidx);
-			break;
-		}
-		err = got_packidx_close(packidx);
 		if (err)
 			break;
 
@@ -1317,89 +1548,170 @@ done:
 	return err;
 }
 
+static int
+cmp_object_id(const void *a, const void *b)
+{
+	return got_object_id_cmp((const struct got_object_id *)a,
+	    (const struct got_object_id *)b);
+}
+
+/*
+ * Return a sorted listing of loose objects in the fan-out directory for
+ * the given first ID byte. The listing is cached and only re-read if the
+ * directory was modified since it was last read.
+ */
 static const struct got_error *
-match_loose_object(struct got_object_id **unique_id, const char *path_objects,
-    const char *object_dir, const char *id_str_prefix, int obj_type,
-    struct got_repository *repo)
+get_loose_object_dir(struct got_loose_object_dir **lodp,
+    struct got_repository *repo, uint8_t id0)
 {
 	const struct got_error *err = NULL;
-	char *path;
+	struct got_loose_object_dir *lod = &repo->loose_object_dirs[id0];
+	struct got_object_id *ids = NULL;
+	size_t nids = 0, nalloc = 0;
+	char *path = NULL;
 	DIR *dir = NULL;
 	struct dirent *dent;
-	struct got_object_id id;
+	struct stat sb;
+	int dir_fd;
 
-	if (asprintf(&path, "%s/%s", path_objects, object_dir) == -1) {
-		err = got_error_from_errno("asprintf");
-		goto done;
+	*lodp = lod;
+
+	if (asprintf(&path, "%s/%.2x", GOT_OBJECTS_DIR, id0) == -1)
+		return got_error_from_errno("asprintf");
+
+	dir_fd = openat(got_repo_get_fd(repo), path, O_DIRECTORY);
+	if (dir_fd == -1) {
+		if (errno == ENOENT) {
+			free_loose_object_dir(lod);
+			lod->cached = 1;
+		} else
+			err = got_error_from_errno2("openat", path);
+		free(path);
+		return err;
 	}
 
-	dir = opendir(path);
+	if (fstat(dir_fd, &sb) == -1) {
+		err = got_error_from_errno2("fstat", path);
+		close(dir_fd);
+		free(path);
+		return err;
+	}
+
+	if (lod->cached && lod->mtime_sec == sb.st_mtim.tv_sec &&
+	    lod->mtime_nsec == sb.st_mtim.tv_nsec) {
+		if (close(dir_fd) == -1)
+			err = got_error_from_errno2("close", path);
+		free(path);
+		return err;
+	}
+
+	dir = fdopendir(dir_fd);
 	if (dir == NULL) {
-		if (errno == ENOENT) {
-			err = NULL;
-			goto done;
-		}
-		err = got_error_from_errno2("opendir", path);
+		err = got_error_from_errno2("fdopendir", path);
+		close(dir_fd);
 		goto done;
 	}
+
 	while ((dent = readdir(dir)) != NULL) {
-		char *id_str;
-		int cmp;
+		char id_str[SHA1_DIGEST_STRING_LENGTH];
 
-		if (strcmp(dent->d_name, ".") == 0 ||
-		    strcmp(dent->d_name, "..") == 0)
+		if (strlen(dent->d_name) != SHA1_DIGEST_STRING_LENGTH - 3)
 			continue;
 
-		if (asprintf(&id_str, "%s%s", object_dir, dent->d_name) == -1) {
-			err = got_error_from_errno("asprintf");
-			goto done;
+		if (nids == nalloc) {
+			struct got_object_id *p;
+			size_t n = nalloc ? nalloc * 2 : 64;
+			p = reallocarray(ids, n, sizeof(*ids));
+			if (p == NULL) {
+				err = got_error_from_errno("reallocarray");
+				goto done;
+			}
+			ids = p;
+			nalloc = n;
 		}
 
-		if (!got_parse_sha1_digest(id.sha1, id_str))
+		/* The directory name holds the first two hex digits. */
+		memcpy(id_str, path + strlen(path) - 2, 2);
+		memcpy(id_str + 2, dent->d_name, SHA1_DIGEST_STRING_LENGTH - 2);
+		if (!got_parse_sha1_digest(ids[nids].sha1, id_str))
 			continue;
+		nids++;
+	}
 
-		/*
-		 * Directory entries do not necessarily appear in
-		 * sorted order, so we must iterate over all of them.
-		 */
-		cmp = strncmp(id_str, id_str_prefix, strlen(id_str_prefix));
-		if (cmp != 0) {
-			free(id_str);
-			continue;
+	/* Directory entries do not necessarily appear in sorted order. */
+	qsort(ids, nids, sizeof(ids[0]), cmp_object_id);
+
+	free_loose_object_dir(lod);
+	lod->ids = ids;
+	lod->nids = nids;
+	lod->mtime_sec = sb.st_mtim.tv_sec;
+	lod->mtime_nsec = sb.st_mtim.tv_nsec;
+	lod->cached = 1;
+	ids = NULL;
+done:
+	if (dir && closedir(dir) != 0 && err == NULL)
+		err = got_error_from_errno2("closedir", path);
+	free(ids);
+	free(path);
+	return err;
+}
+
+static const struct got_error *
+match_loose_object(struct got_object_id **unique_id,
+    struct got_repository *repo, uint8_t id0, const uint8_t *prefix,
+    size_t ndigits, int obj_type)
+{
+	const struct got_error *err = NULL;
+	struct got_loose_object_dir *lod;
+	size_t left = 0, right;
+
+	err = get_loose_object_dir(&lod, repo, id0);
+	if (err)
+		return err;
+
+	right = lod->nids;
+	while (left < right) {
+		size_t i = left + (right - left) / 2;
+		if (got_sha1_digest_prefix_cmp(lod->ids[i].sha1, prefix,
+		    ndigits) < 0)
+			left = i + 1;
+		else
+			right = i;
+	}
+
+	for (; left < lod->nids; left++) {
+		struct got_object_id *id = &lod->ids[left];
+
+		if (got_sha1_digest_prefix_cmp(id->sha1, prefix, ndigits) != 0)
+			break;
+
+		if (obj_type != GOT_OBJ_TYPE_ANY) {
+			int matched_type;
+			err = got_object_get_type(&matched_type, repo, id);
+			if (err)
+				goto done;
+			if (matched_type != obj_type)
+				continue;
 		}
 
 		if (*unique_id == NULL) {
-			if (obj_type != GOT_OBJ_TYPE_ANY) {
-				int matched_type;
-				err = got_object_get_type(&matched_type, repo,
-				    &id);
-				if (err)
-					goto done;
-				if (matched_type != obj_type)
-					continue;
-			}
-			*unique_id = got_object_id_dup(&id);
+			*unique_id = got_object_id_dup(id);
 			if (*unique_id == NULL) {
 				err = got_error_from_errno("got_object_id_dup");
-				free(id_str);
 				goto done;
 			}
 		} else {
-			if (got_object_id_cmp(*unique_id, &id) == 0)
+			if (got_object_id_cmp(*unique_id, id) == 0)
 				continue; /* both packed and loose */
 			err = got_error(GOT_ERR_AMBIGUOUS_ID);
-			free(id_str);
 			goto done;
 		}
 	}
 done:
-	if (dir && closedir(dir) != 0 && err == NULL)
-		err = got_error_from_errno("closedir");
 	if (err) {
 		free(*unique_id);
 		*unique_id = NULL;
 	}
-	free(path);
 	return err;
 }
 
@@ -1408,9 +1720,9 @@ got_repo_match_object_id_prefix(struct got_object_id **id,
     const char *id_str_prefix, int obj_type, struct got_repository *repo)
 {
 	const struct got_error *err = NULL;
-	char *path_objects = got_repo_get_path_objects(repo);
 	char *object_dir = NULL;
-	size_t len;
+	uint8_t prefix[SHA1_DIGEST_LENGTH];
+	size_t len, ndigits;
 	int i;
 
 	*id = NULL;
@@ -1421,21 +1733,19 @@ got_repo_match_object_id_prefix(struct got_object_id **id,
 		return got_error_path(id_str_prefix, GOT_ERR_BAD_OBJ_ID_STR);
 	}
 
+	if (!got_parse_sha1_digest_prefix(prefix, &ndigits, id_str_prefix))
+		return got_error_path(id_str_prefix, GOT_ERR_BAD_OBJ_ID_STR);
+
 	len = strlen(id_str_prefix);
 	if (len >= 2) {
 		err = match_packed_object(id, repo, id_str_prefix, obj_type);
 		if (err)
 			goto done;
-		object_dir = strndup(id_str_prefix, 2);
-		if (object_dir == NULL) {
-			err = got_error_from_errno("strdup");
-			goto done;
-		}
-		err = match_loose_object(id, path_objects, object_dir,
-		    id_str_prefix, obj_type, repo);
+		err = match_loose_object(id, repo, prefix[0], prefix, ndigits,
+		    obj_type);
 	} else if (len == 1) {
 		int i;
-		for (i = 0; i < 0xf; i++) {
+		for (i = 0; i <= 0xf; i++) {
 			if (asprintf(&object_dir, "%s%.1x", id_str_prefix, i)
 			    == -1) {
 				err = got_error_from_errno("asprintf");
@@ -1443,10 +1753,12 @@ got_repo_match_object_id_prefix(struct got_object_id **id,
 			}
 			err = match_packed_object(id, repo, object_dir,
 			    obj_type);
+			free(object_dir);
+			object_dir = NULL;
 			if (err)
 				goto done;
-			err = match_loose_object(id, path_objects, object_dir,
-			    id_str_prefix, obj_type, repo);
+			err = match_loose_object(id, repo, prefix[0] | i,
+			    prefix, ndigits, obj_type);
 			if (err)
 				goto done;
 		}
@@ -1795,13 +2107,29 @@ got_repo_import(struct got_object_id **new_commit_id, const char *path_dir,
 	const struct got_error *err;
 	struct got_object_id *new_tree_id;
 
+	err = got_object_batch_open(repo);
+	if (err)
+		return err;
+
 	err = write_tree(&new_tree_id, path_dir, ignores, repo,
 	    progress_cb, progress_arg);
-	if (err)
+	if (err) {
+		got_object_batch_abort(repo);
 		return err;
+	}
 
 	err = got_object_commit_create(new_commit_id, new_tree_id, NULL, 0,
 	    author, time(NULL), author, time(NULL), logmsg, repo);
 	free(new_tree_id);
+	if (err) {
+		got_object_batch_abort(repo);
+		return err;
+	}
+
+	err = got_object_batch_publish(repo);
+	if (err) {
+		free(*new_commit_id);
+		*new_commit_id = NULL;
+	}
 	return err;
 }
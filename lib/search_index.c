@@ -0,0 +1,1822 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/mman.h>
+#include <sys/queue.h>
+#include <sys/stat.h>
+
+#include <dirent.h>
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sha1.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "got_compat.h"
+
+#include "got_error.h"
+#include "got_object.h"
+#include "got_cancel.h"
+#include "got_opentemp.h"
+#include "got_repository.h"
+#include "got_search_index.h"
+
+#include "got_lib_delta.h"
+#include "got_lib_inflate.h"
+#include "got_lib_object.h"
+#include "got_lib_lockfile.h"
+#include "got_lib_sha1.h"
+
+#ifndef MIN
+#define	MIN(_a,_b) ((_a) < (_b) ? (_a) : (_b))
+#endif
+
+/*
+ * The search index is kept in this directory within the repository if it
+ * exists. Each file in this directory is a segment of the index which is
+ * never modified once written, and which is named after a sequence number.
+ * Updates are serialized by a lock file in this directory.
+ * New commits are added in new segments, and segments of similar size are
+ * merged. A segment contains, with all numbers in big-endian byte order:
+ *
+ * signature, version, number of records, tokens, and postings,
+ * size of text pool, size of name pool
+ * records: commit ID, first parent ID, record number of the first parent
+ *     within this segment, flags, offset of commit data in text pool
+ * commit IDs in sorted order, each followed by its record number
+ * tokens in sorted order: offset of name in name pool, index of first
+ *     posting, number of postings
+ * postings: record numbers of commits containing a token, in ascending order
+ * text pool: author, committer, and log message of each commit
+ * name pool: names of tokens
+ *
+ * Tokens are words of at least GOT_SEARCH_INDEX_MIN_TOKEN alphanumeric
+ * ASCII characters, converted to lower case. Strings are NUL-terminated.
+ */
+#define GOT_SEARCH_INDEX_DIR		"got-search-index"
+#define GOT_SEARCH_INDEX_LOCK		"update"
+#define GOT_SEARCH_INDEX_SIGNATURE	0x676f7453 /* 'g', 'o', 't', 'S' */
+#define GOT_SEARCH_INDEX_VERSION	1
+
+#define GOT_SEARCH_INDEX_HDR_SIZE	40
+#define GOT_SEARCH_INDEX_RECORD_SIZE	(2 * SHA1_DIGEST_LENGTH + 16)
+#define GOT_SEARCH_INDEX_ID_SIZE	(SHA1_DIGEST_LENGTH + 4)
+#define GOT_SEARCH_INDEX_TOKEN_SIZE	20
+
+#define GOT_SEARCH_INDEX_NO_RECNO	0xffffffff
+#define GOT_SEARCH_INDEX_HAS_PARENT	0x01
+
+#define GOT_SEARCH_INDEX_MIN_TOKEN	3
+
+/* Maximum number of commits written to a new segment. */
+#define GOT_SEARCH_INDEX_SEGMENT_MAX	32768
+
+/* Segments are merged regardless of size if there are more than these. */
+#define GOT_SEARCH_INDEX_MAX_SEGMENTS	16
+
+struct got_search_index_segment {
+	TAILQ_ENTRY(got_search_index_segment) entry;
+	char *path;
+	unsigned int seqno;
+	uint8_t *map;
+	size_t size;
+	uint32_t nrecords;
+	uint32_t ntokens;
+	uint64_t npostings;
+	uint64_t text_size;
+	uint64_t names_size;
+	const uint8_t *records;
+	const uint8_t *ids;
+	const uint8_t *tokens;
+	const uint8_t *postings;
+	const char *text;
+	const char *names;
+	uint8_t *candidates; /* records which may match the current search */
+};
+TAILQ_HEAD(got_search_index_segments, got_search_index_segment);
+
+struct got_search_index {
+	char *path;
+	struct got_search_index_segments segments; /* newest first */
+	uint64_t nrecords;
+	unsigned int next_seqno;
+};
+
+struct got_search_index_record {
+	const uint8_t *id;
+	const uint8_t *parent_id;
+	uint32_t parent_recno;
+	uint32_t flags;
+	uint64_t text_off;
+	const char *author;
+	const char *committer;
+	const char *logmsg;
+};
+
+/* A commit which is about to be written to a new segment. */
+struct got_search_index_new_record {
+	struct got_object_id id;
+	struct got_object_id parent_id;
+	int has_parent;
+	char *text;
+	size_t len;
+};
+
+struct got_search_index_token_ref {
+	const char *name;
+	uint32_t len;
+	uint32_t recno;
+};
+
+static uint32_t
+get_val32(const uint8_t *p)
+{
+	uint32_t val;
+
+	memcpy(&val, p, sizeof(val));
+	return be32toh(val);
+}
+
+static uint64_t
+get_val64(const uint8_t *p)
+{
+	uint64_t val;
+
+	memcpy(&val, p, sizeof(val));
+	return be64toh(val);
+}
+
+static int
+is_token_char(unsigned char c)
+{
+	return ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+	    (c >= '0' && c <= '9'));
+}
+
+static char
+to_lower(char c)
+{
+	if (c >= 'A' && c <= 'Z')
+		return c - 'A' + 'a';
+	return c;
+}
+
+static void
+close_segment(struct got_search_index_segment *seg)
+{
+	if (seg->map)
+		munmap(seg->map, seg->size);
+	free(seg->candidates);
+	free(seg->path);
+	free(seg);
+}
+
+static const struct got_error *
+open_segment(struct got_search_index_segment **segp, const char *path,
+    unsigned int seqno)
+{
+	const struct got_error *err = NULL;
+	struct got_search_index_segment *seg;
+	struct stat sb;
+	uint64_t size;
+	int fd;
+
+	*segp = NULL;
+
+	seg = calloc(1, sizeof(*seg));
+	if (seg == NULL)
+		return got_error_from_errno("calloc");
+	seg->seqno = seqno;
+	seg->path = strdup(path);
+	if (seg->path == NULL) {
+		err = got_error_from_errno("strdup");
+		free(seg);
+		return err;
+	}
+
+	fd = open(path, O_RDONLY | O_NOFOLLOW);
+	if (fd == -1) {
+		err = got_error_from_errno2("open", path);
+		goto done;
+	}
+	if (fstat(fd, &sb) == -1) {
+		err = got_error_from_errno2("fstat", path);
+		goto done;
+	}
+	if (sb.st_size < GOT_SEARCH_INDEX_HDR_SIZE || sb.st_size > SIZE_MAX) {
+		err = got_error_path(path, GOT_ERR_SEARCH_INDEX);
+		goto done;
+	}
+	seg->size = sb.st_size;
+	seg->map = mmap(NULL, seg->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (seg->map == MAP_FAILED) {
+		err = got_error_from_errno2("mmap", path);
+		seg->map = NULL;
+		goto done;
+	}
+
+	if (get_val32(seg->map) != GOT_SEARCH_INDEX_SIGNATURE ||
+	    get_val32(seg->map + 4) != GOT_SEARCH_INDEX_VERSION) {
+		err = got_error_path(path, GOT_ERR_SEARCH_INDEX);
+		goto done;
+	}
+	seg->nrecords = get_val32(seg->map + 8);
+	seg->ntokens = get_val32(seg->map + 12);
+	seg->npostings = get_val64(seg->map + 16);
+	seg->text_size = get_val64(seg->map + 24);
+	seg->names_size = get_val64(seg->map + 32);
+
+	/* The sections must fill the entire file. */
+	size = GOT_SEARCH_INDEX_HDR_SIZE;
+	size += (uint64_t)seg->nrecords *
+	    (GOT_SEARCH_INDEX_RECORD_SIZE + GOT_SEARCH_INDEX_ID_SIZE);
+	size += (uint64_t)seg->ntokens * GOT_SEARCH_INDEX_TOKEN_SIZE;
+	if (seg->nrecords == GOT_SEARCH_INDEX_NO_RECNO ||
+	    seg->npostings > seg->size / sizeof(uint32_t) ||
+	    seg->text_size > seg->size || seg->names_size > seg->size ||
+	    size + seg->npostings * sizeof(uint32_t) + seg->text_size +
+	    seg->names_size != seg->size) {
+		err = got_error_path(path, GOT_ERR_SEARCH_INDEX);
+		goto done;
+	}
+	seg->records = seg->map + GOT_SEARCH_INDEX_HDR_SIZE;
+	seg->ids = seg->records +
+	    seg->nrecords * GOT_SEARCH_INDEX_RECORD_SIZE;
+	seg->tokens = seg->ids + seg->nrecords * GOT_SEARCH_INDEX_ID_SIZE;
+	seg->postings = seg->tokens +
+	    seg->ntokens * GOT_SEARCH_INDEX_TOKEN_SIZE;
+	seg->text = (const char *)(seg->postings +
+	    seg->npostings * sizeof(uint32_t));
+	seg->names = seg->text + seg->text_size;
+
+	/* Ensure that string lookups cannot run off the end of a pool. */
+	if ((seg->text_size > 0 && seg->text[seg->text_size - 1] != '\0') ||
+	    (seg->names_size > 0 &&
+	    seg->names[seg->names_size - 1] != '\0'))
+		err = got_error_path(path, GOT_ERR_SEARCH_INDEX);
+done:
+	if (fd != -1 && close(fd) == -1 && err == NULL)
+		err = got_error_from_errno2("close", path);
+	if (err)
+		close_segment(seg);
+	else
+		*segp = seg;
+	return err;
+}
+
+static const struct got_error *
+get_text(const char **s, struct got_search_index_segment *seg, uint64_t off)
+{
+	if (off >= seg->text_size)
+		return got_error_path(seg->path, GOT_ERR_SEARCH_INDEX);
+	*s = seg->text + off;
+	return NULL;
+}
+
+static const struct got_error *
+get_record(struct got_search_index_record *rec,
+    struct got_search_index_segment *seg, uint32_t recno)
+{
+	const struct got_error *err;
+	const uint8_t *p;
+	uint64_t off;
+
+	if (recno >= seg->nrecords)
+		return got_error_path(seg->path, GOT_ERR_SEARCH_INDEX);
+
+	p = seg->records + recno * GOT_SEARCH_INDEX_RECORD_SIZE;
+	rec->id = p;
+	rec->parent_id = p + SHA1_DIGEST_LENGTH;
+	p += 2 * SHA1_DIGEST_LENGTH;
+	rec->parent_recno = get_val32(p);
+	rec->flags = get_val32(p + 4);
+	off = rec->text_off = get_val64(p + 8);
+	if (rec->parent_recno != GOT_SEARCH_INDEX_NO_RECNO &&
+	    rec->parent_recno >= seg->nrecords)
+		return got_error_path(seg->path, GOT_ERR_SEARCH_INDEX);
+
+	err = get_text(&rec->author, seg, off);
+	if (err)
+		return err;
+	off += strlen(rec->author) + 1;
+	err = get_text(&rec->committer, seg, off);
+	if (err)
+		return err;
+	off += strlen(rec->committer) + 1;
+	return get_text(&rec->logmsg, seg, off);
+}
+
+static const struct got_error *
+get_token(const char **name, uint64_t *postings_idx, uint32_t *npostings,
+    struct got_search_index_segment *seg, uint32_t idx)
+{
+	const uint8_t *p = seg->tokens + idx * GOT_SEARCH_INDEX_TOKEN_SIZE;
+	uint64_t name_off;
+
+	name_off = get_val64(p);
+	*postings_idx = get_val64(p + 8);
+	*npostings = get_val32(p + 16);
+	if (name_off >= seg->names_size || *postings_idx > seg->npostings ||
+	    *npostings > seg->npostings - *postings_idx)
+		return got_error_path(seg->path, GOT_ERR_SEARCH_INDEX);
+	*name = seg->names + name_off;
+	return NULL;
+}
+
+static const struct got_error *
+get_posting(uint32_t *recno, struct got_search_index_segment *seg,
+    uint64_t idx)
+{
+	*recno = get_val32(seg->postings + idx * sizeof(uint32_t));
+	if (*recno >= seg->nrecords)
+		return got_error_path(seg->path, GOT_ERR_SEARCH_INDEX);
+	return NULL;
+}
+
+static const struct got_error *
+get_id(const uint8_t **sha1, uint32_t *recno,
+    struct got_search_index_segment *seg, uint32_t idx)
+{
+	const uint8_t *p = seg->ids + idx * GOT_SEARCH_INDEX_ID_SIZE;
+
+	*sha1 = p;
+	*recno = get_val32(p + SHA1_DIGEST_LENGTH);
+	if (*recno >= seg->nrecords)
+		return got_error_path(seg->path, GOT_ERR_SEARCH_INDEX);
+	return NULL;
+}
+
+/* Look up the record number of a commit within a segment. */
+static const struct got_error *
+find_id_in_segment(int *found, uint32_t *recno,
+    struct got_search_index_segment *seg, const uint8_t *sha1)
+{
+	const struct got_error *err;
+	const uint8_t *p;
+	uint32_t left = 0, right = seg->nrecords;
+	int cmp;
+
+	*found = 0;
+
+	while (left < right) {
+		uint32_t i = left + (right - left) / 2;
+		err = get_id(&p, recno, seg, i);
+		if (err)
+			return err;
+		cmp = memcmp(sha1, p, SHA1_DIGEST_LENGTH);
+		if (cmp == 0) {
+			*found = 1;
+			return NULL;
+		}
+		if (cmp < 0)
+			right = i;
+		else
+			left = i + 1;
+	}
+	return NULL;
+}
+
+static const struct got_error *
+find_record(struct got_search_index_segment **segp, uint32_t *recno,
+    struct got_search_index *index, struct got_object_id *id)
+{
+	const struct got_error *err;
+	struct got_search_index_segment *seg;
+	int found;
+
+	*segp = NULL;
+
+	TAILQ_FOREACH(seg, &index->segments, entry) {
+		err = find_id_in_segment(&found, recno, seg, id->sha1);
+		if (err)
+			return err;
+		if (found) {
+			*segp = seg;
+			break;
+		}
+	}
+	return NULL;
+}
+
+static void
+free_segments(struct got_search_index *index)
+{
+	struct got_search_index_segment *seg;
+
+	while (!TAILQ_EMPTY(&index->segments)) {
+		seg = TAILQ_FIRST(&index->segments);
+		TAILQ_REMOVE(&index->segments, seg, entry);
+		close_segment(seg);
+	}
+	index->nrecords = 0;
+	index->next_seqno = 1;
+}
+
+static void
+insert_segment(struct got_search_index *index,
+    struct got_search_index_segment *new)
+{
+	struct got_search_index_segment *seg;
+
+	TAILQ_FOREACH(seg, &index->segments, entry) {
+		if (seg->seqno < new->seqno)
+			break;
+	}
+	if (seg)
+		TAILQ_INSERT_BEFORE(seg, new, entry);
+	else
+		TAILQ_INSERT_TAIL(&index->segments, new, entry);
+	index->nrecords += new->nrecords;
+	if (new->seqno >= index->next_seqno)
+		index->next_seqno = new->seqno + 1;
+}
+
+static const struct got_error *
+load_segments(struct got_search_index *index)
+{
+	const struct got_error *err = NULL;
+	struct got_search_index_segment *seg;
+	DIR *dir;
+	struct dirent *dent;
+	const char *errstr;
+	unsigned int seqno;
+	char *path;
+
+	free_segments(index);
+
+	dir = opendir(index->path);
+	if (dir == NULL)
+		return got_error_from_errno2("opendir", index->path);
+
+	while ((dent = readdir(dir)) != NULL) {
+		if (dent->d_name[0] < '1' || dent->d_name[0] > '9')
+			continue;
+		seqno = strtonum(dent->d_name, 1, UINT_MAX - 1, &errstr);
+		if (errstr)
+			continue;
+		if (asprintf(&path, "%s/%s", index->path,
+		    dent->d_name) == -1) {
+			err = got_error_from_errno("asprintf");
+			break;
+		}
+		err = open_segment(&seg, path, seqno);
+		free(path);
+		if (err) {
+			/* Segments may be removed while being merged. */
+			if (err->code == GOT_ERR_ERRNO && errno == ENOENT) {
+				err = NULL;
+				continue;
+			}
+			break;
+		}
+		insert_segment(index, seg);
+	}
+
+	if (closedir(dir) == -1 && err == NULL)
+		err = got_error_from_errno2("closedir", index->path);
+	if (err)
+		free_segments(index);
+	return err;
+}
+
+const struct got_error *
+got_search_index_open(struct got_search_index **index,
+    struct got_repository *repo)
+{
+	const struct got_error *err;
+	struct stat sb;
+	char *path;
+
+	*index = NULL;
+
+	if (asprintf(&path, "%s/%s", got_repo_get_path_git_dir(repo),
+	    GOT_SEARCH_INDEX_DIR) == -1)
+		return got_error_from_errno("asprintf");
+	if (stat(path, &sb) == -1 || !S_ISDIR(sb.st_mode)) {
+		free(path);
+		return NULL;
+	}
+
+	*index = calloc(1, sizeof(**index));
+	if (*index == NULL) {
+		err = got_error_from_errno("calloc");
+		free(path);
+		return err;
+	}
+	(*index)->path = path;
+	TAILQ_INIT(&(*index)->segments);
+
+	err = load_segments(*index);
+	if (err) {
+		got_search_index_close(*index);
+		*index = NULL;
+	}
+	return err;
+}
+
+const struct got_error *
+got_search_index_unveil(const char *git_dir)
+{
+	const struct got_error *err = NULL;
+	char *path;
+	struct stat sb;
+
+	if (asprintf(&path, "%s/%s", git_dir, GOT_SEARCH_INDEX_DIR) == -1)
+		return got_error_from_errno("asprintf");
+	if (stat(path, &sb) == 0 && S_ISDIR(sb.st_mode) &&
+	    unveil(path, "rwc") != 0)
+		err = got_error_from_errno2("unveil", path);
+	free(path);
+	return err;
+}
+
+void
+got_search_index_close(struct got_search_index *index)
+{
+	free_segments(index);
+	free(index->path);
+	free(index);
+}
+
+static const struct got_error *
+write_data(FILE *f, const void *data, size_t len)
+{
+	if (fwrite(data, 1, len, f) != len)
+		return got_ferror(f, GOT_ERR_IO);
+	return NULL;
+}
+
+static const struct got_error *
+write_val32(FILE *f, uint32_t val)
+{
+	val = htobe32(val);
+	return write_data(f, &val, sizeof(val));
+}
+
+static const struct got_error *
+write_val64(FILE *f, uint64_t val)
+{
+	val = htobe64(val);
+	return write_data(f, &val, sizeof(val));
+}
+
+static const struct got_error *
+write_header(FILE *f, uint32_t nrecords, uint32_t ntokens,
+    uint64_t npostings, uint64_t text_size, uint64_t names_size)
+{
+	const struct got_error *err;
+
+	err = write_val32(f, GOT_SEARCH_INDEX_SIGNATURE);
+	if (err)
+		return err;
+	err = write_val32(f, GOT_SEARCH_INDEX_VERSION);
+	if (err)
+		return err;
+	err = write_val32(f, nrecords);
+	if (err)
+		return err;
+	err = write_val32(f, ntokens);
+	if (err)
+		return err;
+	err = write_val64(f, npostings);
+	if (err)
+		return err;
+	err = write_val64(f, text_size);
+	if (err)
+		return err;
+	return write_val64(f, names_size);
+}
+
+static const struct got_error *
+write_record(FILE *f, const uint8_t *id, const uint8_t *parent_id,
+    uint32_t parent_recno, uint32_t flags, uint64_t text_off)
+{
+	const struct got_error *err;
+	uint8_t null_id[SHA1_DIGEST_LENGTH];
+
+	if (parent_id == NULL) {
+		memset(null_id, 0, sizeof(null_id));
+		parent_id = null_id;
+	}
+
+	err = write_data(f, id, SHA1_DIGEST_LENGTH);
+	if (err)
+		return err;
+	err = write_data(f, parent_id, SHA1_DIGEST_LENGTH);
+	if (err)
+		return err;
+	err = write_val32(f, parent_recno);
+	if (err)
+		return err;
+	err = write_val32(f, flags);
+	if (err)
+		return err;
+	return write_val64(f, text_off);
+}
+
+static const struct got_error *
+write_token(FILE *f, uint64_t name_off, uint64_t postings_idx,
+    uint32_t npostings)
+{
+	const struct got_error *err;
+
+	err = write_val64(f, name_off);
+	if (err)
+		return err;
+	err = write_val64(f, postings_idx);
+	if (err)
+		return err;
+	return write_val32(f, npostings);
+}
+
+/* Write a new segment from a temporary file to its final location. */
+static const struct got_error *
+install_segment(struct got_search_index_segment **seg,
+    struct got_search_index *index, char *tmppath, FILE *f)
+{
+	const struct got_error *err = NULL;
+	char *path;
+
+	*seg = NULL;
+
+	if (fclose(f) == EOF)
+		return got_error_from_errno2("fclose", tmppath);
+
+	if (asprintf(&path, "%s/%u", index->path, index->next_seqno) == -1)
+		return got_error_from_errno("asprintf");
+	if (rename(tmppath, path) == -1) {
+		err = got_error_from_errno3("rename", tmppath, path);
+		goto done;
+	}
+	err = open_segment(seg, path, index->next_seqno);
+	if (err)
+		goto done;
+	insert_segment(index, *seg);
+done:
+	free(path);
+	return err;
+}
+
+static int
+cmp_token_refs(const void *pa, const void *pb)
+{
+	const struct got_search_index_token_ref *a = pa, *b = pb;
+	int cmp;
+
+	cmp = memcmp(a->name, b->name, MIN(a->len, b->len));
+	if (cmp)
+		return cmp;
+	if (a->len != b->len)
+		return a->len < b->len ? -1 : 1;
+	if (a->recno != b->recno)
+		return a->recno < b->recno ? -1 : 1;
+	return 0;
+}
+
+static int
+cmp_new_record_ids(const void *pa, const void *pb)
+{
+	struct got_search_index_new_record * const *a = pa, * const *b = pb;
+
+	return got_object_id_cmp(&(*a)->id, &(*b)->id);
+}
+
+/*
+ * Write a segment for commits found along first-parent links, in the
+ * order in which they were found.
+ */
+static const struct got_error *
+write_new_segment(struct got_search_index *index,
+    struct got_search_index_new_record *records, uint32_t nrecords)
+{
+	const struct got_error *err = NULL;
+	struct got_search_index_segment *seg;
+	struct got_search_index_new_record **sorted = NULL;
+	struct got_search_index_token_ref *refs = NULL, *ref, *prev;
+	size_t nrefs = 0, nalloc = 0;
+	char *lower = NULL, *tmppath = NULL, *basepath = NULL;
+	FILE *f = NULL;
+	uint64_t text_size = 0, names_size = 0, off, npostings = 0;
+	uint32_t i, ntokens = 0;
+	size_t j, n;
+
+	for (i = 0; i < nrecords; i++)
+		text_size += records[i].len;
+
+	/* Split commit data into tokens. */
+	lower = malloc(text_size);
+	if (lower == NULL) {
+		err = got_error_from_errno("malloc");
+		goto done;
+	}
+	off = 0;
+	for (i = 0; i < nrecords; i++) {
+		char *s = lower + off;
+		size_t len = records[i].len, start;
+
+		for (j = 0; j < len; j++)
+			s[j] = to_lower(records[i].text[j]);
+		off += len;
+
+		for (j = 0; j < len; j++) {
+			if (!is_token_char(s[j]))
+				continue;
+			start = j;
+			while (j < len && is_token_char(s[j]))
+				j++;
+			if (j - start < GOT_SEARCH_INDEX_MIN_TOKEN)
+				continue;
+			if (nrefs == nalloc) {
+				struct got_search_index_token_ref *new;
+				size_t newalloc = nalloc ? nalloc * 2 : 1024;
+				new = reallocarray(refs, newalloc,
+				    sizeof(*refs));
+				if (new == NULL) {
+					err = got_error_from_errno(
+					    "reallocarray");
+					goto done;
+				}
+				refs = new;
+				nalloc = newalloc;
+			}
+			refs[nrefs].name = s + start;
+			refs[nrefs].len = j - start;
+			refs[nrefs].recno = i;
+			nrefs++;
+		}
+	}
+	qsort(refs, nrefs, sizeof(*refs), cmp_token_refs);
+
+	prev = NULL;
+	for (j = 0; j < nrefs; j++) {
+		ref = &refs[j];
+		if (prev && prev->len == ref->len &&
+		    memcmp(prev->name, ref->name, ref->len) == 0) {
+			if (prev->recno != ref->recno)
+				npostings++;
+		} else {
+			ntokens++;
+			npostings++;
+			names_size += ref->len + 1;
+		}
+		prev = ref;
+	}
+
+	sorted = calloc(nrecords, sizeof(*sorted));
+	if (sorted == NULL) {
+		err = got_error_from_errno("calloc");
+		goto done;
+	}
+	for (i = 0; i < nrecords; i++)
+		sorted[i] = &records[i];
+	qsort(sorted, nrecords, sizeof(*sorted), cmp_new_record_ids);
+
+	if (asprintf(&basepath, "%s/segment", index->path) == -1) {
+		err = got_error_from_errno("asprintf");
+		goto done;
+	}
+	err = got_opentemp_named(&tmppath, &f, basepath);
+	if (err)
+		goto done;
+
+	err = write_header(f, nrecords, ntokens, npostings, text_size,
+	    names_size);
+	if (err)
+		goto done;
+
+	off = 0;
+	for (i = 0; i < nrecords; i++) {
+		struct got_search_index_new_record *rec = &records[i];
+		uint32_t parent_recno = GOT_SEARCH_INDEX_NO_RECNO;
+
+		if (rec->has_parent && i + 1 < nrecords &&
+		    got_object_id_cmp(&rec->parent_id,
+		    &records[i + 1].id) == 0)
+			parent_recno = i + 1;
+		err = write_record(f, rec->id.sha1,
+		    rec->has_parent ? rec->parent_id.sha1 : NULL, parent_recno,
+		    rec->has_parent ? GOT_SEARCH_INDEX_HAS_PARENT : 0, off);
+		if (err)
+			goto done;
+		off += rec->len;
+	}
+
+	for (i = 0; i < nrecords; i++) {
+		err = write_data(f, sorted[i]->id.sha1, SHA1_DIGEST_LENGTH);
+		if (err)
+			goto done;
+		err = write_val32(f, sorted[i] - records);
+		if (err)
+			goto done;
+	}
+
+	off = 0;
+	npostings = 0;
+	for (j = 0; j < nrefs; j = n) {
+		uint32_t count = 1;
+
+		ref = &refs[j];
+		for (n = j + 1; n < nrefs; n++) {
+			if (refs[n].len != ref->len ||
+			    memcmp(refs[n].name, ref->name, ref->len) != 0)
+				break;
+			if (refs[n].recno != refs[n - 1].recno)
+				count++;
+		}
+		err = write_token(f, off, npostings, count);
+		if (err)
+			goto done;
+		off += ref->len + 1;
+		npostings += count;
+	}
+
+	for (j = 0; j < nrefs; j++) {
+		if (j > 0 && cmp_token_refs(&refs[j - 1], &refs[j]) == 0)
+			continue;
+		err = write_val32(f, refs[j].recno);
+		if (err)
+			goto done;
+	}
+
+	for (i = 0; i < nrecords; i++) {
+		err = write_data(f, records[i].text, records[i].len);
+		if (err)
+			goto done;
+	}
+
+	for (j = 0; j < nrefs; j++) {
+		if (j > 0 && refs[j - 1].len == refs[j].len &&
+		    memcmp(refs[j - 1].name, refs[j].name, refs[j].len) == 0)
+			continue;
+		err = write_data(f, refs[j].name, refs[j].len);
+		if (err)
+			goto done;
+		err = write_data(f, "", 1);
+		if (err)
+			goto done;
+	}
+
+	err = install_segment(&seg, index, tmppath, f);
+	f = NULL;
+done:
+	if (f && fclose(f) == EOF && err == NULL)
+		err = got_error_from_errno2("fclose", tmppath);
+	if (tmppath && unlink(tmppath) == -1 && errno != ENOENT &&
+	    err == NULL)
+		err = got_error_from_errno2("unlink", tmppath);
+	free(tmppath);
+	free(basepath);
+	free(sorted);
+	free(refs);
+	free(lower);
+	return err;
+}
+
+struct got_search_index_merged_token {
+	const char *name;
+	uint32_t idx1;
+	uint32_t idx2;
+};
+
+static const struct got_error *
+write_merged_records(FILE *f, struct got_search_index_segment *seg,
+    struct got_search_index_segment *other, uint32_t recno_offset,
+    uint32_t other_recno_offset, uint64_t text_offset)
+{
+	const struct got_error *err;
+	struct got_search_index_record rec;
+	uint32_t i, parent_recno;
+	int found;
+
+	for (i = 0; i < seg->nrecords; i++) {
+		err = get_record(&rec, seg, i);
+		if (err)
+			return err;
+		parent_recno = rec.parent_recno;
+		if (parent_recno != GOT_SEARCH_INDEX_NO_RECNO)
+			parent_recno += recno_offset;
+		else if (rec.flags & GOT_SEARCH_INDEX_HAS_PARENT) {
+			err = find_id_in_segment(&found, &parent_recno, other,
+			    rec.parent_id);
+			if (err)
+				return err;
+			if (found)
+				parent_recno += other_recno_offset;
+			else
+				parent_recno = GOT_SEARCH_INDEX_NO_RECNO;
+		}
+		err = write_record(f, rec.id,
+		    (rec.flags & GOT_SEARCH_INDEX_HAS_PARENT) ?
+		    rec.parent_id : NULL, parent_recno, rec.flags,
+		    rec.text_off + text_offset);
+		if (err)
+			return err;
+	}
+	return NULL;
+}
+
+static const struct got_error *
+write_merged_postings(FILE *f, struct got_search_index_segment *seg,
+    uint32_t idx, uint32_t recno_offset)
+{
+	const struct got_error *err;
+	const char *name;
+	uint64_t postings_idx;
+	uint32_t i, npostings, recno;
+
+	err = get_token(&name, &postings_idx, &npostings, seg, idx);
+	if (err)
+		return err;
+	for (i = 0; i < npostings; i++) {
+		err = get_posting(&recno, seg, postings_idx + i);
+		if (err)
+			return err;
+		err = write_val32(f, recno + recno_offset);
+		if (err)
+			return err;
+	}
+	return NULL;
+}
+
+/*
+ * Merge two segments into a new segment. Records of the first segment
+ * are placed before records of the second segment.
+ */
+static const struct got_error *
+merge_segments(struct got_search_index_segment **merged,
+    struct got_search_index *index, struct got_search_index_segment *seg1,
+    struct got_search_index_segment *seg2)
+{
+	const struct got_error *err = NULL;
+	struct got_search_index_merged_token *tokens = NULL, *t;
+	const char *name1 = NULL, *name2 = NULL;
+	const uint8_t *id1 = NULL, *id2 = NULL;
+	char *tmppath = NULL, *basepath = NULL;
+	FILE *f = NULL;
+	uint64_t postings_idx, npostings = 0, names_size = 0, off;
+	uint32_t i, j, ntokens = 0, nrecords, recno1 = 0, recno2 = 0, n1, n2;
+	int cmp;
+
+	*merged = NULL;
+
+	nrecords = seg1->nrecords + seg2->nrecords;
+
+	tokens = calloc((size_t)seg1->ntokens + seg2->ntokens,
+	    sizeof(*tokens));
+	if (tokens == NULL)
+		return got_error_from_errno("calloc");
+
+	i = j = 0;
+	while (i < seg1->ntokens || j < seg2->ntokens) {
+		t = &tokens[ntokens++];
+		t->idx1 = GOT_SEARCH_INDEX_NO_RECNO;
+		t->idx2 = GOT_SEARCH_INDEX_NO_RECNO;
+		n1 = n2 = 0;
+		if (i < seg1->ntokens) {
+			err = get_token(&name1, &postings_idx, &n1, seg1, i);
+			if (err)
+				goto done;
+		}
+		if (j < seg2->ntokens) {
+			err = get_token(&name2, &postings_idx, &n2, seg2, j);
+			if (err)
+				goto done;
+		}
+		if (i >= seg1->ntokens)
+			cmp = 1;
+		else if (j >= seg2->ntokens)
+			cmp = -1;
+		else
+			cmp = strcmp(name1, name2);
+		if (cmp <= 0) {
+			t->name = name1;
+			t->idx1 = i++;
+			npostings += n1;
+		}
+		if (cmp >= 0) {
+			t->name = name2;
+			t->idx2 = j++;
+			npostings += n2;
+		}
+		names_size += strlen(t->name) + 1;
+	}
+
+	if (asprintf(&basepath, "%s/segment", index->path) == -1) {
+		err = got_error_from_errno("asprintf");
+		goto done;
+	}
+	err = got_opentemp_named(&tmppath, &f, basepath);
+	if (err)
+		goto done;
+
+	err = write_header(f, nrecords, ntokens, npostings,
+	    seg1->text_size + seg2->text_size, names_size);
+	if (err)
+		goto done;
+
+	err = write_merged_records(f, seg1, seg2, 0, seg1->nrecords, 0);
+	if (err)
+		goto done;
+	err = write_merged_records(f, seg2, seg1, seg1->nrecords, 0,
+	    seg1->text_size);
+	if (err)
+		goto done;
+
+	i = j = 0;
+	while (i < seg1->nrecords || j < seg2->nrecords) {
+		if (i < seg1->nrecords) {
+			err = get_id(&id1, &recno1, seg1, i);
+			if (err)
+				goto done;
+		}
+		if (j < seg2->nrecords) {
+			err = get_id(&id2, &recno2, seg2, j);
+			if (err)
+				goto done;
+		}
+		if (j >= seg2->nrecords || (i < seg1->nrecords &&
+		    memcmp(id1, id2, SHA1_DIGEST_LENGTH) <= 0)) {
+			err = write_data(f, id1, SHA1_DIGEST_LENGTH);
+			if (err == NULL)
+				err = write_val32(f, recno1);
+			i++;
+		} else {
+			err = write_data(f, id2, SHA1_DIGEST_LENGTH);
+			if (err == NULL)
+				err = write_val32(f, recno2 + seg1->nrecords);
+			j++;
+		}
+		if (err)
+			goto done;
+	}
+
+	off = 0;
+	postings_idx = 0;
+	for (i = 0; i < ntokens; i++) {
+		const char *name;
+		uint64_t idx;
+
+		t = &tokens[i];
+		n1 = n2 = 0;
+		if (t->idx1 != GOT_SEARCH_INDEX_NO_RECNO) {
+			err = get_token(&name, &idx, &n1, seg1, t->idx1);
+			if (err)
+				goto done;
+		}
+		if (t->idx2 != GOT_SEARCH_INDEX_NO_RECNO) {
+			err = get_token(&name, &idx, &n2, seg2, t->idx2);
+			if (err)
+				goto done;
+		}
+		err = write_token(f, off, postings_idx, n1 + n2);
+		if (err)
+			goto done;
+		off += strlen(t->name) + 1;
+		postings_idx += n1 + n2;
+	}
+
+	for (i = 0; i < ntokens; i++) {
+		t = &tokens[i];
+		if (t->idx1 != GOT_SEARCH_INDEX_NO_RECNO) {
+			err = write_merged_postings(f, seg1, t->idx1, 0);
+			if (err)
+				goto done;
+		}
+		if (t->idx2 != GOT_SEARCH_INDEX_NO_RECNO) {
+			err = write_merged_postings(f, seg2, t->idx2,
+			    seg1->nrecords);
+			if (err)
+				goto done;
+		}
+	}
+
+	err = write_data(f, seg1->text, seg1->text_size);
+	if (err)
+		goto done;
+	err = write_data(f, seg2->text, seg2->text_size);
+	if (err)
+		goto done;
+
+	for (i = 0; i < ntokens; i++) {
+		err = write_data(f, tokens[i].name,
+		    strlen(tokens[i].name) + 1);
+		if (err)
+			goto done;
+	}
+
+	err = install_segment(merged, index, tmppath, f);
+	f = NULL;
+done:
+	if (f && fclose(f) == EOF && err == NULL)
+		err = got_error_from_errno2("fclose", tmppath);
+	if (tmppath && unlink(tmppath) == -1 && errno != ENOENT &&
+	    err == NULL)
+		err = got_error_from_errno2("unlink", tmppath);
+	free(tmppath);
+	free(basepath);
+	free(tokens);
+	return err;
+}
+
+static const struct got_error *
+remove_segment(struct got_search_index *index,
+    struct got_search_index_segment *seg)
+{
+	const struct got_error *err = NULL;
+
+	if (unlink(seg->path) == -1 && errno != ENOENT)
+		err = got_error_from_errno2("unlink", seg->path);
+	TAILQ_REMOVE(&index->segments, seg, entry);
+	index->nrecords -= seg->nrecords;
+	close_segment(seg);
+	return err;
+}
+
+/*
+ * Merge the two smallest segments while they are of similar size, such
+ * that the number of segments grows logarithmically with the number of
+ * commits in the index.
+ */
+static const struct got_error *
+merge_small_segments(struct got_search_index *index)
+{
+	const struct got_error *err;
+	struct got_search_index_segment *seg, *seg1, *seg2, *merged;
+	int nsegments;
+
+	for (;;) {
+		seg1 = seg2 = NULL;
+		nsegments = 0;
+		TAILQ_FOREACH(seg, &index->segments, entry) {
+			nsegments++;
+			if (seg1 == NULL || seg->nrecords < seg1->nrecords) {
+				seg2 = seg1;
+				seg1 = seg;
+			} else if (seg2 == NULL ||
+			    seg->nrecords < seg2->nrecords)
+				seg2 = seg;
+		}
+		if (nsegments < 2)
+			break;
+		if (nsegments <= GOT_SEARCH_INDEX_MAX_SEGMENTS &&
+		    (uint64_t)seg1->nrecords * 2 < seg2->nrecords)
+			break;
+		if ((uint64_t)seg1->nrecords + seg2->nrecords >=
+		    GOT_SEARCH_INDEX_NO_RECNO)
+			break;
+
+		/* Keep records of the newer segment in front. */
+		if (seg1->seqno < seg2->seqno) {
+			seg = seg1;
+			seg1 = seg2;
+			seg2 = seg;
+		}
+		err = merge_segments(&merged, index, seg1, seg2);
+		if (err)
+			return err;
+		err = remove_segment(index, seg1);
+		if (err)
+			return err;
+		err = remove_segment(index, seg2);
+		if (err)
+			return err;
+	}
+
+	return NULL;
+}
+
+/* Remove temporary files left behind by interrupted updates. */
+static const struct got_error *
+remove_stale_files(struct got_search_index *index)
+{
+	const struct got_error *err = NULL;
+	DIR *dir;
+	struct dirent *dent;
+	char *path;
+
+	dir = opendir(index->path);
+	if (dir == NULL)
+		return got_error_from_errno2("opendir", index->path);
+
+	while ((dent = readdir(dir)) != NULL) {
+		if (strncmp(dent->d_name, "segment-", 8) != 0)
+			continue;
+		if (asprintf(&path, "%s/%s", index->path,
+		    dent->d_name) == -1) {
+			err = got_error_from_errno("asprintf");
+			break;
+		}
+		if (unlink(path) == -1 && errno != ENOENT)
+			err = got_error_from_errno2("unlink", path);
+		free(path);
+		if (err)
+			break;
+	}
+
+	if (closedir(dir) == -1 && err == NULL)
+		err = got_error_from_errno2("closedir", index->path);
+	return err;
+}
+
+static const struct got_error *
+read_new_record(struct got_search_index_new_record *rec,
+    struct got_object_id *id, struct got_repository *repo)
+{
+	const struct got_error *err;
+	struct got_commit_object *commit;
+	const struct got_object_id_queue *parent_ids;
+	struct got_object_qid *pid;
+	const char *author, *committer;
+	char *logmsg = NULL;
+	size_t author_len, committer_len, logmsg_len;
+
+	memset(rec, 0, sizeof(*rec));
+
+	err = got_object_open_as_commit(&commit, repo, id);
+	if (err)
+		return err;
+	err = got_object_commit_get_logmsg(&logmsg, commit);
+	if (err)
+		goto done;
+
+	author = got_object_commit_get_author(commit);
+	committer = got_object_commit_get_committer(commit);
+	author_len = strlen(author) + 1;
+	committer_len = strlen(committer) + 1;
+	logmsg_len = strlen(logmsg) + 1;
+	rec->len = author_len + committer_len + logmsg_len;
+	rec->text = malloc(rec->len);
+	if (rec->text == NULL) {
+		err = got_error_from_errno("malloc");
+		goto done;
+	}
+	memcpy(rec->text, author, author_len);
+	memcpy(rec->text + author_len, committer, committer_len);
+	memcpy(rec->text + author_len + committer_len, logmsg, logmsg_len);
+
+	memcpy(&rec->id, id, sizeof(rec->id));
+	parent_ids = got_object_commit_get_parent_ids(commit);
+	pid = SIMPLEQ_FIRST(parent_ids);
+	if (pid) {
+		memcpy(&rec->parent_id, pid->id, sizeof(rec->parent_id));
+		rec->has_parent = 1;
+	}
+done:
+	free(logmsg);
+	got_object_commit_close(commit);
+	return err;
+}
+
+static void
+free_new_records(struct got_search_index_new_record *records,
+    uint32_t nrecords)
+{
+	uint32_t i;
+
+	for (i = 0; i < nrecords; i++)
+		free(records[i].text);
+}
+
+/*
+ * Follow first-parent links through the index, starting at the specified
+ * record, until a commit is reached which has not been indexed.
+ */
+static const struct got_error *
+skip_indexed_commits(int *have_id, struct got_object_id *id,
+    struct got_search_index *index, struct got_search_index_segment *seg,
+    uint32_t recno, got_cancel_cb cancel_cb, void *cancel_arg)
+{
+	const struct got_error *err;
+	struct got_search_index_record rec;
+	uint64_t nsteps = 0;
+
+	while (seg) {
+		if (cancel_cb) {
+			err = (*cancel_cb)(cancel_arg);
+			if (err)
+				return err;
+		}
+		if (++nsteps > index->nrecords)
+			return got_error_path(seg->path, GOT_ERR_SEARCH_INDEX);
+		err = get_record(&rec, seg, recno);
+		if (err)
+			return err;
+		if ((rec.flags & GOT_SEARCH_INDEX_HAS_PARENT) == 0) {
+			*have_id = 0;
+			return NULL;
+		}
+		if (rec.parent_recno != GOT_SEARCH_INDEX_NO_RECNO) {
+			recno = rec.parent_recno;
+			continue;
+		}
+		memcpy(id->sha1, rec.parent_id, SHA1_DIGEST_LENGTH);
+		err = find_record(&seg, &recno, index, id);
+		if (err)
+			return err;
+	}
+
+	return NULL;
+}
+
+/* Check whether all commits along first-parent links have been indexed. */
+static const struct got_error *
+is_indexed(int *indexed, struct got_object_id *id,
+    struct got_search_index *index, got_cancel_cb cancel_cb, void *cancel_arg)
+{
+	const struct got_error *err;
+	struct got_search_index_segment *seg;
+	struct got_object_id next;
+	uint32_t recno;
+	int have_next;
+
+	*indexed = 0;
+
+	memcpy(&next, id, sizeof(next));
+	err = find_record(&seg, &recno, index, &next);
+	if (err || seg == NULL)
+		return err;
+	err = skip_indexed_commits(&have_next, &next, index, seg, recno,
+	    cancel_cb, cancel_arg);
+	if (err)
+		return err;
+	*indexed = !have_next;
+	return NULL;
+}
+
+const struct got_error *
+got_search_index_update(struct got_search_index *index,
+    struct got_object_id *id, struct got_repository *repo,
+    got_cancel_cb cancel_cb, void *cancel_arg)
+{
+	const struct got_error *err, *unlock_err;
+	struct got_lockfile *lf;
+	struct got_search_index_segment *seg;
+	struct got_search_index_new_record *records = NULL;
+	struct got_object_id next;
+	uint32_t nrecords = 0, recno;
+	int have_next = 1, indexed;
+	char *lock_path;
+
+	err = is_indexed(&indexed, id, index, cancel_cb, cancel_arg);
+	if (err || indexed)
+		return err;
+
+	if (asprintf(&lock_path, "%s/%s", index->path,
+	    GOT_SEARCH_INDEX_LOCK) == -1)
+		return got_error_from_errno("asprintf");
+	err = got_lockfile_lock(&lf, lock_path);
+	free(lock_path);
+	if (err) {
+		/* The index can still be searched if it cannot be updated. */
+		if (err->code == GOT_ERR_ERRNO &&
+		    (errno == EACCES || errno == EROFS))
+			return NULL;
+		return err;
+	}
+
+	/* Pick up segments written by other processes. */
+	err = load_segments(index);
+	if (err)
+		goto done;
+	err = remove_stale_files(index);
+	if (err)
+		goto done;
+
+	records = calloc(GOT_SEARCH_INDEX_SEGMENT_MAX, sizeof(*records));
+	if (records == NULL) {
+		err = got_error_from_errno("calloc");
+		goto done;
+	}
+
+	memcpy(&next, id, sizeof(next));
+	while (have_next) {
+		if (cancel_cb) {
+			err = (*cancel_cb)(cancel_arg);
+			if (err)
+				goto done;
+		}
+
+		err = find_record(&seg, &recno, index, &next);
+		if (err)
+			goto done;
+		if (seg) {
+			err = skip_indexed_commits(&have_next, &next, index,
+			    seg, recno, cancel_cb, cancel_arg);
+			if (err)
+				goto done;
+			continue;
+		}
+
+		err = read_new_record(&records[nrecords], &next, repo);
+		if (err)
+			goto done;
+		if (records[nrecords].has_parent)
+			memcpy(&next, &records[nrecords].parent_id,
+			    sizeof(next));
+		else
+			have_next = 0;
+		nrecords++;
+
+		if (nrecords == GOT_SEARCH_INDEX_SEGMENT_MAX) {
+			err = write_new_segment(index, records, nrecords);
+			if (err)
+				goto done;
+			free_new_records(records, nrecords);
+			nrecords = 0;
+		}
+	}
+	if (nrecords > 0) {
+		err = write_new_segment(index, records, nrecords);
+		if (err)
+			goto done;
+	}
+
+	err = merge_small_segments(index);
+done:
+	if (records) {
+		free_new_records(records, nrecords);
+		free(records);
+	}
+	unlock_err = got_lockfile_unlock(lf);
+	if (unlock_err && err == NULL)
+		err = unlock_err;
+	return err;
+}
+
+static void
+free_words(char **words, int nwords)
+{
+	int i;
+
+	for (i = 0; i < nwords; i++)
+		free(words[i]);
+	free(words);
+}
+
+static const struct got_error *
+add_word(char ***words, int *nwords, const char *word, size_t len)
+{
+	char **new;
+
+	if (len < GOT_SEARCH_INDEX_MIN_TOKEN)
+		return NULL;
+
+	new = reallocarray(*words, *nwords + 1, sizeof(**words));
+	if (new == NULL)
+		return got_error_from_errno("reallocarray");
+	*words = new;
+	(*words)[*nwords] = strndup(word, len);
+	if ((*words)[*nwords] == NULL)
+		return got_error_from_errno("strndup");
+	(*nwords)++;
+	return NULL;
+}
+
+/*
+ * Find words which must be part of any text matched by an extended
+ * regular expression. Only literal characters outside of groups are
+ * considered, and no words are returned if the expression contains
+ * alternatives.
+ */
+static const struct got_error *
+get_search_words(char ***words, int *nwords, const char *pattern)
+{
+	const struct got_error *err = NULL;
+	const char *p;
+	char *word;
+	size_t len = 0;
+
+	*words = NULL;
+	*nwords = 0;
+
+	word = malloc(strlen(pattern) + 1);
+	if (word == NULL)
+		return got_error_from_errno("malloc");
+
+	for (p = pattern; *p != '\0'; p++) {
+		switch (*p) {
+		case '|':
+		case '(':
+		case ')':
+			free_words(*words, *nwords);
+			*words = NULL;
+			*nwords = 0;
+			goto done;
+		case '*':
+		case '?':
+		case '{':
+			/* The preceding character is optional. */
+			if (len > 0)
+				len--;
+			err = add_word(words, nwords, word, len);
+			len = 0;
+			if (*p == '{') {
+				while (p[1] != '\0' && p[1] != '}')
+					p++;
+			}
+			break;
+		case '\\':
+			err = add_word(words, nwords, word, len);
+			len = 0;
+			if (p[1] != '\0')
+				p++;
+			break;
+		case '[':
+			err = add_word(words, nwords, word, len);
+			len = 0;
+			/* Skip the bracket expression. */
+			p++;
+			if (*p == '^')
+				p++;
+			if (*p == ']')
+				p++;
+			while (*p != '\0' && *p != ']') {
+				if (p[0] == '[' && (p[1] == ':' ||
+				    p[1] == '.' || p[1] == '=')) {
+					char delim = p[1];
+					p += 2;
+					while (*p != '\0' &&
+					    !(p[0] == delim && p[1] == ']'))
+						p++;
+					if (*p != '\0')
+						p++;
+				}
+				if (*p != '\0')
+					p++;
+			}
+			if (*p == '\0')
+				p--;
+			break;
+		default:
+			if (is_token_char(*p))
+				word[len++] = to_lower(*p);
+			else {
+				err = add_word(words, nwords, word, len);
+				len = 0;
+			}
+			break;
+		}
+		if (err)
+			goto done;
+	}
+	err = add_word(words, nwords, word, len);
+done:
+	free(word);
+	if (err) {
+		free_words(*words, *nwords);
+		*words = NULL;
+		*nwords = 0;
+	}
+	return err;
+}
+
+static int
+is_hex_word(const char *word)
+{
+	for (; *word != '\0'; word++) {
+		if ((*word < '0' || *word > '9') &&
+		    (*word < 'a' || *word > 'f'))
+			return 0;
+	}
+	return 1;
+}
+
+static void
+set_bit(uint8_t *bitmap, uint32_t n)
+{
+	bitmap[n / 8] |= (1 << (n % 8));
+}
+
+static int
+get_bit(const uint8_t *bitmap, uint32_t n)
+{
+	return (bitmap[n / 8] & (1 << (n % 8))) != 0;
+}
+
+/* Find records which contain all of the given words. */
+static const struct got_error *
+find_candidates(struct got_search_index_segment *seg, char **words,
+    int nwords)
+{
+	const struct got_error *err = NULL;
+	const char *name;
+	const uint8_t *sha1;
+	char hex[SHA1_DIGEST_STRING_LENGTH];
+	uint8_t *matches;
+	uint64_t postings_idx;
+	uint32_t i, j, npostings, recno;
+	size_t nbytes = (seg->nrecords + 7) / 8;
+	int w;
+
+	free(seg->candidates);
+	seg->candidates = NULL;
+	if (seg->nrecords == 0)
+		return NULL;
+
+	seg->candidates = malloc(nbytes);
+	if (seg->candidates == NULL)
+		return got_error_from_errno("malloc");
+	memset(seg->candidates, 0xff, nbytes);
+
+	matches = malloc(nbytes);
+	if (matches == NULL) {
+		err = got_error_from_errno("malloc");
+		goto done;
+	}
+
+	for (w = 0; w < nwords; w++) {
+		memset(matches, 0, nbytes);
+		for (i = 0; i < seg->ntokens; i++) {
+			err = get_token(&name, &postings_idx, &npostings,
+			    seg, i);
+			if (err)
+				goto done;
+			if (strstr(name, words[w]) == NULL)
+				continue;
+			for (j = 0; j < npostings; j++) {
+				err = get_posting(&recno, seg,
+				    postings_idx + j);
+				if (err)
+					goto done;
+				set_bit(matches, recno);
+			}
+		}
+
+		/* Commit IDs are matched as well. */
+		if (is_hex_word(words[w])) {
+			for (i = 0; i < seg->nrecords; i++) {
+				err = get_id(&sha1, &recno, seg, i);
+				if (err)
+					goto done;
+				if (got_sha1_digest_to_str(sha1, hex,
+				    sizeof(hex)) == NULL) {
+					err = got_error(GOT_ERR_BAD_OBJ_ID_STR);
+					goto done;
+				}
+				if (strstr(hex, words[w]))
+					set_bit(matches, recno);
+			}
+		}
+
+		for (i = 0; i < nbytes; i++)
+			seg->candidates[i] &= matches[i];
+	}
+done:
+	free(matches);
+	if (err) {
+		free(seg->candidates);
+		seg->candidates = NULL;
+	}
+	return err;
+}
+
+/* Report a commit which has not been indexed yet. */
+static const struct got_error *
+search_unindexed_commit(int *have_id, struct got_object_id *id,
+    struct got_repository *repo, got_search_index_cb cb, void *cb_arg)
+{
+	const struct got_error *err;
+	struct got_commit_object *commit;
+	const struct got_object_id_queue *parent_ids;
+	struct got_object_qid *pid;
+	struct got_search_index_entry entry;
+	char *logmsg = NULL;
+
+	err = got_object_open_as_commit(&commit, repo, id);
+	if (err)
+		return err;
+	err = got_object_commit_get_logmsg(&logmsg, commit);
+	if (err)
+		goto done;
+
+	entry.id = id;
+	entry.author = got_object_commit_get_author(commit);
+	entry.committer = got_object_commit_get_committer(commit);
+	entry.logmsg = logmsg;
+	entry.indexed = 0;
+	err = cb(cb_arg, &entry);
+	if (err)
+		goto done;
+
+	parent_ids = got_object_commit_get_parent_ids(commit);
+	pid = SIMPLEQ_FIRST(parent_ids);
+	if (pid)
+		memcpy(id, pid->id, sizeof(*id));
+	else
+		*have_id = 0;
+done:
+	free(logmsg);
+	got_object_commit_close(commit);
+	return err;
+}
+
+const struct got_error *
+got_search_index_search(struct got_search_index *index,
+    struct got_object_id *start_id, const char *pattern,
+    struct got_repository *repo, got_search_index_cb cb, void *cb_arg,
+    got_cancel_cb cancel_cb, void *cancel_arg)
+{
+	const struct got_error *err = NULL;
+	struct got_search_index_segment *seg;
+	struct got_search_index_record rec;
+	struct got_search_index_entry entry;
+	struct got_object_id id;
+	char **words;
+	int nwords, have_id = 1;
+	uint32_t recno;
+	uint64_t nsteps = 0;
+
+	err = get_search_words(&words, &nwords, pattern);
+	if (err)
+		return err;
+
+	TAILQ_FOREACH(seg, &index->segments, entry) {
+		free(seg->candidates);
+		seg->candidates = NULL;
+		if (nwords > 0) {
+			err = find_candidates(seg, words, nwords);
+			if (err)
+				goto done;
+		}
+	}
+
+	memcpy(&id, start_id, sizeof(id));
+	err = find_record(&seg, &recno, index, &id);
+	if (err)
+		goto done;
+	while (have_id) {
+		if (cancel_cb) {
+			err = (*cancel_cb)(cancel_arg);
+			if (err)
+				break;
+		}
+
+		if (seg == NULL) {
+			err = search_unindexed_commit(&have_id, &id, repo,
+			    cb, cb_arg);
+			if (err)
+				break;
+			if (have_id) {
+				err = find_record(&seg, &recno, index, &id);
+				if (err)
+					break;
+			}
+			continue;
+		}
+
+		if (++nsteps > index->nrecords) {
+			err = got_error_path(seg->path, GOT_ERR_SEARCH_INDEX);
+			break;
+		}
+		err = get_record(&rec, seg, recno);
+		if (err)
+			break;
+		if (seg->candidates == NULL ||
+		    get_bit(seg->candidates, recno)) {
+			memcpy(id.sha1, rec.id, SHA1_DIGEST_LENGTH);
+			entry.id = &id;
+			entry.author = rec.author;
+			entry.committer = rec.committer;
+			entry.logmsg = rec.logmsg;
+			entry.indexed = 1;
+			err = cb(cb_arg, &entry);
+			if (err)
+				break;
+		}
+
+		if ((rec.flags & GOT_SEARCH_INDEX_HAS_PARENT) == 0)
+			break;
+		if (rec.parent_recno != GOT_SEARCH_INDEX_NO_RECNO) {
+			recno = rec.parent_recno;
+			continue;
+		}
+		memcpy(id.sha1, rec.parent_id, SHA1_DIGEST_LENGTH);
+		err = find_record(&seg, &recno, index, &id);
+		if (err)
+			break;
+	}
+done:
+	if (err && err->code == GOT_ERR_ITER_COMPLETED)
+		err = NULL;
+	free_words(words, nwords);
+	return err;
+}
@@ -16,47 +16,93 @@
 
 #include <sys/types.h>
 #include <sha1.h>
-#include <errno.h>
+#include <endian.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <limits.h>
+#include <string.h>
+
+#if !defined(GOT_SHA1_NO_SHANI) && defined(__GNUC__) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define GOT_SHA1_HAVE_SHANI
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#ifdef GOT_SHA1DC
+/* Keep the SHA1_CTX of libsha1detectcoll apart from the one in <sha1.h>. */
+#define SHA1_CTX SHA1DC_CTX
+#include <sha1dc/sha1.h>
+#undef SHA1_CTX
+#endif
 
 #include "got_lib_sha1.h"
 
+#ifndef MIN
+#define	MIN(_a,_b) ((_a) < (_b) ? (_a) : (_b))
+#endif
+
+#ifndef nitems
+#define nitems(_a) (sizeof(_a) / sizeof((_a)[0]))
+#endif
+
+/* Maps ASCII characters to hex digit values, or -1 if not a hex digit. */
+static const int8_t hex_values[256] = {
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+	-1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
+static const char hex_digits[] = "0123456789abcdef";
+
 int
 got_parse_xdigit(uint8_t *val, const char *hex)
 {
-	char *ep;
-	long lval;
+	int hi, lo;
 
-	errno = 0;
-	lval = strtol(hex, &ep, 16);
-	if (hex[0] == '\0' || *ep != '\0')
+	hi = hex_values[(uint8_t)hex[0]];
+	if (hi == -1)
 		return 0;
-	if (errno == ERANGE && (lval == LONG_MAX || lval == LONG_MIN))
+	if (hex[1] == '\0') {
+		*val = hi;
+		return 1;
+	}
+	lo = hex_values[(uint8_t)hex[1]];
+	if (lo == -1 || hex[2] != '\0')
 		return 0;
 
-	*val = (uint8_t)lval;
+	*val = (hi << 4) | lo;
 	return 1;
 }
 
 int
 got_parse_sha1_digest(uint8_t *digest, const char *line)
 {
-	uint8_t b = 0;
-	char hex[3] = {'\0', '\0', '\0'};
-	int i, j;
+	int i, hi, lo;
 
 	for (i = 0; i < SHA1_DIGEST_LENGTH; i++) {
-		if (line[0] == '\0' || line[1] == '\0')
+		/* A NUL maps to -1, so we never read past the string. */
+		hi = hex_values[(uint8_t)line[0]];
+		if (hi == -1)
 			return 0;
-		for (j = 0; j < 2; j++) {
-			hex[j] = *line;
-			line++;
-		}
-		if (!got_parse_xdigit(&b, hex))
+		lo = hex_values[(uint8_t)line[1]];
+		if (lo == -1)
 			return 0;
-		digest[i] = b;
+		digest[i] = (hi << 4) | lo;
+		line += 2;
 	}
 
 	return 1;
@@ -66,19 +112,328 @@ char *
 got_sha1_digest_to_str(const uint8_t *digest, char *buf, size_t size)
 {
 	char *p = buf;
-	char hex[3];
 	int i;
 
 	if (size < SHA1_DIGEST_STRING_LENGTH)
 		return NULL;
 
 	for (i = 0; i < SHA1_DIGEST_LENGTH; i++) {
-		snprintf(hex, sizeof(hex), "%.2x", digest[i]);
-		p[0] = hex[0];
-		p[1] = hex[1];
+		p[0] = hex_digits[digest[i] >> 4];
+		p[1] = hex_digits[digest[i] & 0x0f];
 		p += 2;
 	}
 	p[0] = '\0';
 
 	return buf;
 }
+
+/*
+ * Parse a hex string of up to SHA1_DIGEST_STRING_LENGTH - 1 digits into
+ * the leading bytes of digest. An odd trailing digit is stored in the
+ * high nibble of the last byte. The number of hex digits parsed is
+ * returned in *ndigits.
+ */
+int
+got_parse_sha1_digest_prefix(uint8_t *digest, size_t *ndigits,
+    const char *prefix)
+{
+	size_t len, i;
+	int val;
+
+	*ndigits = 0;
+
+	len = strlen(prefix);
+	if (len == 0 || len > SHA1_DIGEST_STRING_LENGTH - 1)
+		return 0;
+
+	memset(digest, 0, SHA1_DIGEST_LENGTH);
+	for (i = 0; i < len; i++) {
+		val = hex_values[(uint8_t)prefix[i]];
+		if (val == -1)
+			return 0;
+		digest[i / 2] |= (i % 2) ? val : (val << 4);
+	}
+
+	*ndigits = len;
+	return 1;
+}
+
+/*
+ * Compare the first ndigits hex digits of a digest to a prefix parsed
+ * with got_parse_sha1_digest_prefix(). Sorts like memcmp(3) would.
+ */
+int
+got_sha1_digest_prefix_cmp(const uint8_t *digest, const uint8_t *prefix,
+    size_t ndigits)
+{
+	size_t nbytes = ndigits / 2;
+	int cmp;
+
+	cmp = memcmp(digest, prefix, nbytes);
+	if (cmp != 0 || (ndigits % 2) == 0)
+		return cmp;
+
+	return (digest[nbytes] & 0xf0) - (prefix[nbytes] & 0xf0);
+}
+
+#ifdef GOT_SHA1DC
+typedef char got_sha1dc_ctx_fits[
+    sizeof(SHA1DC_CTX) <= sizeof(((struct got_sha1_ctx *)0)->u.sha1dc) ?
+    1 : -1];
+#endif
+
+static int sha1_backend = -1;
+
+#ifdef GOT_SHA1_HAVE_SHANI
+static int
+cpu_has_shani(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return 0;
+	if ((ecx & bit_SSSE3) == 0 || (ecx & bit_SSE4_1) == 0)
+		return 0;
+	if (__get_cpuid_max(0, NULL) < 7)
+		return 0;
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+	return (ebx & (1 << 29)) != 0; /* SHA */
+}
+
+/*
+ * Run four SHA1 rounds on message block 'g' of 20. Message words for
+ * blocks past the first four are computed in place from the previous
+ * four blocks, which live in msg[] in a rolling fashion.
+ */
+#define SHANI_ROUNDS4(g, f) do {					\
+	if ((g) >= 4)							\
+		msg[(g) % 4] = _mm_sha1msg2_epu32(_mm_xor_si128(	\
+		    _mm_sha1msg1_epu32(msg[(g) % 4], msg[((g) + 1) % 4]), \
+		    msg[((g) + 2) % 4]), msg[((g) + 3) % 4]);		\
+	if ((g) == 0)							\
+		e = _mm_add_epi32(e, msg[0]);				\
+	else								\
+		e = _mm_sha1nexte_epu32(e_prev, msg[(g) % 4]);		\
+	e_prev = abcd;							\
+	abcd = _mm_sha1rnds4_epu32(abcd, e, (f));			\
+} while (0)
+
+__attribute__((target("sha,sse4.1")))
+static void
+sha1_blocks_shani(uint32_t state[5], const uint8_t *data, size_t nblocks)
+{
+	const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL,
+	    0x08090a0b0c0d0e0fULL);
+	__m128i abcd, abcd_save, e, e_save, e_prev, msg[4];
+	int i;
+
+	abcd = _mm_loadu_si128((const __m128i *)state);
+	abcd = _mm_shuffle_epi32(abcd, 0x1b);
+	e = _mm_set_epi32(state[4], 0, 0, 0);
+
+	while (nblocks-- > 0) {
+		abcd_save = abcd;
+		e_save = e;
+
+		for (i = 0; i < 4; i++) {
+			msg[i] = _mm_loadu_si128(
+			    (const __m128i *)(data + i * 16));
+			msg[i] = _mm_shuffle_epi8(msg[i], mask);
+		}
+
+		SHANI_ROUNDS4(0, 0);
+		SHANI_ROUNDS4(1, 0);
+		SHANI_ROUNDS4(2, 0);
+		SHANI_ROUNDS4(3, 0);
+		SHANI_ROUNDS4(4, 0);
+		SHANI_ROUNDS4(5, 1);
+		SHANI_ROUNDS4(6, 1);
+		SHANI_ROUNDS4(7, 1);
+		SHANI_ROUNDS4(8, 1);
+		SHANI_ROUNDS4(9, 1);
+		SHANI_ROUNDS4(10, 2);
+		SHANI_ROUNDS4(11, 2);
+		SHANI_ROUNDS4(12, 2);
+		SHANI_ROUNDS4(13, 2);
+		SHANI_ROUNDS4(14, 2);
+		SHANI_ROUNDS4(15, 3);
+		SHANI_ROUNDS4(16, 3);
+		SHANI_ROUNDS4(17, 3);
+		SHANI_ROUNDS4(18, 3);
+		SHANI_ROUNDS4(19, 3);
+
+		e = _mm_sha1nexte_epu32(e_prev, e_save);
+		abcd = _mm_add_epi32(abcd, abcd_save);
+		data += 64;
+	}
+
+	abcd = _mm_shuffle_epi32(abcd, 0x1b);
+	_mm_storeu_si128((__m128i *)state, abcd);
+	state[4] = _mm_extract_epi32(e, 3);
+}
+
+#undef SHANI_ROUNDS4
+#endif /* GOT_SHA1_HAVE_SHANI */
+
+static int
+sha1_backend_available(int backend)
+{
+	switch (backend) {
+	case GOT_SHA1_BACKEND_PORTABLE:
+		return 1;
+#ifdef GOT_SHA1_HAVE_SHANI
+	case GOT_SHA1_BACKEND_SHANI:
+		return cpu_has_shani();
+#endif
+#ifdef GOT_SHA1DC
+	case GOT_SHA1_BACKEND_SHA1DC:
+		return 1;
+#endif
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+int
+got_sha1_get_backend(void)
+{
+	if (sha1_backend != -1)
+		return sha1_backend;
+
+#ifdef GOT_SHA1DC
+	/* Collision detection was asked for at build time; always use it. */
+	sha1_backend = GOT_SHA1_BACKEND_SHA1DC;
+#else
+	if (sha1_backend_available(GOT_SHA1_BACKEND_SHANI))
+		sha1_backend = GOT_SHA1_BACKEND_SHANI;
+	else
+		sha1_backend = GOT_SHA1_BACKEND_PORTABLE;
+#endif
+	return sha1_backend;
+}
+
+int
+got_sha1_set_backend(int backend)
+{
+	if (!sha1_backend_available(backend))
+		return 0;
+
+	sha1_backend = backend;
+	return 1;
+}
+
+void
+got_sha1_init(struct got_sha1_ctx *ctx)
+{
+	static const uint32_t iv[5] = {
+		0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0
+	};
+
+	ctx->backend = got_sha1_get_backend();
+	switch (ctx->backend) {
+	case GOT_SHA1_BACKEND_SHANI:
+		memcpy(ctx->u.block.state, iv, sizeof(iv));
+		ctx->u.block.count = 0;
+		break;
+#ifdef GOT_SHA1DC
+	case GOT_SHA1_BACKEND_SHA1DC:
+		SHA1DCInit((SHA1DC_CTX *)ctx->u.sha1dc);
+		break;
+#endif
+	default:
+		SHA1Init(&ctx->u.portable);
+		break;
+	}
+}
+
+#ifdef GOT_SHA1_HAVE_SHANI
+static void
+sha1_block_update(struct got_sha1_ctx *ctx, const uint8_t *data, size_t len)
+{
+	size_t used = ctx->u.block.count % 64, n;
+
+	ctx->u.block.count += len;
+
+	if (used > 0) {
+		n = MIN(len, 64 - used);
+		memcpy(ctx->u.block.buffer + used, data, n);
+		data += n;
+		len -= n;
+		if (used + n < 64)
+			return;
+		sha1_blocks_shani(ctx->u.block.state, ctx->u.block.buffer, 1);
+	}
+
+	if (len >= 64) {
+		sha1_blocks_shani(ctx->u.block.state, data, len / 64);
+		data += len & ~(size_t)63;
+		len %= 64;
+	}
+
+	memcpy(ctx->u.block.buffer, data, len);
+}
+
+static void
+sha1_block_final(uint8_t *digest, struct got_sha1_ctx *ctx)
+{
+	static const uint8_t pad[64] = { 0x80 };
+	uint64_t nbits = htobe64(ctx->u.block.count * 8);
+	size_t used = ctx->u.block.count % 64, i;
+
+	sha1_block_update(ctx, pad, used < 56 ? 56 - used : 120 - used);
+	sha1_block_update(ctx, (uint8_t *)&nbits, sizeof(nbits));
+
+	for (i = 0; i < nitems(ctx->u.block.state); i++) {
+		uint32_t v = htobe32(ctx->u.block.state[i]);
+		memcpy(digest + i * sizeof(v), &v, sizeof(v));
+	}
+}
+#endif /* GOT_SHA1_HAVE_SHANI */
+
+void
+got_sha1_update(struct got_sha1_ctx *ctx, const uint8_t *data, size_t len)
+{
+	switch (ctx->backend) {
+#ifdef GOT_SHA1_HAVE_SHANI
+	case GOT_SHA1_BACKEND_SHANI:
+		sha1_block_update(ctx, data, len);
+		break;
+#endif
+#ifdef GOT_SHA1DC
+	case GOT_SHA1_BACKEND_SHA1DC:
+		SHA1DCUpdate((SHA1DC_CTX *)ctx->u.sha1dc, (const char *)data,
+		    len);
+		break;
+#endif
+	default:
+		SHA1Update(&ctx->u.portable, data, len);
+		break;
+	}
+}
+
+void
+got_sha1_final(uint8_t *digest, struct got_sha1_ctx *ctx)
+{
+	switch (ctx->backend) {
+#ifdef GOT_SHA1_HAVE_SHANI
+	case GOT_SHA1_BACKEND_SHANI:
+		sha1_block_final(digest, ctx);
+		break;
+#endif
+#ifdef GOT_SHA1DC
+	case GOT_SHA1_BACKEND_SHA1DC:
+		/*
+		 * If a collision attack is detected, SHA1DCFinal() yields a
+		 * "safe" hash which differs from the plain SHA1 digest.
+		 * Attack content will thus fail ID and checksum verification.
+		 */
+		SHA1DCFinal(digest, (SHA1DC_CTX *)ctx->u.sha1dc);
+		break;
+#endif
+	default:
+		SHA1Final(digest, &ctx->u.portable);
+		break;
+	}
+}
@@ -0,0 +1,503 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/queue.h>
+#include <sys/uio.h>
+
+#include <dirent.h>
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sha1.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <imsg.h>
+
+#include "got_compat.h"
+
+#include "got_error.h"
+#include "got_object.h"
+#include "got_repository.h"
+#include "got_cancel.h"
+#include "got_opentemp.h"
+#include "got_verify.h"
+
+#include "got_lib_sha1.h"
+#include "got_lib_delta.h"
+#include "got_lib_object.h"
+#include "got_lib_privsep.h"
+#include "got_lib_pack.h"
+#include "got_lib_object_cache.h"
+#include "got_lib_repository.h"
+
+#ifndef MIN
+#define	MIN(_a,_b) ((_a) < (_b) ? (_a) : (_b))
+#endif
+
+#ifndef MAX
+#define	MAX(_a,_b) ((_a) > (_b) ? (_a) : (_b))
+#endif
+
+/*
+ * Pack files are split into at most this many ranges per worker, to even
+ * out the load if some ranges take longer to verify than others. Ranges
+ * contain at least GOT_VERIFY_RANGE_MIN_OBJECTS objects.
+ */
+#define GOT_VERIFY_RANGES_PER_WORKER	4
+#define GOT_VERIFY_RANGE_MIN_OBJECTS	256
+
+struct got_verify_pack {
+	TAILQ_ENTRY(got_verify_pack) entry;
+	struct got_pack pack;		/* path_packfile, fd, and filesize */
+	struct got_packidx *packidx;
+	int ntasks;			/* tasks not yet completed */
+};
+TAILQ_HEAD(got_verify_pack_head, got_verify_pack);
+
+struct got_verify_task {
+	TAILQ_ENTRY(got_verify_task) entry;
+	struct got_verify_pack *vpack;
+	off_t start;
+	off_t end;
+	int checksum;
+};
+TAILQ_HEAD(got_verify_task_head, got_verify_task);
+
+struct got_verify_worker {
+	struct got_privsep_pack_worker pw;
+	struct got_verify_task *task;	/* NULL if worker is idle */
+};
+
+static const struct got_error *
+close_vpack(struct got_verify_pack *vpack)
+{
+	const struct got_error *err = NULL;
+
+	if (vpack->packidx)
+		err = got_packidx_close(vpack->packidx);
+	if (vpack->pack.fd != -1 && close(vpack->pack.fd) != 0 && err == NULL)
+		err = got_error_from_errno("close");
+	free(vpack->pack.path_packfile);
+	free(vpack);
+	return err;
+}
+
+static int
+cmp_offsets(const void *pa, const void *pb)
+{
+	const off_t a = *(const off_t *)pa, b = *(const off_t *)pb;
+
+	if (a < b)
+		return -1;
+	if (a > b)
+		return 1;
+	return 0;
+}
+
+static const struct got_error *
+add_task(struct got_verify_task_head *tasks, struct got_verify_pack *vpack,
+    off_t start, off_t end, int checksum)
+{
+	struct got_verify_task *task;
+
+	task = calloc(1, sizeof(*task));
+	if (task == NULL)
+		return got_error_from_errno("calloc");
+
+	task->vpack = vpack;
+	task->start = start;
+	task->end = end;
+	task->checksum = checksum;
+	TAILQ_INSERT_TAIL(tasks, task, entry);
+	vpack->ntasks++;
+	return NULL;
+}
+
+/*
+ * Open a pack file and its index, and queue tasks which verify the pack
+ * file's checksum and its objects. Objects are split into ranges of roughly
+ * equal size in bytes along the object offsets listed in the pack index.
+ */
+static const struct got_error *
+queue_pack(struct got_verify_pack **vpackp, int *nobjects,
+    struct got_verify_pack_head *vpacks,
+    struct got_verify_task_head *tasks, struct got_repository *repo,
+    const char *idxname, int nworkers, got_verify_problem_cb problem_cb,
+    void *problem_arg)
+{
+	const struct got_error *err = NULL;
+	struct got_verify_pack *vpack;
+	char *path_packidx = NULL;
+	off_t *offsets = NULL, start, end, target, range_size;
+	uint32_t nobj, i;
+	int nranges, n;
+	struct stat sb;
+
+	*vpackp = NULL;
+	*nobjects = 0;
+
+	vpack = calloc(1, sizeof(*vpack));
+	if (vpack == NULL)
+		return got_error_from_errno("calloc");
+	vpack->pack.fd = -1;
+
+	if (asprintf(&path_packidx, "%s/%s", GOT_OBJECTS_PACK_DIR,
+	    idxname) == -1) {
+		err = got_error_from_errno("asprintf");
+		goto done;
+	}
+	if (asprintf(&vpack->pack.path_packfile, "%.*s%s",
+	    (int)(strlen(path_packidx) - strlen(GOT_PACKIDX_SUFFIX)),
+	    path_packidx, GOT_PACKFILE_SUFFIX) == -1) {
+		err = got_error_from_errno("asprintf");
+		vpack->pack.path_packfile = NULL;
+		goto done;
+	}
+
+	err = got_packidx_open(&vpack->packidx, got_repo_get_fd(repo),
+	    path_packidx, 1);
+	if (err) {
+		if (err->code != GOT_ERR_BAD_PACKIDX &&
+		    err->code != GOT_ERR_PACKIDX_CSUM)
+			goto done;
+		vpack->packidx = NULL;
+		err = problem_cb(problem_arg, vpack->pack.path_packfile, NULL,
+		    0, GOT_VERIFY_BAD_PACKIDX);
+		goto done;
+	}
+
+	vpack->pack.fd = openat(got_repo_get_fd(repo),
+	    vpack->pack.path_packfile, O_RDONLY | O_NOFOLLOW);
+	if (vpack->pack.fd == -1) {
+		err = got_error_from_errno2("openat",
+		    vpack->pack.path_packfile);
+		goto done;
+	}
+	if (fstat(vpack->pack.fd, &sb) != 0) {
+		err = got_error_from_errno2("fstat", vpack->pack.path_packfile);
+		goto done;
+	}
+	vpack->pack.filesize = sb.st_size;
+	end = vpack->pack.filesize - SHA1_DIGEST_LENGTH;
+
+	nobj = be32toh(vpack->packidx->hdr.fanout_table[0xff]);
+	offsets = calloc(nobj > 0 ? nobj : 1, sizeof(*offsets));
+	if (offsets == NULL) {
+		err = got_error_from_errno("calloc");
+		goto done;
+	}
+	n = 0;
+	for (i = 0; i < nobj; i++) {
+		struct got_object_id id;
+		off_t offset;
+
+		offset = got_packidx_get_object_offset(vpack->packidx, i);
+		if (offset >= (off_t)sizeof(struct got_packfile_hdr) &&
+		    offset < end) {
+			offsets[n++] = offset;
+			continue;
+		}
+		/* Offsets outside of the pack file are never verified. */
+		memcpy(id.sha1, vpack->packidx->hdr.sorted_ids[i].sha1,
+		    sizeof(id.sha1));
+		err = problem_cb(problem_arg, vpack->pack.path_packfile, &id,
+		    offset, GOT_VERIFY_BAD_OBJ_DATA);
+		if (err)
+			goto done;
+	}
+	qsort(offsets, n, sizeof(offsets[0]), cmp_offsets);
+
+	err = add_task(tasks, vpack, 0, 0, 1);
+	if (err)
+		goto done;
+
+	if (n > 0) {
+		nranges = MIN(nworkers * GOT_VERIFY_RANGES_PER_WORKER,
+		    n / GOT_VERIFY_RANGE_MIN_OBJECTS);
+		nranges = MAX(nranges, 1);
+		range_size = (end - offsets[0]) / nranges;
+		start = offsets[0];
+		target = start + range_size;
+		for (i = 1; i < n && nranges > 1; i++) {
+			if (offsets[i] < target)
+				continue;
+			err = add_task(tasks, vpack, start, offsets[i], 0);
+			if (err)
+				goto done;
+			start = offsets[i];
+			target = start + range_size;
+			nranges--;
+		}
+		err = add_task(tasks, vpack, start, end, 0);
+		if (err)
+			goto done;
+	}
+
+	*nobjects = n;
+done:
+	free(path_packidx);
+	free(offsets);
+	if (err || vpack->packidx == NULL) {
+		struct got_verify_task *task, *next;
+
+		for (task = TAILQ_FIRST(tasks); task; task = next) {
+			next = TAILQ_NEXT(task, entry);
+			if (task->vpack != vpack)
+				continue;
+			TAILQ_REMOVE(tasks, task, entry);
+			free(task);
+		}
+		close_vpack(vpack);
+	} else {
+		TAILQ_INSERT_TAIL(vpacks, vpack, entry);
+		*vpackp = vpack;
+	}
+	return err;
+}
+
+static const struct got_error *
+send_task(struct got_verify_worker *worker, struct got_verify_task *task,
+    struct got_repository *repo)
+{
+	const struct got_error *err;
+	int i, fd;
+
+	err = got_privsep_pack_worker_switch(&worker->pw,
+	    got_repo_get_fd(repo), task->vpack->pack.path_packfile,
+	    task->vpack->packidx);
+	if (err)
+		return err;
+
+	err = got_privsep_send_pack_verify_req(&worker->pw.ibuf, task->start,
+	    task->end, task->checksum);
+	if (err)
+		return err;
+
+	if (!task->checksum) {
+		/* Temporary files for objects too large to verify in memory. */
+		for (i = 0; i < 3; i++) {
+			fd = got_opentempfd();
+			if (fd == -1)
+				return got_error_from_errno("got_opentempfd");
+			err = got_privsep_send_tmpfd(&worker->pw.ibuf, fd);
+			if (err)
+				return err;
+		}
+	}
+
+	worker->task = task;
+	return NULL;
+}
+
+static const struct got_error *
+recv_task_result(int *nobjects, struct got_verify_worker *worker,
+    got_verify_problem_cb problem_cb, void *problem_arg)
+{
+	const struct got_error *err;
+	struct got_imsg_pack_verify_problem *problems;
+	struct got_verify_pack *vpack = worker->task->vpack;
+	struct got_object_id id;
+	int i, nproblems;
+
+	err = got_privsep_recv_pack_verify_result(&problems, &nproblems,
+	    nobjects, &worker->pw.ibuf);
+	if (err)
+		return err;
+
+	for (i = 0; i < nproblems; i++) {
+		memcpy(id.sha1, problems[i].id, sizeof(id.sha1));
+		err = problem_cb(problem_arg, vpack->pack.path_packfile,
+		    problems[i].problem == GOT_VERIFY_BAD_PACK_CHECKSUM ?
+		    NULL : &id, problems[i].offset, problems[i].problem);
+		if (err)
+			break;
+	}
+
+	free(problems);
+	free(worker->task);
+	worker->task = NULL;
+	return err;
+}
+
+const struct got_error *
+got_verify_packs(int *npacks, int *nobjects, struct got_repository *repo,
+    int nworkers, got_verify_problem_cb problem_cb, void *problem_arg,
+    got_cancel_cb cancel_cb, void *cancel_arg)
+{
+	const struct got_error *err = NULL, *stop_err;
+	struct got_verify_pack_head vpacks;
+	struct got_verify_task_head tasks;
+	struct got_verify_worker *workers = NULL;
+	struct got_verify_pack *vpack;
+	struct got_verify_task *task;
+	struct pollfd *pfd = NULL;
+	DIR *packdir = NULL;
+	struct dirent *dent;
+	int packdir_fd, i, n, nbusy = 0, packs_done = 0;
+
+	*npacks = 0;
+	*nobjects = 0;
+	TAILQ_INIT(&vpacks);
+	TAILQ_INIT(&tasks);
+
+	if (nworkers < 1)
+		nworkers = 1;
+
+	packdir_fd = openat(got_repo_get_fd(repo), GOT_OBJECTS_PACK_DIR,
+	    O_DIRECTORY);
+	if (packdir_fd == -1) {
+		if (errno != ENOENT)
+			err = got_error_from_errno2("openat",
+			    GOT_OBJECTS_PACK_DIR);
+		return err;
+	}
+	packdir = fdopendir(packdir_fd);
+	if (packdir == NULL) {
+		err = got_error_from_errno("fdopendir");
+		close(packdir_fd);
+		return err;
+	}
+
+	workers = calloc(nworkers, sizeof(*workers));
+	pfd = calloc(nworkers, sizeof(*pfd));
+	if (workers == NULL || pfd == NULL) {
+		err = got_error_from_errno("calloc");
+		goto done;
+	}
+	for (i = 0; i < nworkers; i++)
+		workers[i].pw.imsg_fd = -1;
+
+	for (;;) {
+		if (cancel_cb) {
+			err = (*cancel_cb)(cancel_arg);
+			if (err)
+				break;
+		}
+
+		/* Open one pack at a time to bound the number of open files. */
+		while (TAILQ_EMPTY(&tasks) && !packs_done) {
+			dent = readdir(packdir);
+			if (dent == NULL) {
+				packs_done = 1;
+				break;
+			}
+			if (!got_repo_is_packidx_filename(dent->d_name,
+			    strlen(dent->d_name)))
+				continue;
+			err = queue_pack(&vpack, &n, &vpacks, &tasks, repo,
+			    dent->d_name, nworkers, problem_cb, problem_arg);
+			if (err)
+				goto done;
+			if (vpack == NULL)
+				continue;
+			(*npacks)++;
+			*nobjects += n;
+		}
+
+		/* Hand out tasks to idle workers. */
+		for (i = 0; i < nworkers && !TAILQ_EMPTY(&tasks); i++) {
+			if (workers[i].task)
+				continue;
+			if (workers[i].pw.imsg_fd == -1) {
+				err = got_privsep_pack_worker_start(
+				    &workers[i].pw, got_repo_get_path(repo));
+				if (err)
+					goto done;
+			}
+			task = TAILQ_FIRST(&tasks);
+			TAILQ_REMOVE(&tasks, task, entry);
+			err = send_task(&workers[i], task, repo);
+			if (err) {
+				if (workers[i].task == NULL)
+					free(task);
+				goto done;
+			}
+			nbusy++;
+		}
+
+		if (nbusy == 0)
+			break;
+
+		n = 0;
+		for (i = 0; i < nworkers; i++) {
+			if (workers[i].task == NULL)
+				continue;
+			pfd[n].fd = workers[i].pw.imsg_fd;
+			pfd[n].events = POLLIN;
+			pfd[n].revents = 0;
+			n++;
+		}
+		if (poll(pfd, n, INFTIM) == -1) {
+			if (errno == EINTR)
+				continue;
+			err = got_error_from_errno("poll");
+			goto done;
+		}
+
+		n = 0;
+		for (i = 0; i < nworkers; i++) {
+			int nverified;
+
+			if (workers[i].task == NULL)
+				continue;
+			if (pfd[n++].revents == 0)
+				continue;
+			vpack = workers[i].task->vpack;
+			err = recv_task_result(&nverified, &workers[i],
+			    problem_cb, problem_arg);
+			if (err)
+				goto done;
+			nbusy--;
+			if (--vpack->ntasks > 0)
+				continue;
+			TAILQ_REMOVE(&vpacks, vpack, entry);
+			err = close_vpack(vpack);
+			if (err)
+				goto done;
+		}
+	}
+done:
+	for (i = 0; i < nworkers && workers; i++) {
+		if (workers[i].pw.imsg_fd == -1)
+			continue;
+		stop_err = got_privsep_pack_worker_stop(&workers[i].pw,
+		    workers[i].task != NULL);
+		free(workers[i].task);
+		if (stop_err && err == NULL)
+			err = stop_err;
+	}
+	while ((task = TAILQ_FIRST(&tasks))) {
+		TAILQ_REMOVE(&tasks, task, entry);
+		free(task);
+	}
+	while ((vpack = TAILQ_FIRST(&vpacks))) {
+		TAILQ_REMOVE(&vpacks, vpack, entry);
+		close_vpack(vpack);
+	}
+	free(workers);
+	free(pfd);
+	if (packdir && closedir(packdir) != 0 && err == NULL)
+		err = got_error_from_errno("closedir");
+	return err;
+}
@@ -5467,6 +5467,10 @@ commit_worktree(struct got_object_id **new_commit_id,
 		goto done;
 	}
 
+	err = got_object_batch_open(repo);
+	if (err)
+		goto done;
+
 	/* Create blobs from added and modified files and record their IDs. */
 	TAILQ_FOREACH(pe, commitable_paths, entry) {
 		struct got_commitable *ct = pe->data;
@@ -5511,6 +5515,11 @@ commit_worktree(struct got_object_id **new_commit_id,
 	if (err)
 		goto done;
 
+	/* Make new objects visible before any reference points at them. */
+	err = got_object_batch_publish(repo);
+	if (err)
+		goto done;
+
 	/* Check if a concurrent commit to our branch has occurred. */
 	head_ref_name = got_worktree_get_head_ref_name(worktree);
 	if (head_ref_name == NULL) {
@@ -5544,6 +5553,7 @@ commit_worktree(struct got_object_id **new_commit_id,
 	if (err)
 		goto done;
 done:
+	got_object_batch_abort(repo);
 	if (head_tree)
 		got_object_tree_close(head_tree);
 	if (head_commit)
@@ -131,7 +131,7 @@ get_obj_type_label(const char **label, int obj_type)
 }
 
 static const struct got_error *
-read_checksum(uint32_t *crc, SHA1_CTX *sha1_ctx, int fd, size_t len)
+read_checksum(uint32_t *crc, struct got_sha1_ctx *sha1_ctx, int fd, size_t len)
 {
 	uint8_t buf[8192];
 	size_t n;
@@ -146,14 +146,14 @@ read_checksum(uint32_t *crc, SHA1_CTX *sha1_ctx, int fd, size_t len)
 		if (crc)
 			*crc = crc32(*crc, buf, r);
 		if (sha1_ctx)
-			SHA1Update(sha1_ctx, buf, r);
+			got_sha1_update(sha1_ctx, buf, r);
 	}
 
 	return NULL;
 }
 
 static const struct got_error *
-read_file_sha1(SHA1_CTX *ctx, FILE *f, size_t len)
+read_file_sha1(struct got_sha1_ctx *ctx, FILE *f, size_t len)
 {
 	uint8_t buf[8192];
 	size_t n, r;
@@ -165,7 +165,7 @@ read_file_sha1(SHA1_CTX *ctx, FILE *f, size_t len)
 				return NULL;
 			return got_ferror(f, GOT_ERR_IO);
 		}
-		SHA1Update(ctx, buf, r);
+		got_sha1_update(ctx, buf, r);
 	}
 
 	return NULL;
@@ -173,10 +173,10 @@ read_file_sha1(SHA1_CTX *ctx, FILE *f, size_t len)
 
 static const struct got_error *
 read_packed_object(struct got_pack *pack, struct got_indexed_object *obj,
-    FILE *tmpfile, SHA1_CTX *pack_sha1_ctx)
+    FILE *tmpfile, struct got_sha1_ctx *pack_sha1_ctx)
 {
 	const struct got_error *err = NULL;
-	SHA1_CTX ctx;
+	struct got_sha1_ctx ctx;
 	uint8_t *data = NULL;
 	size_t datalen = 0;
 	ssize_t n;
@@ -196,7 +196,7 @@ read_packed_object(struct got_pack *pack, struct got_indexed_object *obj,
 
 	if (pack->map) {
 		obj->crc = crc32(obj->crc, pack->map + mapoff, obj->tslen);
-		SHA1Update(pack_sha1_ctx, pack->map + mapoff, obj->tslen);
+		got_sha1_update(pack_sha1_ctx, pack->map + mapoff, obj->tslen);
 		mapoff += obj->tslen;
 	} else {
 		/* XXX Seek back and get the CRC of on-disk type+size bytes. */
@@ -227,18 +227,28 @@ read_packed_object(struct got_pack *pack, struct got_indexed_object *obj,
 				    &obj->len, &csum, pack->fd, tmpfile);
 			}
 		} else {
+			data = malloc(obj->size > 0 ? obj->size : 1);
+			if (data == NULL) {
+				err = got_error_from_errno("malloc");
+				break;
+			}
 			if (pack->map) {
-				err = got_inflate_to_mem_mmap(&data, &datalen,
+				err = got_inflate_to_buf_mmap(data, obj->size,
 				    &obj->len, &csum, pack->map, mapoff,
 				    pack->filesize - mapoff);
 			} else {
-				err = got_inflate_to_mem_fd(&data, &datalen,
-				    &obj->len, &csum, obj->size, pack->fd);
+				err = got_inflate_to_buf_fd(data, obj->size,
+				    &obj->len, &csum, pack->fd);
+			}
+			if (err) {
+				free(data);
+				break;
 			}
+			datalen = obj->size;
 		}
 		if (err)
 			break;
-		SHA1Init(&ctx);
+		got_sha1_init(&ctx);
 		err = get_obj_type_label(&obj_label, obj->type);
 		if (err) {
 			free(data);
@@ -251,14 +261,14 @@ read_packed_object(struct got_pack *pack, struct got_indexed_object *obj,
 			break;
 		}
 		headerlen = strlen(header) + 1;
-		SHA1Update(&ctx, header, headerlen);
+		got_sha1_update(&ctx, header, headerlen);
 		if (obj->size > GOT_DELTA_RESULT_SIZE_CACHED_MAX) {
 			err = read_file_sha1(&ctx, tmpfile, datalen);
 			if (err)
 				break;
 		} else
-			SHA1Update(&ctx, data, datalen);
-		SHA1Final(obj->id.sha1, &ctx);
+			got_sha1_update(&ctx, data, datalen);
+		got_sha1_final(obj->id.sha1, &ctx);
 		free(header);
 		free(data);
 		break;
@@ -273,7 +283,7 @@ read_packed_object(struct got_pack *pack, struct got_indexed_object *obj,
 			    SHA1_DIGEST_LENGTH);
 			obj->crc = crc32(obj->crc, pack->map + mapoff,
 			    SHA1_DIGEST_LENGTH);
-			SHA1Update(pack_sha1_ctx, pack->map + mapoff,
+			got_sha1_update(pack_sha1_ctx, pack->map + mapoff,
 			    SHA1_DIGEST_LENGTH);
 			mapoff += SHA1_DIGEST_LENGTH;
 			err = got_inflate_to_mem_mmap(NULL, &datalen,
@@ -294,8 +304,8 @@ read_packed_object(struct got_pack *pack, struct got_indexed_object *obj,
 			}
 			obj->crc = crc32(obj->crc, obj->delta.ref.ref_id.sha1,
 			    SHA1_DIGEST_LENGTH);
-			SHA1Update(pack_sha1_ctx, obj->delta.ref.ref_id.sha1,
-			    SHA1_DIGEST_LENGTH);
+			got_sha1_update(pack_sha1_ctx,
+			    obj->delta.ref.ref_id.sha1, SHA1_DIGEST_LENGTH);
 			err = got_inflate_to_mem_fd(NULL, &datalen, &obj->len,
 			    &csum, obj->size, pack->fd);
 			if (err)
@@ -314,7 +324,7 @@ read_packed_object(struct got_pack *pack, struct got_indexed_object *obj,
 		if (pack->map) {
 			obj->crc = crc32(obj->crc, pack->map + mapoff,
 			    obj->delta.ofs.base_offsetlen);
-			SHA1Update(pack_sha1_ctx, pack->map + mapoff,
+			got_sha1_update(pack_sha1_ctx, pack->map + mapoff,
 			    obj->delta.ofs.base_offsetlen);
 			mapoff += obj->delta.ofs.base_offsetlen;
 			err = got_inflate_to_mem_mmap(NULL, &datalen,
@@ -353,11 +363,11 @@ read_packed_object(struct got_pack *pack, struct got_indexed_object *obj,
 }
 
 static const struct got_error *
-hwrite(int fd, void *buf, int len, SHA1_CTX *ctx)
+hwrite(int fd, void *buf, int len, struct got_sha1_ctx *ctx)
 {
 	ssize_t w;
 
-	SHA1Update(ctx, buf, len);
+	got_sha1_update(ctx, buf, len);
 
 	w = write(fd, buf, len);
 	if (w == -1)
@@ -378,7 +388,7 @@ resolve_deltified_object(struct got_pack *pack, struct got_packidx *packidx,
 	struct got_delta *delta;
 	uint8_t *buf = NULL;
 	size_t len = 0;
-	SHA1_CTX ctx;
+	struct got_sha1_ctx ctx;
 	char *header = NULL;
 	size_t headerlen;
 	uint64_t max_size;
@@ -423,15 +433,15 @@ resolve_deltified_object(struct got_pack *pack, struct got_packidx *packidx,
 		goto done;
 	}
 	headerlen = strlen(header) + 1;
-	SHA1Init(&ctx);
-	SHA1Update(&ctx, header, headerlen);
+	got_sha1_init(&ctx);
+	got_sha1_update(&ctx, header, headerlen);
 	if (max_size > GOT_DELTA_RESULT_SIZE_CACHED_MAX) {
 		err = read_file_sha1(&ctx, tmpfile, len);
 		if (err)
 			goto done;
 	} else
-		SHA1Update(&ctx, buf, len);
-	SHA1Final(obj->id.sha1, &ctx);
+		got_sha1_update(&ctx, buf, len);
+	got_sha1_final(obj->id.sha1, &ctx);
 done:
 	free(buf);
 	free(header);
@@ -627,7 +637,7 @@ index_pack(struct got_pack *pack, int idxfd, FILE *tmpfile,
 	char pack_sha1[SHA1_DIGEST_LENGTH];
 	int nobj, nvalid, nloose, nresolved = 0, i;
 	struct got_indexed_object *objects = NULL, *obj;
-	SHA1_CTX ctx;
+	struct got_sha1_ctx ctx;
 	uint8_t packidx_hash[SHA1_DIGEST_LENGTH];
 	ssize_t r, w;
 	int pass, have_ref_deltas = 0, first_delta_idx = -1;
@@ -664,8 +674,8 @@ index_pack(struct got_pack *pack, int idxfd, FILE *tmpfile,
 		    "bad packfile with zero objects");
 
 	/* We compute the SHA1 of pack file contents and verify later on. */
-	SHA1Init(&ctx);
-	SHA1Update(&ctx, (void *)&hdr, sizeof(hdr));
+	got_sha1_init(&ctx);
+	got_sha1_update(&ctx, (void *)&hdr, sizeof(hdr));
 
 	/*
 	 * Create an in-memory pack index which will grow as objects
@@ -788,7 +798,7 @@ index_pack(struct got_pack *pack, int idxfd, FILE *tmpfile,
 	 * Having done a full pass over the pack file and can now
 	 * verify its checksum.
 	 */
-	SHA1Final(pack_sha1, &ctx);
+	got_sha1_final(pack_sha1, &ctx);
 	if (memcmp(pack_sha1_expected, pack_sha1, SHA1_DIGEST_LENGTH) != 0) {
 		err = got_error_msg(GOT_ERR_BAD_PACKFILE,
 		    "pack file checksum mismatch");
@@ -916,7 +926,7 @@ index_pack(struct got_pack *pack, int idxfd, FILE *tmpfile,
 	free(objects);
 	objects = NULL;
 
-	SHA1Init(&ctx);
+	got_sha1_init(&ctx);
 	putbe32(buf, GOT_PACKIDX_V2_MAGIC);
 	putbe32(buf + 4, GOT_PACKIDX_VERSION);
 	err = hwrite(idxfd, buf, 8, &ctx);
@@ -947,7 +957,7 @@ index_pack(struct got_pack *pack, int idxfd, FILE *tmpfile,
 	if (err)
 		goto done;
 
-	SHA1Final(packidx_hash, &ctx);
+	got_sha1_final(packidx_hash, &ctx);
 	w = write(idxfd, packidx_hash, sizeof(packidx_hash));
 	if (w == -1) {
 		err = got_error_from_errno("write");
@@ -1070,7 +1080,7 @@ main(int argc, char **argv)
 		err = got_error_from_errno("lseek");
 		goto done;
 	}
-	pack.filesize = packfile_size; /* XXX off_t vs size_t */
+	pack.filesize = packfile_size;
 
 	if (lseek(pack.fd, 0, SEEK_SET) == -1) {
 		err = got_error_from_errno("lseek");
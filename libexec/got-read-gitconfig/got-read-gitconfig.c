@@ -35,6 +35,7 @@
 #include "got_repository.h"
 
 #include "got_lib_delta.h"
+#include "got_lib_deflate.h"
 #include "got_lib_object.h"
 #include "got_lib_privsep.h"
 #include "got_lib_gitconfig.h"
@@ -258,6 +259,39 @@ gitconfig_owner_request(struct imsgbuf *ibuf, struct got_gitconfig *gitconfig)
 	return send_gitconfig_str(ibuf, value);
 }
 
+static const struct got_error *
+gitconfig_loose_compression_request(struct imsgbuf *ibuf,
+    struct got_gitconfig *gitconfig)
+{
+	int level;
+
+	if (gitconfig == NULL)
+		return got_error(GOT_ERR_PRIVSEP_MSG);
+
+	/* core.compression provides the default for core.looseCompression. */
+	level = got_gitconfig_get_num(gitconfig, "core", "compression",
+	    GOT_DEFLATE_LEVEL_LOOSE);
+	level = got_gitconfig_get_num(gitconfig, "core", "looseCompression",
+	    level);
+	if (level < Z_DEFAULT_COMPRESSION || level > Z_BEST_COMPRESSION)
+		level = GOT_DEFLATE_LEVEL_LOOSE;
+
+	return send_gitconfig_int(ibuf, level);
+}
+
+static const struct got_error *
+gitconfig_fsync_object_files_request(struct imsgbuf *ibuf,
+    struct got_gitconfig *gitconfig)
+{
+	char *value;
+
+	if (gitconfig == NULL)
+		return got_error(GOT_ERR_PRIVSEP_MSG);
+
+	value = got_gitconfig_get_str(gitconfig, "core", "fsyncObjectFiles");
+	return send_gitconfig_int(ibuf, value ? get_boolean_val(value) : 0);
+}
+
 static const struct got_error *
 gitconfig_extensions_request(struct imsgbuf *ibuf,
     struct got_gitconfig *gitconfig)
@@ -384,6 +418,14 @@ main(int argc, char *argv[])
 		case GOT_IMSG_GITCONFIG_OWNER_REQUEST:
 			err = gitconfig_owner_request(&ibuf, gitconfig);
 			break;
+		case GOT_IMSG_GITCONFIG_LOOSE_COMPRESSION_REQUEST:
+			err = gitconfig_loose_compression_request(&ibuf,
+			    gitconfig);
+			break;
+		case GOT_IMSG_GITCONFIG_FSYNC_OBJECT_FILES_REQUEST:
+			err = gitconfig_fsync_object_files_request(&ibuf,
+			    gitconfig);
+			break;
 		default:
 			err = got_error(GOT_ERR_PRIVSEP_MSG);
 			break;
@@ -18,7 +18,9 @@
 #include <sys/uio.h>
 #include <sys/time.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 
+#include <endian.h>
 #include <limits.h>
 #include <signal.h>
 #include <stdint.h>
@@ -34,15 +36,23 @@
 #include "got_error.h"
 #include "got_object.h"
 #include "got_path.h"
+#include "got_cancel.h"
+#include "got_verify.h"
 
+#include "got_lib_sha1.h"
 #include "got_lib_delta.h"
 #include "got_lib_delta_cache.h"
 #include "got_lib_object.h"
 #include "got_lib_object_cache.h"
+#include "got_lib_object_idset.h"
 #include "got_lib_object_parse.h"
 #include "got_lib_privsep.h"
 #include "got_lib_pack.h"
 
+#ifndef MIN
+#define	MIN(_a,_b) ((_a) < (_b) ? (_a) : (_b))
+#endif
+
 static volatile sig_atomic_t sigint_received;
 
 static void
@@ -469,20 +479,23 @@ tree_path_changed(int *changed, uint8_t **buf1, uint8_t **buf2,
 			break;
 		}
 
+		/*
+		 * If the path does not exist in the second tree, keep looking
+		 * for it in the first tree, as got_object_tree_path_changed()
+		 * does. The path might not exist in the first tree either.
+		 */
 		pte2 = find_entry_by_name(entries2, *nentries2, seg, seglen);
-		if (pte2 == NULL) {
-			*changed = 1;
-			break;
-		}
-
-		if (pte1->mode != pte2->mode) {
-			*changed = 1;
-			break;
-		}
+		if (pte2) {
+			if (pte1->mode != pte2->mode) {
+				*changed = 1;
+				break;
+			}
 
-		if (memcmp(pte1->id, pte2->id, SHA1_DIGEST_LENGTH) == 0) {
-			*changed = 0;
-			break;
+			if (memcmp(pte1->id, pte2->id,
+			    SHA1_DIGEST_LENGTH) == 0) {
+				*changed = 0;
+				break;
+			}
 		}
 
 		if (*s == '\0') { /* final path element */
@@ -513,6 +526,14 @@ tree_path_changed(int *changed, uint8_t **buf1, uint8_t **buf2,
 			if (err)
 				break;
 
+			if (pte2 == NULL) {
+				/* Path does not exist in the second tree. */
+				got_object_parsed_tree_entries_free(entries2);
+				*nentries2 = 0;
+				free(*buf2);
+				*buf2 = NULL;
+				continue;
+			}
 			memcpy(id2.sha1, pte2->id, SHA1_DIGEST_LENGTH);
 			idx = got_packidx_get_object_idx(packidx, &id2);
 			if (idx == -1) {
@@ -773,236 +794,1312 @@ done:
 }
 
 static const struct got_error *
-receive_packidx(struct got_packidx **packidx, struct imsgbuf *ibuf)
+path_changed_request(struct imsg *imsg, struct imsgbuf *ibuf,
+    struct got_pack *pack, struct got_packidx *packidx,
+    struct got_object_cache *objcache)
 {
 	const struct got_error *err = NULL;
-	struct imsg imsg;
-	struct got_imsg_packidx ipackidx;
-	size_t datalen;
-	struct got_packidx *p;
+	struct got_imsg_packed_object iobj;
+	struct got_object_qid *pid;
+	struct got_commit_object *commit = NULL, *pcommit = NULL;
+	struct got_pathlist_head entries, pentries;
+	int nentries = 0, pnentries = 0;
+	uint8_t *buf = NULL, *pbuf = NULL;
+	struct got_object_id id;
+	size_t datalen, path_len;
+	char *path;
+	int idx, pidx, changed = -1;
 
-	*packidx = NULL;
+	TAILQ_INIT(&entries);
+	TAILQ_INIT(&pentries);
 
-	err = got_privsep_recv_imsg(&imsg, ibuf, 0);
-	if (err)
-		return err;
+	datalen = imsg->hdr.len - IMSG_HEADER_SIZE;
+	if (datalen < sizeof(iobj) + 2)
+		return got_error(GOT_ERR_PRIVSEP_LEN);
+	memcpy(&iobj, imsg->data, sizeof(iobj));
+	memcpy(id.sha1, iobj.id, SHA1_DIGEST_LENGTH);
 
-	p = calloc(1, sizeof(*p));
-	if (p == NULL) {
-		err = got_error_from_errno("calloc");
-		goto done;
-	}
+	path_len = datalen - sizeof(iobj) - 1;
+	path = imsg->data + sizeof(iobj);
+	if (path[path_len] != '\0')
+		return got_error(GOT_ERR_PRIVSEP_LEN);
 
-	if (imsg.hdr.type != GOT_IMSG_PACKIDX) {
-		err = got_error(GOT_ERR_PRIVSEP_MSG);
+	/*
+	 * Cases we cannot decide without objects from other pack files
+	 * are left to the main process.
+	 */
+	err = open_commit(&commit, pack, packidx, iobj.idx, &id, objcache);
+	if (err)
 		goto done;
-	}
-
-	if (imsg.fd == -1) {
-		err = got_error(GOT_ERR_PRIVSEP_NO_FD);
+	pid = SIMPLEQ_FIRST(&commit->parent_ids);
+	if (pid == NULL)
 		goto done;
-	}
-
-	datalen = imsg.hdr.len - IMSG_HEADER_SIZE;
-	if (datalen != sizeof(ipackidx)) {
-		err = got_error(GOT_ERR_PRIVSEP_LEN);
+	idx = got_packidx_get_object_idx(packidx, pid->id);
+	if (idx == -1)
+		goto done;
+	err = open_commit(&pcommit, pack, packidx, idx, pid->id, objcache);
+	if (err)
 		goto done;
-	}
-	memcpy(&ipackidx, imsg.data, sizeof(ipackidx));
 
-	p->len = ipackidx.len;
-	p->fd = dup(imsg.fd);
-	if (p->fd == -1) {
-		err = got_error_from_errno("dup");
+	idx = got_packidx_get_object_idx(packidx, commit->tree_id);
+	pidx = got_packidx_get_object_idx(packidx, pcommit->tree_id);
+	if (idx == -1 || pidx == -1)
 		goto done;
-	}
-	if (lseek(p->fd, 0, SEEK_SET) == -1) {
-		err = got_error_from_errno("lseek");
+	err = open_tree(&buf, &entries, &nentries, pack, packidx, idx,
+	    commit->tree_id, objcache);
+	if (err)
+		goto done;
+	err = open_tree(&pbuf, &pentries, &pnentries, pack, packidx, pidx,
+	    pcommit->tree_id, objcache);
+	if (err)
 		goto done;
-	}
 
-#ifndef GOT_PACK_NO_MMAP
-	p->map = mmap(NULL, p->len, PROT_READ, MAP_PRIVATE, p->fd, 0);
-	if (p->map == MAP_FAILED)
-		p->map = NULL; /* fall back to read(2) */
-#endif
-	err = got_packidx_init_hdr(p, 1);
+	err = tree_path_changed(&changed, &buf, &pbuf, &entries, &nentries,
+	    &pentries, &pnentries, path, pack, packidx, ibuf, objcache);
+	if (err)
+		changed = -1;
 done:
+	if (err && err->code == GOT_ERR_NO_OBJ)
+		err = NULL;
+	if (err == NULL)
+		err = got_privsep_send_path_changed(ibuf, changed);
+	if (commit)
+		got_object_commit_close(commit);
+	if (pcommit)
+		got_object_commit_close(pcommit);
+	if (nentries != 0)
+		got_object_parsed_tree_entries_free(&entries);
+	if (pnentries != 0)
+		got_object_parsed_tree_entries_free(&pentries);
+	free(buf);
+	free(pbuf);
 	if (err) {
-		if (imsg.fd != -1)
-			close(imsg.fd);
-		got_packidx_close(p);
-	} else
-		*packidx = p;
-	imsg_free(&imsg);
+		if (err->code == GOT_ERR_PRIVSEP_PIPE)
+			err = NULL;
+		else
+			got_privsep_send_error(ibuf, err);
+	}
+
 	return err;
 }
 
+/* Look up the ID and mode of the object at a path in a packed tree. */
 static const struct got_error *
-receive_pack(struct got_pack **packp, struct imsgbuf *ibuf)
+tree_path_id(struct got_object_id *id, mode_t *mode,
+    struct got_object_id *tree_id, const char *path, struct got_pack *pack,
+    struct got_packidx *packidx, struct got_object_cache *objcache)
 {
 	const struct got_error *err = NULL;
-	struct imsg imsg;
-	struct got_imsg_pack ipack;
-	size_t datalen;
-	struct got_pack *pack;
+	struct got_pathlist_head entries;
+	struct got_parsed_tree_entry *pte;
+	uint8_t *buf = NULL;
+	int nentries = 0, idx;
+	const char *s = path;
+	size_t seglen;
 
-	*packp = NULL;
+	TAILQ_INIT(&entries);
+	memcpy(id, tree_id, sizeof(*id));
+	*mode = S_IFDIR;
 
-	err = got_privsep_recv_imsg(&imsg, ibuf, 0);
-	if (err)
-		return err;
+	while (*s == '/')
+		s++;
+	while (*s) {
+		if (!S_ISDIR(*mode)) {
+			err = got_error_path(path, GOT_ERR_NO_TREE_ENTRY);
+			break;
+		}
+		idx = got_packidx_get_object_idx(packidx, id);
+		if (idx == -1) {
+			err = got_error_no_obj(id);
+			break;
+		}
+		if (nentries != 0) {
+			got_object_parsed_tree_entries_free(&entries);
+			nentries = 0;
+		}
+		free(buf);
+		buf = NULL;
+		err = open_tree(&buf, &entries, &nentries, pack, packidx, idx,
+		    id, objcache);
+		if (err)
+			break;
 
-	pack = calloc(1, sizeof(*pack));
-	if (pack == NULL) {
-		err = got_error_from_errno("calloc");
-		goto done;
+		seglen = strcspn(s, "/");
+		pte = find_entry_by_name(&entries, nentries, s, seglen);
+		if (pte == NULL) {
+			err = got_error_path(path, GOT_ERR_NO_TREE_ENTRY);
+			break;
+		}
+		memcpy(id->sha1, pte->id, SHA1_DIGEST_LENGTH);
+		*mode = pte->mode;
+		s += seglen;
+		while (*s == '/')
+			s++;
 	}
 
-	if (imsg.hdr.type != GOT_IMSG_PACK) {
-		err = got_error(GOT_ERR_PRIVSEP_MSG);
-		goto done;
-	}
+	if (nentries != 0)
+		got_object_parsed_tree_entries_free(&entries);
+	free(buf);
+	return err;
+}
 
-	if (imsg.fd == -1) {
-		err = got_error(GOT_ERR_PRIVSEP_NO_FD);
-		goto done;
-	}
+/* A commit queued for traversal by a history traversal request. */
+struct history_node {
+	struct got_object_id id;
+	struct got_commit_object *commit;	/* NULL once traversed */
+	unsigned int seq;
+};
+
+/* The object at the traversed path in a commit. */
+struct history_path {
+	int state;
+#define HISTORY_PATH_UNKNOWN	0 /* objects are missing from this pack */
+#define HISTORY_PATH_FOUND	1
+#define HISTORY_PATH_MISSING	2
+	struct got_object_id id;
+	mode_t mode;
+};
 
-	datalen = imsg.hdr.len - IMSG_HEADER_SIZE;
-	if (datalen != sizeof(ipack)) {
-		err = got_error(GOT_ERR_PRIVSEP_LEN);
-		goto done;
-	}
-	memcpy(&ipack, imsg.data, sizeof(ipack));
+/*
+ * Commits which remain to be traversed, most recent commit first.
+ * The queue is kept across requests which belong to the same session,
+ * such that commits are traversed and reported only once.
+ * Path lookups are remembered per commit since most commits get compared
+ * to their children as well as to their parents.
+ */
+struct history_queue {
+	int session;
+	char *path;
+	struct got_object_idset *visited;
+	struct got_object_idset *paths;
+	struct history_node **nodes;
+	int nqueued;
+	int nalloc;
+	unsigned int seq;
+};
 
-	pack->filesize = ipack.filesize;
-	pack->fd = dup(imsg.fd);
-	if (pack->fd == -1) {
-		err = got_error_from_errno("dup");
-		goto done;
-	}
-	if (lseek(pack->fd, 0, SEEK_SET) == -1) {
-		err = got_error_from_errno("lseek");
-		goto done;
-	}
-	pack->path_packfile = strdup(ipack.path_packfile);
-	if (pack->path_packfile == NULL) {
-		err = got_error_from_errno("strdup");
-		goto done;
+static const struct got_error *
+get_history_path(struct history_path **hpath, struct history_queue *q,
+    struct got_object_id *commit_id, struct got_pack *pack,
+    struct got_packidx *packidx, struct got_object_cache *objcache)
+{
+	const struct got_error *err = NULL;
+	struct history_path *hp;
+	struct history_node *node;
+	struct got_commit_object *commit = NULL;
+	int idx, close_commit = 0;
+
+	*hpath = got_object_idset_get(q->paths, commit_id);
+	if (*hpath)
+		return NULL;
+
+	hp = calloc(1, sizeof(*hp));
+	if (hp == NULL)
+		return got_error_from_errno("calloc");
+	hp->state = HISTORY_PATH_UNKNOWN;
+
+	node = got_object_idset_get(q->visited, commit_id);
+	if (node && node->commit)
+		commit = node->commit;
+	else {
+		idx = got_packidx_get_object_idx(packidx, commit_id);
+		if (idx != -1) {
+			err = open_commit(&commit, pack, packidx, idx,
+			    commit_id, objcache);
+			if (err && err->code != GOT_ERR_NO_OBJ)
+				goto done;
+			err = NULL;
+			close_commit = 1;
+		}
 	}
 
-	pack->delta_cache = got_delta_cache_alloc(100,
-	    GOT_DELTA_RESULT_SIZE_CACHED_MAX);
-	if (pack->delta_cache == NULL) {
-		err = got_error_from_errno("got_delta_cache_alloc");
-		goto done;
+	if (commit) {
+		err = tree_path_id(&hp->id, &hp->mode, commit->tree_id,
+		    q->path, pack, packidx, objcache);
+		if (err == NULL)
+			hp->state = HISTORY_PATH_FOUND;
+		else if (err->code == GOT_ERR_NO_TREE_ENTRY)
+			hp->state = HISTORY_PATH_MISSING;
+		if (err && (err->code == GOT_ERR_NO_TREE_ENTRY ||
+		    err->code == GOT_ERR_NO_OBJ))
+			err = NULL;
+		if (close_commit)
+			got_object_commit_close(commit);
+		if (err)
+			goto done;
 	}
 
-#ifndef GOT_PACK_NO_MMAP
-	pack->map = mmap(NULL, pack->filesize, PROT_READ, MAP_PRIVATE,
-	    pack->fd, 0);
-	if (pack->map == MAP_FAILED)
-		pack->map = NULL; /* fall back to read(2) */
-#endif
+	err = got_object_idset_add(q->paths, commit_id, hp);
 done:
-	if (err) {
-		if (imsg.fd != -1)
-			close(imsg.fd);
-		free(pack);
-	} else
-		*packp = pack;
-	imsg_free(&imsg);
+	if (err)
+		free(hp);
+	else
+		*hpath = hp;
 	return err;
 }
 
-int
-main(int argc, char *argv[])
+/*
+ * Only the executable bit of files is relevant when comparing modes,
+ * as in got_object_tree_path_changed().
+ */
+static mode_t
+normalize_mode_for_comparison(mode_t mode)
 {
-	const struct got_error *err = NULL;
-	struct imsgbuf ibuf;
-	struct imsg imsg;
-	struct got_packidx *packidx = NULL;
-	struct got_pack *pack = NULL;
-	struct got_object_cache objcache;
+	if (S_ISDIR(mode))
+		return mode & S_IFDIR;
+	if (S_ISLNK(mode))
+		return mode & S_IFLNK;
+	return mode & S_IXUSR;
+}
 
-	//static int attached;
-	//while (!attached) sleep(1);
+/*
+ * Decide whether a commit changed the path compared to its first parent.
+ * Set changed to -1 if this cannot be decided with objects in this pack.
+ */
+static const struct got_error *
+history_path_changed(int *changed, struct history_queue *q,
+    struct got_commit_object *commit, struct history_path *hp,
+    struct got_pack *pack, struct got_packidx *packidx,
+    struct got_object_cache *objcache)
+{
+	const struct got_error *err;
+	struct got_object_qid *pid;
+	struct history_path *php;
 
-	signal(SIGINT, catch_sigint);
+	*changed = -1;
 
-	imsg_init(&ibuf, GOT_IMSG_FD_CHILD);
+	/* A missing path is an error the main process should run into. */
+	if (hp->state != HISTORY_PATH_FOUND)
+		return NULL;
 
-	err = got_object_cache_init(&objcache, GOT_OBJECT_CACHE_TYPE_OBJ);
-	if (err) {
-		err = got_error_from_errno("got_object_cache_init");
-		got_privsep_send_error(&ibuf, err);
-		return 1;
+	pid = SIMPLEQ_FIRST(&commit->parent_ids);
+	if (pid == NULL) {
+		*changed = 1; /* The path was created in this commit. */
+		return NULL;
 	}
 
-#ifndef PROFILE
-	/* revoke access to most system calls */
-	if (pledge("stdio recvfd", NULL) == -1) {
-		err = got_error_from_errno("pledge");
-		got_privsep_send_error(&ibuf, err);
-		return 1;
+	err = get_history_path(&php, q, pid->id, pack, packidx, objcache);
+	if (err)
+		return err;
+	if (php->state == HISTORY_PATH_MISSING)
+		*changed = 1;
+	else if (php->state == HISTORY_PATH_FOUND) {
+		*changed = (got_object_id_cmp(&hp->id, &php->id) != 0 ||
+		    normalize_mode_for_comparison(hp->mode) !=
+		    normalize_mode_for_comparison(php->mode));
 	}
-#endif
+	return NULL;
+}
 
-	err = receive_packidx(&packidx, &ibuf);
-	if (err) {
-		got_privsep_send_error(&ibuf, err);
-		return 1;
-	}
+/*
+ * Look up the IDs of the path in a merge commit and in each of its parents.
+ * Set *npath_ids to zero if objects are missing from this pack.
+ */
+static const struct got_error *
+merge_path_ids(struct got_imsg_traversed_path_id *path_ids, int *npath_ids,
+    struct history_queue *q, struct got_commit_object *commit,
+    struct history_path *hp, struct got_pack *pack,
+    struct got_packidx *packidx, struct got_object_cache *objcache)
+{
+	const struct got_error *err;
+	struct got_object_qid *pid;
+	struct history_path *php;
+	int i = 0;
 
-	err = receive_pack(&pack, &ibuf);
-	if (err) {
-		got_privsep_send_error(&ibuf, err);
-		return 1;
-	}
+	*npath_ids = 0;
 
-	for (;;) {
-		imsg.fd = -1;
+	if (hp->state != HISTORY_PATH_FOUND)
+		return NULL;
+	memcpy(path_ids[i].id, hp->id.sha1, SHA1_DIGEST_LENGTH);
+	path_ids[i++].found = 1;
 
-		if (sigint_received) {
-			err = got_error(GOT_ERR_CANCELLED);
-			break;
+	SIMPLEQ_FOREACH(pid, &commit->parent_ids, entry) {
+		err = get_history_path(&php, q, pid->id, pack, packidx,
+		    objcache);
+		if (err)
+			return err;
+		if (php->state == HISTORY_PATH_UNKNOWN)
+			return NULL;
+		if (php->state == HISTORY_PATH_FOUND) {
+			memcpy(path_ids[i].id, php->id.sha1,
+			    SHA1_DIGEST_LENGTH);
+			path_ids[i].found = 1;
 		}
+		i++;
+	}
 
-		err = got_privsep_recv_imsg(&imsg, &ibuf, 0);
-		if (err) {
-			if (err->code == GOT_ERR_PRIVSEP_PIPE)
-				err = NULL;
-			break;
-		}
+	*npath_ids = i;
+	return NULL;
+}
 
-		if (imsg.hdr.type == GOT_IMSG_STOP)
-			break;
+/*
+ * Find the parent of a merge commit which should be followed as the only
+ * branch when looking for changes to the path, in the same way as the
+ * commit graph does. Return NULL if all parents should be followed.
+ */
+static struct got_object_qid *
+merge_branch_to_follow(struct got_commit_object *commit,
+    struct got_imsg_traversed_path_id *path_ids)
+{
+	struct got_imsg_traversed_path_id *prev = NULL;
+	struct got_object_qid *pid;
+	int i = 1, branches_differ = 0;
 
-		switch (imsg.hdr.type) {
-		case GOT_IMSG_PACKED_OBJECT_REQUEST:
-			err = object_request(&imsg, &ibuf, pack, packidx,
-			    &objcache);
+	SIMPLEQ_FOREACH(pid, &commit->parent_ids, entry) {
+		struct got_imsg_traversed_path_id *pp = &path_ids[i++];
+
+		if (!pp->found) {
+			branches_differ = 1;
+			continue;
+		}
+		if (prev && memcmp(pp->id, prev->id, SHA1_DIGEST_LENGTH) != 0)
+			branches_differ = 1;
+		prev = pp;
+
+		/* This branch has created the merged content. */
+		if (memcmp(path_ids[0].id, pp->id, SHA1_DIGEST_LENGTH) == 0)
+			return pid;
+	}
+
+	/* The path's content is the same on all branches. */
+	if (!branches_differ)
+		return SIMPLEQ_FIRST(&commit->parent_ids);
+	return NULL;
+}
+
+static int
+history_node_is_newer(struct history_node *a, struct history_node *b)
+{
+	if (a->commit->committer_time != b->commit->committer_time)
+		return a->commit->committer_time > b->commit->committer_time;
+	return a->seq < b->seq;
+}
+
+/* Queue a commit unless it was seen before or is not in this pack. */
+static const struct got_error *
+queue_history_node(struct history_node **nodep, struct history_queue *q,
+    struct got_object_id *id, struct got_pack *pack,
+    struct got_packidx *packidx, struct got_object_cache *objcache)
+{
+	const struct got_error *err;
+	struct history_node *node;
+	int idx, i;
+
+	*nodep = NULL;
+
+	if (got_object_idset_contains(q->visited, id))
+		return NULL;
+	idx = got_packidx_get_object_idx(packidx, id);
+	if (idx == -1)
+		return NULL;
+
+	if (q->nqueued == q->nalloc) {
+		struct history_node **nodes;
+		int nalloc = q->nalloc ? q->nalloc * 2 : 64;
+
+		nodes = recallocarray(q->nodes, q->nalloc, nalloc,
+		    sizeof(*nodes));
+		if (nodes == NULL)
+			return got_error_from_errno("recallocarray");
+		q->nodes = nodes;
+		q->nalloc = nalloc;
+	}
+
+	node = calloc(1, sizeof(*node));
+	if (node == NULL)
+		return got_error_from_errno("calloc");
+	memcpy(&node->id, id, sizeof(node->id));
+	err = open_commit(&node->commit, pack, packidx, idx, &node->id,
+	    objcache);
+	if (err) {
+		free(node);
+		if (err->code == GOT_ERR_NO_OBJ)
+			err = NULL;
+		return err;
+	}
+	err = got_object_idset_add(q->visited, &node->id, node);
+	if (err) {
+		got_object_commit_close(node->commit);
+		free(node);
+		return err;
+	}
+	node->seq = q->seq++;
+
+	i = q->nqueued++;
+	while (i > 0 && history_node_is_newer(node, q->nodes[(i - 1) / 2])) {
+		q->nodes[i] = q->nodes[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	q->nodes[i] = node;
+	*nodep = node;
+	return NULL;
+}
+
+static struct history_node *
+dequeue_newest_history_node(struct history_queue *q)
+{
+	struct history_node *node, *last;
+	int i = 0, child;
+
+	node = q->nodes[0];
+	last = q->nodes[--q->nqueued];
+	while ((child = 2 * i + 1) < q->nqueued) {
+		if (child + 1 < q->nqueued &&
+		    history_node_is_newer(q->nodes[child + 1], q->nodes[child]))
+			child++;
+		if (!history_node_is_newer(q->nodes[child], last))
+			break;
+		q->nodes[i] = q->nodes[child];
+		i = child;
+	}
+	if (q->nqueued > 0)
+		q->nodes[i] = last;
+	return node;
+}
+
+static const struct got_error *
+free_history_path(struct got_object_id *id, void *data, void *arg)
+{
+	free(data);
+	return NULL;
+}
+
+static const struct got_error *
+free_history_node(struct got_object_id *id, void *data, void *arg)
+{
+	struct history_node *node = data;
+
+	if (node->commit)
+		got_object_commit_close(node->commit);
+	free(node);
+	return NULL;
+}
+
+static void
+free_history_queue(struct history_queue *q)
+{
+	if (q->visited) {
+		got_object_idset_for_each(q->visited, free_history_node, NULL);
+		got_object_idset_free(q->visited);
+	}
+	if (q->paths) {
+		got_object_idset_for_each(q->paths, free_history_path, NULL);
+		got_object_idset_free(q->paths);
+	}
+	free(q->nodes);
+	free(q->path);
+	memset(q, 0, sizeof(*q));
+}
+
+static const struct got_error *
+send_traversed_history(uint8_t *buf, size_t len, int ncommits,
+    struct imsgbuf *ibuf)
+{
+	struct got_imsg_traversed_history ihist;
+
+	ihist.ncommits = ncommits;
+	memcpy(buf, &ihist, sizeof(ihist));
+	if (imsg_compose(ibuf, GOT_IMSG_TRAVERSED_HISTORY, 0, 0, -1,
+	    buf, len) == -1)
+		return got_error_from_errno("imsg_compose TRAVERSED_HISTORY");
+
+	return got_privsep_flush_imsg(ibuf);
+}
+
+/*
+ * Traverse all parents of the requested commits in the order of their
+ * commit timestamps, most recent first, for as long as commits are found
+ * in this pack file. Report every traversed commit with its parents and
+ * whether it changed the path compared to its first parent.
+ */
+static const struct got_error *
+history_traversal_request(struct imsg *imsg, struct imsgbuf *ibuf,
+    struct got_pack *pack, struct got_packidx *packidx,
+    struct got_object_cache *objcache, struct history_queue *q)
+{
+	const struct got_error *err = NULL;
+	const size_t max_datalen = MAX_IMSGSIZE - IMSG_HEADER_SIZE;
+	struct got_imsg_history_traversal_request ireq;
+	struct got_imsg_traversed_path_id *path_ids = NULL;
+	struct history_node *node;
+	uint8_t *buf = NULL;
+	size_t datalen, path_len, len;
+	char *path;
+	int i, ncommits = 0, ntraversed = 0, npath_ids;
+
+	datalen = imsg->hdr.len - IMSG_HEADER_SIZE;
+	if (datalen < sizeof(ireq))
+		return got_error(GOT_ERR_PRIVSEP_LEN);
+	memcpy(&ireq, imsg->data, sizeof(ireq));
+	if (ireq.nids < 0 ||
+	    datalen < sizeof(ireq) + ireq.nids * SHA1_DIGEST_LENGTH + 2)
+		return got_error(GOT_ERR_PRIVSEP_LEN);
+	path = imsg->data + sizeof(ireq) + ireq.nids * SHA1_DIGEST_LENGTH;
+	path_len = datalen - sizeof(ireq) - ireq.nids * SHA1_DIGEST_LENGTH - 1;
+	if (path[path_len] != '\0')
+		return got_error(GOT_ERR_PRIVSEP_LEN);
+
+	if (q->visited == NULL || q->session != ireq.session ||
+	    strcmp(q->path, path) != 0) {
+		free_history_queue(q);
+		q->session = ireq.session;
+		q->path = strdup(path);
+		if (q->path == NULL) {
+			err = got_error_from_errno("strdup");
+			goto done;
+		}
+		q->visited = got_object_idset_alloc();
+		q->paths = got_object_idset_alloc();
+		if (q->visited == NULL || q->paths == NULL) {
+			err = got_error_from_errno("got_object_idset_alloc");
+			goto done;
+		}
+	}
+
+	buf = malloc(max_datalen);
+	if (buf == NULL) {
+		err = got_error_from_errno("malloc");
+		goto done;
+	}
+	len = sizeof(struct got_imsg_traversed_history);
+
+	for (i = 0; i < ireq.nids; i++) {
+		struct got_object_id id;
+
+		memcpy(id.sha1, (uint8_t *)imsg->data + sizeof(ireq) +
+		    i * SHA1_DIGEST_LENGTH, SHA1_DIGEST_LENGTH);
+		err = queue_history_node(&node, q, &id, pack, packidx,
+		    objcache);
+		if (err)
+			goto done;
+	}
+
+	while (q->nqueued > 0 && ntraversed < ireq.max_commits) {
+		struct got_imsg_traversed_commit icommit;
+		struct got_commit_object *commit;
+		struct got_object_qid *pid, *follow;
+		struct history_node *pnode;
+		struct history_path *hp = NULL;
+		size_t reclen;
+		int changed = 1;
+
+		if (sigint_received) {
+			err = got_error(GOT_ERR_CANCELLED);
+			goto done;
+		}
+
+		node = dequeue_newest_history_node(q);
+		commit = node->commit;
+		ntraversed++;
+
+		if (!got_path_is_root_dir(path)) {
+			err = get_history_path(&hp, q, &node->id, pack,
+			    packidx, objcache);
+			if (err)
+				goto done;
+		}
+
+		/* Skip branches which do not contribute to the path. */
+		follow = NULL;
+		npath_ids = 0;
+		if (commit->nparents > 1 && hp) {
+			free(path_ids);
+			path_ids = calloc(commit->nparents + 1,
+			    sizeof(*path_ids));
+			if (path_ids == NULL) {
+				err = got_error_from_errno("calloc");
+				goto done;
+			}
+			err = merge_path_ids(path_ids, &npath_ids, q, commit,
+			    hp, pack, packidx, objcache);
+			if (err)
+				goto done;
+			if (npath_ids > 0)
+				follow = merge_branch_to_follow(commit,
+				    path_ids);
+		}
+
+		/*
+		 * Merge commits with more parents than fit into a message
+		 * are not reported, and neither are their parents traversed.
+		 * The main process opens such commits and their parents
+		 * one by one instead.
+		 */
+		reclen = sizeof(icommit) +
+		    commit->nparents * SHA1_DIGEST_LENGTH +
+		    npath_ids * sizeof(*path_ids);
+		if (sizeof(struct got_imsg_traversed_history) + reclen >
+		    max_datalen) {
+			got_object_commit_close(node->commit);
+			node->commit = NULL;
+			continue;
+		}
+
+		SIMPLEQ_FOREACH(pid, &commit->parent_ids, entry) {
+			if (follow && pid != follow)
+				continue;
+			err = queue_history_node(&pnode, q, pid->id,
+			    pack, packidx, objcache);
+			if (err)
+				goto done;
+		}
+
+		if (hp) {
+			err = history_path_changed(&changed, q, commit, hp,
+			    pack, packidx, objcache);
+			if (err)
+				goto done;
+		}
+
+		memset(&icommit, 0, sizeof(icommit));
+		memcpy(icommit.id, node->id.sha1, SHA1_DIGEST_LENGTH);
+		icommit.committer_time = commit->committer_time;
+		icommit.changed = changed;
+		icommit.nparents = commit->nparents;
+		icommit.npath_ids = npath_ids;
+
+		if (len + reclen > max_datalen) {
+			err = send_traversed_history(buf, len, ncommits, ibuf);
+			if (err)
+				goto done;
+			len = sizeof(struct got_imsg_traversed_history);
+			ncommits = 0;
+		}
+		memcpy(buf + len, &icommit, sizeof(icommit));
+		len += sizeof(icommit);
+		SIMPLEQ_FOREACH(pid, &commit->parent_ids, entry) {
+			memcpy(buf + len, pid->id->sha1, SHA1_DIGEST_LENGTH);
+			len += SHA1_DIGEST_LENGTH;
+		}
+		if (npath_ids > 0) {
+			memcpy(buf + len, path_ids,
+			    npath_ids * sizeof(*path_ids));
+			len += npath_ids * sizeof(*path_ids);
+		}
+		ncommits++;
+
+		got_object_commit_close(node->commit);
+		node->commit = NULL;
+	}
+
+	if (ncommits > 0) {
+		err = send_traversed_history(buf, len, ncommits, ibuf);
+		if (err)
+			goto done;
+	}
+	err = send_commit_traversal_done(ibuf);
+done:
+	free(path_ids);
+	free(buf);
+	if (err) {
+		free_history_queue(q);
+		if (err->code == GOT_ERR_PRIVSEP_PIPE)
+			err = NULL;
+		else
+			got_privsep_send_error(ibuf, err);
+	}
+	return err;
+}
+
+struct verify_obj {
+	off_t offset;
+	int idx;
+};
+
+static int
+cmp_verify_obj(const void *pa, const void *pb)
+{
+	const struct verify_obj *a = pa, *b = pb;
+
+	if (a->offset < b->offset)
+		return -1;
+	if (a->offset > b->offset)
+		return 1;
+	return 0;
+}
+
+static const struct got_error *
+verify_crc32(int *ok, struct got_pack *pack, off_t start, off_t end,
+    uint32_t expected_crc)
+{
+	uint8_t buf[8192];
+	uLong crc = crc32(0L, NULL, 0);
+	ssize_t r;
+
+	*ok = 0;
+
+	while (start < end) {
+		r = pread(pack->fd, buf, MIN(sizeof(buf), end - start), start);
+		if (r == -1)
+			return got_error_from_errno("pread");
+		if (r == 0)
+			return NULL; /* truncated pack file */
+		crc = crc32(crc, buf, r);
+		start += r;
+	}
+
+	*ok = (crc == expected_crc);
+	return NULL;
+}
+
+static const struct got_error *
+hash_file(struct got_sha1_ctx *ctx, FILE *f, size_t len)
+{
+	uint8_t buf[8192];
+	size_t n;
+
+	if (fflush(f) == EOF || fseeko(f, 0L, SEEK_SET) == -1)
+		return got_error_from_errno("fseeko");
+
+	while (len > 0) {
+		n = fread(buf, 1, MIN(sizeof(buf), len), f);
+		if (n == 0) {
+			if (ferror(f))
+				return got_ferror(f, GOT_ERR_IO);
+			break;
+		}
+		got_sha1_update(ctx, buf, n);
+		len -= n;
+	}
+
+	return NULL;
+}
+
+static const struct got_error *
+reset_file(FILE *f)
+{
+	if (fseeko(f, 0L, SEEK_SET) == -1)
+		return got_error_from_errno("fseeko");
+	if (ftruncate(fileno(f), 0L) == -1)
+		return got_error_from_errno("ftruncate");
+	return NULL;
+}
+
+/*
+ * Extract an object and check that its data matches the object's ID.
+ * Errors which indicate a corrupt object are reported as a problem.
+ */
+static const struct got_error *
+verify_object(int *problem, struct got_pack *pack,
+    struct got_packidx *packidx, int idx, FILE *outfile, FILE *basefile,
+    FILE *accumfile)
+{
+	const struct got_error *err = NULL;
+	struct got_object *obj = NULL;
+	struct got_object_id id;
+	struct got_sha1_ctx ctx;
+	uint8_t sha1[SHA1_DIGEST_LENGTH];
+	uint8_t *buf = NULL;
+	uint64_t size;
+	size_t len = 0;
+	const char *label;
+	char header[64];
+
+	*problem = 0;
+
+	memcpy(id.sha1, packidx->hdr.sorted_ids[idx].sha1, sizeof(id.sha1));
+
+	err = got_packfile_open_object(&obj, pack, packidx, idx, &id);
+	if (err)
+		goto done;
+
+	if (obj->flags & GOT_OBJ_FLAG_DELTIFIED) {
+		err = got_pack_get_max_delta_object_size(&size, obj, pack);
+		if (err)
+			goto done;
+	} else
+		size = obj->size;
+
+	if (size <= GOT_DELTA_RESULT_SIZE_CACHED_MAX) {
+		err = got_packfile_extract_object_to_mem(&buf, &len, obj,
+		    pack);
+	} else {
+		err = reset_file(outfile);
+		if (err == NULL)
+			err = reset_file(basefile);
+		if (err == NULL)
+			err = reset_file(accumfile);
+		if (err == NULL)
+			err = got_packfile_extract_object(pack, obj, outfile,
+			    basefile, accumfile);
+		len = obj->size;
+	}
+	if (err)
+		goto done;
+
+	switch (obj->type) {
+	case GOT_OBJ_TYPE_COMMIT:
+		label = GOT_OBJ_LABEL_COMMIT;
+		break;
+	case GOT_OBJ_TYPE_TREE:
+		label = GOT_OBJ_LABEL_TREE;
+		break;
+	case GOT_OBJ_TYPE_BLOB:
+		label = GOT_OBJ_LABEL_BLOB;
+		break;
+	case GOT_OBJ_TYPE_TAG:
+		label = GOT_OBJ_LABEL_TAG;
+		break;
+	default:
+		err = got_error(GOT_ERR_OBJ_TYPE);
+		goto done;
+	}
+
+	got_sha1_init(&ctx);
+	got_sha1_update(&ctx, header,
+	    snprintf(header, sizeof(header), "%s %zu", label, len) + 1);
+	if (buf)
+		got_sha1_update(&ctx, buf, len);
+	else {
+		err = hash_file(&ctx, outfile, len);
+		if (err)
+			goto done;
+	}
+	got_sha1_final(sha1, &ctx);
+	if (memcmp(sha1, id.sha1, sizeof(sha1)) != 0)
+		*problem = GOT_VERIFY_BAD_OBJ_ID;
+done:
+	free(buf);
+	if (obj)
+		got_object_close(obj);
+	if (err && err->code != GOT_ERR_ERRNO && err->code != GOT_ERR_IO &&
+	    err->code != GOT_ERR_CANCELLED) {
+		*problem = GOT_VERIFY_BAD_OBJ_DATA;
+		err = NULL;
+	}
+	return err;
+}
+
+/*
+ * Compare the SHA1 checksum of the pack file with the checksum stored at
+ * its end, and with the checksum recorded in the pack index.
+ */
+static const struct got_error *
+verify_pack_checksum(int *ok, struct got_pack *pack,
+    struct got_packidx *packidx)
+{
+	uint8_t buf[65536];
+	uint8_t sha1[SHA1_DIGEST_LENGTH], trailer[SHA1_DIGEST_LENGTH];
+	struct got_sha1_ctx ctx;
+	off_t off = 0, end;
+	ssize_t r;
+
+	*ok = 0;
+
+	if (pack->filesize < sizeof(struct got_packfile_hdr) + sizeof(trailer))
+		return NULL;
+	end = pack->filesize - sizeof(trailer);
+
+	got_sha1_init(&ctx);
+	while (off < end) {
+		if (sigint_received)
+			return got_error(GOT_ERR_CANCELLED);
+		r = pread(pack->fd, buf, MIN(sizeof(buf), end - off), off);
+		if (r == -1)
+			return got_error_from_errno("pread");
+		if (r == 0)
+			return NULL;
+		got_sha1_update(&ctx, buf, r);
+		off += r;
+	}
+	got_sha1_final(sha1, &ctx);
+
+	r = pread(pack->fd, trailer, sizeof(trailer), end);
+	if (r == -1)
+		return got_error_from_errno("pread");
+	if (r != sizeof(trailer))
+		return NULL;
+
+	*ok = (memcmp(sha1, trailer, sizeof(sha1)) == 0 &&
+	    memcmp(sha1, packidx->hdr.trailer->packfile_sha1,
+	    sizeof(sha1)) == 0);
+	return NULL;
+}
+
+static const struct got_error *
+pack_verify_request(struct imsg *imsg, struct imsgbuf *ibuf,
+    struct got_pack *pack, struct got_packidx *packidx)
+{
+	const struct got_error *err = NULL;
+	struct got_imsg_pack_verify_request ireq;
+	struct verify_obj *objs = NULL;
+	struct got_object_id id;
+	FILE *outfile = NULL, *basefile = NULL, *accumfile = NULL;
+	size_t datalen;
+	uint32_t nobj, i;
+	int nverify = 0, n, ok, problem;
+	off_t offset, end;
+
+	datalen = imsg->hdr.len - IMSG_HEADER_SIZE;
+	if (datalen != sizeof(ireq))
+		return got_error(GOT_ERR_PRIVSEP_LEN);
+	memcpy(&ireq, imsg->data, sizeof(ireq));
+
+	if (ireq.checksum) {
+		err = verify_pack_checksum(&ok, pack, packidx);
+		if (err == NULL && !ok)
+			err = got_privsep_send_pack_verify_problem(ibuf, NULL,
+			    0, GOT_VERIFY_BAD_PACK_CHECKSUM);
+		goto done;
+	}
+
+	err = receive_file(&outfile, ibuf, GOT_IMSG_TMPFD);
+	if (err)
+		goto done;
+	err = receive_file(&basefile, ibuf, GOT_IMSG_TMPFD);
+	if (err)
+		goto done;
+	err = receive_file(&accumfile, ibuf, GOT_IMSG_TMPFD);
+	if (err)
+		goto done;
+
+	nobj = be32toh(packidx->hdr.fanout_table[0xff]);
+	objs = calloc(nobj > 0 ? nobj : 1, sizeof(*objs));
+	if (objs == NULL) {
+		err = got_error_from_errno("calloc");
+		goto done;
+	}
+	for (i = 0; i < nobj; i++) {
+		offset = got_packidx_get_object_offset(packidx, i);
+		if (offset < ireq.start || offset >= ireq.end)
+			continue;
+		objs[nverify].offset = offset;
+		objs[nverify].idx = i;
+		nverify++;
+	}
+	qsort(objs, nverify, sizeof(objs[0]), cmp_verify_obj);
+
+	for (n = 0; n < nverify; n++) {
+		if (sigint_received) {
+			err = got_error(GOT_ERR_CANCELLED);
+			goto done;
+		}
+
+		memcpy(id.sha1, packidx->hdr.sorted_ids[objs[n].idx].sha1,
+		    sizeof(id.sha1));
+		end = (n + 1 < nverify ? objs[n + 1].offset : ireq.end);
+		err = verify_crc32(&ok, pack, objs[n].offset, end,
+		    be32toh(packidx->hdr.crc32[objs[n].idx]));
+		if (err)
+			goto done;
+		if (!ok) {
+			err = got_privsep_send_pack_verify_problem(ibuf, &id,
+			    objs[n].offset, GOT_VERIFY_BAD_CRC32);
+			if (err)
+				goto done;
+		}
+
+		err = verify_object(&problem, pack, packidx, objs[n].idx,
+		    outfile, basefile, accumfile);
+		if (err)
+			goto done;
+		if (problem) {
+			err = got_privsep_send_pack_verify_problem(ibuf, &id,
+			    objs[n].offset, problem);
+			if (err)
+				goto done;
+		}
+	}
+done:
+	if (err == NULL)
+		err = got_privsep_send_pack_verify_done(ibuf, nverify);
+	free(objs);
+	if (outfile && fclose(outfile) != 0 && err == NULL)
+		err = got_error_from_errno("fclose");
+	if (basefile && fclose(basefile) != 0 && err == NULL)
+		err = got_error_from_errno("fclose");
+	if (accumfile && fclose(accumfile) != 0 && err == NULL)
+		err = got_error_from_errno("fclose");
+	if (err) {
+		if (err->code == GOT_ERR_PRIVSEP_PIPE)
+			err = NULL;
+		else
+			got_privsep_send_error(ibuf, err);
+	}
+
+	return err;
+}
+
+/*
+ * Pack files this process has open. The main process tells us which slot
+ * to use for a new pack file, and which slot to read from afterwards.
+ * Cached objects and history traversal state refer to a particular pack
+ * file and are kept along with it.
+ */
+struct pack_slot {
+	struct got_packidx *packidx;
+	struct got_pack *pack;
+	struct got_object_cache objcache;
+	struct history_queue history;
+};
+
+static void
+close_pack_slot(struct pack_slot *s)
+{
+	if (s->packidx)
+		got_packidx_close(s->packidx);
+	if (s->pack) {
+		got_pack_close(s->pack);
+		free(s->pack);
+	}
+	got_object_cache_close(&s->objcache);
+	free_history_queue(&s->history);
+	memset(s, 0, sizeof(*s));
+}
+
+static const struct got_error *
+receive_packidx(struct pack_slot **slotp, struct pack_slot *slots,
+    struct imsg *imsg)
+{
+	const struct got_error *err = NULL;
+	struct got_imsg_packidx ipackidx;
+	size_t datalen;
+	struct got_packidx *p;
+	struct pack_slot *s;
+
+	*slotp = NULL;
+
+	if (imsg->fd == -1)
+		return got_error(GOT_ERR_PRIVSEP_NO_FD);
+
+	datalen = imsg->hdr.len - IMSG_HEADER_SIZE;
+	if (datalen != sizeof(ipackidx))
+		return got_error(GOT_ERR_PRIVSEP_LEN);
+	memcpy(&ipackidx, imsg->data, sizeof(ipackidx));
+	if (ipackidx.slot < 0 || ipackidx.slot >= GOT_PRIVSEP_PACK_SLOTS)
+		return got_error(GOT_ERR_PRIVSEP_MSG);
+
+	s = &slots[ipackidx.slot];
+	close_pack_slot(s);
+
+	p = calloc(1, sizeof(*p));
+	if (p == NULL)
+		return got_error_from_errno("calloc");
+
+	p->len = ipackidx.len;
+	p->fd = dup(imsg->fd);
+	if (p->fd == -1) {
+		err = got_error_from_errno("dup");
+		goto done;
+	}
+	if (lseek(p->fd, 0, SEEK_SET) == -1) {
+		err = got_error_from_errno("lseek");
+		goto done;
+	}
+
+#ifndef GOT_PACK_NO_MMAP
+	p->map = mmap(NULL, p->len, PROT_READ, MAP_PRIVATE, p->fd, 0);
+	if (p->map == MAP_FAILED)
+		p->map = NULL; /* fall back to read(2) */
+#endif
+	/* The pack index stays open, so it only needs to be verified once. */
+	err = got_packidx_init_hdr(p, 1);
+	if (err)
+		goto done;
+
+	err = got_object_cache_init(&s->objcache, GOT_OBJECT_CACHE_TYPE_OBJ);
+done:
+	if (err) {
+		got_packidx_close(p);
+		close_pack_slot(s);
+	} else {
+		s->packidx = p;
+		*slotp = s;
+	}
+	return err;
+}
+
+static const struct got_error *
+receive_pack(struct pack_slot **slotp, struct pack_slot *slots,
+    struct imsg *imsg)
+{
+	const struct got_error *err = NULL;
+	struct got_imsg_pack ipack;
+	size_t datalen;
+	struct got_pack *pack;
+	struct pack_slot *s;
+
+	*slotp = NULL;
+
+	if (imsg->fd == -1)
+		return got_error(GOT_ERR_PRIVSEP_NO_FD);
+
+	datalen = imsg->hdr.len - IMSG_HEADER_SIZE;
+	if (datalen != sizeof(ipack))
+		return got_error(GOT_ERR_PRIVSEP_LEN);
+	memcpy(&ipack, imsg->data, sizeof(ipack));
+	if (ipack.slot < 0 || ipack.slot >= GOT_PRIVSEP_PACK_SLOTS)
+		return got_error(GOT_ERR_PRIVSEP_MSG);
+
+	/* The pack index must have been sent for this slot already. */
+	s = &slots[ipack.slot];
+	if (s->packidx == NULL || s->pack != NULL)
+		return got_error(GOT_ERR_PRIVSEP_MSG);
+
+	pack = calloc(1, sizeof(*pack));
+	if (pack == NULL)
+		return got_error_from_errno("calloc");
+
+	pack->filesize = ipack.filesize;
+	pack->fd = dup(imsg->fd);
+	if (pack->fd == -1) {
+		err = got_error_from_errno("dup");
+		goto done;
+	}
+	if (lseek(pack->fd, 0, SEEK_SET) == -1) {
+		err = got_error_from_errno("lseek");
+		goto done;
+	}
+	pack->path_packfile = strdup(ipack.path_packfile);
+	if (pack->path_packfile == NULL) {
+		err = got_error_from_errno("strdup");
+		goto done;
+	}
+
+	pack->delta_cache = got_delta_cache_alloc(100,
+	    GOT_DELTA_RESULT_SIZE_CACHED_MAX);
+	if (pack->delta_cache == NULL) {
+		err = got_error_from_errno("got_delta_cache_alloc");
+		goto done;
+	}
+
+	err = got_pack_init_mmap(pack, 0, 0);
+done:
+	if (err) {
+		got_pack_close(pack);
+		free(pack);
+	} else {
+		s->pack = pack;
+		*slotp = s;
+	}
+	return err;
+}
+
+static const struct got_error *
+select_pack(struct pack_slot **slotp, struct pack_slot *slots,
+    struct imsg *imsg)
+{
+	struct got_imsg_pack_select isel;
+	size_t datalen;
+
+	*slotp = NULL;
+
+	datalen = imsg->hdr.len - IMSG_HEADER_SIZE;
+	if (datalen != sizeof(isel))
+		return got_error(GOT_ERR_PRIVSEP_LEN);
+	memcpy(&isel, imsg->data, sizeof(isel));
+	if (isel.slot < 0 || isel.slot >= GOT_PRIVSEP_PACK_SLOTS ||
+	    slots[isel.slot].pack == NULL)
+		return got_error(GOT_ERR_PRIVSEP_MSG);
+
+	*slotp = &slots[isel.slot];
+	return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+	const struct got_error *err = NULL;
+	struct imsgbuf ibuf;
+	struct imsg imsg;
+	struct pack_slot slots[GOT_PRIVSEP_PACK_SLOTS], *s = NULL;
+	int i;
+
+	//static int attached;
+	//while (!attached) sleep(1);
+
+	signal(SIGINT, catch_sigint);
+
+	imsg_init(&ibuf, GOT_IMSG_FD_CHILD);
+	memset(slots, 0, sizeof(slots));
+
+#ifndef PROFILE
+	/* revoke access to most system calls */
+	if (pledge("stdio recvfd", NULL) == -1) {
+		err = got_error_from_errno("pledge");
+		got_privsep_send_error(&ibuf, err);
+		return 1;
+	}
+#endif
+
+	for (;;) {
+		imsg.fd = -1;
+
+		if (sigint_received) {
+			err = got_error(GOT_ERR_CANCELLED);
+			break;
+		}
+
+		err = got_privsep_recv_imsg(&imsg, &ibuf, 0);
+		if (err) {
+			if (err->code == GOT_ERR_PRIVSEP_PIPE)
+				err = NULL;
+			break;
+		}
+
+		if (imsg.hdr.type == GOT_IMSG_STOP)
+			break;
+
+		/*
+		 * The main process may switch us to a different pack file
+		 * at any time. Other requests require a pack and pack index.
+		 */
+		if (imsg.hdr.type != GOT_IMSG_PACKIDX &&
+		    imsg.hdr.type != GOT_IMSG_PACK &&
+		    imsg.hdr.type != GOT_IMSG_PACK_SELECT &&
+		    (s == NULL || s->pack == NULL)) {
+			err = got_error(GOT_ERR_PRIVSEP_MSG);
+			if (imsg.fd != -1)
+				close(imsg.fd);
+			imsg_free(&imsg);
+			break;
+		}
+
+		switch (imsg.hdr.type) {
+		case GOT_IMSG_PACKIDX:
+			err = receive_packidx(&s, slots, &imsg);
+			break;
+		case GOT_IMSG_PACK:
+			err = receive_pack(&s, slots, &imsg);
+			break;
+		case GOT_IMSG_PACK_SELECT:
+			err = select_pack(&s, slots, &imsg);
+			break;
+		case GOT_IMSG_PACKED_OBJECT_REQUEST:
+			err = object_request(&imsg, &ibuf, s->pack, s->packidx,
+			    &s->objcache);
 			break;
 		case GOT_IMSG_COMMIT_REQUEST:
-			err = commit_request(&imsg, &ibuf, pack, packidx,
-			    &objcache);
+			err = commit_request(&imsg, &ibuf, s->pack, s->packidx,
+			    &s->objcache);
 			break;
 		case GOT_IMSG_TREE_REQUEST:
-			err = tree_request(&imsg, &ibuf, pack, packidx,
-			    &objcache);
+			err = tree_request(&imsg, &ibuf, s->pack, s->packidx,
+			    &s->objcache);
 			break;
 		case GOT_IMSG_BLOB_REQUEST:
-			err = blob_request(&imsg, &ibuf, pack, packidx,
-			    &objcache);
+			err = blob_request(&imsg, &ibuf, s->pack, s->packidx,
+			    &s->objcache);
 			break;
 		case GOT_IMSG_TAG_REQUEST:
-			err = tag_request(&imsg, &ibuf, pack, packidx,
-			    &objcache);
+			err = tag_request(&imsg, &ibuf, s->pack, s->packidx,
+			    &s->objcache);
 			break;
 		case GOT_IMSG_COMMIT_TRAVERSAL_REQUEST:
-			err = commit_traversal_request(&imsg, &ibuf, pack,
-			    packidx, &objcache);
+			err = commit_traversal_request(&imsg, &ibuf, s->pack,
+			    s->packidx, &s->objcache);
+			break;
+		case GOT_IMSG_PACK_VERIFY_REQUEST:
+			err = pack_verify_request(&imsg, &ibuf, s->pack,
+			    s->packidx);
+			break;
+		case GOT_IMSG_PATH_CHANGED_REQUEST:
+			err = path_changed_request(&imsg, &ibuf, s->pack,
+			    s->packidx, &s->objcache);
+			break;
+		case GOT_IMSG_HISTORY_TRAVERSAL_REQUEST:
+			err = history_traversal_request(&imsg, &ibuf, s->pack,
+			    s->packidx, &s->objcache, &s->history);
 			break;
 		default:
 			err = got_error(GOT_ERR_PRIVSEP_MSG);
@@ -1016,11 +2113,8 @@ main(int argc, char *argv[])
 			break;
 	}
 
-	if (packidx)
-		got_packidx_close(packidx);
-	if (pack)
-		got_pack_close(pack);
-	got_object_cache_close(&objcache);
+	for (i = 0; i < GOT_PRIVSEP_PACK_SLOTS; i++)
+		close_pack_slot(&slots[i]);
 	imsg_clear(&ibuf);
 	if (err) {
 		if (!sigint_received && err->code != GOT_ERR_PRIVSEP_PIPE) {
@@ -980,6 +980,200 @@ EOF
 	test_done "$testroot" "$ret"
 }
 
+test_blame_cache() {
+	local testroot=`test_init blame_cache`
+
+	got checkout $testroot/repo $testroot/wt > /dev/null
+	ret="$?"
+	if [ "$ret" != "0" ]; then
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	mkdir $testroot/repo/.git/got-blame-cache
+
+	echo 1 > $testroot/wt/alpha
+	(cd $testroot/wt && got commit -m "change 1" > /dev/null)
+	for i in 2 3; do
+		echo $i >> $testroot/wt/alpha
+		(cd $testroot/wt && got commit -m "change $i" > /dev/null)
+	done
+
+	(cd $testroot/wt && got blame alpha > $testroot/stdout.expected)
+	ls $testroot/repo/.git/got-blame-cache | wc -l | tr -d ' ' \
+		> $testroot/ncached
+	echo 1 > $testroot/ncached.expected
+	cmp -s $testroot/ncached.expected $testroot/ncached
+	ret="$?"
+	if [ "$ret" != "0" ]; then
+		echo "blame result was not cached" >&2
+		diff -u $testroot/ncached.expected $testroot/ncached
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	# blame the cached commit itself
+	(cd $testroot/wt && got blame alpha > $testroot/stdout)
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret="$?"
+	if [ "$ret" != "0" ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	# blame a newer commit which leads to the cached commit
+	sed -i -e 's/2/changed/' $testroot/wt/alpha
+	echo 4 >> $testroot/wt/alpha
+	(cd $testroot/wt && got commit -m "change 4" > /dev/null)
+	(cd $testroot/wt && got blame alpha > $testroot/stdout)
+
+	mv $testroot/repo/.git/got-blame-cache $testroot/got-blame-cache
+	(cd $testroot/wt && got blame alpha > $testroot/stdout.expected)
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret="$?"
+	if [ "$ret" != "0" ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	# damaged cache files must be ignored
+	mv $testroot/got-blame-cache $testroot/repo/.git/got-blame-cache
+	for f in $testroot/repo/.git/got-blame-cache/*; do
+		chmod u+w $f
+		dd if=/dev/zero of=$f bs=1 count=4 seek=40 conv=notrunc \
+			2> /dev/null
+	done
+	(cd $testroot/wt && got blame alpha > $testroot/stdout)
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret="$?"
+	if [ "$ret" != "0" ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	blame_cmp "$testroot" "alpha"
+	ret="$?"
+	test_done "$testroot" "$ret"
+}
+
+test_blame_mode_change() {
+	local testroot=`test_init blame_mode_change`
+
+	got checkout $testroot/repo $testroot/wt > /dev/null
+	ret="$?"
+	if [ "$ret" != "0" ]; then
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	echo 1 > $testroot/wt/alpha
+	(cd $testroot/wt && got commit -m "change 1" > /dev/null)
+	echo 2 >> $testroot/wt/alpha
+	(cd $testroot/wt && got commit -m "change 2" > /dev/null)
+
+	# commit which changes only the file's mode
+	chmod +x $testroot/wt/alpha
+	(cd $testroot/wt && got commit -m "make alpha executable" > /dev/null)
+	(cd $testroot/repo && git ls-tree master alpha | cut -d ' ' -f 1 \
+		> $testroot/mode)
+	echo 100755 > $testroot/mode.expected
+	cmp -s $testroot/mode.expected $testroot/mode
+	ret="$?"
+	if [ "$ret" != "0" ]; then
+		diff -u $testroot/mode.expected $testroot/mode
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	echo 3 >> $testroot/wt/alpha
+	(cd $testroot/wt && got commit -m "change 3" > /dev/null)
+
+	blame_cmp "$testroot" "alpha"
+	ret="$?"
+	test_done "$testroot" "$ret"
+}
+
+test_blame_range() {
+	local testroot=`test_init blame_range`
+
+	got checkout $testroot/repo $testroot/wt > /dev/null
+	ret="$?"
+	if [ "$ret" != "0" ]; then
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	echo 1 > $testroot/wt/alpha
+	(cd $testroot/wt && got commit -m "change 1" > /dev/null)
+	for i in 2 3 4 5; do
+		echo $i >> $testroot/wt/alpha
+		(cd $testroot/wt && got commit -m "change $i" > /dev/null)
+	done
+	sed -i -e 's/4/changed/' $testroot/wt/alpha
+	(cd $testroot/wt && got commit -m "change 4 again" > /dev/null)
+
+	(cd $testroot/wt && got blame alpha | sed -n 2,4p \
+		> $testroot/stdout.expected)
+	(cd $testroot/wt && got blame -L 2,4 alpha > $testroot/stdout)
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret="$?"
+	if [ "$ret" != "0" ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	(cd $testroot/wt && got blame -L 4,6 alpha > $testroot/stdout \
+		2> $testroot/stderr)
+	ret="$?"
+	if [ "$ret" = "0" ]; then
+		echo "blame succeeded unexpectedly" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+	echo "got: alpha has only 5 lines: value out of range" \
+		> $testroot/stderr.expected
+	cmp -s $testroot/stderr.expected $testroot/stderr
+	ret="$?"
+	if [ "$ret" != "0" ]; then
+		diff -u $testroot/stderr.expected $testroot/stderr
+	fi
+	test_done "$testroot" "$ret"
+}
+
+test_blame_renamed_file() {
+	local testroot=`test_init blame_renamed_file`
+
+	echo 1 > $testroot/repo/alpha
+	git_commit $testroot/repo -m "change 1"
+	echo 2 >> $testroot/repo/alpha
+	echo 3 >> $testroot/repo/alpha
+	echo 4 >> $testroot/repo/alpha
+	git_commit $testroot/repo -m "change 2"
+
+	# rename alpha and change one of its lines in the same commit
+	(cd $testroot/repo && git mv alpha omega)
+	sed -i -e 's/^3$/three/' $testroot/repo/omega
+	git_commit $testroot/repo -m "renamed alpha"
+
+	echo 5 >> $testroot/repo/omega
+	git_commit $testroot/repo -m "change 3"
+
+	got checkout $testroot/repo $testroot/wt > /dev/null
+	ret="$?"
+	if [ "$ret" != "0" ]; then
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	blame_cmp "$testroot" "omega"
+	ret="$?"
+	test_done "$testroot" "$ret"
+}
+
 test_parseargs "$@"
 run_test test_blame_basic
 run_test test_blame_tag
@@ -994,3 +1188,7 @@ run_test test_blame_added_on_branch
 run_test test_blame_submodule
 run_test test_blame_symlink
 run_test test_blame_lines_shifted_skip
+run_test test_blame_cache
+run_test test_blame_mode_change
+run_test test_blame_range
+run_test test_blame_renamed_file
@@ -814,6 +814,56 @@ test_commit_gitconfig_author() {
 	test_done "$testroot" "$ret"
 }
 
+test_commit_gitconfig_loose_objects() {
+	local testroot=`test_init commit_gitconfig_loose_objects`
+
+	got checkout $testroot/repo $testroot/wt > /dev/null
+	ret="$?"
+	if [ "$ret" != "0" ]; then
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	(cd $testroot/repo && git config core.looseCompression 9)
+	(cd $testroot/repo && git config core.fsyncObjectFiles true)
+
+	echo "modified alpha" > $testroot/wt/alpha
+	echo "new file" > $testroot/wt/new1
+	echo "new file" > $testroot/wt/new2
+	(cd $testroot/wt && got add new1 new2 > /dev/null)
+	(cd $testroot/wt && got commit -m 'test loose objects' > /dev/null)
+	ret="$?"
+	if [ "$ret" != "0" ]; then
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	# No temporary files should be left behind.
+	(cd $testroot/repo/.git/objects && \
+		find . -type f -path './[0-9a-f][0-9a-f]/*-*') > $testroot/stdout
+	echo -n > $testroot/stdout.expected
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret="$?"
+	if [ "$ret" != "0" ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	# A zlib header of 78 da indicates the best compression level.
+	local blob_id=`get_blob_id $testroot/repo "" new1`
+	local objpath=`echo $blob_id | sed -e 's,^\(..\),\1/,'`
+	od -An -tx1 -N2 $testroot/repo/.git/objects/$objpath | tr -d ' ' \
+		> $testroot/stdout
+	echo "78da" > $testroot/stdout.expected
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret="$?"
+	if [ "$ret" != "0" ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+	fi
+	test_done "$testroot" "$ret"
+}
+
 test_commit_xbit_change() {
 	local testroot=`test_init commit_xbit_change`
 
@@ -1377,6 +1427,7 @@ run_test test_commit_tree_entry_sorting
 run_test test_commit_gotconfig_author
 run_test test_commit_gotconfig_worktree_author
 run_test test_commit_gitconfig_author
+run_test test_commit_gitconfig_loose_objects
 run_test test_commit_xbit_change
 run_test test_commit_normalizes_filemodes
 run_test test_commit_with_unrelated_submodule
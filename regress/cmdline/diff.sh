@@ -657,6 +657,68 @@ test_diff_binary_files() {
 	test_done "$testroot" "$ret"
 }
 
+test_diff_renames() {
+	local testroot=`test_init diff_renames`
+
+	printf "1\n2\n3\n4\n5\n6\n7\n8\n" > $testroot/repo/lines
+	(cd $testroot/repo && git add lines)
+	git_commit $testroot/repo -m "add lines"
+	local commit_id0=`git_show_head $testroot/repo`
+	local alpha_blobid=`get_blob_id $testroot/repo "" alpha`
+	local lines_blobid=`get_blob_id $testroot/repo "" lines`
+
+	(cd $testroot/repo && git mv alpha omega)
+	(cd $testroot/repo && git mv lines renamed)
+	printf "1\n2\n3\n4\n5\n6\n7\neight\n" > $testroot/repo/renamed
+	git_commit $testroot/repo -m "rename files"
+	local commit_id1=`git_show_head $testroot/repo`
+	local renamed_blobid=`get_blob_id $testroot/repo "" renamed`
+
+	echo "diff $commit_id0 $commit_id1" > $testroot/stdout.expected
+	echo "blob - $alpha_blobid" >> $testroot/stdout.expected
+	echo "blob + $alpha_blobid" >> $testroot/stdout.expected
+	echo "rename alpha -> omega" >> $testroot/stdout.expected
+	echo "blob - $lines_blobid" >> $testroot/stdout.expected
+	echo "blob + $renamed_blobid" >> $testroot/stdout.expected
+	echo "rename lines -> renamed" >> $testroot/stdout.expected
+	echo '--- lines' >> $testroot/stdout.expected
+	echo '+++ renamed' >> $testroot/stdout.expected
+	echo '@@ -5,4 +5,4 @@' >> $testroot/stdout.expected
+	echo ' 5' >> $testroot/stdout.expected
+	echo ' 6' >> $testroot/stdout.expected
+	echo ' 7' >> $testroot/stdout.expected
+	echo '-8' >> $testroot/stdout.expected
+	echo '+eight' >> $testroot/stdout.expected
+
+	got diff -M -r $testroot/repo $commit_id0 $commit_id1 \
+		> $testroot/stdout
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret="$?"
+	if [ "$ret" != "0" ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	# without -M renamed files are shown as deleted and added
+	got diff -r $testroot/repo $commit_id0 $commit_id1 \
+		| grep '^[-+][-+][-+] ' > $testroot/stdout
+	echo '--- alpha' > $testroot/stdout.expected
+	echo '+++ /dev/null' >> $testroot/stdout.expected
+	echo '--- /dev/null' >> $testroot/stdout.expected
+	echo '+++ omega' >> $testroot/stdout.expected
+	echo '--- lines' >> $testroot/stdout.expected
+	echo '+++ /dev/null' >> $testroot/stdout.expected
+	echo '--- /dev/null' >> $testroot/stdout.expected
+	echo '+++ renamed' >> $testroot/stdout.expected
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret="$?"
+	if [ "$ret" != "0" ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+	fi
+	test_done "$testroot" "$ret"
+}
+
 test_parseargs "$@"
 run_test test_diff_basic
 run_test test_diff_shows_conflict
@@ -667,3 +729,4 @@ run_test test_diff_submodule_of_same_repo
 run_test test_diff_symlinks_in_work_tree
 run_test test_diff_symlinks_in_repo
 run_test test_diff_binary_files
+run_test test_diff_renames
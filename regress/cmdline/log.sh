@@ -806,6 +806,264 @@ test_log_submodule() {
 	test_done "$testroot" "$ret"
 }
 
+test_log_jobs() {
+	local testroot=`test_init log_jobs`
+
+	for i in 1 2 3; do
+		(cd $testroot/repo && git checkout -q -b branch$i master)
+		echo "new file on branch$i" > $testroot/repo/epsilon/new$i
+		(cd $testroot/repo && git add epsilon/new$i)
+		git_commit $testroot/repo -m "adding epsilon/new$i"
+		echo "modified beta on branch$i" > $testroot/repo/beta
+		git_commit $testroot/repo -m "modified beta on branch$i"
+		(cd $testroot/repo && git checkout -q master)
+		(cd $testroot/repo && git merge -q --no-ff \
+			-m "merge branch$i" branch$i)
+	done
+	(cd $testroot/repo && git repack -a -d -q)
+
+	got log -b -j 1 -r $testroot/repo epsilon | grep ^commit \
+		> $testroot/stdout.expected
+	ret="$?"
+	if [ "$ret" != "0" ]; then
+		echo "log command failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	got log -b -j 4 -r $testroot/repo epsilon | grep ^commit \
+		> $testroot/stdout
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret="$?"
+	if [ "$ret" != "0" ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	# merge commits, commits on branches, and the initial commit
+	local n=`wc -l < $testroot/stdout`
+	if [ "$n" != "7" ]; then
+		echo "unexpected number of commits: $n" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+	test_done "$testroot" "$ret"
+}
+
+test_log_follow_renames() {
+	local testroot=`test_init log_follow_renames`
+	local commit_id0=`git_show_head $testroot/repo`
+
+	echo "modified alpha" > $testroot/repo/alpha
+	git_commit $testroot/repo -m "modified alpha"
+	local commit_id1=`git_show_head $testroot/repo`
+
+	(cd $testroot/repo && git mv alpha epsilon/omega)
+	git_commit $testroot/repo -m "renamed alpha"
+	local commit_id2=`git_show_head $testroot/repo`
+
+	echo "modified omega" > $testroot/repo/epsilon/omega
+	git_commit $testroot/repo -m "modified omega"
+	local commit_id3=`git_show_head $testroot/repo`
+
+	# without -M the log stops where the file was added
+	echo "commit $commit_id3 (master)" > $testroot/stdout.expected
+	echo "commit $commit_id2" >> $testroot/stdout.expected
+	got log -r $testroot/repo epsilon/omega | grep ^commit \
+		> $testroot/stdout
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret="$?"
+	if [ "$ret" != "0" ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	echo "commit $commit_id3 (master)" > $testroot/stdout.expected
+	echo "commit $commit_id2" >> $testroot/stdout.expected
+	echo "commit $commit_id1" >> $testroot/stdout.expected
+	echo "commit $commit_id0" >> $testroot/stdout.expected
+	got log -M -r $testroot/repo epsilon/omega | grep ^commit \
+		> $testroot/stdout
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret="$?"
+	if [ "$ret" != "0" ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	# patches are shown for the path the file had in each commit
+	echo "+++ alpha" > $testroot/stdout.expected
+	echo "+++ alpha" >> $testroot/stdout.expected
+	echo "+++ epsilon/omega" >> $testroot/stdout.expected
+	echo "+++ epsilon/omega" >> $testroot/stdout.expected
+	got log -M -R -p -r $testroot/repo epsilon/omega | grep '^+++ ' \
+		> $testroot/stdout
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret="$?"
+	if [ "$ret" != "0" ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+	fi
+	test_done "$testroot" "$ret"
+}
+
+test_log_search_index() {
+	local testroot=`test_init log_search_index`
+	local commit_id0=`git_show_head $testroot/repo`
+
+	mkdir $testroot/repo/.git/got-search-index
+
+	echo "modified alpha" > $testroot/repo/alpha
+	git_commit $testroot/repo -m "fix alpha"
+	local commit_id1=`git_show_head $testroot/repo`
+
+	(cd $testroot/repo && git checkout -q -b newbranch)
+	echo "modified beta" > $testroot/repo/beta
+	git_commit $testroot/repo -m "fix beta on a branch"
+
+	(cd $testroot/repo && git checkout -q master)
+	echo "modified delta" > $testroot/repo/gamma/delta
+	git_commit $testroot/repo -m "modified delta"
+	(cd $testroot/repo && git merge -q --no-ff -m "merge fixes" newbranch)
+	local commit_id2=`git_show_head $testroot/repo`
+
+	# commits on the branch are not part of first-parent history
+	echo "commit $commit_id2 (master)" > $testroot/stdout.expected
+	echo "commit $commit_id1" >> $testroot/stdout.expected
+	got log -r $testroot/repo -s 'fix' | grep ^commit > $testroot/stdout
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret="$?"
+	if [ "$ret" != "0" ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	ls $testroot/repo/.git/got-search-index > $testroot/stdout
+	if [ ! -s $testroot/stdout ]; then
+		echo "search index was not created" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+
+	# new commits are added to the index
+	echo "modified alpha again" > $testroot/repo/alpha
+	git_commit $testroot/repo -m "another fix for alpha"
+	local commit_id3=`git_show_head $testroot/repo`
+
+	echo "commit $commit_id3 (master)" > $testroot/stdout.expected
+	echo "commit $commit_id1" >> $testroot/stdout.expected
+	got log -r $testroot/repo -s 'fix.*alpha' | grep ^commit \
+		> $testroot/stdout
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret="$?"
+	if [ "$ret" != "0" ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	echo "commit $commit_id0" > $testroot/stdout.expected
+	echo "commit $commit_id1" >> $testroot/stdout.expected
+	got log -r $testroot/repo -R -s 'adding|fix a' | grep ^commit \
+		> $testroot/stdout
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret="$?"
+	if [ "$ret" != "0" ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	# a read-only index is searched without being updated
+	echo "modified beta again" > $testroot/repo/beta
+	git_commit $testroot/repo -m "fix beta"
+	chmod 555 $testroot/repo/.git/got-search-index
+	got log -r $testroot/repo -s 'fix' > $testroot/stdout
+	ret="$?"
+	chmod 755 $testroot/repo/.git/got-search-index
+	if [ "$ret" != "0" ]; then
+		echo "got log command failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	mv $testroot/repo/.git/got-search-index $testroot/got-search-index
+	got log -r $testroot/repo -s 'fix' > $testroot/stdout.expected
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret="$?"
+	if [ "$ret" != "0" ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+	fi
+	test_done "$testroot" "$ret"
+}
+
+test_log_packed_merges() {
+	local testroot=`test_init log_packed_merges`
+	local base_commit=`git_show_head $testroot/repo`
+	local base_tree=`git_show_tree $testroot/repo`
+	local parents=""
+	local i tree commit_id
+
+	# a merge commit with more parents than fit into one message
+	echo "modified alpha on a branch" > $testroot/repo/alpha
+	(cd $testroot/repo && git add alpha)
+	local branch_tree=`cd $testroot/repo && git write-tree`
+	for i in `seq 400`; do
+		tree=$base_tree
+		if [ $((i % 100)) -eq 0 ]; then
+			tree=$branch_tree
+		fi
+		commit_id=`cd $testroot/repo && \
+			git commit-tree -p $base_commit -m "branch $i" $tree`
+		parents="$parents -p $commit_id"
+	done
+	echo "modified alpha in a merge" > $testroot/repo/alpha
+	(cd $testroot/repo && git add alpha)
+	tree=`cd $testroot/repo && git write-tree`
+	commit_id=`cd $testroot/repo && \
+		git commit-tree $parents -m "octopus merge" $tree`
+	(cd $testroot/repo && git update-ref refs/heads/master $commit_id)
+	(cd $testroot/repo && git reset -q --hard)
+
+	# and a regular merge commit
+	(cd $testroot/repo && git checkout -q -b newbranch master)
+	echo "modified alpha on newbranch" > $testroot/repo/alpha
+	git_commit $testroot/repo -m "modified alpha on newbranch"
+	(cd $testroot/repo && git checkout -q master)
+	echo "modified beta on master" > $testroot/repo/beta
+	git_commit $testroot/repo -m "modified beta on master"
+	(cd $testroot/repo && git merge -q --no-ff -m "merge newbranch" \
+		newbranch)
+
+	got log -b -r $testroot/repo alpha > $testroot/stdout.expected
+	got log -b -r $testroot/repo >> $testroot/stdout.expected
+
+	(cd $testroot/repo && git repack -a -d -q)
+
+	got log -b -r $testroot/repo alpha > $testroot/stdout
+	got log -b -r $testroot/repo >> $testroot/stdout
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret="$?"
+	if [ "$ret" != "0" ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	# the merges, commits on branches which changed alpha, and the
+	# initial commit
+	local n=`got log -b -r $testroot/repo alpha | grep -c ^commit`
+	if [ "$n" != "8" ]; then
+		echo "unexpected number of commits: $n" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+	test_done "$testroot" "$ret"
+}
+
 test_parseargs "$@"
 run_test test_log_in_repo
 run_test test_log_in_bare_repo
@@ -820,3 +1078,7 @@ run_test test_log_reverse_display
 run_test test_log_in_worktree_different_repo
 run_test test_log_changed_paths
 run_test test_log_submodule
+run_test test_log_jobs
+run_test test_log_follow_renames
+run_test test_log_search_index
+run_test test_log_packed_merges
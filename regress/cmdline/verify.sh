@@ -0,0 +1,126 @@
+#!/bin/sh
+#
+# Copyright (c) 2026 agent <agent@local>
+#
+# Permission to use, copy, modify, and distribute this software for any
+# purpose with or without fee is hereby granted, provided that the above
+# copyright notice and this permission notice appear in all copies.
+#
+# THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+# WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+# MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+# ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+# WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+# ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+# OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+. ./common.sh
+
+test_verify_basic() {
+	local testroot=`test_init verify_basic`
+
+	# repository without pack files
+	git_init $testroot/empty
+	echo "verified 0 objects in 0 pack files" > $testroot/stdout.expected
+	got verify -r $testroot/empty > $testroot/stdout
+	ret="$?"
+	if [ "$ret" != "0" ]; then
+		echo "got verify command failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret="$?"
+	if [ "$ret" != "0" ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	echo "modified alpha" > $testroot/repo/alpha
+	git_commit $testroot/repo -m "modified alpha"
+	(cd $testroot/repo && git repack -a -d -q)
+	local nobjects=`(cd $testroot/repo && git count-objects -v) | \
+		grep '^in-pack:' | cut -d' ' -f2`
+
+	for jobs in 1 4; do
+		echo "verified $nobjects objects in 1 pack file" \
+			> $testroot/stdout.expected
+		got verify -j $jobs -r $testroot/repo > $testroot/stdout
+		ret="$?"
+		if [ "$ret" != "0" ]; then
+			echo "got verify command failed unexpectedly" >&2
+			test_done "$testroot" "$ret"
+			return 1
+		fi
+		cmp -s $testroot/stdout.expected $testroot/stdout
+		ret="$?"
+		if [ "$ret" != "0" ]; then
+			diff -u $testroot/stdout.expected $testroot/stdout
+			test_done "$testroot" "$ret"
+			return 1
+		fi
+	done
+
+	test_done "$testroot" "$ret"
+}
+
+test_verify_corrupt_object() {
+	local testroot=`test_init verify_corrupt_object`
+
+	(cd $testroot/repo && git repack -a -d -q)
+	cp -R $testroot/repo $testroot/corrupt
+
+	local alpha_id=`get_blob_id $testroot/repo "" alpha`
+	local packidx=`ls $testroot/corrupt/.git/objects/pack/pack-*.idx`
+	local packfile=${packidx%.idx}.pack
+	local packname=objects/pack/`basename $packfile`
+
+	# Overwrite the last byte of alpha's compressed data.
+	local alpha_offset=`(cd $testroot/corrupt && \
+		git verify-pack -v $packidx) | grep "^$alpha_id " | \
+		awk '{print $5}'`
+	local offset=`(cd $testroot/corrupt && \
+		git verify-pack -v $packidx) | grep "^$alpha_id " | \
+		awk '{print $5 + $4 - 1}'`
+	chmod u+w $packfile
+	printf '\377' | dd of=$packfile bs=1 seek=$offset conv=notrunc \
+		2> /dev/null
+
+	got verify -j 1 -r $testroot/corrupt > $testroot/stdout \
+		2> $testroot/stderr
+	ret="$?"
+	if [ "$ret" = "0" ]; then
+		echo "got verify command succeeded unexpectedly" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+
+	echo "$packname: pack file checksum mismatch" \
+		> $testroot/stdout.expected
+	echo "$packname: $alpha_id at offset $alpha_offset: CRC32 mismatch" \
+		>> $testroot/stdout.expected
+	echo -n "$packname: $alpha_id at offset $alpha_offset: " \
+		>> $testroot/stdout.expected
+	echo "bad object data" >> $testroot/stdout.expected
+	echo "verified 8 objects in 1 pack file" >> $testroot/stdout.expected
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret="$?"
+	if [ "$ret" != "0" ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	echo "got: 3 problems found: bad pack file" > $testroot/stderr.expected
+	cmp -s $testroot/stderr.expected $testroot/stderr
+	ret="$?"
+	if [ "$ret" != "0" ]; then
+		diff -u $testroot/stderr.expected $testroot/stderr
+	fi
+	test_done "$testroot" "$ret"
+}
+
+test_parseargs "$@"
+run_test test_verify_basic
+run_test test_verify_corrupt_object
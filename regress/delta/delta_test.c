@@ -117,6 +117,64 @@ delta_apply(void)
 	return (err == NULL);
 }
 
+static int
+delta_compose(void)
+{
+	const struct got_error *err = NULL;
+	/* "aabbccdd" -> "ccddxxxx" -> "ddyyxxxx" */
+	const char *base = "aabbccdd", *expected = "ddyyxxxx";
+	const char *delta1 = "\x08\x08\x91\x04\x04\x04xxxx";
+	const char *delta2 = "\x08\x08\x91\x02\x02\x02yy\x91\x04\x04";
+	struct got_delta_ops dops1, dops2, composed;
+	uint8_t buf[8], result[8];
+	size_t len;
+
+	err = got_delta_ops_parse(&dops1, delta1, 10);
+	if (err)
+		return 0;
+	err = got_delta_ops_parse(&dops2, delta2, 11);
+	if (err) {
+		got_delta_ops_free(&dops1);
+		return 0;
+	}
+
+	/* Applying the composed delta must match applying both in turn. */
+	err = got_delta_ops_compose(&composed, &dops1, &dops2, 0);
+	if (err == NULL)
+		err = got_delta_ops_apply((uint8_t *)base, strlen(base),
+		    &composed, result, &len, sizeof(result));
+	if (err == NULL && (len != strlen(expected) ||
+	    memcmp(result, expected, len) != 0))
+		err = got_error(GOT_ERR_BAD_DELTA);
+	if (err == NULL)
+		err = got_delta_apply_in_mem((uint8_t *)base, strlen(base),
+		    delta1, 10, buf, &len, sizeof(buf));
+	if (err == NULL)
+		err = got_delta_apply_in_mem(buf, len, delta2, 11, result,
+		    &len, sizeof(result));
+	if (err == NULL && (len != strlen(expected) ||
+	    memcmp(result, expected, len) != 0))
+		err = got_error(GOT_ERR_BAD_DELTA);
+
+	/* A copy beyond the end of the first delta's result must fail. */
+	got_delta_ops_free(&composed);
+	got_delta_ops_free(&dops2);
+	if (err == NULL)
+		err = got_delta_ops_parse(&dops2, "\x00\x04\x04xxxx", 7);
+	if (err == NULL) {
+		err = got_delta_ops_compose(&composed, &dops2, &dops1, 0);
+		if (err == NULL)
+			err = got_error(GOT_ERR_EXPECTED);
+		else if (err->code == GOT_ERR_BAD_DELTA)
+			err = NULL;
+	}
+
+	got_delta_ops_free(&dops1);
+	got_delta_ops_free(&dops2);
+	got_delta_ops_free(&composed);
+	return (err == NULL);
+}
+
 static int quiet;
 
 #define RUN_TEST(expr, name) \
@@ -167,6 +225,7 @@ main(int argc, char *argv[])
 		err(1, "unveil");
 
 	RUN_TEST(delta_apply(), "delta_apply");
+	RUN_TEST(delta_compose(), "delta_compose");
 
 	return failure ? 1 : 0;
 }
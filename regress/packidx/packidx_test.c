@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/queue.h>
+#include <sys/uio.h>
+
+#include <endian.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+#include <imsg.h>
+#include <sha1.h>
+#include <zlib.h>
+
+#include "got_error.h"
+#include "got_object.h"
+
+#include "got_lib_sha1.h"
+#include "got_lib_delta.h"
+#include "got_lib_inflate.h"
+#include "got_lib_object.h"
+#include "got_lib_privsep.h"
+#include "got_lib_pack.h"
+
+static int verbose;
+static int quiet;
+
+void
+test_printf(char *fmt, ...)
+{
+	va_list ap;
+
+	if (!verbose)
+		return;
+
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+}
+
+static int
+cmp_ids(const void *a, const void *b)
+{
+	return memcmp(a, b, SHA1_DIGEST_LENGTH);
+}
+
+/*
+ * Set up a pack index in memory which lists nids object IDs. IDs are
+ * generated by hashing a counter, which spreads them like real ones.
+ */
+static int
+make_packidx(struct got_packidx *packidx, uint32_t *fanout,
+    struct got_packidx_object_id **sorted_ids, uint32_t nids)
+{
+	struct got_packidx_object_id *ids;
+	uint32_t i, n;
+	struct got_sha1_ctx ctx;
+
+	ids = calloc(nids ? nids : 1, sizeof(*ids));
+	if (ids == NULL)
+		return 0;
+	for (i = 0; i < nids; i++) {
+		got_sha1_init(&ctx);
+		got_sha1_update(&ctx, (uint8_t *)&i, sizeof(i));
+		got_sha1_final(ids[i].sha1, &ctx);
+	}
+	qsort(ids, nids, sizeof(ids[0]), cmp_ids);
+
+	n = 0;
+	for (i = 0; i <= 0xff; i++) {
+		while (n < nids && ids[n].sha1[0] <= i)
+			n++;
+		fanout[i] = htobe32(n);
+	}
+
+	memset(packidx, 0, sizeof(*packidx));
+	packidx->hdr.fanout_table = fanout;
+	packidx->hdr.sorted_ids = ids;
+	*sorted_ids = ids;
+	return 1;
+}
+
+static int
+packidx_lookup(uint32_t nids)
+{
+	struct got_packidx packidx;
+	struct got_packidx_object_id *sorted_ids;
+	struct got_object_id *ids = NULL;
+	uint32_t fanout[0xff + 1];
+	int ok = 0;
+	uint32_t i;
+
+	if (!make_packidx(&packidx, fanout, &sorted_ids, nids))
+		return 0;
+
+	ids = calloc(2 * nids + 1, sizeof(*ids));
+	if (ids == NULL)
+		goto done;
+
+	/* Query every object in reverse order and objects not in the pack. */
+	for (i = 0; i < nids; i++) {
+		memcpy(ids[i].sha1, sorted_ids[nids - i - 1].sha1,
+		    SHA1_DIGEST_LENGTH);
+		memcpy(ids[nids + i].sha1, sorted_ids[i].sha1,
+		    SHA1_DIGEST_LENGTH);
+		ids[nids + i].sha1[SHA1_DIGEST_LENGTH - 1] ^= 0x01;
+	}
+
+	for (i = 0; i < nids; i++) {
+		if (got_packidx_get_object_idx(&packidx, &ids[i]) !=
+		    nids - i - 1) {
+			test_printf("object %u not found\n", nids - i - 1);
+			goto done;
+		}
+		if (got_packidx_get_object_idx(&packidx, &ids[nids + i]) !=
+		    -1) {
+			test_printf("bogus object %u found\n", i);
+			goto done;
+		}
+	}
+
+	ok = 1;
+done:
+	free(sorted_ids);
+	free(ids);
+	return ok;
+}
+
+#define RUN_TEST(expr, name) \
+	{ test_ok = (expr);  \
+	if (!quiet) printf("test_%s %s\n", (name), test_ok ? "ok" : "failed"); \
+	failure = (failure || !test_ok); }
+
+void
+usage(void)
+{
+	fprintf(stderr, "usage: packidx_test [-v] [-q]\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	int test_ok = 0, failure = 0;
+	int ch;
+
+#ifndef PROFILE
+	if (pledge("stdio", NULL) == -1)
+		err(1, "pledge");
+#endif
+
+	while ((ch = getopt(argc, argv, "vq")) != -1) {
+		switch (ch) {
+		case 'v':
+			verbose = 1;
+			quiet = 0;
+			break;
+		case 'q':
+			quiet = 1;
+			verbose = 0;
+			break;
+		default:
+			usage();
+			return 1;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	RUN_TEST(packidx_lookup(0), "packidx_lookup_empty");
+	RUN_TEST(packidx_lookup(1), "packidx_lookup_one");
+	RUN_TEST(packidx_lookup(300), "packidx_lookup_small");
+	RUN_TEST(packidx_lookup(100000), "packidx_lookup_large");
+
+	return failure ? 1 : 0;
+}
@@ -0,0 +1,444 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <err.h>
+#include <sha1.h>
+
+#include "got_lib_sha1.h"
+
+#ifndef nitems
+#define nitems(_a) (sizeof(_a) / sizeof((_a)[0]))
+#endif
+
+static int verbose;
+static int quiet;
+
+static const char xdigits[] = "0123456789abcdef";
+
+static const char *backend_names[] = {
+	"portable",
+	"shani",
+	"sha1dc",
+};
+
+void
+test_printf(char *fmt, ...)
+{
+	va_list ap;
+
+	if (!verbose)
+		return;
+
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+}
+
+static void
+hash_chunked(uint8_t *digest, const uint8_t *data, size_t len, size_t chunk)
+{
+	struct got_sha1_ctx ctx;
+	size_t n;
+
+	got_sha1_init(&ctx);
+	while (len > 0) {
+		n = chunk < len ? chunk : len;
+		got_sha1_update(&ctx, data, n);
+		data += n;
+		len -= n;
+	}
+	got_sha1_final(digest, &ctx);
+}
+
+static int
+sha1_vectors(void)
+{
+	static const struct {
+		const char *input;
+		size_t repeat;
+		const char *digest;
+	} vectors[] = {
+		{ "", 1, "da39a3ee5e6b4b0d3255bfef95601890afd80709" },
+		{ "abc", 1, "a9993e364706816aba3e25717850c26c9cd0d89d" },
+		{ "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 1,
+		    "84983e441c3bd26ebaae4aa1f95129e5e54670f1" },
+		{ "a", 1000000, "34aa973cd4c4daa4f61eeb2bdbad27316534016f" },
+	};
+	uint8_t digest[SHA1_DIGEST_LENGTH];
+	char hex[SHA1_DIGEST_STRING_LENGTH];
+	struct got_sha1_ctx ctx;
+	size_t i, j;
+	int backend;
+
+	for (backend = 0; backend < nitems(backend_names); backend++) {
+		if (!got_sha1_set_backend(backend))
+			continue;
+		for (i = 0; i < nitems(vectors); i++) {
+			got_sha1_init(&ctx);
+			for (j = 0; j < vectors[i].repeat; j++)
+				got_sha1_update(&ctx,
+				    (const uint8_t *)vectors[i].input,
+				    strlen(vectors[i].input));
+			got_sha1_final(digest, &ctx);
+			got_sha1_digest_to_str(digest, hex, sizeof(hex));
+			if (strcmp(hex, vectors[i].digest) != 0) {
+				test_printf("%s: vector %zu: %s != %s\n",
+				    backend_names[backend], i, hex,
+				    vectors[i].digest);
+				return 0;
+			}
+		}
+	}
+
+	return 1;
+}
+
+/*
+ * Hash inputs of all sizes around the 64-byte block boundaries in
+ * differently sized chunks, and check that all backends agree.
+ */
+static int
+sha1_backends_agree(void)
+{
+	uint8_t data[1024];
+	uint8_t expect[SHA1_DIGEST_LENGTH], digest[SHA1_DIGEST_LENGTH];
+	const size_t chunks[] = { 1, 7, 63, 64, 65, 200, sizeof(data) };
+	size_t len, i;
+	int backend;
+
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = (i * 2654435761U) >> 13;
+
+	for (len = 0; len <= sizeof(data); len += (len < 200 ? 1 : 61)) {
+		if (!got_sha1_set_backend(GOT_SHA1_BACKEND_PORTABLE))
+			return 0;
+		hash_chunked(expect, data, len, sizeof(data));
+		for (backend = 0; backend < nitems(backend_names);
+		    backend++) {
+			if (!got_sha1_set_backend(backend))
+				continue;
+			for (i = 0; i < nitems(chunks); i++) {
+				hash_chunked(digest, data, len, chunks[i]);
+				if (memcmp(digest, expect, sizeof(digest))) {
+					test_printf("%s: length %zu chunk %zu "
+					    "mismatch\n",
+					    backend_names[backend], len,
+					    chunks[i]);
+					return 0;
+				}
+			}
+		}
+	}
+
+	return 1;
+}
+
+static int
+hex_roundtrip(void)
+{
+	uint8_t digest[SHA1_DIGEST_LENGTH], parsed[SHA1_DIGEST_LENGTH];
+	char hex[SHA1_DIGEST_STRING_LENGTH], upper[SHA1_DIGEST_STRING_LENGTH];
+	int i, j;
+
+	for (i = 0; i < 256; i++) {
+		for (j = 0; j < SHA1_DIGEST_LENGTH; j++)
+			digest[j] = i + j * 13;
+		if (got_sha1_digest_to_str(digest, hex, sizeof(hex)) == NULL)
+			return 0;
+		if (strlen(hex) != SHA1_DIGEST_STRING_LENGTH - 1)
+			return 0;
+		if (!got_parse_sha1_digest(parsed, hex) ||
+		    memcmp(parsed, digest, sizeof(digest)) != 0) {
+			test_printf("%s did not round-trip\n", hex);
+			return 0;
+		}
+		for (j = 0; j < sizeof(upper); j++)
+			upper[j] = toupper((unsigned char)hex[j]);
+		if (!got_parse_sha1_digest(parsed, upper) ||
+		    memcmp(parsed, digest, sizeof(digest)) != 0) {
+			test_printf("%s did not parse\n", upper);
+			return 0;
+		}
+	}
+
+	if (got_sha1_digest_to_str(digest, hex, sizeof(hex) - 1) != NULL)
+		return 0;
+
+	return 1;
+}
+
+static int
+hex_invalid(void)
+{
+	const char *bad[] = {
+		"",
+		"0123456789abcdef0123456789abcdef0123456", /* too short */
+		"0123456789abcdef0123456789abcdef012345g7",
+		"g123456789abcdef0123456789abcdef01234567",
+		" 123456789abcdef0123456789abcdef01234567",
+		"-123456789abcdef0123456789abcdef01234567",
+		"0x23456789abcdef0123456789abcdef01234567",
+	};
+	uint8_t digest[SHA1_DIGEST_LENGTH];
+	size_t i, ndigits;
+	uint8_t val;
+
+	for (i = 0; i < nitems(bad); i++) {
+		if (got_parse_sha1_digest(digest, bad[i])) {
+			test_printf("parsed bogus digest '%s'\n", bad[i]);
+			return 0;
+		}
+	}
+
+	if (!got_parse_sha1_digest_prefix(digest, &ndigits, "a1B") ||
+	    ndigits != 3 || digest[0] != 0xa1 || digest[1] != 0xb0 ||
+	    digest[2] != 0)
+		return 0;
+	if (got_parse_sha1_digest_prefix(digest, &ndigits, "a1x") ||
+	    got_parse_sha1_digest_prefix(digest, &ndigits, ""))
+		return 0;
+
+	if (!got_parse_xdigit(&val, "f") || val != 0xf ||
+	    !got_parse_xdigit(&val, "7E") || val != 0x7e ||
+	    got_parse_xdigit(&val, "") || got_parse_xdigit(&val, "7g") ||
+	    got_parse_xdigit(&val, "123"))
+		return 0;
+
+	return 1;
+}
+
+static double
+elapsed(struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) +
+	    (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Print the throughput of each available backend. */
+static void
+sha1_benchmark(void)
+{
+	const size_t bufsize = 1024 * 1024, total = 256 * bufsize;
+	uint8_t digest[SHA1_DIGEST_LENGTH];
+	struct got_sha1_ctx ctx;
+	struct timespec start;
+	uint8_t *buf;
+	size_t n, i;
+	int backend;
+	double t;
+
+	buf = malloc(bufsize);
+	if (buf == NULL)
+		err(1, "malloc");
+	for (i = 0; i < bufsize; i++)
+		buf[i] = i * 31;
+
+	for (backend = 0; backend < nitems(backend_names); backend++) {
+		if (!got_sha1_set_backend(backend))
+			continue;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		got_sha1_init(&ctx);
+		for (n = 0; n < total; n += bufsize)
+			got_sha1_update(&ctx, buf, bufsize);
+		got_sha1_final(digest, &ctx);
+		t = elapsed(&start);
+		printf("%-8s  bulk %8.1f MB/s\n", backend_names[backend],
+		    total / t / (1024 * 1024));
+
+		/* Object headers and index entries are small inputs. */
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (n = 0; n < 1000000; n++) {
+			got_sha1_init(&ctx);
+			got_sha1_update(&ctx, buf, 100);
+			got_sha1_final(digest, &ctx);
+		}
+		t = elapsed(&start);
+		printf("%-8s  small %7.1f ns/hash\n", backend_names[backend],
+		    t * 1e9 / 1000000);
+	}
+
+	free(buf);
+}
+
+/* How digests were converted before the lookup tables existed. */
+static char *
+legacy_digest_to_str(const uint8_t *digest, char *buf, size_t size)
+{
+	char *p = buf;
+	char hex[3];
+	int i;
+
+	if (size < SHA1_DIGEST_STRING_LENGTH)
+		return NULL;
+
+	for (i = 0; i < SHA1_DIGEST_LENGTH; i++) {
+		snprintf(hex, sizeof(hex), "%.2x", digest[i]);
+		p[0] = hex[0];
+		p[1] = hex[1];
+		p += 2;
+	}
+	p[0] = '\0';
+
+	return buf;
+}
+
+static int
+legacy_parse_digest(uint8_t *digest, const char *line)
+{
+	char hex[3] = {'\0', '\0', '\0'};
+	char *ep;
+	long lval;
+	int i;
+
+	for (i = 0; i < SHA1_DIGEST_LENGTH; i++) {
+		if (line[0] == '\0' || line[1] == '\0')
+			return 0;
+		hex[0] = line[0];
+		hex[1] = line[1];
+		line += 2;
+		errno = 0;
+		lval = strtol(hex, &ep, 16);
+		if (*ep != '\0' || (errno == ERANGE &&
+		    (lval == LONG_MAX || lval == LONG_MIN)))
+			return 0;
+		digest[i] = (uint8_t)lval;
+	}
+
+	return 1;
+}
+
+/* Print the time taken to format and parse an object ID. */
+static void
+hex_benchmark(void)
+{
+	const int n = 1000000;
+	uint8_t digest[SHA1_DIGEST_LENGTH];
+	char hex[SHA1_DIGEST_STRING_LENGTH];
+	struct timespec start;
+	unsigned int sum = 0;
+	int i;
+
+	memset(digest, 0x5a, sizeof(digest));
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < n; i++) {
+		digest[0] = i;
+		legacy_digest_to_str(digest, hex, sizeof(hex));
+		sum += hex[1];
+	}
+	printf("to_str    snprintf %6.1f ns/id\n", elapsed(&start) * 1e9 / n);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < n; i++) {
+		digest[0] = i;
+		got_sha1_digest_to_str(digest, hex, sizeof(hex));
+		sum += hex[1];
+	}
+	printf("to_str    table    %6.1f ns/id\n", elapsed(&start) * 1e9 / n);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < n; i++) {
+		hex[1] = xdigits[i % 16];
+		legacy_parse_digest(digest, hex);
+		sum += digest[0];
+	}
+	printf("parse     strtol   %6.1f ns/id\n", elapsed(&start) * 1e9 / n);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < n; i++) {
+		hex[1] = xdigits[i % 16];
+		got_parse_sha1_digest(digest, hex);
+		sum += digest[0];
+	}
+	printf("parse     table    %6.1f ns/id\n", elapsed(&start) * 1e9 / n);
+
+	/* Keep the compiler from discarding the loops. */
+	if (sum == 0)
+		printf("\n");
+}
+
+#define RUN_TEST(expr, name) \
+	{ test_ok = (expr);  \
+	if (!quiet) printf("test_%s %s\n", (name), test_ok ? "ok" : "failed"); \
+	failure = (failure || !test_ok); }
+
+void
+usage(void)
+{
+	fprintf(stderr, "usage: sha1_test [-b] [-v] [-q]\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	int test_ok = 0, failure = 0;
+	int ch, benchmark = 0;
+
+#ifndef PROFILE
+	if (pledge("stdio", NULL) == -1)
+		err(1, "pledge");
+#endif
+
+	while ((ch = getopt(argc, argv, "bvq")) != -1) {
+		switch (ch) {
+		case 'b':
+			benchmark = 1;
+			break;
+		case 'v':
+			verbose = 1;
+			quiet = 0;
+			break;
+		case 'q':
+			quiet = 1;
+			verbose = 0;
+			break;
+		default:
+			usage();
+			return 1;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (benchmark) {
+		sha1_benchmark();
+		hex_benchmark();
+		return 0;
+	}
+
+	RUN_TEST(sha1_vectors(), "sha1_vectors");
+	RUN_TEST(sha1_backends_agree(), "sha1_backends_agree");
+	RUN_TEST(hex_roundtrip(), "hex_roundtrip");
+	RUN_TEST(hex_invalid(), "hex_invalid");
+
+	return failure ? 1 : 0;
+}
@@ -53,6 +53,7 @@
 #include "got_privsep.h"
 #include "got_path.h"
 #include "got_worktree.h"
+#include "got_search_index.h"
 
 //#define update_panels() (0)
 //#define doupdate() (0)
@@ -338,6 +339,7 @@ struct tog_log_view_state {
 	struct tog_log_thread_args thread_args;
 	struct commit_queue_entry *matched_entry;
 	struct commit_queue_entry *search_entry;
+	struct got_search_index *search_index;
 	struct tog_colors colors;
 };
 
@@ -367,6 +369,8 @@ struct tog_blame_cb_args {
 
 struct tog_blame_thread_args {
 	const char *path;
+	int first_line;
+	int last_line;
 	struct got_repository *repo;
 	struct tog_blame_cb_args *cb_args;
 	int *complete;
@@ -398,6 +402,8 @@ struct tog_blame_view_state {
 	char *path;
 	struct got_repository *repo;
 	struct got_object_id *commit_id;
+	int first_line;	/* range of lines to annotate in commit_id, or 0 */
+	int last_line;
 	struct tog_blame blame;
 	int matched_line;
 	struct tog_colors colors;
@@ -515,6 +521,7 @@ struct tog_view {
 #define TOG_SEARCH_HAVE_NONE	3
 	regex_t regex;
 	regmatch_t regmatch;
+	char *search_pattern;
 };
 
 static const struct got_error *open_diff_view(struct tog_view *,
@@ -539,7 +546,7 @@ static const struct got_error *search_start_log_view(struct tog_view *);
 static const struct got_error *search_next_log_view(struct tog_view *);
 
 static const struct got_error *open_blame_view(struct tog_view *, char *,
-    struct got_object_id *, struct got_repository *);
+    struct got_object_id *, int, int, struct got_repository *);
 static const struct got_error *show_blame_view(struct tog_view *);
 static const struct got_error *input_blame_view(struct tog_view **,
     struct tog_view *, int);
@@ -603,6 +610,7 @@ view_close(struct tog_view *view)
 		del_panel(view->panel);
 	if (view->window)
 		delwin(view->window);
+	free(view->search_pattern);
 	free(view);
 	return err;
 }
@@ -809,6 +817,13 @@ view_search_start(struct tog_view *view)
 	}
 
 	if (regcomp(&view->regex, pattern, REG_EXTENDED | REG_NEWLINE) == 0) {
+		free(view->search_pattern);
+		view->search_pattern = strdup(pattern);
+		if (view->search_pattern == NULL) {
+			err = got_error_from_errno("strdup");
+			regfree(&view->regex);
+			return err;
+		}
 		err = view->search_start(view);
 		if (err) {
 			regfree(&view->regex);
@@ -2144,6 +2159,10 @@ close_log_view(struct tog_view *view)
 		err = got_error_set_errno(errcode, "pthread_cond_destroy");
 
 	free_commits(&s->commits);
+	if (s->search_index) {
+		got_search_index_close(s->search_index);
+		s->search_index = NULL;
+	}
 	free(s->in_repo_path);
 	s->in_repo_path = NULL;
 	free(s->start_id);
@@ -2160,9 +2179,80 @@ search_start_log_view(struct tog_view *view)
 
 	s->matched_entry = NULL;
 	s->search_entry = NULL;
+
+	if (s->search_index == NULL && !s->log_branches &&
+	    got_path_is_root_dir(s->in_repo_path))
+		return got_search_index_open(&s->search_index, s->repo);
 	return NULL;
 }
 
+struct tog_search_index_arg {
+	regex_t *regex;
+	int have_match;
+};
+
+static const struct got_error *
+match_indexed_commit(void *arg, struct got_search_index_entry *entry)
+{
+	const struct got_error *err;
+	struct tog_search_index_arg *a = arg;
+	regmatch_t regmatch;
+	char *id_str;
+
+	/* Commits which have not been indexed yet must be loaded. */
+	if (!entry->indexed) {
+		a->have_match = 1;
+		return got_error(GOT_ERR_ITER_COMPLETED);
+	}
+
+	err = got_object_id_str(&id_str, entry->id);
+	if (err)
+		return err;
+	if (regexec(a->regex, entry->author, 1, &regmatch, 0) == 0 ||
+	    regexec(a->regex, entry->committer, 1, &regmatch, 0) == 0 ||
+	    regexec(a->regex, id_str, 1, &regmatch, 0) == 0 ||
+	    regexec(a->regex, entry->logmsg, 1, &regmatch, 0) == 0) {
+		a->have_match = 1;
+		err = got_error(GOT_ERR_ITER_COMPLETED);
+	}
+	free(id_str);
+	return err;
+}
+
+/*
+ * Use the search index to check whether any commit which has not been
+ * loaded yet matches the current search.
+ */
+static const struct got_error *
+search_index_has_match(int *have_match, struct tog_view *view)
+{
+	const struct got_error *err;
+	struct tog_log_view_state *s = &view->state.log;
+	struct commit_queue_entry *entry;
+	struct got_object_id *id = s->start_id;
+	struct got_object_qid *pid;
+	struct tog_search_index_arg arg;
+
+	*have_match = 0;
+
+	entry = TAILQ_LAST(&s->commits.head, commit_queue_head);
+	if (entry) {
+		pid = SIMPLEQ_FIRST(got_object_commit_get_parent_ids(
+		    entry->commit));
+		if (pid == NULL)
+			return NULL;
+		id = pid->id;
+	}
+
+	arg.regex = &view->regex;
+	arg.have_match = 0;
+	err = got_search_index_search(s->search_index, id,
+	    view->search_pattern, s->repo, match_indexed_commit, &arg,
+	    NULL, NULL);
+	*have_match = arg.have_match;
+	return err;
+}
+
 static const struct got_error *
 search_next_log_view(struct tog_view *view)
 {
@@ -2212,8 +2302,16 @@ search_next_log_view(struct tog_view *view)
 		int have_match = 0;
 
 		if (entry == NULL) {
+			if (view->searching == TOG_SEARCH_FORWARD &&
+			    !s->thread_args.log_complete && s->search_index) {
+				err = search_index_has_match(&have_match, view);
+				if (err)
+					return err;
+			} else
+				have_match = 1;
 			if (s->thread_args.log_complete ||
-			    view->searching == TOG_SEARCH_BACKWARD) {
+			    view->searching == TOG_SEARCH_BACKWARD ||
+			    !have_match) {
 				view->search_next_done =
 				    (s->matched_entry == NULL ?
 				    TOG_SEARCH_HAVE_NONE : TOG_SEARCH_NO_MORE);
@@ -2755,6 +2853,11 @@ cmd_log(int argc, char *argv[])
 
 	init_curses();
 
+	/* The blame view may be opened from this view. */
+	error = got_blame_unveil_cache(got_repo_get_path_git_dir(repo));
+	if (error)
+		goto done;
+
 	error = apply_unveil(got_repo_get_path(repo),
 	    worktree ? got_worktree_get_root_path(worktree) : NULL);
 	if (error)
@@ -3280,7 +3383,8 @@ create_diff(struct tog_diff_view_state *s)
 	case GOT_OBJ_TYPE_TREE:
 		err = got_diff_objects_as_trees(&s->line_offsets, &s->nlines,
 		    s->id1, s->id2, "", "", s->diff_context,
-		    s->ignore_whitespace, s->force_text_diff, s->repo, s->f);
+		    s->ignore_whitespace, s->force_text_diff, 0, s->repo,
+		    s->f);
 		break;
 	case GOT_OBJ_TYPE_COMMIT: {
 		const struct got_object_id_queue *parent_ids;
@@ -3315,7 +3419,7 @@ create_diff(struct tog_diff_view_state *s)
 
 		err = got_diff_objects_as_commits(&s->line_offsets, &s->nlines,
 		    s->id1, s->id2, s->diff_context, s->ignore_whitespace,
-		    s->force_text_diff, s->repo, s->f);
+		    s->force_text_diff, 0, s->repo, s->f);
 		break;
 	}
 	default:
@@ -3876,8 +3980,8 @@ __dead static void
 usage_blame(void)
 {
 	endwin();
-	fprintf(stderr, "usage: %s blame [-c commit] [-r repository-path] path\n",
-	    getprogname());
+	fprintf(stderr, "usage: %s blame [-c commit] [-L first,last] "
+	    "[-r repository-path] path\n", getprogname());
 	exit(1);
 }
 
@@ -4104,8 +4208,8 @@ blame_thread(void *arg)
 	if (err)
 		return (void *)err;
 
-	err = got_blame(ta->path, a->commit_id, ta->repo,
-	    blame_cb, ta->cb_args, ta->cancel_cb, ta->cancel_arg);
+	err = got_blame(ta->path, a->commit_id, ta->first_line, ta->last_line,
+	    ta->repo, blame_cb, ta->cb_args, ta->cancel_cb, ta->cancel_arg);
 	if (err && err->code == GOT_ERR_CANCELLED)
 		err = NULL;
 
@@ -4256,6 +4360,20 @@ run_blame(struct tog_view *view)
 		goto done;
 	}
 
+	/* Line numbers of the range only apply to the initial commit. */
+	if (got_object_id_cmp(s->blamed_commit->id, s->commit_id) == 0) {
+		if (s->last_line > blame->nlines) {
+			err = got_error_fmt(GOT_ERR_RANGE,
+			    "%s has only %d lines", s->path, blame->nlines);
+			goto done;
+		}
+		blame->thread_args.first_line = s->first_line;
+		blame->thread_args.last_line = s->last_line;
+	} else {
+		blame->thread_args.first_line = 0;
+		blame->thread_args.last_line = 0;
+	}
+
 	err = got_repo_open(&thread_repo, got_repo_get_path(s->repo), NULL);
 	if (err)
 		goto done;
@@ -4295,7 +4413,8 @@ done:
 
 static const struct got_error *
 open_blame_view(struct tog_view *view, char *path,
-    struct got_object_id *commit_id, struct got_repository *repo)
+    struct got_object_id *commit_id, int first_line, int last_line,
+    struct got_repository *repo)
 {
 	const struct got_error *err = NULL;
 	struct tog_blame_view_state *s = &view->state.blame;
@@ -4313,12 +4432,14 @@ open_blame_view(struct tog_view *view, char *path,
 	}
 
 	SIMPLEQ_INSERT_HEAD(&s->blamed_commits, s->blamed_commit, entry);
-	s->first_displayed_line = 1;
-	s->last_displayed_line = view->nlines;
+	s->first_displayed_line = first_line ? first_line : 1;
+	s->last_displayed_line = s->first_displayed_line + view->nlines - 1;
 	s->selected_line = 1;
 	s->blame_complete = 0;
 	s->repo = repo;
 	s->commit_id = commit_id;
+	s->first_line = first_line;
+	s->last_line = last_line;
 	memset(&s->blame, 0, sizeof(s->blame));
 
 	SIMPLEQ_INIT(&s->colors);
@@ -4673,15 +4794,31 @@ cmd_blame(int argc, char *argv[])
 	char *cwd = NULL, *repo_path = NULL, *in_repo_path = NULL;
 	char *link_target = NULL;
 	struct got_object_id *commit_id = NULL;
-	char *commit_id_str = NULL;
-	int ch;
+	char *commit_id_str = NULL, *comma;
+	int ch, first_line = 0, last_line = 0;
 	struct tog_view *view;
+	const char *errstr;
 
-	while ((ch = getopt(argc, argv, "c:r:")) != -1) {
+	while ((ch = getopt(argc, argv, "c:L:r:")) != -1) {
 		switch (ch) {
 		case 'c':
 			commit_id_str = optarg;
 			break;
+		case 'L':
+			comma = strchr(optarg, ',');
+			if (comma == NULL)
+				errx(1, "-L option requires first,last: %s",
+				    optarg);
+			*comma = '\0';
+			first_line = strtonum(optarg, 1, INT_MAX, &errstr);
+			if (errstr != NULL)
+				errx(1, "first line is %s: %s", errstr, optarg);
+			last_line = strtonum(comma + 1, first_line, INT_MAX,
+			    &errstr);
+			if (errstr != NULL)
+				errx(1, "last line is %s: %s", errstr,
+				    comma + 1);
+			break;
 		case 'r':
 			repo_path = realpath(optarg, NULL);
 			if (repo_path == NULL)
@@ -4729,6 +4866,10 @@ cmd_blame(int argc, char *argv[])
 
 	init_curses();
 
+	error = got_blame_unveil_cache(got_repo_get_path_git_dir(repo));
+	if (error)
+		goto done;
+
 	error = apply_unveil(got_repo_get_path(repo), NULL);
 	if (error)
 		goto done;
@@ -4764,7 +4905,7 @@ cmd_blame(int argc, char *argv[])
 		goto done;
 
 	error = open_blame_view(view, link_target ? link_target : in_repo_path,
-	    commit_id, repo);
+	    commit_id, first_line, last_line, repo);
 	if (error)
 		goto done;
 	if (worktree) {
@@ -5052,7 +5193,7 @@ blame_tree_entry(struct tog_view **new_view, int begin_x,
 		goto done;
 	}
 
-	err = open_blame_view(blame_view, path, commit_id, repo);
+	err = open_blame_view(blame_view, path, commit_id, 0, 0, repo);
 	if (err) {
 		if (err->code == GOT_ERR_CANCELLED)
 			err = NULL;
@@ -5544,6 +5685,11 @@ cmd_tree(int argc, char *argv[])
 
 	init_curses();
 
+	/* The blame view may be opened from this view. */
+	error = got_blame_unveil_cache(got_repo_get_path_git_dir(repo));
+	if (error)
+		goto done;
+
 	error = apply_unveil(got_repo_get_path(repo), NULL);
 	if (error)
 		goto done;
@@ -6261,6 +6407,11 @@ cmd_ref(int argc, char *argv[])
 
 	init_curses();
 
+	/* The blame view may be opened from this view. */
+	error = got_blame_unveil_cache(got_repo_get_path_git_dir(repo));
+	if (error)
+		goto done;
+
 	error = apply_unveil(got_repo_get_path(repo), NULL);
 	if (error)
 		goto done;